@@ -1,32 +1,20 @@
 #include "Conv_Pooling_NN.h"
 
 
-Conv_Pooling_NN::Conv_Pooling_NN(
+template <typename dtype>
+Conv_Pooling_NN<dtype>::Conv_Pooling_NN(
     double l_rate,
     double mmt_rate,
     lint threads,
     const std::string & model_file,
     const dataset::Dataset &d_set)
-    : NN(l_rate, mmt_rate, threads, model_file, d_set)
+    : NN<dtype>(l_rate, mmt_rate, threads, model_file, d_set)
 {
     // Initialize all layers and
     // reshape all inputs and labels so that they are suitable for matrix multiplication
-    // lint input_size = this->m_train_set[0].shape().size();
-    lint output_size = this->m_train_labels[0].shape().size();
-
-    for (size_t i = 0; i < this->m_train_set.size(); ++i)
-    {
-        this->m_train_set[i].left_extend_shape();
-        this->m_train_set[i].normalize();
-        this->m_train_labels[i].reshape(neurons::Shape{ 1, output_size });
-    }
-
-    for (size_t i = 0; i < this->m_test_set.size(); ++i)
-    {
-        this->m_test_set[i].left_extend_shape();
-        this->m_test_set[i].normalize();
-        this->m_test_labels[i].reshape(neurons::Shape{ 1, output_size });
-    }
+    neurons::Shape input_shape{ this->m_sample_shape };
+    input_shape.left_extend();
+    this->prepare_samples(input_shape, neurons::Shape{ 1, this->m_label_shape.size() }, true);
 
     // Initialize all layers
     if (!this->load(this->m_model_file))
@@ -36,12 +24,13 @@ Conv_Pooling_NN::Conv_Pooling_NN(
 }
 
 
-void Conv_Pooling_NN::print_layers(std::ostream & os) const
+template <typename dtype>
+void Conv_Pooling_NN<dtype>::print_layers(std::ostream & os) const
 {
     for (size_t i = 0; i < this->m_layers.size(); ++i)
     {
-        neurons::TMatrix<> w = (dynamic_cast<neurons::Traditional_NN_layer *>(this->m_layers[i].get()))->weights();
-        neurons::TMatrix<> b = (dynamic_cast<neurons::Traditional_NN_layer *>(this->m_layers[i].get()))->bias();
+        neurons::TMatrix<dtype> w = (dynamic_cast<neurons::Traditional_NN_layer<dtype> *>(this->m_layers[i].get()))->weights();
+        neurons::TMatrix<dtype> b = (dynamic_cast<neurons::Traditional_NN_layer<dtype> *>(this->m_layers[i].get()))->bias();
 
         os << "=================== Layer: " << i << " ====================\n";
         os << "Weights:\n";
@@ -51,19 +40,20 @@ void Conv_Pooling_NN::print_layers(std::ostream & os) const
     }
 }
 
-void Conv_Pooling_NN::save_layers_as_images() const
+template <typename dtype>
+void Conv_Pooling_NN<dtype>::save_layers_as_images() const
 {
     for (size_t i = 0; i < this->m_layers.size(); ++i)
     {
-        neurons::TMatrix<> w = (dynamic_cast<neurons::Traditional_NN_layer *>(this->m_layers[i].get()))->weights();
-        neurons::TMatrix<> b = (dynamic_cast<neurons::Traditional_NN_layer *>(this->m_layers[i].get()))->bias();
+        neurons::TMatrix<dtype> w = (dynamic_cast<neurons::Traditional_NN_layer<dtype> *>(this->m_layers[i].get()))->weights();
+        neurons::TMatrix<dtype> b = (dynamic_cast<neurons::Traditional_NN_layer<dtype> *>(this->m_layers[i].get()))->bias();
 
         w.normalize(0, 255);
-        std::vector<neurons::TMatrix<>> kernel_list = w.collapse(w.shape().dim() - 1);
+        std::vector<neurons::TMatrix<dtype>> kernel_list = w.collapse(w.shape().dim() - 1);
 
         for (size_t j = 0; j < kernel_list.size(); ++j)
         {
-            std::vector<neurons::TMatrix<>> kernel_ch = kernel_list[j].collapse(kernel_list[j].shape().dim() - 1);
+            std::vector<neurons::TMatrix<dtype>> kernel_ch = kernel_list[j].collapse(kernel_list[j].shape().dim() - 1);
 
             for (size_t k = 0; k < kernel_ch.size(); ++k)
             {
@@ -74,108 +64,292 @@ void Conv_Pooling_NN::save_layers_as_images() const
     }
 }
 
-bool Conv_Pooling_NN::load(const std::string & file_name)
+template <typename dtype>
+bool Conv_Pooling_NN<dtype>::load(const std::string & file_name)
 {
-    return false;
+    //Do not forget to clear all layers of this network
+    this->m_layers.clear();
+    this->m_pooling_layers.clear();
+    this->m_mapped_model.reset();
+
+    // There are no files of the legacy format
+    if (!neurons::Model_file::is_model_file(file_name))
+    {
+        return false;
+    }
+
+    neurons::Model_file model{ file_name };
+    this->add_layers(model, model.layers().size(), false);
+
+    // A checkpoint restores momentum of the layers and the training run it was saved by
+    size_t index = 0;
+    for (const neurons::Model_layer & layer : model.layers())
+    {
+        if (neurons::Pooling_layer<dtype>::POOLING != layer.m_type)
+        {
+            this->m_layers[index++]->restore_momentum(layer);
+        }
+    }
+    if (model.has_training_state())
+    {
+        this->restore_training_state(model.training_state());
+    }
+
+    return true;
 }
 
-bool Conv_Pooling_NN::load_until(const std::string & file_name, lint layer_index)
+template <typename dtype>
+bool Conv_Pooling_NN<dtype>::load_until(const std::string & file_name, lint layer_index)
 {
-    return false;
+    //Do not forget to clear all layers of this network
+    this->m_layers.clear();
+    this->m_pooling_layers.clear();
+    this->m_mapped_model.reset();
+
+    if (!neurons::Model_file::is_model_file(file_name))
+    {
+        return false;
+    }
+
+    neurons::Model_file model{ file_name };
+    this->add_layers(model, layer_index, false);
+    this->add_output_layer();
+
+    return true;
+}
+
+template <typename dtype>
+bool Conv_Pooling_NN<dtype>::load_mapped(const std::string & file_name)
+{
+    this->m_layers.clear();
+    this->m_pooling_layers.clear();
+    this->m_mapped_model.reset();
+
+    if (!neurons::Model_file::is_model_file(file_name))
+    {
+        return false;
+    }
+
+    std::shared_ptr<neurons::Model_file> model = std::make_shared<neurons::Model_file>(file_name);
+    this->add_layers(*model, model->layers().size(), true);
+    this->m_mapped_model = model;
+
+    return true;
+}
+
+template <typename dtype>
+void Conv_Pooling_NN<dtype>::add_layers(const neurons::Model_file & model, lint n_layers, bool borrow)
+{
+    for (const neurons::Model_layer & layer : model.layers())
+    {
+        if (neurons::Pooling_layer<dtype>::POOLING == layer.m_type)
+        {
+            if (this->m_layers.empty() || this->m_pooling_layers.back())
+            {
+                throw std::invalid_argument(std::string("Conv_Pooling_NN::add_layers: a pooling layer pools no layer"));
+            }
+
+            this->m_pooling_layers.back() = std::make_shared<neurons::Pooling_layer<dtype>>(
+                neurons::Pooling_layer<dtype>::from_model_layer(
+                    layer, this->m_layers[this->m_layers.size() - 1]->output_shape(), this->m_threads));
+            continue;
+        }
+
+        if (static_cast<lint>(this->m_layers.size()) >= n_layers)
+        {
+            break;
+        }
+
+        // Inputs of each layer are pooled outputs of the layer before it
+        neurons::Shape input_shape = this->m_layers.empty() ?
+            this->m_sample_shape : this->pooled_output_shape(this->m_layers.size() - 1);
+
+        neurons::TMatrix<dtype> w, b;
+        std::unique_ptr<neurons::Activation<dtype>> act_func;
+        std::unique_ptr<neurons::ErrorFunction<dtype>> err_func;
+
+        std::string nn_type = neurons::Traditional_NN_layer<dtype>::from_model_layer(layer, borrow, w, b, act_func, err_func);
+
+        if (neurons::NN_layer<dtype>::FCNN == nn_type)
+        {
+            this->m_layers.push_back(std::make_shared<neurons::FCNN_layer<dtype>>(
+                this->m_mmt_rate, this->m_threads, std::move(w), std::move(b), act_func, err_func));
+        }
+        else if (neurons::NN_layer<dtype>::CNN == nn_type && 2 == layer.m_params.size())
+        {
+            this->m_layers.push_back(std::make_shared<neurons::CNN_layer<dtype>>(
+                this->m_mmt_rate,
+                input_shape[1],
+                input_shape[2],
+                input_shape[3],
+                layer.m_params[0], // stride
+                layer.m_params[1], // padding
+                this->m_threads,
+                std::move(w), std::move(b), act_func, err_func));
+        }
+        else
+        {
+            throw std::invalid_argument(std::string("Conv_Pooling_NN::add_layers: unexpected layer of ") + nn_type);
+        }
+
+        this->m_pooling_layers.push_back(nullptr);
+    }
+}
+
+template <typename dtype>
+void Conv_Pooling_NN<dtype>::add_output_layer()
+{
+    lint input_size = this->m_layers.empty() ?
+        this->m_sample_shape.size() : this->pooled_output_shape(this->m_layers.size() - 1).size();
+
+    this->m_layers.push_back(std::make_shared<neurons::FCNN_layer<dtype>>(
+        this->m_mmt_rate, input_size, this->m_label_shape.size(),
+        this->m_threads, nullptr, new neurons::Softmax_CrossEntropy<dtype>));
+    this->m_pooling_layers.push_back(nullptr);
+}
+
+template <typename dtype>
+neurons::Shape Conv_Pooling_NN<dtype>::pooled_output_shape(size_t layer_index) const
+{
+    if (this->m_pooling_layers[layer_index])
+    {
+        return this->m_pooling_layers[layer_index]->output_shape();
+    }
+
+    return this->m_layers[layer_index]->output_shape();
+}
+
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> Conv_Pooling_NN<dtype>::pool(
+    size_t layer_index, std::vector<neurons::TMatrix<dtype>> && outputs, lint thread_id) const
+{
+    if (this->m_pooling_layers[layer_index])
+    {
+        return this->m_pooling_layers[layer_index]->operation_instances()[thread_id]->forward_propagate(outputs);
+    }
+
+    return std::move(outputs);
 }
 
-void Conv_Pooling_NN::initialize_model()
+template <typename dtype>
+void Conv_Pooling_NN<dtype>::initialize_model()
 {
-    lint output_size = this->m_train_labels[0].shape().size();
+    lint output_size = this->m_label_shape.size();
 
     this->m_layers.push_back(
-        std::make_shared<neurons::CNN_layer>(
+        std::make_shared<neurons::CNN_layer<dtype>>(
             this->m_mmt_rate,
-            this->m_train_set[0].shape()[1],
-            this->m_train_set[0].shape()[2],
-            this->m_train_set[0].shape()[3],
+            this->m_sample_shape[1],
+            this->m_sample_shape[2],
+            this->m_sample_shape[3],
             6, // filters 
             6, // filter rows
             6, // filter cols
             2, // stride
             2, // padding
             this->m_threads,
-            new neurons::Tanh));
+            new neurons::Tanh<dtype>));
 
     this->m_pooling_layers.push_back(
-        neurons::Pooling_layer{
+        std::make_shared<neurons::Pooling_layer<dtype>>(
         this->m_layers[0]->output_shape(),
         neurons::Shape{ 1, 2, 2, this->m_layers[0]->output_shape()[this->m_layers[0]->output_shape().dim() - 1] },
         this->m_threads
-    });
+    ));
 
     this->m_layers.push_back(
-        std::make_shared<neurons::CNN_layer>(
+        std::make_shared<neurons::CNN_layer<dtype>>(
             this->m_mmt_rate,
-            this->m_pooling_layers[0].output_shape()[1],
-            this->m_pooling_layers[0].output_shape()[2],
-            this->m_pooling_layers[0].output_shape()[3],
+            this->m_pooling_layers[0]->output_shape()[1],
+            this->m_pooling_layers[0]->output_shape()[2],
+            this->m_pooling_layers[0]->output_shape()[3],
             30, // filters
             3, // filter rows
             3, // filter cols
             1, // stride
             1, // padding
             this->m_threads,
-            new neurons::Tanh));
+            new neurons::Tanh<dtype>));
 
     this->m_pooling_layers.push_back(
-        neurons::Pooling_layer{
+        std::make_shared<neurons::Pooling_layer<dtype>>(
         this->m_layers[1]->output_shape(),
         neurons::Shape{ 1, 2, 2, this->m_layers[1]->output_shape()[this->m_layers[1]->output_shape().dim() - 1] },
         this->m_threads
-    });
+    ));
 
     this->m_layers.push_back(
-        std::make_shared<neurons::FCNN_layer>(
+        std::make_shared<neurons::FCNN_layer<dtype>>(
             this->m_mmt_rate,
-            this->m_pooling_layers[1].output_shape().size(), output_size, this->m_threads,
-            nullptr, new neurons::Softmax_CrossEntropy));
+            this->m_pooling_layers[1]->output_shape().size(), output_size, this->m_threads,
+            nullptr, new neurons::Softmax_CrossEntropy<dtype>));
+
+    this->m_pooling_layers.push_back(nullptr);
 }
 
-void Conv_Pooling_NN::save(const std::string & file_name) const
+template <typename dtype>
+void Conv_Pooling_NN<dtype>::save(const std::string & file_name) const
 {
+    neurons::write_model_file(file_name, this->model_layers(false));
 }
 
-std::vector<neurons::TMatrix<>> Conv_Pooling_NN::predict(
-    const std::vector<neurons::TMatrix<>>& inputs, lint thread_id) const
+template <typename dtype>
+std::vector<neurons::Model_layer> Conv_Pooling_NN<dtype>::model_layers(bool momentum) const
 {
-    std::vector<neurons::TMatrix<>> l_inputs = inputs;
-    for (size_t i = 0; i < l_inputs.size(); ++i)
+    std::vector<neurons::Model_layer> layers;
+    for (size_t i = 0; i < this->m_layers.size(); ++i)
     {
-        l_inputs[i].left_extend_shape();
-    }
-
-    // std::cout << "============================= forward propagation =============================\n";
-    // std::cout << l_inputs[0];
-
-    l_inputs = this->m_layers[0]->operation_instances()[thread_id]->batch_forward_propagate(l_inputs);
-
-    // std::cout << l_inputs[0];
+        layers.push_back(this->m_layers[i]->to_model_layer());
+        if (momentum)
+        {
+            this->m_layers[i]->add_momentum(layers.back());
+        }
 
-    l_inputs = this->m_pooling_layers[0].operation_instances()[thread_id]->forward_propagate(l_inputs);
+        if (this->m_pooling_layers[i])
+        {
+            layers.push_back(this->m_pooling_layers[i]->to_model_layer());
+        }
+    }
 
-    // std::cout << l_inputs[0];
+    return layers;
+}
 
-    l_inputs = this->m_layers[1]->operation_instances()[thread_id]->batch_forward_propagate(l_inputs);
+template <typename dtype>
+bool Conv_Pooling_NN<dtype>::writes_model_files() const
+{
+    return true;
+}
 
-    // std::cout << l_inputs[0];
+template <typename dtype>
+bool Conv_Pooling_NN<dtype>::normalizes_inputs() const
+{
+    return false;
+}
 
-    l_inputs = this->m_pooling_layers[1].operation_instances()[thread_id]->forward_propagate(l_inputs);
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> Conv_Pooling_NN<dtype>::predict(
+    const std::vector<const neurons::TMatrix<dtype> *> & inputs, lint thread_id) const
+{
+    std::vector<neurons::TMatrix<dtype>> l_inputs{ inputs.size() };
+    for (size_t i = 0; i < l_inputs.size(); ++i)
+    {
+        l_inputs[i] = *inputs[i];
+        l_inputs[i].left_extend_shape();
+    }
 
-    // std::cout << l_inputs[0];
+    for (size_t i = 0; i < this->m_layers.size() - 1; ++i)
+    {
+        l_inputs = this->pool(
+            i, this->m_layers[i]->operation_instances()[thread_id]->batch_forward_propagate(l_inputs), thread_id);
+    }
 
     for (size_t i = 0; i < l_inputs.size(); ++i)
     {
         l_inputs[i].reshape(neurons::Shape{ 1, l_inputs[i].shape().size() });
     }
 
-    std::vector<neurons::TMatrix<>> preds =
-        this->m_layers[2]->operation_instances()[thread_id]->batch_forward_propagate(l_inputs);
+    std::vector<neurons::TMatrix<dtype>> preds =
+        this->m_layers[this->m_layers.size() - 1]->operation_instances()[thread_id]->batch_forward_propagate(l_inputs);
 
     for (size_t i = 0; i < preds.size(); ++i)
     {
@@ -186,82 +360,64 @@ std::vector<neurons::TMatrix<>> Conv_Pooling_NN::predict(
 }
 
 
-std::vector<neurons::TMatrix<>> Conv_Pooling_NN::test(
-    const std::vector<neurons::TMatrix<>>& inputs,
-    const std::vector<neurons::TMatrix<>>& targets,
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> Conv_Pooling_NN<dtype>::test(
+    const std::vector<const neurons::TMatrix<dtype> *> & inputs,
+    const std::vector<const neurons::TMatrix<dtype> *> & targets,
     lint thread_id)
 {
-    std::vector<neurons::TMatrix<>> l_inputs = inputs;
-
-    // std::cout << "============================= forward propagation =============================\n";
-    // std::cout << l_inputs[0];
-
-    l_inputs = this->m_layers[0]->operation_instances()[thread_id]->batch_forward_propagate(l_inputs);
+    // The first layer reads samples directly from the data set
+    std::vector<neurons::TMatrix<dtype>> l_inputs =
+        this->pool(0, this->m_layers[0]->operation_instances()[thread_id]->batch_forward_propagate(inputs), thread_id);
 
-    // std::cout << l_inputs[0];
-
-    l_inputs = this->m_pooling_layers[0].operation_instances()[thread_id]->forward_propagate(l_inputs);
-
-    // std::cout << l_inputs[0];
-
-    l_inputs = this->m_layers[1]->operation_instances()[thread_id]->batch_forward_propagate(l_inputs);
-
-    // std::cout << l_inputs[0];
-
-    l_inputs = this->m_pooling_layers[1].operation_instances()[thread_id]->forward_propagate(l_inputs);
-
-    // std::cout << l_inputs[0];
+    for (size_t i = 1; i < this->m_layers.size() - 1; ++i)
+    {
+        l_inputs = this->pool(
+            i, this->m_layers[i]->operation_instances()[thread_id]->batch_forward_propagate(l_inputs), thread_id);
+    }
 
     for (size_t i = 0; i < l_inputs.size(); ++i)
     {
         l_inputs[i].reshape(neurons::Shape{ 1, l_inputs[i].shape().size() });
     }
 
-    std::vector<neurons::TMatrix<>> preds =
-        this->m_layers[2]->operation_instances()[thread_id]->batch_forward_propagate(l_inputs, targets);
+    std::vector<neurons::TMatrix<dtype>> preds =
+        this->m_layers[this->m_layers.size() - 1]->operation_instances()[thread_id]->batch_forward_propagate(
+            neurons::matrix_pointers(l_inputs), targets);
 
     return preds;
 }
 
 
-std::vector<neurons::TMatrix<>> Conv_Pooling_NN::optimise(
-    const std::vector<neurons::TMatrix<>>& inputs,
-    const std::vector<neurons::TMatrix<>>& targets,
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> Conv_Pooling_NN<dtype>::optimise(
+    const std::vector<const neurons::TMatrix<dtype> *> & inputs,
+    const std::vector<const neurons::TMatrix<dtype> *> & targets,
     lint thread_id)
 {
-    std::vector<neurons::TMatrix<>> preds = this->test(inputs, targets, thread_id);
+    std::vector<neurons::TMatrix<dtype>> preds = this->test(inputs, targets, thread_id);
 
-    // std::cout << "============================= back propagation =============================\n";
-
-    std::vector<neurons::TMatrix<>> E_to_x_diffs =
-        this->m_layers[2]->operation_instances()[thread_id]->batch_back_propagate(this->m_l_rate);
+    std::vector<neurons::TMatrix<dtype>> E_to_x_diffs =
+        this->m_layers[this->m_layers.size() - 1]->operation_instances()[thread_id]->batch_back_propagate(this->m_l_rate);
 
     for (size_t i = 0; i < E_to_x_diffs.size(); ++i)
     {
-        E_to_x_diffs[i].reshape(this->m_pooling_layers[1].output_shape());
+        E_to_x_diffs[i].reshape(this->pooled_output_shape(this->m_layers.size() - 2));
     }
 
-    // std::cout << E_to_x_diffs[0];
-
-    E_to_x_diffs = this->m_pooling_layers[1].operation_instances()[thread_id]->back_propagate(E_to_x_diffs);
-
-    // std::cout << E_to_x_diffs[0];
-
-    E_to_x_diffs = this->m_layers[1]->operation_instances()[thread_id]->batch_back_propagate(this->m_l_rate, E_to_x_diffs);
-
-    // std::cout << E_to_x_diffs[0];
-
-    E_to_x_diffs = this->m_pooling_layers[0].operation_instances()[thread_id]->back_propagate(E_to_x_diffs);
-
-    // std::cout << E_to_x_diffs[0];
+    for (lint i = this->m_layers.size() - 2; i >= 0; --i)
+    {
+        if (this->m_pooling_layers[i])
+        {
+            E_to_x_diffs = this->m_pooling_layers[i]->operation_instances()[thread_id]->back_propagate(E_to_x_diffs);
+        }
 
-    E_to_x_diffs = this->m_layers[0]->operation_instances()[thread_id]->batch_back_propagate(this->m_l_rate, E_to_x_diffs);
+        E_to_x_diffs = this->m_layers[i]->operation_instances()[thread_id]->batch_back_propagate(this->m_l_rate, E_to_x_diffs);
+    }
 
     return preds;
 }
 
 
-
-
-
-
+template class Conv_Pooling_NN<float>;
+template class Conv_Pooling_NN<double>;
@@ -12,13 +12,15 @@ Programmed by Chunnan Sheng
 #include "CNN_layer.h"
 #include "Pooling.h"
 
-class Conv_Pooling_NN : public NN
+template <typename dtype = double>
+class Conv_Pooling_NN : public NN<dtype>
 {
 private:
 
-    //std::vector<neurons::CNN_layer> m_conv_layers;
-    std::vector<neurons::Pooling_layer> m_pooling_layers;
-    //neurons::FCNN_layer m_nn_layer;
+    //std::vector<neurons::CNN_layer<dtype>> m_conv_layers;
+    // The pooling layer after each layer of m_layers, nullptr if the layer is not pooled
+    std::vector<std::shared_ptr<neurons::Pooling_layer<dtype>>> m_pooling_layers;
+    //neurons::FCNN_layer<dtype> m_nn_layer;
 
 public:
     Conv_Pooling_NN(
@@ -43,24 +45,52 @@ public:
 
     virtual bool load_until(const std::string & file_name, lint layer_index);
 
+    // Load a model file for inference only, weights are borrowed from a read-only mapping of the file
+    // (see Multi_Layer_NN::load_mapped). False if the file is not a model file.
+    bool load_mapped(const std::string & file_name);
+
     virtual void initialize_model();
 
     virtual void save(const std::string & file_name) const;
 
+protected:
+
+    // Pooling layers are saved after the layers they pool
+    virtual std::vector<neurons::Model_layer> model_layers(bool momentum) const;
+
+    virtual bool writes_model_files() const;
+
+    // Samples are predicted as they are given
+    virtual bool normalizes_inputs() const;
+
 private:
 
-    virtual std::vector<neurons::TMatrix<>> test(
-        const std::vector<neurons::TMatrix<>> & inputs,
-        const std::vector<neurons::TMatrix<>> & targets,
+    // Append the first n_layers layers of a model file (pooling layers are not counted, the pooling layer
+    // after the last one is appended with it), their weights are borrowed if borrow is true
+    void add_layers(const neurons::Model_file & model, lint n_layers, bool borrow);
+
+    // Append the softmax layer which load_until puts after the loaded layers
+    void add_output_layer();
+
+    // Shape of the output of a layer, after its pooling layer if it is pooled
+    neurons::Shape pooled_output_shape(size_t layer_index) const;
+
+    // Pool outputs of a layer if it is pooled
+    std::vector<neurons::TMatrix<dtype>> pool(
+        size_t layer_index, std::vector<neurons::TMatrix<dtype>> && outputs, lint thread_id) const;
+
+    virtual std::vector<neurons::TMatrix<dtype>> test(
+        const std::vector<const neurons::TMatrix<dtype> *> & inputs,
+        const std::vector<const neurons::TMatrix<dtype> *> & targets,
         lint thread_id);
 
-    virtual std::vector<neurons::TMatrix<>> optimise(
-        const std::vector<neurons::TMatrix<>> & inputs,
-        const std::vector<neurons::TMatrix<>> & targets,
+    virtual std::vector<neurons::TMatrix<dtype>> optimise(
+        const std::vector<const neurons::TMatrix<dtype> *> & inputs,
+        const std::vector<const neurons::TMatrix<dtype> *> & targets,
         lint thread_id);
 
-    virtual std::vector<neurons::TMatrix<>> predict(
-        const std::vector<neurons::TMatrix<>> & inputs,
+    virtual std::vector<neurons::TMatrix<dtype>> predict(
+        const std::vector<const neurons::TMatrix<dtype> *> & inputs,
         lint thread_id) const;
 
 };
@@ -1,46 +1,30 @@
 #include "CIFAR_10.h"
-#include <fstream>
 #include <iostream>
 #include <cstdint>
 #include <memory>
+#include <algorithm>
 
-std::unique_ptr<char[]> dataset::CIFAR_10::read_cifar_file(lint & file_len, const std::string & path) const
+std::shared_ptr<dataset::Mapped_file> dataset::CIFAR_10::map_cifar_file(const std::string & path) const
 {
-    std::ifstream file;
-    file.open(path, std::ios::in | std::ios::binary | std::ios::ate);
+    auto file = std::make_shared<Mapped_file>(path);
 
-    if (!file)
-    {
-        std::cout << "Error opening file " << path << std::endl;
-        throw std::invalid_argument(std::string("Path or file not found"));
-    }
-
-    file_len = file.tellg();
-    if (file_len % (this->m_image_len + this->m_label_len))
+    if (file->size() % (this->m_image_len + this->m_label_len))
     {
         std::cout << "cifar file format is wrong" << std::endl;
         return {};
     }
 
-    std::unique_ptr<char[]> buffer(new char[file_len]);
-
-    //Read the entire file at once
-    file.seekg(0, std::ios::beg);
-    file.read(buffer.get(), file_len);
-    file.close();
-
-    return buffer;
+    return file;
 }
 
-void dataset::CIFAR_10::cifar_binary_to_dataset(
-    std::vector<neurons::TMatrix<>>& images,
-    std::vector<neurons::TMatrix<>>& labels,
-    const std::unique_ptr<char[]>& binary,
-    lint binary_len, lint limit) const
+void dataset::CIFAR_10::cifar_file_to_store(
+    Image_store & images,
+    const std::shared_ptr<Mapped_file> & file,
+    lint limit) const
 {
-    uint8_t* u_binary = reinterpret_cast<uint8_t*>(binary.get());
-    lint len = binary_len / (this->m_image_len + this->m_label_len);
-    lint img_size = this->m_image_rows * this->m_image_cols;
+    const uint8_t* u_binary = reinterpret_cast<const uint8_t*>(file->data());
+    lint record_len = this->m_image_len + this->m_label_len;
+    lint len = file->size() / record_len;
 
     if (0 == limit)
     {
@@ -52,34 +36,17 @@ void dataset::CIFAR_10::cifar_binary_to_dataset(
         len = limit;
     }
 
-    uint8_t * image_pos = u_binary;
-    for (lint i = 0; i < len; ++i)
-    {
-        neurons::TMatrix<> image{ neurons::Shape{ this->m_image_rows, this->m_image_cols, this->m_image_chls } };
-
-        neurons::TMatrix<> label{ neurons::Shape{this->m_label_size}, 0 };
-        neurons::Coordinate pixel_pos{ 0, 0, 0 };
-
-        label[{*image_pos}] = 1;
-        ++image_pos;
-
-        for (lint k = 0; k < this->m_image_chls; ++k)
-        {
-            for (lint i = 0; i < this->m_image_rows; ++i)
-            {
-                for (lint j = 0; j < this->m_image_cols; ++j)
-                {
-                    pixel_pos[0] = i; pixel_pos[1] = j; pixel_pos[2] = k;
-                    image[pixel_pos] = *image_pos;
+    Image_store::Span span;
+    span.m_pixel_owner = file;
+    span.m_label_owner = file;
+    span.m_pixels = u_binary + this->m_label_len;
+    span.m_labels = u_binary;
+    span.m_images = len;
+    span.m_image_stride = record_len;
+    span.m_label_stride = record_len;
+    span.m_planar = true;
 
-                    ++image_pos;
-                }
-            }
-        }
-
-        images.push_back(image);
-        labels.push_back(label);
-    }
+    images.add_span(span);
 }
 
 dataset::CIFAR_10::CIFAR_10(const std::string & dir)
@@ -88,36 +55,210 @@ dataset::CIFAR_10::CIFAR_10(const std::string & dir)
 
 void dataset::CIFAR_10::get_training_set(
     std::vector<neurons::TMatrix<>>& inputs, std::vector<neurons::TMatrix<>>& labels, lint limit) const
+{
+    Image_store images;
+    this->get_training_store(images, limit);
+    images.to_matrices(inputs, labels);
+}
+
+void dataset::CIFAR_10::get_test_set(
+    std::vector<neurons::TMatrix<>>& inputs, std::vector<neurons::TMatrix<>>& labels, lint limit) const
+{
+    Image_store images;
+    this->get_test_store(images, limit);
+    images.to_matrices(inputs, labels);
+}
+
+bool dataset::CIFAR_10::get_training_store(Image_store & images, lint limit) const
 {
     limit /= 5;
-    lint file_len;
+    images = Image_store{ neurons::Shape{ this->m_image_rows, this->m_image_cols, this->m_image_chls }, this->m_label_size };
 
     for (lint i = 0; i < 5; ++i)
     {
-        auto buffer = this->read_cifar_file(file_len, this->m_dir + "data_batch_" + std::to_string(i + 1) +".bin");
+        auto file = this->map_cifar_file(this->m_dir + "data_batch_" + std::to_string(i + 1) +".bin");
 
-        if (!buffer)
+        if (!file)
         {
             throw std::invalid_argument(std::string{ "Error while opening CIFAR file ..." });
         }
 
-        this->cifar_binary_to_dataset(inputs, labels, buffer, file_len, limit);
+        this->cifar_file_to_store(images, file, limit);
     }
+
+    return true;
 }
 
-void dataset::CIFAR_10::get_test_set(
-    std::vector<neurons::TMatrix<>>& inputs, std::vector<neurons::TMatrix<>>& labels, lint limit) const
+bool dataset::CIFAR_10::get_test_store(Image_store & images, lint limit) const
 {
-    lint file_len;
-
-    auto buffer = this->read_cifar_file(file_len, this->m_dir + "test_batch.bin");
+    auto file = this->map_cifar_file(this->m_dir + "test_batch.bin");
 
-    if (!buffer)
+    if (!file)
     {
         throw std::invalid_argument(std::string{ "Error while opening CIFAR file ..." });
     }
 
-    this->cifar_binary_to_dataset(inputs, labels, buffer, file_len, limit);
+    images = Image_store{ neurons::Shape{ this->m_image_rows, this->m_image_cols, this->m_image_chls }, this->m_label_size };
+    this->cifar_file_to_store(images, file, limit);
+
+    return true;
+}
+
+std::unique_ptr<dataset::Sample_stream> dataset::CIFAR_10::open_training_stream(lint shard, lint shards) const
+{
+    std::vector<std::string> files;
+    std::vector<lint> file_ends;
+    lint records = 0;
+
+    for (lint i = 0; i < 5; ++i)
+    {
+        files.push_back(this->m_dir + "data_batch_" + std::to_string(i + 1) + ".bin");
+
+        std::ifstream file{ files.back(), std::ios::in | std::ios::binary | std::ios::ate };
+        if (!file)
+        {
+            std::cout << "Error opening file " << files.back() << std::endl;
+            throw std::invalid_argument(std::string("Path or file not found"));
+        }
+
+        lint file_len = file.tellg();
+        if (file_len % (this->m_image_len + this->m_label_len))
+        {
+            throw std::invalid_argument(std::string{ "Error while opening CIFAR file ..." });
+        }
+
+        records += file_len / (this->m_image_len + this->m_label_len);
+        file_ends.push_back(records);
+    }
+
+    return std::unique_ptr<Sample_stream>{ new CIFAR_10_stream{
+        files,
+        file_ends,
+        neurons::Shape{ this->m_image_rows, this->m_image_cols, this->m_image_chls },
+        this->m_label_size,
+        records * shard / shards,
+        records * (shard + 1) / shards } };
+}
+
+
+dataset::CIFAR_10_stream::CIFAR_10_stream(
+    const std::vector<std::string> & files,
+    const std::vector<lint> & file_ends,
+    const neurons::Shape & image_shape,
+    lint classes,
+    lint first,
+    lint end)
+    :
+    m_files{ files },
+    m_file_ends{ file_ends },
+    m_image_shape{ image_shape },
+    m_classes{ classes },
+    m_first{ first },
+    m_end{ end },
+    m_next{ first },
+    m_file_index{ -1 }
+{
+    this->rewind();
+}
+
+neurons::Shape dataset::CIFAR_10_stream::image_shape() const
+{
+    return this->m_image_shape;
+}
+
+dataset::lint dataset::CIFAR_10_stream::classes() const
+{
+    return this->m_classes;
+}
+
+dataset::lint dataset::CIFAR_10_stream::size() const
+{
+    return this->m_end - this->m_first;
+}
+
+dataset::lint dataset::CIFAR_10_stream::read(Image_store & images, lint max_images)
+{
+    lint channels = this->m_image_shape[2];
+    lint image_size = this->m_image_shape.size();
+    lint plane = image_size / channels;
+    lint record_len = image_size + 1;
+
+    lint total = 0;
+    while (total < max_images && this->m_next < this->m_end)
+    {
+        // Records of a chunk may come from two files
+        lint count = std::min(max_images - total,
+            std::min(this->m_end, this->m_file_ends[this->m_file_index]) - this->m_next);
+
+        this->m_record_buffer.resize(count * record_len);
+        this->m_file.read(this->m_record_buffer.data(), count * record_len);
+        if (!this->m_file)
+        {
+            throw std::invalid_argument(std::string("dataset::CIFAR_10_stream::read: failed to read CIFAR file."));
+        }
+
+        lint first = images.size();
+        images.resize(first + count);
+
+        // Each record is a label followed by planes of channels, which are interleaved in the store
+        const uint8_t *record = reinterpret_cast<const uint8_t *>(this->m_record_buffer.data());
+        for (lint i = 0; i < count; ++i)
+        {
+            images.set_label(first + i, record[0]);
+
+            uint8_t *pixels = images.writable_pixels(first + i);
+            for (lint k = 0; k < channels; ++k)
+            {
+                const uint8_t *channel = record + 1 + k * plane;
+                for (lint p = 0; p < plane; ++p)
+                {
+                    pixels[p * channels + k] = channel[p];
+                }
+            }
+
+            record += record_len;
+        }
+
+        total += count;
+        this->m_next += count;
+
+        if (this->m_next < this->m_end && this->m_next == this->m_file_ends[this->m_file_index])
+        {
+            this->seek_next();
+        }
+    }
+
+    return total;
+}
+
+void dataset::CIFAR_10_stream::rewind()
+{
+    this->m_next = this->m_first;
+    this->seek_next();
 }
 
+void dataset::CIFAR_10_stream::seek_next()
+{
+    lint index = std::upper_bound(this->m_file_ends.begin(), this->m_file_ends.end(), this->m_next) - this->m_file_ends.begin();
+    if (index >= static_cast<lint>(this->m_files.size()))
+    {
+        return;
+    }
+
+    if (index != this->m_file_index)
+    {
+        this->m_file.close();
+        this->m_file.open(this->m_files[index], std::ios::in | std::ios::binary);
+        this->m_file_index = index;
+
+        if (!this->m_file)
+        {
+            std::cout << "Error opening file " << this->m_files[index] << std::endl;
+            throw std::invalid_argument(std::string("Path or file not found"));
+        }
+    }
 
+    this->m_file.clear();
+    lint first_of_file = index > 0 ? this->m_file_ends[index - 1] : 0;
+    this->m_file.seekg((this->m_next - first_of_file) * (this->m_image_shape.size() + 1), std::ios::beg);
+}
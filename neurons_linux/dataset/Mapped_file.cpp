@@ -0,0 +1,126 @@
+#include "Mapped_file.h"
+#include <iostream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+#ifdef _WIN32
+
+dataset::Mapped_file::Mapped_file(const std::string & path)
+    : m_data{ nullptr }, m_size{ 0 }, m_file{ INVALID_HANDLE_VALUE }, m_mapping{ nullptr }
+{
+    this->m_file = CreateFileA(
+        path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (INVALID_HANDLE_VALUE == this->m_file)
+    {
+        std::cout << "Error opening file " << path << std::endl;
+        throw std::invalid_argument(std::string("Path or file not found"));
+    }
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(this->m_file, &size);
+    this->m_size = size.QuadPart;
+
+    // Files of zero size cannot be mapped
+    if (this->m_size > 0)
+    {
+        this->m_mapping = CreateFileMappingA(this->m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (nullptr != this->m_mapping)
+        {
+            this->m_data = static_cast<const char *>(MapViewOfFile(this->m_mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+
+        if (nullptr == this->m_data)
+        {
+            if (nullptr != this->m_mapping)
+            {
+                CloseHandle(this->m_mapping);
+            }
+            CloseHandle(this->m_file);
+            throw std::invalid_argument(std::string("dataset::Mapped_file: failed to map ") + path);
+        }
+    }
+}
+
+dataset::Mapped_file::~Mapped_file()
+{
+    if (nullptr != this->m_data)
+    {
+        UnmapViewOfFile(this->m_data);
+    }
+
+    if (nullptr != this->m_mapping)
+    {
+        CloseHandle(this->m_mapping);
+    }
+
+    CloseHandle(this->m_file);
+}
+
+#else
+
+dataset::Mapped_file::Mapped_file(const std::string & path)
+    : m_data{ nullptr }, m_size{ 0 }
+{
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd < 0)
+    {
+        std::cout << "Error opening file " << path << std::endl;
+        throw std::invalid_argument(std::string("Path or file not found"));
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        throw std::invalid_argument(std::string("dataset::Mapped_file: failed to get size of ") + path);
+    }
+    this->m_size = st.st_size;
+
+    // Files of zero size cannot be mapped
+    if (this->m_size > 0)
+    {
+        void *data = mmap(nullptr, this->m_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (MAP_FAILED == data)
+        {
+            close(fd);
+            throw std::invalid_argument(std::string("dataset::Mapped_file: failed to map ") + path);
+        }
+
+        this->m_data = static_cast<const char *>(data);
+    }
+
+    // The mapping stays valid after the file is closed
+    close(fd);
+}
+
+dataset::Mapped_file::~Mapped_file()
+{
+    if (nullptr != this->m_data)
+    {
+        munmap(const_cast<char *>(this->m_data), this->m_size);
+    }
+}
+
+#endif
+
+
+const char * dataset::Mapped_file::data() const
+{
+    return this->m_data;
+}
+
+dataset::lint dataset::Mapped_file::size() const
+{
+    return this->m_size;
+}
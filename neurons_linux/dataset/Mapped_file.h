@@ -0,0 +1,43 @@
+#pragma once
+#include <string>
+
+namespace dataset
+{
+    typedef long long int lint;
+
+    /*
+    A read-only memory mapping of a whole file.
+
+    Nothing is read when the file is mapped, pages are loaded by the OS when they are touched.
+    Pages are shared through the page cache by all processes mapping the same file,
+    so concurrent trainers on one host keep only one copy of a data set in memory.
+    */
+    class Mapped_file
+    {
+    private:
+        const char *m_data;
+        lint m_size;
+
+#ifdef _WIN32
+        void *m_file;
+        void *m_mapping;
+#endif
+
+    public:
+        // An exception is thrown if the file cannot be opened or mapped
+        explicit Mapped_file(const std::string & path);
+
+        ~Mapped_file();
+
+        Mapped_file(const Mapped_file & other) = delete;
+        Mapped_file(Mapped_file && other) = delete;
+        Mapped_file & operator = (const Mapped_file & other) = delete;
+        Mapped_file & operator = (Mapped_file && other) = delete;
+
+    public:
+        const char * data() const;
+
+        // Size of the file in bytes
+        lint size() const;
+    };
+}
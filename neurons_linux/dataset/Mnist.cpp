@@ -1,8 +1,8 @@
 #include "Mnist.h"
-#include <fstream>
 #include <iostream>
 #include <cstdint>
 #include <memory>
+#include <algorithm>
 
 /*!
 * \brief Extract the MNIST header from the given buffer
@@ -10,9 +10,9 @@
 * \param position The current reading positoin
 * \return The value of the mnist header
 */
-int64_t dataset::Mnist::read_header(const std::unique_ptr<char[]>& buffer, size_t position) const
+int64_t dataset::Mnist::read_header(const char * buffer, size_t position) const
 {
-    auto header = reinterpret_cast<uint32_t*>(buffer.get());
+    auto header = reinterpret_cast<const uint32_t*>(buffer);
 
     auto value = *(header + position);
     auto decode = (value << 24) | ((value << 8) & 0x00FF0000) | ((value >> 8) & 0X0000FF00) | (value >> 24);
@@ -21,34 +21,24 @@ int64_t dataset::Mnist::read_header(const std::unique_ptr<char[]>& buffer, size_
 }
 
 /*!
-* \brief Read a MNIST file inside a raw buffer
+* \brief Map a MNIST file into memory and validate its header in place
 * \param path The path to the image file
-* \return The buffer of byte on success, a nullptr-unique_ptr otherwise
+* \return The mapped file on success, a nullptr otherwise
 */
-inline std::unique_ptr<char[]> dataset::Mnist::read_mnist_file(const std::string & path, uint32_t key) const
+std::shared_ptr<dataset::Mapped_file> dataset::Mnist::map_mnist_file(const std::string & path, uint32_t key) const
 {
-    std::ifstream file;
-    file.open(path, std::ios::in | std::ios::binary | std::ios::ate);
+    auto file = std::make_shared<Mapped_file>(path);
+    auto size = file->size();
+    const char *buffer = file->data();
 
-    if (!file)
+    if (size < (0x803 == key ? 16 : 8))
     {
-        std::cout << "Error opening file " << path << std::endl;
-        throw std::invalid_argument(std::string("Path or file not found"));
+        std::cout << "The file is too small to hold the header, probably not a MNIST file" << std::endl;
+        return {};
     }
 
-    auto size = file.tellg();
-    std::unique_ptr<char[]> buffer(new char[size]);
-
-    //Read the entire file at once
-    file.seekg(0, std::ios::beg);
-    file.read(buffer.get(), size);
-    file.close();
-
     auto magic = read_header(buffer, 0);
 
-    // std::cout << key << std::endl;
-    // std::cout << magic << std::endl;
-
     if (magic != key)
     {
         std::cout << "Invalid magic number, probably not a MNIST file" << std::endl;
@@ -76,98 +66,74 @@ inline std::unique_ptr<char[]> dataset::Mnist::read_mnist_file(const std::string
         }
     }
 
-    return buffer;
+    return file;
 }
 
 
-void dataset::Mnist::read_mnist_image_file(std::vector<neurons::TMatrix<>> & images, const std::string& path, lint limit) const
+void dataset::Mnist::read_mnist_files(
+    Image_store & images, const std::string & image_path, const std::string & label_path, lint limit) const
 {
-    auto buffer = this->read_mnist_file(path, 0x803);
+    images = Image_store{};
 
-    if (buffer)
-    {
-        auto count = this->read_header(buffer, 1);
-        auto rows = this->read_header(buffer, 2);
-        auto columns = this->read_header(buffer, 3);
+    auto image_file = this->map_mnist_file(image_path, 0x803);
+    auto label_file = this->map_mnist_file(label_path, 0x801);
 
-        if (limit > 0 && count > limit)
-        {
-            count = limit;
-        }
+    if (!image_file || !label_file)
+    {
+        return;
+    }
 
-        //Skip the header
-        //Cast to unsigned char is necessary cause signedness of char is
-        //platform-specific
-        uint8_t* image_buffer = reinterpret_cast<uint8_t*>(buffer.get() + 16);
+    auto count = this->read_header(image_file->data(), 1);
+    auto rows = this->read_header(image_file->data(), 2);
+    auto columns = this->read_header(image_file->data(), 3);
+    auto label_count = this->read_header(label_file->data(), 1);
 
-        for (lint i = 0; i < count; ++i)
-        {
-            neurons::TMatrix<> new_image{ neurons::Shape{ rows, columns, 1 } };
-            neurons::Coordinate pos{ 0, 0, 0 };
-            for (lint j = 0; j < rows; ++j)
-            {
-                for (lint k = 0; k < columns; ++k)
-                {
-                    uint8_t pixel = *image_buffer++;
-                    pos[0] = j; pos[1] = k;
-                    new_image[pos] = pixel;
-                }
-            }
-
-            images.push_back(new_image);
-        }
+    if (limit > 0 && count > limit)
+    {
+        count = limit;
     }
-}
-
 
-void dataset::Mnist::read_mnist_label_file(std::vector<neurons::TMatrix<>> & labels, const std::string& path, lint limit) const
-{
-    auto buffer = read_mnist_file(path, 0x801);
+    if (limit > 0 && label_count > limit)
+    {
+        label_count = limit;
+    }
 
-    if (buffer)
+    if (count != label_count)
     {
-        auto count = this->read_header(buffer, 1);
+        throw std::invalid_argument(
+            std::string("dataset::Mnist::read_mnist_files: number of labels does not match number of images."));
+    }
 
-        //Skip the header
-        //Cast to unsigned char is necessary cause signedness of char is
-        //platform-specific
-        uint8_t* label_buffer = reinterpret_cast<uint8_t*>(buffer.get() + 8);
+    //Skip the headers
+    //Cast to unsigned char is necessary cause signedness of char is
+    //platform-specific
+    const uint8_t* image_buffer = reinterpret_cast<const uint8_t*>(image_file->data() + 16);
+    const uint8_t* label_buffer = reinterpret_cast<const uint8_t*>(label_file->data() + 8);
 
-        if (limit > 0 && count > limit)
+    uint8_t max_val = 0;
+    for (lint i = 0; i < count; ++i)
+    {
+        uint8_t label_val = *(label_buffer + i);
+        if (label_val > max_val)
         {
-            count = limit;
+            max_val = label_val;
         }
+    }
 
-        uint8_t max_val = 0;
-        for (lint i = 0; i < count; ++i)
-        {
-            uint8_t label_val = *(label_buffer + i);
-            if (label_val > max_val)
-            {
-                max_val = label_val;
-            }
-        }
+    // Pixels are already in the order of rows, columns and the only channel
+    images = Image_store{ neurons::Shape{ rows, columns, 1 }, max_val + 1 };
 
-        for (lint i = 0; i < count; ++i)
-        {
-            neurons::TMatrix<> label{ neurons::Shape{ max_val + 1 } };
-            uint8_t label_val = *(label_buffer + i);
-
-            for (uint8_t j = 0; j <= max_val; ++j)
-            {
-                if (j == label_val)
-                {
-                    label[{j}] = 1;
-                }
-                else
-                {
-                    label[{j}] = 0;
-                }
-            }
-
-            labels.push_back(label);
-        }
-    }
+    Image_store::Span span;
+    span.m_pixel_owner = image_file;
+    span.m_label_owner = label_file;
+    span.m_pixels = image_buffer;
+    span.m_labels = label_buffer;
+    span.m_images = count;
+    span.m_image_stride = rows * columns;
+    span.m_label_stride = 1;
+    span.m_planar = false;
+
+    images.add_span(span);
 }
 
 
@@ -187,14 +153,158 @@ dataset::Mnist::Mnist(
 void dataset::Mnist::get_training_set(
     std::vector<neurons::TMatrix<>>& inputs, std::vector<neurons::TMatrix<>>& labels, lint limit) const
 {
-    this->read_mnist_image_file(inputs, this->m_train_file, limit);
-    this->read_mnist_label_file(labels, this->m_train_label, limit);
+    Image_store images;
+    this->get_training_store(images, limit);
+    images.to_matrices(inputs, labels);
 }
 
 
 void dataset::Mnist::get_test_set(
     std::vector<neurons::TMatrix<>>& inputs, std::vector<neurons::TMatrix<>>& labels, lint limit) const
 {
-    this->read_mnist_image_file(inputs, this->m_test_file, limit);
-    this->read_mnist_label_file(labels, this->m_test_label, limit);
+    Image_store images;
+    this->get_test_store(images, limit);
+    images.to_matrices(inputs, labels);
+}
+
+
+bool dataset::Mnist::get_training_store(Image_store & images, lint limit) const
+{
+    this->read_mnist_files(images, this->m_train_file, this->m_train_label, limit);
+
+    return true;
+}
+
+
+bool dataset::Mnist::get_test_store(Image_store & images, lint limit) const
+{
+    this->read_mnist_files(images, this->m_test_file, this->m_test_label, limit);
+
+    return true;
+}
+
+
+std::unique_ptr<dataset::Sample_stream> dataset::Mnist::open_training_stream(lint shard, lint shards) const
+{
+    // Headers are validated in the mapped files, only pages of headers and labels are loaded
+    auto image_file = this->map_mnist_file(this->m_train_file, 0x803);
+    auto label_file = this->map_mnist_file(this->m_train_label, 0x801);
+
+    if (!image_file || !label_file)
+    {
+        return nullptr;
+    }
+
+    auto count = this->read_header(image_file->data(), 1);
+    auto rows = this->read_header(image_file->data(), 2);
+    auto columns = this->read_header(image_file->data(), 3);
+
+    if (count != this->read_header(label_file->data(), 1))
+    {
+        throw std::invalid_argument(
+            std::string("dataset::Mnist::open_training_stream: number of labels does not match number of images."));
+    }
+
+    // Number of classes is decided by labels of the whole training set, so all shards agree on it
+    const uint8_t* label_buffer = reinterpret_cast<const uint8_t*>(label_file->data() + 8);
+    uint8_t max_val = 0;
+    for (lint i = 0; i < count; ++i)
+    {
+        if (label_buffer[i] > max_val)
+        {
+            max_val = label_buffer[i];
+        }
+    }
+
+    return std::unique_ptr<Sample_stream>{ new Mnist_stream{
+        this->m_train_file,
+        this->m_train_label,
+        neurons::Shape{ rows, columns, 1 },
+        max_val + 1,
+        count * shard / shards,
+        count * (shard + 1) / shards } };
+}
+
+
+dataset::Mnist_stream::Mnist_stream(
+    const std::string & image_path,
+    const std::string & label_path,
+    const neurons::Shape & image_shape,
+    lint classes,
+    lint first,
+    lint end)
+    :
+    m_image_file{ image_path, std::ios::in | std::ios::binary },
+    m_label_file{ label_path, std::ios::in | std::ios::binary },
+    m_image_shape{ image_shape },
+    m_classes{ classes },
+    m_first{ first },
+    m_end{ end },
+    m_next{ first }
+{
+    if (!this->m_image_file || !this->m_label_file)
+    {
+        throw std::invalid_argument(std::string("Path or file not found"));
+    }
+
+    this->rewind();
+}
+
+neurons::Shape dataset::Mnist_stream::image_shape() const
+{
+    return this->m_image_shape;
+}
+
+dataset::lint dataset::Mnist_stream::classes() const
+{
+    return this->m_classes;
+}
+
+dataset::lint dataset::Mnist_stream::size() const
+{
+    return this->m_end - this->m_first;
+}
+
+dataset::lint dataset::Mnist_stream::read(Image_store & images, lint max_images)
+{
+    lint count = std::min(max_images, this->m_end - this->m_next);
+    if (count <= 0)
+    {
+        return 0;
+    }
+
+    lint image_size = this->m_image_shape.size();
+    lint first = images.size();
+    images.resize(first + count);
+
+    // Images of a chunk are contiguous in both the file and the store
+    this->m_image_file.read(reinterpret_cast<char *>(images.writable_pixels(first)), count * image_size);
+
+    this->m_label_buffer.resize(count);
+    this->m_label_file.read(this->m_label_buffer.data(), count);
+
+    if (!this->m_image_file || !this->m_label_file)
+    {
+        throw std::invalid_argument(std::string("dataset::Mnist_stream::read: failed to read MNIST files."));
+    }
+
+    for (lint i = 0; i < count; ++i)
+    {
+        images.set_label(first + i, static_cast<uint8_t>(this->m_label_buffer[i]));
+    }
+
+    this->m_next += count;
+    return count;
+}
+
+void dataset::Mnist_stream::rewind()
+{
+    this->m_image_file.clear();
+    this->m_label_file.clear();
+
+    // Skip the headers
+    this->m_image_file.seekg(16 + this->m_first * this->m_image_shape.size(), std::ios::beg);
+    this->m_label_file.seekg(8 + this->m_first, std::ios::beg);
+
+    this->m_next = this->m_first;
 }
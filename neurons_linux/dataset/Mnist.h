@@ -1,5 +1,7 @@
 #pragma once
 #include "Dataset.h"
+#include "Mapped_file.h"
+#include <fstream>
 #include <string>
 #include <vector>
 
@@ -7,6 +9,44 @@
 
 namespace dataset
 {
+    // Samples of a pair of MNIST image and label files read chunk by chunk
+    class Mnist_stream : public Sample_stream
+    {
+    private:
+        std::ifstream m_image_file;
+        std::ifstream m_label_file;
+
+        neurons::Shape m_image_shape;
+        lint m_classes;
+
+        // Samples [m_first, m_end) of the files are in the stream
+        lint m_first;
+        lint m_end;
+        lint m_next;
+
+        std::vector<char> m_label_buffer;
+
+    public:
+        Mnist_stream(
+            const std::string & image_path,
+            const std::string & label_path,
+            const neurons::Shape & image_shape,
+            lint classes,
+            lint first,
+            lint end);
+
+    public:
+        virtual neurons::Shape image_shape() const;
+
+        virtual lint classes() const;
+
+        virtual lint size() const;
+
+        virtual lint read(Image_store & images, lint max_images);
+
+        virtual void rewind();
+    };
+
     class Mnist : public Dataset
     {
     private:
@@ -22,18 +62,18 @@ namespace dataset
         * \param position The current reading positoin
         * \return The value of the mnist header
         */
-        int64_t read_header(const std::unique_ptr<char[]>& buffer, size_t position) const;
+        int64_t read_header(const char * buffer, size_t position) const;
 
         /*!
-        * \brief Read a MNIST file inside a raw buffer
+        * \brief Map a MNIST file into memory and validate its header in place
         * \param path The path to the image file
-        * \return The buffer of byte on success, a nullptr-unique_ptr otherwise
+        * \return The mapped file on success, a nullptr otherwise
         */
-        inline std::unique_ptr<char[]> read_mnist_file(const std::string & path, uint32_t key) const;
+        std::shared_ptr<Mapped_file> map_mnist_file(const std::string & path, uint32_t key) const;
 
-        void read_mnist_image_file(std::vector<neurons::TMatrix<>> & images, const std::string& path, lint limit = 0) const;
-
-        void read_mnist_label_file(std::vector<neurons::TMatrix<>> & labels, const std::string& path, lint limit = 0) const;
+        // Images and labels refer to the mapped files, nothing is copied
+        void read_mnist_files(
+            Image_store & images, const std::string & image_path, const std::string & label_path, lint limit = 0) const;
 
     public:
 
@@ -48,5 +88,11 @@ namespace dataset
 
         virtual void get_test_set(
             std::vector<neurons::TMatrix<>> & inputs, std::vector<neurons::TMatrix<>> & labels, lint limit = 0) const;
+
+        virtual bool get_training_store(Image_store & images, lint limit = 0) const;
+
+        virtual bool get_test_store(Image_store & images, lint limit = 0) const;
+
+        virtual std::unique_ptr<Sample_stream> open_training_stream(lint shard, lint shards) const;
     };
 }
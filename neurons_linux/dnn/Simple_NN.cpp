@@ -9,8 +9,8 @@ Simple_NN::Simple_NN(
     const dataset::Dataset &d_set)
     : 
     NN(l_rate, mmt_rate, threads, model_file, d_set),
-    m_input_size{ m_train_set[0].shape().size() },
-    m_output_size{ m_train_labels[0].shape().size() }
+    m_input_size{ m_sample_shape.size() },
+    m_output_size{ m_label_shape.size() }
 {
     // Initialize all layers
     if (!this->load(this->m_model_file))
@@ -18,27 +18,15 @@ Simple_NN::Simple_NN(
         this->initialize_model();
     }
 
-    for (size_t i = 0; i < this->m_train_set.size(); ++i)
-    {
-        this->m_train_set[i].reshape(neurons::Shape{ 1, m_input_size });
-        this->m_train_set[i].normalize();
-        this->m_train_labels[i].reshape(neurons::Shape{ 1, m_output_size });
-    }
-
-    for (size_t i = 0; i < this->m_test_set.size(); ++i)
-    {
-        this->m_test_set[i].reshape(neurons::Shape{ 1, m_input_size });;
-        this->m_test_set[i].normalize();
-        this->m_test_labels[i].reshape(neurons::Shape{ 1, m_output_size });
-    }
+    this->prepare_samples(neurons::Shape{ 1, m_input_size }, neurons::Shape{ 1, m_output_size }, true);
 }
 
 void Simple_NN::print_layers(std::ostream & os) const
 {
     for (size_t i = 0; i < this->m_layers.size(); ++i)
     {
-        neurons::TMatrix<> w = (dynamic_cast<neurons::Traditional_NN_layer *>(this->m_layers[i].get()))->weights();
-        neurons::TMatrix<> b = (dynamic_cast<neurons::Traditional_NN_layer *>(this->m_layers[i].get()))->bias();
+        neurons::TMatrix<> w = (dynamic_cast<neurons::Traditional_NN_layer<> *>(this->m_layers[i].get()))->weights();
+        neurons::TMatrix<> b = (dynamic_cast<neurons::Traditional_NN_layer<> *>(this->m_layers[i].get()))->bias();
 
         os << "=================== Layer: " << i << " ====================\n";
         os << "Weights:\n";
@@ -52,8 +40,8 @@ void Simple_NN::save_layers_as_images() const
 {
     for (size_t i = 0; i < this->m_layers.size(); ++i)
     {
-        neurons::TMatrix<> w = (dynamic_cast<neurons::Traditional_NN_layer *>(this->m_layers[i].get()))->weights();
-        neurons::TMatrix<> b = (dynamic_cast<neurons::Traditional_NN_layer *>(this->m_layers[i].get()))->bias();
+        neurons::TMatrix<> w = (dynamic_cast<neurons::Traditional_NN_layer<> *>(this->m_layers[i].get()))->weights();
+        neurons::TMatrix<> b = (dynamic_cast<neurons::Traditional_NN_layer<> *>(this->m_layers[i].get()))->bias();
 
         w.normalize(0, 255);
         w.save_matrix_as_image(this->m_model_file + "_layer_" + std::to_string(i) + ".pgm");
@@ -83,15 +71,15 @@ bool Simple_NN::load(const std::string & file_name)
 
     lint size;
     neurons::TMatrix<> w, b;
-    std::unique_ptr<neurons::Activation> act_func;
-    std::unique_ptr<neurons::ErrorFunction> err_func;
+    std::unique_ptr<neurons::Activation<>> act_func;
+    std::unique_ptr<neurons::ErrorFunction<>> err_func;
     char * re; lint re_len;
 
-    neurons::Traditional_NN_layer::from_binary_data(position, size, w, b, act_func, err_func, re, re_len);
+    neurons::Traditional_NN_layer<>::from_binary_data(position, size, w, b, act_func, err_func, re, re_len);
 
 
     this->m_layers.push_back(
-        std::make_shared<neurons::FCNN_layer>(this->m_mmt_rate, this->m_threads, w, b, act_func, err_func));
+        std::make_shared<neurons::FCNN_layer<>>(this->m_mmt_rate, this->m_threads, w, b, act_func, err_func));
 
     return true;
 }
@@ -104,9 +92,9 @@ bool Simple_NN::load_until(const std::string & file_name, lint layer_index)
 void Simple_NN::initialize_model()
 {
     // Initialize the first layer
-    this->m_layers.push_back(std::make_shared<neurons::FCNN_layer>(
+    this->m_layers.push_back(std::make_shared<neurons::FCNN_layer<>>(
         this->m_mmt_rate,
-        m_input_size, m_output_size, this->m_threads, nullptr, new neurons::Softmax_CrossEntropy));
+        m_input_size, m_output_size, this->m_threads, nullptr, new neurons::Softmax_CrossEntropy<>));
 }
 
 
@@ -126,8 +114,14 @@ void Simple_NN::save(const std::string & file_name) const
 }
 
 
+bool Simple_NN::normalizes_inputs() const
+{
+    return false;
+}
+
+
 std::vector<neurons::TMatrix<>> Simple_NN::predict(
-    const std::vector<neurons::TMatrix<>>& inputs, lint thread_id) const
+    const std::vector<const neurons::TMatrix<> *> & inputs, lint thread_id) const
 {
     std::vector<neurons::TMatrix<>> preds =
         this->m_layers[0]->operation_instances()[thread_id]->batch_forward_propagate(inputs);
@@ -142,8 +136,8 @@ std::vector<neurons::TMatrix<>> Simple_NN::predict(
 
 
 std::vector<neurons::TMatrix<>> Simple_NN::test(
-    const std::vector<neurons::TMatrix<>>& inputs,
-    const std::vector<neurons::TMatrix<>>& targets,
+    const std::vector<const neurons::TMatrix<> *> & inputs,
+    const std::vector<const neurons::TMatrix<> *> & targets,
     lint thread_id)
 {
     std::vector<neurons::TMatrix<>> preds =
@@ -153,8 +147,8 @@ std::vector<neurons::TMatrix<>> Simple_NN::test(
 
 
 std::vector<neurons::TMatrix<>> Simple_NN::optimise(
-    const std::vector<neurons::TMatrix<>>& inputs,
-    const std::vector<neurons::TMatrix<>>& targets,
+    const std::vector<const neurons::TMatrix<> *> & inputs,
+    const std::vector<const neurons::TMatrix<> *> & targets,
     lint thread_id)
 {
     std::vector<neurons::TMatrix<>> preds = this->test(inputs, targets, thread_id);
@@ -11,7 +11,7 @@ A simple NN without any hidden layers
 #include "FCNN_layer.h"
 #include <iostream>
 
-class Simple_NN : public NN
+class Simple_NN : public NN<>
 {
 private:
 
@@ -45,20 +45,25 @@ public:
 
     virtual void save(const std::string & file_name) const;
 
+protected:
+
+    // Samples are predicted as they are given
+    virtual bool normalizes_inputs() const;
+
 private:
 
     virtual std::vector<neurons::TMatrix<>> test(
-        const std::vector<neurons::TMatrix<>> & inputs,
-        const std::vector<neurons::TMatrix<>> & targets,
+        const std::vector<const neurons::TMatrix<> *> & inputs,
+        const std::vector<const neurons::TMatrix<> *> & targets,
         lint thread_id);
 
     virtual std::vector<neurons::TMatrix<>> optimise(
-        const std::vector<neurons::TMatrix<>> & inputs,
-        const std::vector<neurons::TMatrix<>> & targets,
+        const std::vector<const neurons::TMatrix<> *> & inputs,
+        const std::vector<const neurons::TMatrix<> *> & targets,
         lint thread_id);
 
     virtual std::vector<neurons::TMatrix<>> predict(
-        const std::vector<neurons::TMatrix<>> & inputs,
+        const std::vector<const neurons::TMatrix<> *> & inputs,
         lint thread_id) const;
 
 };
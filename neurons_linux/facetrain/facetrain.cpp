@@ -19,6 +19,7 @@ void printusage(std::string prog)
     std::cout << "       -n <network file>" << std::endl;
 	std::cout << "       [-f <network borrow from>]" << std::endl;
     std::cout << "       [-N <network type>]" << std::endl;
+    std::cout << "       [-p <precision: double or float>]" << std::endl;
     std::cout << "       [-S <number of epochs between saves of network>]" << std::endl;
     std::cout << "       [-T]" << std::endl;
     std::cout << "       [-H]" << std::endl;
@@ -29,6 +30,7 @@ void printusage(std::string prog)
     std::cout << "       [-l <learning-rate>]" << std::endl;
     std::cout << "       [-m <momentum>]" << std::endl;
     std::cout << "       [-s <random number generator seed>]" << std::endl;
+    std::cout << "       [-P (sample batches without replacement, reshuffled every epoch)]" << std::endl;
     std::cout << "       [-t <training set list>]" << std::endl;
     std::cout << "       [-1 <testing set 1 list>]" << std::endl;
     std::cout << "       [-2 <testing set 2 list>]" << std::endl;
@@ -113,6 +115,7 @@ int main(int argc, const char* argv[])
     lint list_errors = 0;
     bool test_only = false;
     lint argv_seed = 1;
+    bool argv_shuffle = false;
     bool argv_hidtopgm = false;
     lint n_epochs_between_save = 100;
     int argv_list_errors = 0;
@@ -122,6 +125,7 @@ int main(int argc, const char* argv[])
     lint argv_nthreads = 4;
     lint argv_epoch_size = 10;
     std::string argv_network = "dnn";
+    std::string argv_precision = "double";
 
     if (argc < 2)
     {
@@ -181,6 +185,8 @@ int main(int argc, const char* argv[])
                 break;
             case 'S': n_epochs_between_save = atoi(argv[++ind]);
                 break;
+            case 'P': argv_shuffle = true;
+                break;
             case 't': fname_train.assign(argv[++ind]);
                 break;
             case '1': fname_test1.assign(argv[++ind]);
@@ -201,6 +207,8 @@ int main(int argc, const char* argv[])
                 break;
             case 'N': argv_network.assign(argv[++ind]);
                 break;
+            case 'p': argv_precision.assign(argv[++ind]);
+                break;
             case 'm': argv_momentum = std::stoi(argv[++ind]);
                 break;
             case 'H': 
@@ -271,10 +279,19 @@ int main(int argc, const char* argv[])
         return -1;
     }
 
-    run_facial_network(
+    if ("double" != argv_precision && "float" != argv_precision)
+    {
+        std::cout << "Precision should be one of the follows: double, float.\n";
+        return -1;
+    }
+
+    auto run_network = "float" == argv_precision ? run_facial_network<float> : run_facial_network<double>;
+
+    run_network(
         argv_hidtopgm, // false
         test_only,
         argv_seed,
+        argv_shuffle,
         argv_batch_size,    //8,
         argv_nthreads,      //4,
         argv_epoch_size,    // 100,
@@ -83,7 +83,7 @@ int run_dnn(int argc, std::vector<std::string> argv)
 
     neurons::global::global_rand_engine.seed(static_cast<unsigned int>(neurons::now_in_seconds()));
 
-    Multi_Layer_NN nn{ 0.001, 0.3, argv_threads, model_file_name, *data_set };
+    Multi_Layer_NN<> nn{ 0.001, 0.3, argv_threads, model_file_name, *data_set };
     // nn.print_layers(std::cout);
     // nn.save_layers_as_images();
 
@@ -141,7 +141,7 @@ int run_cnn(int argc, std::vector<std::string> argv)
 
     neurons::global::global_rand_engine.seed(static_cast<unsigned int>(neurons::now_in_seconds()));
 
-    Conv_NN nn{ 0.001, 0.3, argv_threads, model_file_name, *data_set };
+    Conv_NN<> nn{ 0.001, 0.3, argv_threads, model_file_name, *data_set };
     // nn.print_layers(std::cout);
     // nn.save_layers_as_images();
 
@@ -197,10 +197,13 @@ int run_cnn(int argc, std::vector<std::string> argv)
 }
 
 
+// dtype is the precision the network is trained and tested in
+template <typename dtype>
 int run_facial_network(
     bool hitopgm,
     bool test_only,
     lint seed,
+    bool shuffle,
     lint batch_size,
     lint n_threads,
     lint epoch_size,
@@ -220,7 +223,7 @@ int run_facial_network(
     dataset::PGM pgm_train_dataset{ train_list, test_1_list, label_id };
     dataset::PGM pgm_test_dataset{ std::vector<std::string>{}, test_2_list, label_id };
 
-    std::unique_ptr<NN> network;
+    std::unique_ptr<NN<dtype>> network;
 
     if (seed < 0)
     {
@@ -233,7 +236,7 @@ int run_facial_network(
 
     if ("cnn" == network_type)
     {
-        network = std::make_unique<Conv_NN>(
+        network = std::make_unique<Conv_NN<dtype>>(
             learning_rate, momentum, n_threads, "cnn_" + network_file_name, pgm_train_dataset);
 
         if (!network_from_file_name.empty())
@@ -243,7 +246,7 @@ int run_facial_network(
     }
     else if ("dnn" == network_type)
     {
-        network = std::make_unique<Multi_Layer_NN>(
+        network = std::make_unique<Multi_Layer_NN<dtype>>(
             learning_rate, momentum, n_threads, "dnn_" + network_file_name, pgm_train_dataset);
 
         if (!network_from_file_name.empty())
@@ -257,6 +260,11 @@ int run_facial_network(
         return 0;
     }
 
+    if (shuffle)
+    {
+        network->set_sampling(NN<dtype>::Sampling::epoch_shuffle);
+    }
+
     if (hitopgm)
     {
         network->save_layers_as_images();
@@ -275,7 +283,18 @@ int run_facial_network(
 
     lint n_tests = 0;
     double n_rights = 0;
-    std::vector<neurons::TMatrix<>> test_pred = network->network_predict(batch_size, test_input);
+    // Samples are predicted in the precision of the network, predictions are compared in double
+    std::vector<neurons::TMatrix<dtype>> network_input;
+    for (size_t i = 0; i < test_input.size(); ++i)
+    {
+        network_input.push_back(neurons::TMatrix<dtype>{ test_input[i] });
+    }
+
+    std::vector<neurons::TMatrix<>> test_pred;
+    for (const neurons::TMatrix<dtype> & pred : network->network_predict(batch_size, network_input))
+    {
+        test_pred.push_back(neurons::TMatrix<>{ pred });
+    }
 
     for (size_t i = 0; i < test_labels.size(); ++i)
     {
@@ -0,0 +1,359 @@
+#include "Allocator.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <cstdlib>
+#endif
+
+const size_t neurons::Allocator::ALIGNMENT;
+const size_t neurons::Pool_allocator::MIN_BLOCK;
+const size_t neurons::Pool_allocator::MAX_BLOCK;
+const size_t neurons::Pool_allocator::MAX_CACHED_BYTES;
+const lint neurons::Pool_allocator::TRIM_INTERVAL;
+
+namespace
+{
+    const size_t SIZE_CLASSES = 17;
+
+    void * system_allocate(size_t bytes)
+    {
+#ifdef _WIN32
+        void *block = _aligned_malloc(bytes, neurons::Allocator::ALIGNMENT);
+        if (nullptr == block)
+        {
+            throw std::bad_alloc();
+        }
+#else
+        void *block = nullptr;
+        if (0 != posix_memalign(&block, neurons::Allocator::ALIGNMENT, bytes))
+        {
+            throw std::bad_alloc();
+        }
+#endif
+        return block;
+    }
+
+    void system_free(void *block)
+    {
+#ifdef _WIN32
+        _aligned_free(block);
+#else
+        free(block);
+#endif
+    }
+
+    // Size class of a block of bytes and the size of blocks of the class
+    size_t size_class(size_t bytes, size_t & block_size)
+    {
+        size_t index = 0;
+        block_size = neurons::Pool_allocator::MIN_BLOCK;
+        while (block_size < bytes)
+        {
+            block_size <<= 1;
+            ++index;
+        }
+
+        return index;
+    }
+
+    struct Thread_cache;
+
+    // Shared by all threads. It is never destroyed, matrices may be freed during destruction of statics.
+    struct Allocator_state
+    {
+        std::atomic<neurons::Allocator *> m_current;
+
+        std::mutex m_mutex;
+        // Every allocator ever set, matrices may still free their blocks through them
+        std::vector<std::shared_ptr<neurons::Allocator>> m_allocators;
+        std::vector<Thread_cache *> m_caches;
+
+        // Counts of threads that have exited
+        lint m_retired_allocations;
+        lint m_retired_system_allocations;
+
+        // Counts of all steps before the current one
+        lint m_total_allocations;
+        lint m_total_system_allocations;
+        neurons::Allocation_count m_last_step;
+
+        // Number of finished steps
+        std::atomic<lint> m_step;
+
+        Allocator_state()
+            : m_current{ nullptr },
+            m_retired_allocations{ 0 },
+            m_retired_system_allocations{ 0 },
+            m_total_allocations{ 0 },
+            m_total_system_allocations{ 0 },
+            m_last_step{ 0, 0 },
+            m_step{ 0 }
+        {
+            this->m_allocators.push_back(std::make_shared<neurons::Pool_allocator>());
+            this->m_current = this->m_allocators.back().get();
+        }
+    };
+
+    Allocator_state & state()
+    {
+        static Allocator_state *allocator_state = new Allocator_state;
+        return *allocator_state;
+    }
+
+    // Free lists and counters of a thread
+    struct Thread_cache
+    {
+        std::vector<void *> m_free[SIZE_CLASSES];
+        // The fewest blocks each free list has had since the last trim
+        size_t m_low_water[SIZE_CLASSES];
+        lint m_step;
+        // Allocations and frees of blocks of size classes since the last trim
+        lint m_operations;
+
+        // Only the owner thread writes them, other threads read them at the end of steps
+        std::atomic<lint> m_allocations;
+        std::atomic<lint> m_system_allocations;
+        // Bytes of the blocks in the free lists
+        std::atomic<lint> m_cached_bytes;
+
+        bool m_alive;
+
+        Thread_cache()
+            : m_step{ state().m_step.load() }, m_operations{ 0 }, m_allocations{ 0 }, m_system_allocations{ 0 }, m_cached_bytes{ 0 }, m_alive{ true }
+        {
+            std::fill(this->m_low_water, this->m_low_water + SIZE_CLASSES, 0);
+
+            std::lock_guard<std::mutex> lock{ state().m_mutex };
+            state().m_caches.push_back(this);
+        }
+
+        ~Thread_cache()
+        {
+            for (size_t i = 0; i < SIZE_CLASSES; ++i)
+            {
+                for (void *block : this->m_free[i])
+                {
+                    system_free(block);
+                }
+                this->m_free[i].clear();
+            }
+            this->m_cached_bytes.store(0, std::memory_order_relaxed);
+
+            std::lock_guard<std::mutex> lock{ state().m_mutex };
+            auto & caches = state().m_caches;
+            caches.erase(std::find(caches.begin(), caches.end(), this));
+            state().m_retired_allocations += this->m_allocations.load();
+            state().m_retired_system_allocations += this->m_system_allocations.load();
+
+            // Blocks freed by destructors of statics of this thread go to the system
+            this->m_alive = false;
+        }
+
+        static void add(std::atomic<lint> & counter, lint n = 1)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        // Return blocks unused during the last step to the system, or during the last TRIM_INTERVAL
+        // operations of the thread if no step ended meanwhile (threads which do not train)
+        void trim()
+        {
+            lint step = state().m_step.load(std::memory_order_relaxed);
+            if (step == this->m_step && ++this->m_operations < neurons::Pool_allocator::TRIM_INTERVAL)
+            {
+                return;
+            }
+            this->m_step = step;
+            this->m_operations = 0;
+
+            size_t block_size = neurons::Pool_allocator::MIN_BLOCK;
+            for (size_t i = 0; i < SIZE_CLASSES; ++i, block_size <<= 1)
+            {
+                std::vector<void *> & free_list = this->m_free[i];
+                size_t unused = std::min(this->m_low_water[i], free_list.size());
+
+                // The oldest blocks are at the front
+                for (size_t j = 0; j < unused; ++j)
+                {
+                    system_free(free_list[j]);
+                }
+                free_list.erase(free_list.begin(), free_list.begin() + unused);
+                this->m_low_water[i] = free_list.size();
+                add(this->m_cached_bytes, -static_cast<lint>(unused * block_size));
+            }
+        }
+    };
+
+    thread_local Thread_cache thread_cache;
+}
+
+
+void * neurons::Pool_allocator::allocate(size_t bytes)
+{
+    if (0 == bytes)
+    {
+        return nullptr;
+    }
+
+    if (bytes > MAX_BLOCK)
+    {
+        if (thread_cache.m_alive)
+        {
+            Thread_cache::add(thread_cache.m_system_allocations);
+        }
+        return system_allocate(bytes);
+    }
+
+    // Blocks are always of the size of their class, any thread may put them in a free list
+    size_t block_size;
+    size_t index = size_class(bytes, block_size);
+    if (!thread_cache.m_alive)
+    {
+        return system_allocate(block_size);
+    }
+
+    thread_cache.trim();
+    std::vector<void *> & free_list = thread_cache.m_free[index];
+
+    if (free_list.empty())
+    {
+        Thread_cache::add(thread_cache.m_system_allocations);
+        return system_allocate(block_size);
+    }
+
+    void *block = free_list.back();
+    free_list.pop_back();
+    thread_cache.m_low_water[index] = std::min(thread_cache.m_low_water[index], free_list.size());
+    Thread_cache::add(thread_cache.m_cached_bytes, -static_cast<lint>(block_size));
+
+    return block;
+}
+
+void neurons::Pool_allocator::deallocate(void *block, size_t bytes)
+{
+    if (nullptr == block)
+    {
+        return;
+    }
+
+    if (bytes > MAX_BLOCK || !thread_cache.m_alive)
+    {
+        system_free(block);
+        return;
+    }
+
+    thread_cache.trim();
+
+    size_t block_size;
+    size_t index = size_class(bytes, block_size);
+    if (thread_cache.m_cached_bytes.load(std::memory_order_relaxed) + static_cast<lint>(block_size) > static_cast<lint>(MAX_CACHED_BYTES))
+    {
+        system_free(block);
+        return;
+    }
+
+    thread_cache.m_free[index].push_back(block);
+    Thread_cache::add(thread_cache.m_cached_bytes, block_size);
+}
+
+
+std::shared_ptr<neurons::Allocator> neurons::matrix_allocator()
+{
+    std::lock_guard<std::mutex> lock{ state().m_mutex };
+    for (auto & allocator : state().m_allocators)
+    {
+        if (allocator.get() == state().m_current.load())
+        {
+            return allocator;
+        }
+    }
+
+    return nullptr;
+}
+
+std::shared_ptr<neurons::Allocator> neurons::set_matrix_allocator(std::shared_ptr<Allocator> allocator)
+{
+    if (nullptr == allocator)
+    {
+        throw std::invalid_argument(std::string("neurons::set_matrix_allocator: the allocator is null"));
+    }
+
+    std::shared_ptr<Allocator> replaced = matrix_allocator();
+
+    std::lock_guard<std::mutex> lock{ state().m_mutex };
+    state().m_allocators.push_back(allocator);
+    state().m_current = allocator.get();
+
+    return replaced;
+}
+
+void * neurons::allocate_matrix_storage(size_t bytes)
+{
+    if (0 == bytes)
+    {
+        return nullptr;
+    }
+
+    if (thread_cache.m_alive)
+    {
+        Thread_cache::add(thread_cache.m_allocations);
+    }
+
+    return state().m_current.load(std::memory_order_acquire)->allocate(bytes);
+}
+
+void neurons::deallocate_matrix_storage(void *block, size_t bytes)
+{
+    if (nullptr != block)
+    {
+        state().m_current.load(std::memory_order_acquire)->deallocate(block, bytes);
+    }
+}
+
+void neurons::end_allocation_step()
+{
+    Allocator_state & allocator_state = state();
+
+    std::lock_guard<std::mutex> lock{ allocator_state.m_mutex };
+
+    lint allocations = allocator_state.m_retired_allocations;
+    lint system_allocations = allocator_state.m_retired_system_allocations;
+    for (Thread_cache *cache : allocator_state.m_caches)
+    {
+        allocations += cache->m_allocations.load(std::memory_order_relaxed);
+        system_allocations += cache->m_system_allocations.load(std::memory_order_relaxed);
+    }
+
+    allocator_state.m_last_step.m_allocations = allocations - allocator_state.m_total_allocations;
+    allocator_state.m_last_step.m_system_allocations = system_allocations - allocator_state.m_total_system_allocations;
+    allocator_state.m_total_allocations = allocations;
+    allocator_state.m_total_system_allocations = system_allocations;
+
+    ++allocator_state.m_step;
+}
+
+neurons::Allocation_count neurons::last_step_allocations()
+{
+    std::lock_guard<std::mutex> lock{ state().m_mutex };
+    return state().m_last_step;
+}
+
+lint neurons::cached_matrix_bytes()
+{
+    std::lock_guard<std::mutex> lock{ state().m_mutex };
+    lint bytes = 0;
+    for (Thread_cache *cache : state().m_caches)
+    {
+        bytes += cache->m_cached_bytes.load(std::memory_order_relaxed);
+    }
+
+    return bytes;
+}
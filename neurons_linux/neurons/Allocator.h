@@ -0,0 +1,89 @@
+#pragma once
+#include "Shape.h"
+#include <cstddef>
+#include <memory>
+
+namespace neurons
+{
+    // Numbers of blocks of matrix storage allocated in a training step
+    struct Allocation_count
+    {
+        // Blocks asked for by matrices
+        lint m_allocations;
+        // Blocks the default allocator had to get from the system
+        lint m_system_allocations;
+    };
+
+    /*
+    Allocator of storage of matrices (TMatrix::m_data).
+    Blocks are aligned to ALIGNMENT bytes, and they are freed with the size they were allocated with.
+    */
+    class Allocator
+    {
+    public:
+        static const size_t ALIGNMENT = 64;
+
+        virtual ~Allocator() {}
+
+        // A block of at least bytes, nullptr if bytes is 0
+        virtual void * allocate(size_t bytes) = 0;
+
+        virtual void deallocate(void *block, size_t bytes) = 0;
+    };
+
+    /*
+    The default allocator of matrix storage.
+
+    Blocks are rounded up to size classes of powers of 2 from 64 bytes to 4 MB.
+    Freed blocks are kept in free lists of the thread that frees them, and following allocations
+    of the thread take them back without locks or calls to the system. A training step allocates
+    and frees blocks of the same sizes step after step, so after the first step almost every
+    block comes from the free lists: they are the step arenas of the threads.
+    When a step ends (see end_allocation_step), blocks that stayed in a free list during the whole
+    step are returned to the system, so each thread only keeps what its steps need.
+    Threads notice the end of a step the next time they allocate or free. A thread that sees no step
+    end for TRIM_INTERVAL allocations and frees trims its free lists the same way.
+    A thread keeps at most MAX_CACHED_BYTES in its free lists, blocks freed beyond that go back
+    to the system: a thread freeing blocks other threads allocated (such as the worker of a
+    server answering requests of callers) would otherwise keep all of them, step or not.
+
+    Free lists are per thread and not per allocator, blocks of a size class are all alike.
+    Blocks larger than the largest size class are allocated from the system directly.
+    */
+    class Pool_allocator : public Allocator
+    {
+    public:
+        static const size_t MIN_BLOCK = 64;
+        static const size_t MAX_BLOCK = 4 << 20;
+        static const size_t MAX_CACHED_BYTES = 64 << 20;
+        static const lint TRIM_INTERVAL = 1 << 16;
+
+        virtual void * allocate(size_t bytes);
+
+        virtual void deallocate(void *block, size_t bytes);
+    };
+
+    // The allocator of matrix storage, a Pool_allocator unless it is replaced
+    std::shared_ptr<Allocator> matrix_allocator();
+
+    // Replace the allocator of matrix storage and return the replaced one.
+    // Matrices free their storage with the allocator of the time they are freed, so the new
+    // allocator has to be able to free blocks of the old one (for example by wrapping it),
+    // unless it is set before any matrix is created. Replaced allocators are kept alive.
+    std::shared_ptr<Allocator> set_matrix_allocator(std::shared_ptr<Allocator> allocator);
+
+    // Storage of matrices, allocations are counted
+    void * allocate_matrix_storage(size_t bytes);
+
+    void deallocate_matrix_storage(void *block, size_t bytes);
+
+    // A training step has finished (NN calls it after commit_training): counts of allocations
+    // of the step are published, and free lists of the default allocator are trimmed.
+    void end_allocation_step();
+
+    // Allocations of the last finished step
+    Allocation_count last_step_allocations();
+
+    // Bytes of the blocks in free lists of the default allocator, of all threads
+    lint cached_matrix_bytes();
+}
@@ -32,12 +32,86 @@ namespace neurons
         TMatrix<> & get_diff_to_weights() const;
     };
 
+    /*
+    Winograd convolution F(m x m, 3 x 3) of 3 x 3 filters with stride 1, instantiated for float and double.
+
+    The output is computed in tiles of m x m pixels. Each tile needs a patch of (m + 2) x (m + 2)
+    pixels of the input d and a filter g, which are transformed as
+
+        U = G g transpose(G),    V = transpose(B) d B,    Y = transpose(A) (U . V) A
+
+    where . is multiplication element by element. Summed up over channels, U . V of all tiles
+    become (m + 2)^2 matrix products [tiles, channels] x [channels, filters].
+    An m x m tile costs (m + 2)^2 multiplications per channel and filter instead of 9 m^2:
+    2.25 times fewer for F(2 x 2, 3 x 3) and 4 times fewer for F(4 x 4, 3 x 3), while the
+    transforms only cost additions (and few multiplications) per channel or per filter.
+    F(4 x 4, 3 x 3) loses a few more bits of precision than F(2 x 2, 3 x 3).
+    */
+    template <typename dtype = double>
+    class Winograd_2d
+    {
+    private:
+        Shape m_input_sh;
+        Shape m_output_sh;
+
+        lint m_r_zero_p;
+        lint m_c_zero_p;
+
+        // Size m of output tiles, 2 or 4
+        lint m_tile;
+        lint m_tile_rows;
+        lint m_tile_cols;
+
+        // Transformed filters of [(m + 2)^2, channels, filters]
+        mutable TMatrix<dtype> m_u;
+        // Weights m_u was transformed from, filters are transformed again only if the weights change
+        mutable TMatrix<dtype> m_transformed_w;
+        // Transformed patches of [(m + 2)^2, tiles, channels]
+        mutable TMatrix<dtype> m_v;
+        // Products of [(m + 2)^2, tiles, filters]
+        mutable TMatrix<dtype> m_m;
+
+    public:
+        // Products of fewer tiles (of all samples) or of less work (tiles * channels * filters) are faster by
+        // matrix multiplication of patches: on single images from [1, 8, 7, 6] by 30 filters to [1, 56, 56, 64]
+        // by 64 filters, the transforms and the small products cost more than the multiplications they save.
+        static const lint MIN_TILES = 32;
+        static const lint MIN_WORK = 65536;
+
+        // True if the convolution of these weights and strides can be computed this way
+        static bool supports(const Shape & weights_shape, lint r_stride, lint c_stride);
+
+        Winograd_2d();
+
+        // Shapes are those of Conv_2d, tile is 2 or 4, or 0 to choose by size of the output:
+        // F(4 x 4, 3 x 3) if there are at least 2 whole tiles of 4 x 4 in each direction.
+        Winograd_2d(const Shape & input_shape, const Shape & weights_shape, lint r_zero_p, lint c_zero_p, lint tile = 0);
+
+        // Convolutional product without the bias, written into out which is of the output shape
+        void product(TMatrix<dtype> & out, const TMatrix<dtype> & input, const TMatrix<dtype> & weights) const;
+
+        lint tile() const { return this->m_tile; }
+
+        // True if the product is large enough to be faster this way (see MIN_TILES and MIN_WORK)
+        bool worthwhile() const;
+
+    private:
+        void transform_filters(const TMatrix<dtype> & weights) const;
+
+        // Transform patches of tiles [begin, end), tiles of all samples are counted one after another
+        void transform_input(const TMatrix<dtype> & input, lint begin, lint end) const;
+
+        // Transform products of tiles [begin, end) back into pixels of the output
+        void transform_output(TMatrix<dtype> & out, lint begin, lint end) const;
+    };
+
+    // 2-dimensional convolution of matrices of dtype, instantiated for float and double
+    template <typename dtype = double>
     class Conv_2d
     {
     private:
 
         Shape m_input_sh;
-        Shape m_ex_in_sh;
         Shape m_weights_sh;
         Shape m_output_sh;
 
@@ -47,11 +121,15 @@ namespace neurons
         lint m_r_zero_p;
         lint m_c_zero_p;
 
-        mutable TMatrix<> m_diff_to_w;
-        mutable TMatrix<> m_diff_to_x;
+        // Patches of the input unfolded as rows (im2col), reused by every call
+        mutable TMatrix<dtype> m_cols;
+        // Gradients of the unfolded patches during back propagation
+        mutable TMatrix<dtype> m_col_diffs;
 
+        // The product of 3 x 3 filters with stride 1 is computed by Winograd_2d
+        bool m_use_winograd;
+        Winograd_2d<dtype> m_winograd;
 
-    
     public:
         Conv_2d(const Shape & input_shape, const Shape & weights_shape, lint r_stride = 1, lint c_stride = 1, lint r_zero_p = 0, lint c_zero_p = 0);
         Conv_2d();
@@ -66,16 +144,34 @@ namespace neurons
         // 10 is number of filters.
         // Shape of the result will be: [4, 24, 24, 10], in which 4 is batch size, [24, 24] is
         // output size, and 10 is depth (identical as number of filters)
-        TMatrix<> operator () (const TMatrix<> & input, const TMatrix<> & weights, const TMatrix<> & bias);
-
-        TMatrix<> & get_diff_to_weights() const;
-
-        TMatrix<> & get_diff_to_input() const;
+        //
+        // The input is unfolded into a [4 * 24 * 24, 5 * 5 * 3] matrix of patches (im2col),
+        // then the product is a single matrix multiplication with weights seen as [5 * 5 * 3, 10].
+        //
+        // Filters of 3 x 3 with stride 1 are multiplied by Winograd convolution instead if the product
+        // is large enough (see Winograd_2d::worthwhile).
+        //
+        // The product and its derivatives split their work over the threads of the process pool
+        // given to the calling thread (see Intra_op_scope): the product and dE/dx over rows of
+        // the output and of the input of all samples, dE/dw over filters.
+        TMatrix<dtype> operator () (const TMatrix<dtype> & input, const TMatrix<dtype> & weights, const TMatrix<dtype> & bias);
+
+        // Convolutional product without the bias, written into a buffer of the caller which is reused
+        // when it has the output shape. The bias is left to a fused epilogue (see Activation).
+        void product(TMatrix<dtype> & out, const TMatrix<dtype> & input, const TMatrix<dtype> & weights);
+
+        // Derivative dE/dx of the input, given dE/dz of the convolutional product z.
+        // dE/dz is of the output shape, dE/dx is of the input shape.
+        TMatrix<dtype> diff_to_input(const TMatrix<dtype> & diff_E_to_z, const TMatrix<dtype> & weights) const;
+
+        // Derivative dE/dw of the weights, given the input and dE/dz of the convolutional product z.
+        // The result is added to diff_E_to_w, which is of the weights shape.
+        void add_diff_to_weights(TMatrix<dtype> & diff_E_to_w, const TMatrix<dtype> & input, const TMatrix<dtype> & diff_E_to_z) const;
 
         Shape get_output_shape() const;
 
     public:
-        TMatrix<> zero_padding(const TMatrix<> & input);
+        TMatrix<dtype> zero_padding(const TMatrix<dtype> & input);
 
         lint r_stride() const { return this->m_r_stride; }
 
@@ -84,6 +180,26 @@ namespace neurons
         lint r_zero_p() const { return this->m_r_zero_p; }
         
         lint c_zero_p() const { return this->m_c_zero_p; }
+
+        // Compute the product by Winograd convolution if the filters and strides allow it,
+        // or always by matrix multiplication of patches. By default Winograd convolution is on
+        // for products it is worthwhile for.
+        void set_winograd(bool enabled);
+
+        bool uses_winograd() const { return this->m_use_winograd; }
+
+    private:
+        // Resize m_cols to [positions, patch size] if it is not
+        void prepare_cols() const;
+
+        // Unfold each patch of the input into a row of m_cols, zero padding is applied on the fly.
+        // Only patches of output rows [begin, end) are unfolded, output rows of all samples are
+        // counted one after another (row = sample * output rows + output row).
+        void im2col(const TMatrix<dtype> & input, lint begin, lint end) const;
+
+        // Fold rows of patches back into the input shape, overlapped pixels are summed up.
+        // Only input rows [begin, end) are written, counted the same way as in im2col.
+        void col2im(const TMatrix<dtype> & cols, TMatrix<dtype> & output, lint begin, lint end) const;
     };
 
     class Conv_3d
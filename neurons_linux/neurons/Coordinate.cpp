@@ -4,20 +4,21 @@
 #include <cstring>
 
 neurons::Coordinate::Coordinate(std::initializer_list<lint> list)
-    : m_dim(list.end() - list.begin())
+    : m_dim{ 0 }, m_data{ this->m_inline }, m_has_shape{ false }
 {
-    if (this->m_dim < 1)
+    if (list.end() - list.begin() < 1)
     {
         throw std::invalid_argument(invalid_coord_dim);
     }
 
-    this->m_data = new lint[this->m_dim];
+    this->allocate(list.end() - list.begin());
 
     lint *p = this->m_data;
     for (auto itr = list.begin(); itr != list.end(); ++itr, ++p)
     {
         if (*itr < 0)
         {
+            this->release();
             throw std::invalid_argument(invalid_coord_val);
         }
         *p = *itr;
@@ -29,7 +30,6 @@ neurons::Coordinate::Coordinate(std::initializer_list<lint> list, const Shape &
 {
     if (shape.m_dim != this->m_dim)
     {
-        delete[]this->m_data;
         throw std::invalid_argument(std::string("Shape and coordinate incompatible"));
     }
 
@@ -37,19 +37,19 @@ neurons::Coordinate::Coordinate(std::initializer_list<lint> list, const Shape &
     {
         if (this->m_data[i] >= shape.m_data[i])
         {
-            delete[]this->m_data;
             throw std::invalid_argument(std::string("Shape and coordinate incompatible"));
         }
     }
 
-    this->m_shape = std::make_unique<Shape>(shape);
+    this->m_shape = shape;
+    this->m_has_shape = true;
 }
 
 
 neurons::Coordinate::Coordinate(const Shape & shape)
-    : m_dim{ shape.m_dim }, m_shape{ std::make_unique<Shape>(shape) }
+    : m_dim{ 0 }, m_data{ this->m_inline }, m_shape{ shape }, m_has_shape{ true }
 {
-    this->m_data = new lint[this->m_dim];
+    this->allocate(shape.m_dim);
     for (lint i = 0; i < this->m_dim; ++i)
     {
         this->m_data[i] = 0;
@@ -58,49 +58,93 @@ neurons::Coordinate::Coordinate(const Shape & shape)
 
 
 neurons::Coordinate::Coordinate(const Coordinate & other)
-    : m_dim{ other.m_dim }, m_shape{ std::make_unique<Shape>(*(other.m_shape)) }
+    : m_dim{ 0 }, m_data{ this->m_inline }, m_shape{ other.m_shape }, m_has_shape{ other.m_has_shape }
 {
-    this->m_data = new lint[this->m_dim];
+    this->allocate(other.m_dim);
 
     std::memcpy(this->m_data, other.m_data, this->m_dim * sizeof(lint));
 }
 
 
 neurons::Coordinate::Coordinate(Coordinate && other)
-    : m_dim{ other.m_dim }, m_data{ other.m_data }, m_shape{ std::move(other.m_shape) }
+    : m_dim{ 0 }, m_data{ this->m_inline }, m_has_shape{ false }
 {
-    other.m_dim = 0;
-    other.m_data = nullptr;
+    this->move_from(other);
 }
 
 neurons::Coordinate::~Coordinate()
 {
-    delete[]this->m_data;
+    this->release();
 }
 
 neurons::Coordinate & neurons::Coordinate::operator = (const Coordinate & other)
 {
-    delete[]m_data;
-    this->m_dim = other.m_dim;
-    this->m_shape = std::make_unique<Shape>(*(other.m_shape));
+    if (this == &other)
+    {
+        return *this;
+    }
 
-    this->m_data = new lint[m_dim];
-    std::memcpy(this->m_data, other.m_data, m_dim * sizeof(lint));
+    this->allocate(other.m_dim);
+    this->m_shape = other.m_shape;
+    this->m_has_shape = other.m_has_shape;
+    std::memcpy(this->m_data, other.m_data, this->m_dim * sizeof(lint));
 
     return *this;
 }
 
 neurons::Coordinate & neurons::Coordinate::operator = (Coordinate && other)
 {
-    delete[]m_data;
+    if (this != &other)
+    {
+        this->move_from(other);
+    }
+
+    return *this;
+}
+
+void neurons::Coordinate::allocate(lint dim)
+{
+    if (dim <= Shape::INLINE_DIMS)
+    {
+        this->release();
+    }
+    else if (dim != this->m_dim)
+    {
+        this->release();
+        this->m_data = new lint[dim];
+    }
+    this->m_dim = dim;
+}
+
+void neurons::Coordinate::release()
+{
+    if (this->m_data != this->m_inline)
+    {
+        delete[]this->m_data;
+        this->m_data = this->m_inline;
+    }
+}
+
+void neurons::Coordinate::move_from(Coordinate & other)
+{
+    this->release();
     this->m_dim = other.m_dim;
     this->m_shape = std::move(other.m_shape);
-    this->m_data = other.m_data;
+    this->m_has_shape = other.m_has_shape;
 
-    other.m_dim = 0;
-    other.m_data = nullptr;
+    if (other.m_data == other.m_inline)
+    {
+        std::memcpy(this->m_inline, other.m_inline, other.m_dim * sizeof(lint));
+    }
+    else
+    {
+        // Heap storage changes hands
+        this->m_data = other.m_data;
+        other.m_data = other.m_inline;
+    }
 
-    return *this;
+    other.m_dim = 0;
+    other.m_has_shape = false;
 }
 
 lint neurons::Coordinate::operator [] (lint index) const
@@ -115,7 +159,7 @@ lint & neurons::Coordinate::operator [] (lint index)
 
 neurons::Coordinate & neurons::Coordinate::operator++()
 {
-    if (nullptr == this->m_shape)
+    if (!this->m_has_shape)
     {
         throw std::bad_function_call();
     }
@@ -124,7 +168,7 @@ neurons::Coordinate & neurons::Coordinate::operator++()
     while (plus_pos >= 0)
     {
         lint increased = this->m_data[plus_pos] + 1;
-        if (increased < this->m_shape->m_data[plus_pos])
+        if (increased < this->m_shape.m_data[plus_pos])
         {
             this->m_data[plus_pos] = increased;
             break;
@@ -148,7 +192,7 @@ neurons::Coordinate neurons::Coordinate::operator++(int)
 
 neurons::Coordinate & neurons::Coordinate::transposed_plus()
 {
-    if (nullptr == this->m_shape)
+    if (!this->m_has_shape)
     {
         throw std::bad_function_call();
     }
@@ -157,7 +201,7 @@ neurons::Coordinate & neurons::Coordinate::transposed_plus()
     while (plus_pos < this->m_dim)
     {
         lint increased = this->m_data[plus_pos] + 1;
-        if (increased < this->m_shape->m_data[plus_pos])
+        if (increased < this->m_shape.m_data[plus_pos])
         {
             this->m_data[plus_pos] = increased;
             break;
@@ -179,9 +223,9 @@ lint neurons::Coordinate::dim() const
 
 neurons::Coordinate & neurons::Coordinate::reverse()
 {
-    if (nullptr != this->m_shape)
+    if (this->m_has_shape)
     {
-        this->m_shape->reverse();
+        this->m_shape.reverse();
     }
 
     for (lint i = 0; i < this->m_dim / 2; ++i)
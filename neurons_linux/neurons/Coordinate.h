@@ -19,12 +19,14 @@ namespace neurons
     private:
         // Number of dimensions
         lint m_dim;
-        // Detailed data of this coordinate
+        // Detailed data of this coordinate, it points to m_inline if m_dim <= Shape::INLINE_DIMS
         lint *m_data;
+        lint m_inline[Shape::INLINE_DIMS];
 
         // The shape used to restrict behavior of the coordinate
         // The coordinate can only change within the range defined by the shape
-        std::unique_ptr<Shape> m_shape;
+        Shape m_shape;
+        bool m_has_shape;
 
     public:
         // The coordinate can be created by a list of numbers.
@@ -70,6 +72,17 @@ namespace neurons
 
         Coordinate & transposed_plus();
 
+    private:
+        // Point m_data to storage of dim dimensions, the old storage is released
+        void allocate(lint dim);
+
+        // Release storage of m_data if it is on the heap
+        void release();
+
+        // Take dimensions and the shape of other, which is left empty
+        void move_from(Coordinate & other);
+
+    public:
         friend bool operator == (const Coordinate &left, const Coordinate &right);
         friend bool operator != (const Coordinate &left, const Coordinate &right);
         friend std::ostream & operator << (std::ostream & os, const Coordinate & co);
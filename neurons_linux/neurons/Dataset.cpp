@@ -1,4 +1,263 @@
 #include "Dataset.h"
+#include <algorithm>
 
 
+dataset::Image_store::Image_store()
+    : m_image_size{ 0 }, m_classes{ 0 }
+{}
 
+dataset::Image_store::Image_store(const neurons::Shape & image_shape, lint classes)
+    : m_image_shape{ image_shape }, m_image_size{ image_shape.size() }, m_classes{ classes }
+{}
+
+lint dataset::Image_store::size() const
+{
+    if (this->m_spans.empty())
+    {
+        return this->m_labels.size();
+    }
+
+    return this->m_span_ends.back();
+}
+
+const neurons::Shape & dataset::Image_store::image_shape() const
+{
+    return this->m_image_shape;
+}
+
+lint dataset::Image_store::classes() const
+{
+    return this->m_classes;
+}
+
+void dataset::Image_store::set_classes(lint classes)
+{
+    this->m_classes = classes;
+}
+
+void dataset::Image_store::resize(lint images)
+{
+    if (!this->m_spans.empty())
+    {
+        throw std::invalid_argument(
+            std::string("dataset::Image_store::resize: the store refers to images it does not own."));
+    }
+
+    this->m_pixels.resize(images * this->m_image_size, 0);
+    this->m_labels.resize(images, 0);
+}
+
+void dataset::Image_store::add_span(const Span & span)
+{
+    if (!this->m_labels.empty())
+    {
+        throw std::invalid_argument(
+            std::string("dataset::Image_store::add_span: the store already owns images."));
+    }
+
+    if (span.m_images <= 0)
+    {
+        return;
+    }
+
+    this->m_spans.push_back(span);
+    this->m_span_ends.push_back((this->m_span_ends.empty() ? 0 : this->m_span_ends.back()) + span.m_images);
+}
+
+uint8_t * dataset::Image_store::writable_pixels(lint index)
+{
+    if (!this->m_spans.empty())
+    {
+        throw std::invalid_argument(
+            std::string("dataset::Image_store::writable_pixels: the store refers to images it does not own."));
+    }
+
+    return this->m_pixels.data() + index * this->m_image_size;
+}
+
+const uint8_t * dataset::Image_store::pixels(lint index) const
+{
+    bool planar;
+    return this->locate(index, planar);
+}
+
+uint8_t dataset::Image_store::label(lint index) const
+{
+    if (this->m_spans.empty())
+    {
+        return this->m_labels[index];
+    }
+
+    lint offset;
+    const Span & span = this->find_span(index, offset);
+    return span.m_labels[offset * span.m_label_stride];
+}
+
+void dataset::Image_store::set_label(lint index, uint8_t label)
+{
+    this->m_labels[index] = label;
+}
+
+const dataset::Image_store::Span & dataset::Image_store::find_span(lint index, lint & offset) const
+{
+    // Spans are few, usually one per file
+    lint i = std::upper_bound(this->m_span_ends.begin(), this->m_span_ends.end(), index) - this->m_span_ends.begin();
+    offset = index - (i > 0 ? this->m_span_ends[i - 1] : 0);
+
+    return this->m_spans[i];
+}
+
+const uint8_t * dataset::Image_store::locate(lint index, bool & planar) const
+{
+    if (this->m_spans.empty())
+    {
+        planar = false;
+        return this->m_pixels.data() + index * this->m_image_size;
+    }
+
+    lint offset;
+    const Span & span = this->find_span(index, offset);
+    planar = span.m_planar;
+    return span.m_pixels + offset * span.m_image_stride;
+}
+
+void dataset::Image_store::copy_image(lint index, const Image_store & other, lint other_index)
+{
+    if (other.m_image_shape != this->m_image_shape)
+    {
+        throw std::invalid_argument(
+            std::string("dataset::Image_store::copy_image: shapes of images do not match."));
+    }
+
+    bool planar;
+    const uint8_t *pixels = other.locate(other_index, planar);
+    lint channels = planar ? this->m_image_shape[this->m_image_shape.dim() - 1] : 1;
+
+    convert_pixels(this->writable_pixels(index), pixels, channels, this->m_image_size / channels,
+        [](uint8_t pixel) { return pixel; });
+    this->set_label(index, other.label(other_index));
+}
+
+void dataset::Image_store::to_matrices(std::vector<neurons::TMatrix<>> & images, std::vector<neurons::TMatrix<>> & labels) const
+{
+    lint first_image = images.size();
+    lint first_label = labels.size();
+    images.resize(first_image + this->size());
+    labels.resize(first_label + this->size());
+
+    for (lint i = 0; i < this->size(); ++i)
+    {
+        this->materialize(images[first_image + i], i, this->m_image_shape, Scaling::none);
+        this->materialize_label(labels[first_label + i], i, neurons::Shape{ this->m_classes });
+    }
+}
+
+
+dataset::Sample_stream::~Sample_stream()
+{}
+
+
+dataset::Shuffle_buffer::Shuffle_buffer(
+    std::unique_ptr<Sample_stream> stream, lint buffer_size, lint chunk_size, unsigned int seed)
+    :
+    m_stream{ std::move(stream) },
+    m_chunk_size{ chunk_size > 0 ? chunk_size : 1 },
+    m_buffer{ m_stream->image_shape(), m_stream->classes() },
+    m_chunk{ m_stream->image_shape(), m_stream->classes() },
+    m_chunk_next{ 0 },
+    m_engine{ seed }
+{
+    if (this->m_stream->size() <= 0)
+    {
+        throw std::invalid_argument(std::string("dataset::Shuffle_buffer: the stream is empty."));
+    }
+
+    // A buffer larger than the stream would hold duplicates of samples
+    lint size = std::min(std::max(buffer_size, 1LL), this->m_stream->size());
+
+    this->m_buffer.resize(size);
+    for (lint i = 0; i < size; ++i)
+    {
+        this->next_of_stream(this->m_buffer, i);
+    }
+}
+
+const neurons::Shape & dataset::Shuffle_buffer::image_shape() const
+{
+    return this->m_buffer.image_shape();
+}
+
+lint dataset::Shuffle_buffer::classes() const
+{
+    return this->m_buffer.classes();
+}
+
+lint dataset::Shuffle_buffer::size() const
+{
+    return this->m_buffer.size();
+}
+
+void dataset::Shuffle_buffer::next(Image_store & images, lint index)
+{
+    std::uniform_int_distribution<lint> distribution{ 0, this->m_buffer.size() - 1 };
+    lint selected = distribution(this->m_engine);
+
+    images.copy_image(index, this->m_buffer, selected);
+    this->next_of_stream(this->m_buffer, selected);
+}
+
+void dataset::Shuffle_buffer::next_of_stream(Image_store & images, lint index)
+{
+    if (this->m_chunk_next >= this->m_chunk.size())
+    {
+        // Memory of the chunk is reused
+        this->m_chunk.resize(0);
+        if (0 == this->m_stream->read(this->m_chunk, this->m_chunk_size))
+        {
+            this->m_stream->rewind();
+            this->m_stream->read(this->m_chunk, this->m_chunk_size);
+        }
+        this->m_chunk_next = 0;
+    }
+
+    images.copy_image(index, this->m_chunk, this->m_chunk_next);
+    ++this->m_chunk_next;
+}
+
+
+dataset::Dataset::Dataset()
+    : m_stream_settings{ 0, 0, 0, 1 }
+{}
+
+dataset::Dataset::~Dataset()
+{}
+
+void dataset::Dataset::set_streaming(lint chunk_size, lint buffer_size, lint shard, lint shards)
+{
+    if (shards <= 0 || shard < 0 || shard >= shards)
+    {
+        throw std::invalid_argument(std::string("dataset::Dataset::set_streaming: the shard is out of range."));
+    }
+
+    this->m_stream_settings = Stream_settings{ chunk_size, buffer_size, shard, shards };
+}
+
+const dataset::Dataset::Stream_settings & dataset::Dataset::stream_settings() const
+{
+    return this->m_stream_settings;
+}
+
+std::unique_ptr<dataset::Sample_stream> dataset::Dataset::open_training_stream(lint /*shard*/, lint /*shards*/) const
+{
+    return nullptr;
+}
+
+bool dataset::Dataset::get_training_store(Image_store & /*images*/, lint /*limit*/) const
+{
+    return false;
+}
+
+bool dataset::Dataset::get_test_store(Image_store & /*images*/, lint /*limit*/) const
+{
+    return false;
+}
@@ -1,124 +1,243 @@
 #include "FCNN_layer.h"
 
-neurons::FCNN_layer::FCNN_layer()
+template <typename dtype>
+neurons::FCNN_layer<dtype>::FCNN_layer()
 {}
 
-neurons::FCNN_layer::FCNN_layer(
+template <typename dtype>
+neurons::FCNN_layer<dtype>::FCNN_layer(
     double mmt_rate,
     lint input_size,
     lint output_size,
     lint threads,
-    neurons::Activation *act_func,
-    neurons::ErrorFunction *err_func)
+    neurons::Activation<dtype> *act_func,
+    neurons::ErrorFunction<dtype> *err_func)
     :
-    Traditional_NN_layer(
+    Traditional_NN_layer<dtype>(
         mmt_rate,
         neurons::Shape{ input_size, output_size }, neurons::Shape{ 1, output_size }, threads, act_func, err_func)
 {
     double var = static_cast<double>(10) / this->m_w.shape()[0];
-    this->m_w.gaussian_random(0, var);
-    this->m_b.gaussian_random(0, var);
+    // Drawn in double, so layers of any precision start from the same weights with the same seed
+    this->m_w = TMatrix<dtype>{ TMatrix<>{ this->m_w.shape() }.gaussian_random(0, var) };
+    this->m_b = TMatrix<dtype>{ TMatrix<>{ this->m_b.shape() }.gaussian_random(0, var) };
 
     for (lint i = 0; i < threads; ++i)
     {
-        this->m_ops[i] = std::make_shared<FCNN_layer_op>( this->m_w, this->m_b, this->m_act_func, this->m_err_func );
+        this->m_ops[i] = std::make_shared<FCNN_layer_op<dtype>>( this->m_w, this->m_b, this->m_act_func, this->m_err_func );
     }
 }
 
-neurons::FCNN_layer::FCNN_layer(double mmt_rate, lint threads, TMatrix<>& w, TMatrix<>& b, 
-    std::unique_ptr<Activation>& act_func, std::unique_ptr<ErrorFunction>& err_func)
+template <typename dtype>
+neurons::FCNN_layer<dtype>::FCNN_layer(double mmt_rate, lint threads, TMatrix<dtype> w, TMatrix<dtype> b,
+    std::unique_ptr<Activation<dtype>>& act_func, std::unique_ptr<ErrorFunction<dtype>>& err_func)
     :
-    Traditional_NN_layer(mmt_rate, threads, w, b, act_func, err_func)
+    Traditional_NN_layer<dtype>(mmt_rate, threads, std::move(w), std::move(b), act_func, err_func)
 {
     for (lint i = 0; i < threads; ++i)
     {
-        this->m_ops[i] = std::make_shared<FCNN_layer_op>(this->m_w, this->m_b, this->m_act_func, this->m_err_func);
+        this->m_ops[i] = std::make_shared<FCNN_layer_op<dtype>>(this->m_w, this->m_b, this->m_act_func, this->m_err_func);
     }
 }
 
-neurons::FCNN_layer::FCNN_layer(const FCNN_layer & other)
-    : Traditional_NN_layer(other)
+template <typename dtype>
+neurons::FCNN_layer<dtype>::FCNN_layer(const FCNN_layer & other)
+    : Traditional_NN_layer<dtype>(other)
 {
     for (size_t i = 0; i < other.m_ops.size(); ++i)
     {
-        this->m_ops[i] = std::make_shared<FCNN_layer_op>(
-            *(dynamic_cast<FCNN_layer_op*>(other.m_ops[i].get())));
+        this->m_ops[i] = std::make_shared<FCNN_layer_op<dtype>>(
+            *(dynamic_cast<FCNN_layer_op<dtype>*>(other.m_ops[i].get())));
     }
+
+    this->share_w_and_b_with_ops();
 }
 
-neurons::FCNN_layer::FCNN_layer(FCNN_layer && other)
-    : Traditional_NN_layer(other)
+template <typename dtype>
+neurons::FCNN_layer<dtype>::FCNN_layer(FCNN_layer && other)
+    : Traditional_NN_layer<dtype>(other)
 {
     for (size_t i = 0; i < other.m_ops.size(); ++i)
     {
         this->m_ops[i] = std::move(other.m_ops[i]);
     }
+
+    this->share_w_and_b_with_ops();
 }
 
-neurons::FCNN_layer & neurons::FCNN_layer::operator=(const FCNN_layer & other)
+template <typename dtype>
+neurons::FCNN_layer<dtype> & neurons::FCNN_layer<dtype>::operator=(const FCNN_layer & other)
 {
-    NN_layer::operator=(other);
+    Traditional_NN_layer<dtype>::operator=(other);
 
     for (size_t i = 0; i < other.m_ops.size(); ++i)
     {
-        this->m_ops[i] = std::make_shared<FCNN_layer_op>(
-            *(dynamic_cast<FCNN_layer_op*>(other.m_ops[i].get())));
+        this->m_ops[i] = std::make_shared<FCNN_layer_op<dtype>>(
+            *(dynamic_cast<FCNN_layer_op<dtype>*>(other.m_ops[i].get())));
     }
 
+    this->share_w_and_b_with_ops();
+
     return *this;
 }
 
-neurons::FCNN_layer & neurons::FCNN_layer::operator=(FCNN_layer && other)
+template <typename dtype>
+neurons::FCNN_layer<dtype> & neurons::FCNN_layer<dtype>::operator=(FCNN_layer && other)
 {
-    NN_layer::operator=(other);
+    Traditional_NN_layer<dtype>::operator=(std::move(other));
 
     for (size_t i = 0; i < other.m_ops.size(); ++i)
     {
         this->m_ops[i] = std::move(other.m_ops[i]);
     }
 
+    this->share_w_and_b_with_ops();
+
     return *this;
 }
 
-neurons::Shape neurons::FCNN_layer::output_shape() const
+template <typename dtype>
+neurons::Shape neurons::FCNN_layer<dtype>::output_shape() const
 {
     return this->m_b.shape();
 }
 
 /////////////////////////////////////////////////
 
-neurons::FCNN_layer_op::FCNN_layer_op()
+template <typename dtype>
+neurons::FCNN_layer_op<dtype>::FCNN_layer_op()
 {}
 
-neurons::FCNN_layer_op::FCNN_layer_op(
-    const TMatrix<> &w,
-    const TMatrix<> &b,
-    const std::unique_ptr<Activation> &act_func,
-    const std::unique_ptr<ErrorFunction> &err_func)
-    : Traditional_NN_layer_op(w, b, act_func, err_func)
+template <typename dtype>
+neurons::FCNN_layer_op<dtype>::FCNN_layer_op(
+    const TMatrix<dtype> &w,
+    const TMatrix<dtype> &b,
+    const std::unique_ptr<Activation<dtype>> &act_func,
+    const std::unique_ptr<ErrorFunction<dtype>> &err_func)
+    : Traditional_NN_layer_op<dtype>(w, b, act_func, err_func)
 {}
 
-neurons::FCNN_layer_op::FCNN_layer_op(const FCNN_layer_op & other)
-    : Traditional_NN_layer_op(other)
+template <typename dtype>
+neurons::FCNN_layer_op<dtype>::FCNN_layer_op(const FCNN_layer_op & other)
+    : Traditional_NN_layer_op<dtype>(other)
 {}
 
-neurons::FCNN_layer_op::FCNN_layer_op(FCNN_layer_op && other)
-    : Traditional_NN_layer_op(other)
+template <typename dtype>
+neurons::FCNN_layer_op<dtype>::FCNN_layer_op(FCNN_layer_op && other)
+    : Traditional_NN_layer_op<dtype>(other)
 {}
 
-neurons::FCNN_layer_op & neurons::FCNN_layer_op::operator = (const FCNN_layer_op & other)
+template <typename dtype>
+neurons::FCNN_layer_op<dtype> & neurons::FCNN_layer_op<dtype>::operator = (const FCNN_layer_op & other)
 {
-    NN_layer_op::operator = (other);
+    NN_layer_op<dtype>::operator = (other);
     return *this;
 }
 
-neurons::FCNN_layer_op & neurons::FCNN_layer_op::operator = (FCNN_layer_op && other)
+template <typename dtype>
+neurons::FCNN_layer_op<dtype> & neurons::FCNN_layer_op<dtype>::operator = (FCNN_layer_op && other)
 {
-    NN_layer_op::operator = (other);
+    NN_layer_op<dtype>::operator = (other);
     return *this;
 }
 
-std::vector<neurons::TMatrix<>> neurons::FCNN_layer_op::batch_forward_propagate(const std::vector<TMatrix<>> & inputs)
+template <typename dtype>
+void neurons::FCNN_layer_op<dtype>::linear_transform(const std::vector<const TMatrix<dtype> *> & inputs)
+{
+    lint samples = inputs.size();
+    lint in_size = this->m_w->shape()[0];
+    lint out_size = this->m_w->shape()[1];
+
+    Shape x_sh{ samples, in_size };
+    if (this->m_x.shape() != x_sh)
+    {
+        this->m_x = TMatrix<dtype>{ x_sh };
+    }
+
+    for (lint i = 0; i < samples; ++i)
+    {
+        if (inputs[i]->shape().size() != in_size)
+        {
+            throw std::invalid_argument(
+                std::string("neurons::FCNN_layer_op::linear_transform: size of input does not match the weights."));
+        }
+
+        std::copy(inputs[i]->m_data, inputs[i]->m_data + in_size, this->m_x.m_data + i * in_size);
+    }
+
+    // x * w, in which x of all samples are stacked together
+    Shape z_sh{ samples, out_size };
+    if (this->m_product.shape() != z_sh)
+    {
+        this->m_product = TMatrix<dtype>{ z_sh };
+    }
+
+    neurons::gemm<dtype>(false, false, samples, out_size, in_size,
+        1, this->m_x.m_data, in_size, this->m_w->m_data, out_size, 0, this->m_product.m_data, out_size);
+}
+
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> neurons::FCNN_layer_op<dtype>::back_propagate_from_z(double l_rate, const TMatrix<dtype> & diff_E_to_z)
+{
+    this->prepare_gradients();
+
+    lint samples = this->m_x.shape()[0];
+    lint in_size = this->m_w->shape()[0];
+    lint out_size = this->m_w->shape()[1];
+
+    // Calculate the derivative dE/dx of all samples: dE/dx = dE/dz * transpose(w)
+    // E is the error from the last layer.
+    // x is input of the current layer.
+    TMatrix<dtype> diff_E_to_x{ Shape{ samples, in_size } };
+    neurons::gemm<dtype>(false, true, samples, in_size, out_size,
+        1, diff_E_to_z.m_data, out_size, this->m_w->m_data, out_size, 0, diff_E_to_x.m_data, in_size);
+
+    // Calculate dE/dw of the whole batch: dE/dw = transpose(x) * dE/dz
+    // w are weights of the current layer.
+    neurons::gemm<dtype>(true, false, in_size, out_size, samples,
+        l_rate, this->m_x.m_data, in_size, diff_E_to_z.m_data, out_size, 0, this->m_w_gradient.m_data, out_size);
+
+    // Calculate dE/db of the whole batch, which is sum of dE/dz of all samples
+    // b are bias of the current layer.
+    this->m_b_gradient = 0;
+    for (lint i = 0; i < samples; ++i)
+    {
+        const dtype *dz_row = diff_E_to_z.m_data + i * out_size;
+        for (lint j = 0; j < out_size; ++j)
+        {
+            this->m_b_gradient.m_data[j] += dz_row[j];
+        }
+    }
+    this->m_b_gradient *= l_rate;
+
+    // dE/dx of each sample is a column vector
+    std::vector<TMatrix<dtype>> E_to_x_diffs{ static_cast<size_t>(samples) };
+    for (lint i = 0; i < samples; ++i)
+    {
+        E_to_x_diffs[i] = TMatrix<dtype>{ Shape{ in_size, 1 } };
+        std::copy(diff_E_to_x.m_data + i * in_size, diff_E_to_x.m_data + (i + 1) * in_size, E_to_x_diffs[i].m_data);
+    }
+
+    return E_to_x_diffs;
+}
+
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> neurons::FCNN_layer_op<dtype>::batch_forward_propagate(const std::vector<TMatrix<dtype>> & inputs)
+{
+    return this->batch_forward_propagate(neurons::matrix_pointers(inputs));
+}
+
+
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> neurons::FCNN_layer_op<dtype>::batch_forward_propagate(
+    const std::vector<TMatrix<dtype>>& inputs, const std::vector<TMatrix<dtype>>& targets)
+{
+    return this->batch_forward_propagate(neurons::matrix_pointers(inputs), neurons::matrix_pointers(targets));
+}
+
+
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> neurons::FCNN_layer_op<dtype>::batch_forward_propagate(const std::vector<const TMatrix<dtype> *> & inputs)
 {
     if (nullptr == this->m_act_func)
     {
@@ -127,24 +246,26 @@ std::vector<neurons::TMatrix<>> neurons::FCNN_layer_op::batch_forward_propagate(
     }
 
     size_t samples = inputs.size();
-    this->m_x = inputs;
-    std::vector<neurons::TMatrix<>> outputs{ samples };
+    std::vector<neurons::TMatrix<dtype>> outputs{ samples };
     this->m_act_diffs.resize(samples);
 
+    this->linear_transform(inputs);
+    Shape out_sh{ 1, this->m_product.shape()[1] };
+
     for (size_t i = 0; i < samples; ++i)
     {
-        // z = x * w + b
-        neurons::TMatrix<> product = this->m_x[i] * this->m_w + this->m_b;
-        // y = g(z)
-        this->m_act_func->operator()(outputs[i], this->m_act_diffs[i], product);
+        // y = g(z) where z = x * w + b, the bias is added by the activation function
+        this->m_act_func->operator()(
+            outputs[i], this->m_act_diffs[i], out_sh, this->m_product.m_data + i * out_sh[1], *this->m_b);
     }
 
     return outputs;
 }
 
 
-std::vector<neurons::TMatrix<>> neurons::FCNN_layer_op::batch_forward_propagate(
-    const std::vector<TMatrix<>>& inputs, const std::vector<TMatrix<>>& targets)
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> neurons::FCNN_layer_op<dtype>::batch_forward_propagate(
+    const std::vector<const TMatrix<dtype> *> & inputs, const std::vector<const TMatrix<dtype> *> & targets)
 {
     if (nullptr == this->m_err_func)
     {
@@ -153,95 +274,71 @@ std::vector<neurons::TMatrix<>> neurons::FCNN_layer_op::batch_forward_propagate(
     }
 
     size_t samples = inputs.size();
-    this->m_x = inputs;
-    std::vector<neurons::TMatrix<>> outputs{ samples };
+    std::vector<neurons::TMatrix<dtype>> outputs{ samples };
     this->m_act_diffs.resize(samples);
 
+    this->linear_transform(inputs);
+    Shape out_sh{ 1, this->m_product.shape()[1] };
+
     for (size_t i = 0; i < samples; ++i)
     {
-        // z = x * w + b
-        neurons::TMatrix<> product = this->m_x[i] * this->m_w + this->m_b;
-        // y = g(z) and E = error(y, t)
-        this->m_loss += this->m_err_func->operator()(outputs[i], this->m_act_diffs[i], targets[i], product);
+        // y = g(z) and E = error(y, t) where z = x * w + b
+        this->m_loss += this->m_err_func->operator()(outputs[i], this->m_act_diffs[i], *targets[i],
+            out_sh, this->m_product.m_data + i * out_sh[1], *this->m_b);
     }
 
     return outputs;
 }
 
 
-std::vector<neurons::TMatrix<>> neurons::FCNN_layer_op::batch_back_propagate(double l_rate, const std::vector<TMatrix<>> &E_to_y_diffs)
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> neurons::FCNN_layer_op<dtype>::batch_back_propagate(double l_rate, const std::vector<TMatrix<dtype>> &E_to_y_diffs)
 {
-    size_t samples = this->m_x.size();
-    std::vector<TMatrix<>> E_to_x_diffs{ samples };
+    lint samples = this->m_x.shape()[0];
+    lint out_size = this->m_w->shape()[1];
 
-    this->m_w_gradient = 0;
-    this->m_b_gradient = 0;
-
-    // batch learning of the chain rule (back propagation).
-    for (size_t i = 0; i < samples; ++i)
+    // Back propagate from y = g(z) to z
+    // dE/dy of each sample arrives as a column vector, its elements are in the same order as z
+    TMatrix<dtype> diff_E_to_z{ Shape{ samples, out_size } };
+    for (lint i = 0; i < samples; ++i)
     {
-        // Back propagate from y = g(z) to z
-        neurons::TMatrix<> diff_E_to_z = neurons::multiply(this->m_act_diffs[i], neurons::transpose(E_to_y_diffs[i]));
-
-        // Calculate the derivative dE/dx
-        // E is the error from the last layer.
-        // x is input of the current layer.
-        E_to_x_diffs[i] = this->m_w * neurons::transpose(diff_E_to_z);
-
-        // Calculate dE/dw and update the weights.
-        // E is the error from the last layer.
-        // w are weights of the current layer.
-        this->m_w_gradient += neurons::transpose(this->m_x[i]) * diff_E_to_z;
-
-        // Calculate dE/db and update the bias.
-        // E is the error from the last layer.
-        // b are bias of the current layer.
-        this->m_b_gradient += diff_E_to_z;
+        const dtype *act_diff = this->m_act_diffs[i].m_data;
+        const dtype *E_to_y = E_to_y_diffs[i].m_data;
+        dtype *dz_row = diff_E_to_z.m_data + i * out_size;
+
+        for (lint j = 0; j < out_size; ++j)
+        {
+            dz_row[j] = act_diff[j] * E_to_y[j];
+        }
     }
 
-    this->m_w_gradient *= l_rate;
-    this->m_b_gradient *= l_rate;
-
-    return E_to_x_diffs;
+    return this->back_propagate_from_z(l_rate, diff_E_to_z);
 }
 
 
-std::vector<neurons::TMatrix<>> neurons::FCNN_layer_op::batch_back_propagate(double l_rate)
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> neurons::FCNN_layer_op<dtype>::batch_back_propagate(double l_rate)
 {
-    size_t samples = this->m_x.size();
-    std::vector<TMatrix<>> E_to_x_diffs{ samples };
-
-    this->m_w_gradient = 0;
-    this->m_b_gradient = 0;
+    lint samples = this->m_x.shape()[0];
+    lint out_size = this->m_w->shape()[1];
 
-    // batch learning of the chain rule (back propagation).
-    for (size_t i = 0; i < samples; ++i)
+    // The error function has already calculated dE/dz of each sample
+    TMatrix<dtype> diff_E_to_z{ Shape{ samples, out_size } };
+    for (lint i = 0; i < samples; ++i)
     {
-        // Calculate the derivative dE/dx
-        // E is the error from the last layer.
-        // x is input of the current layer.
-        E_to_x_diffs[i] = this->m_w * neurons::transpose(this->m_act_diffs[i]);
-
-        // Calculate dE/dw and update the weights.
-        // E is the error from the last layer.
-        // w are weights of the current layer.
-        this->m_w_gradient += neurons::transpose(this->m_x[i]) * this->m_act_diffs[i];
-
-        // Calculate dE/db and update the bias.
-        // E is the error from the last layer.
-        // b are bias of the current layer.
-        this->m_b_gradient += this->m_act_diffs[i];
+        std::copy(this->m_act_diffs[i].m_data, this->m_act_diffs[i].m_data + out_size, diff_E_to_z.m_data + i * out_size);
     }
-    
-    this->m_w_gradient *= l_rate;
-    this->m_b_gradient *= l_rate;
 
-    return E_to_x_diffs;
+    return this->back_propagate_from_z(l_rate, diff_E_to_z);
 }
 
-neurons::Shape neurons::FCNN_layer_op::output_shape() const
+template <typename dtype>
+neurons::Shape neurons::FCNN_layer_op<dtype>::output_shape() const
 {
-    return this->m_b.shape();
+    return this->m_b->shape();
 }
 
-
+template class neurons::FCNN_layer<float>;
+template class neurons::FCNN_layer<double>;
+template class neurons::FCNN_layer_op<float>;
+template class neurons::FCNN_layer_op<double>;
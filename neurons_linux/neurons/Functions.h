@@ -5,6 +5,9 @@ namespace neurons
 {
     # define M_PI          3.141592653589793238462643383279502884L /* pi */
 
+    // Activation and error functions are templates of the element type of matrices they work on,
+    // they are instantiated for float and double (see the end of Functions.cpp).
+    template <typename dtype = double>
     class Activation
     {
     public:
@@ -19,141 +22,190 @@ namespace neurons
         static const std::string SOFTMAX;
         static const std::string NULL_FUNC;
 
-        static std::unique_ptr<Activation> get_function_by_name(const std::string & func_name);
+        static std::unique_ptr<Activation<dtype>> get_function_by_name(const std::string & func_name);
 
     public:
         Activation() {}
 
-        virtual std::unique_ptr<Activation> clone() = 0;
+        virtual std::unique_ptr<Activation<dtype>> clone() = 0;
 
-        virtual void operator () (TMatrix<> & output, TMatrix<> & diff, const TMatrix<> & in) = 0;
+        // Compute the activation of in and its derivative. output and diff are buffers of the caller,
+        // their memory is reused when they already have as many elements as in.
+        virtual void operator () (TMatrix<dtype> & output, TMatrix<dtype> & diff, const TMatrix<dtype> & in);
+
+        // Fused epilogue of layers: z = product + bias, output = g(z) and diff = g'(z).
+        // product is one sample of the given shape as it comes out of a GEMM or convolution,
+        // the bias is added along its last dimension. Bias, activation and derivative are applied
+        // block by block while each block is still in L1 cache, z is never stored on its own.
+        virtual void operator () (TMatrix<dtype> & output, TMatrix<dtype> & diff,
+            const Shape & shape, const dtype *product, const TMatrix<dtype> & bias);
+
+        // Epilogue of inference: output = g(product + bias) without the derivative.
+        // output is a buffer of shape.size() elements of the caller, nothing is kept in the
+        // activation so a single instance may serve many threads at the same time.
+        virtual void infer(const Shape & shape, const dtype *product, const TMatrix<dtype> & bias, dtype *output) const;
 
         virtual std::string to_string() const = 0;
+
+    protected:
+        // y = g(z) and dy = g'(z) of n elements, y may be the same buffer as z.
+        // dy is nullptr when only the activation is needed.
+        virtual void activate(lint n, const dtype *z, dtype *y, dtype *dy) const = 0;
     };
 
 
-    class Linear : public Activation
+    template <typename dtype = double>
+    class Linear : public Activation<dtype>
     {
     public:
         Linear() {};
 
-        virtual std::unique_ptr<Activation> clone();
-
-        virtual void operator () (TMatrix<> & output, TMatrix<> & diff, const TMatrix<> & in);
+        virtual std::unique_ptr<Activation<dtype>> clone();
 
         virtual std::string to_string() const;
+
+    protected:
+        virtual void activate(lint n, const dtype *z, dtype *y, dtype *dy) const;
     };
 
 
-    class Sigmoid : public Activation
+    template <typename dtype = double>
+    class Sigmoid : public Activation<dtype>
     {
     public:
         Sigmoid() {}
 
-        virtual std::unique_ptr<Activation> clone();
-
-        virtual void operator () (TMatrix<> & output, TMatrix<> & diff, const TMatrix<> & in);
+        virtual std::unique_ptr<Activation<dtype>> clone();
 
         virtual std::string to_string() const;
+
+    protected:
+        virtual void activate(lint n, const dtype *z, dtype *y, dtype *dy) const;
     };
 
 
-    class Tanh : public Activation
+    template <typename dtype = double>
+    class Tanh : public Activation<dtype>
     {
     public:
         Tanh() {}
 
-        virtual std::unique_ptr<Activation> clone();
-
-        virtual void operator () (TMatrix<> & output, TMatrix<> & diff, const TMatrix<> & in);
+        virtual std::unique_ptr<Activation<dtype>> clone();
 
         virtual std::string to_string() const;
+
+    protected:
+        virtual void activate(lint n, const dtype *z, dtype *y, dtype *dy) const;
     };
 
 
-    class Relu : public Activation
+    template <typename dtype = double>
+    class Relu : public Activation<dtype>
     {
     public:
         Relu() {}
 
-        virtual std::unique_ptr<Activation> clone();
-
-        virtual void operator () (TMatrix<> & output, TMatrix<> & diff, const TMatrix<> & in);
+        virtual std::unique_ptr<Activation<dtype>> clone();
 
         virtual std::string to_string() const;
+
+    protected:
+        virtual void activate(lint n, const dtype *z, dtype *y, dtype *dy) const;
     };
 
 
-    class LeakyRelu : public Activation
+    template <typename dtype = double>
+    class LeakyRelu : public Activation<dtype>
     {
     public:
         LeakyRelu() {}
 
-        virtual std::unique_ptr<Activation> clone();
-
-        virtual void operator () (TMatrix<> & output, TMatrix<> & diff, const TMatrix<> & in);
+        virtual std::unique_ptr<Activation<dtype>> clone();
 
         virtual std::string to_string() const;
+
+    protected:
+        virtual void activate(lint n, const dtype *z, dtype *y, dtype *dy) const;
     };
 
 
-    class Arctan : public Activation
+    template <typename dtype = double>
+    class Arctan : public Activation<dtype>
     {
     public:
         Arctan() {}
 
-        virtual std::unique_ptr<Activation> clone();
-
-        virtual void operator () (TMatrix<> & output, TMatrix<> & diff, const TMatrix<> & in);
+        virtual std::unique_ptr<Activation<dtype>> clone();
 
         virtual std::string to_string() const;
+
+    protected:
+        virtual void activate(lint n, const dtype *z, dtype *y, dtype *dy) const;
     };
 
 
-    class Sin : public Activation
+    template <typename dtype = double>
+    class Sin : public Activation<dtype>
     {
     public:
         Sin() {}
 
-        virtual std::unique_ptr<Activation> clone();
-
-        virtual void operator () (TMatrix<> & output, TMatrix<> & diff, const TMatrix<> & in);
+        virtual std::unique_ptr<Activation<dtype>> clone();
 
         virtual std::string to_string() const;
+
+    protected:
+        virtual void activate(lint n, const dtype *z, dtype *y, dtype *dy) const;
     };
 
 
-    class Softsign : public Activation
+    template <typename dtype = double>
+    class Softsign : public Activation<dtype>
     {
     public:
         Softsign() {}
 
-        virtual std::unique_ptr<Activation> clone();
-
-        virtual void operator () (TMatrix<> & output, TMatrix<> & diff, const TMatrix<> & in);
+        virtual std::unique_ptr<Activation<dtype>> clone();
 
         virtual std::string to_string() const;
+
+    protected:
+        virtual void activate(lint n, const dtype *z, dtype *y, dtype *dy) const;
     };
 
 
-    class Softmax : public Activation
+    template <typename dtype = double>
+    class Softmax : public Activation<dtype>
     {
     public:
         Softmax() {};
 
-        virtual std::unique_ptr<Activation> clone();
+        virtual std::unique_ptr<Activation<dtype>> clone();
+
+        using Activation<dtype>::operator ();
+
+        // The whole sample is normalized together, so the bias is added to all of it first
+        virtual void operator () (TMatrix<dtype> & output, TMatrix<dtype> & diff,
+            const Shape & shape, const dtype *product, const TMatrix<dtype> & bias);
 
-        virtual void operator () (TMatrix<> & output, TMatrix<> & diff, const TMatrix<> & in);
+        virtual void infer(const Shape & shape, const dtype *product, const TMatrix<dtype> & bias, dtype *output) const;
 
         virtual std::string to_string() const;
+
+    protected:
+        // All n elements are normalized together
+        virtual void activate(lint n, const dtype *z, dtype *y, dtype *dy) const;
     };
 
 
+    template <typename dtype = double>
     class ErrorFunction
     {
     protected:
-        std::unique_ptr<Activation> m_act_func;
-        mutable TMatrix<> m_act;
+        std::unique_ptr<Activation<dtype>> m_act_func;
+        mutable TMatrix<dtype> m_act;
+        // z = product + bias of the fused epilogue
+        TMatrix<dtype> m_z;
 
     public:
         static const std::string HALF_SQUARE_ERROR;
@@ -161,78 +213,94 @@ namespace neurons
         static const std::string SOFTMAX_CROSS_ENTROPY;
         static const std::string NULL_FUNC;
 
-        static std::unique_ptr<ErrorFunction> get_function_by_name(std::string & func_name);
+        static std::unique_ptr<ErrorFunction<dtype>> get_function_by_name(std::string & func_name);
 
     public:
         ErrorFunction() {}
 
-        virtual std::unique_ptr<ErrorFunction> clone() = 0;
+        virtual std::unique_ptr<ErrorFunction<dtype>> clone() = 0;
 
-        virtual double operator () (TMatrix<> & diff, const TMatrix<> & target, const TMatrix<> & input) = 0;
-        virtual double operator () (TMatrix<> & pred, TMatrix<> & diff, const TMatrix<> & target, const TMatrix<> & input) = 0;
+        virtual double operator () (TMatrix<dtype> & diff, const TMatrix<dtype> & target, const TMatrix<dtype> & input) = 0;
+        virtual double operator () (TMatrix<dtype> & pred, TMatrix<dtype> & diff, const TMatrix<dtype> & target, const TMatrix<dtype> & input) = 0;
+
+        // Fused epilogue of the output layer, input = product + bias as in Activation.
+        // Output layers are small, so by default z is built in one pass and handed to the function above.
+        virtual double operator () (TMatrix<dtype> & pred, TMatrix<dtype> & diff, const TMatrix<dtype> & target,
+            const Shape & shape, const dtype *product, const TMatrix<dtype> & bias);
 
         virtual std::string to_string() const = 0;
 
-        virtual TMatrix<> & get_activation() const = 0;
+        virtual TMatrix<dtype> & get_activation() const = 0;
 
-        std::unique_ptr<Activation> get_act_func() const;
+        std::unique_ptr<Activation<dtype>> get_act_func() const;
 
     };
 
 
-    class HalfSquareError : public ErrorFunction
+    template <typename dtype = double>
+    class HalfSquareError : public ErrorFunction<dtype>
     {
     private:
 
     public:
-        HalfSquareError(const std::unique_ptr<Activation> & act_func);
+        HalfSquareError(const std::unique_ptr<Activation<dtype>> & act_func);
+
+        HalfSquareError(Activation<dtype> * act_func);
 
-        HalfSquareError(Activation * act_func);
+        virtual std::unique_ptr<ErrorFunction<dtype>> clone();
 
-        virtual std::unique_ptr<ErrorFunction> clone();
+        virtual double operator () (TMatrix<dtype> & diff, const TMatrix<dtype> & target, const TMatrix<dtype> & input);
+        virtual double operator () (TMatrix<dtype> & pred, TMatrix<dtype> & diff, const TMatrix<dtype> & target, const TMatrix<dtype> & input);
 
-        virtual double operator () (TMatrix<> & diff, const TMatrix<> & target, const TMatrix<> & input);
-        virtual double operator () (TMatrix<> & pred, TMatrix<> & diff, const TMatrix<> & target, const TMatrix<> & input);
+        // Uses the fused epilogue of the activation function
+        virtual double operator () (TMatrix<dtype> & pred, TMatrix<dtype> & diff, const TMatrix<dtype> & target,
+            const Shape & shape, const dtype *product, const TMatrix<dtype> & bias);
 
-        virtual TMatrix<> & get_activation() const;
+        virtual TMatrix<dtype> & get_activation() const;
 
         virtual std::string to_string() const;
+
+    private:
+        // Loss of m_act against the target, diff holds the derivative of the activation and becomes dE/dz
+        double loss(TMatrix<dtype> & diff, const TMatrix<dtype> & target) const;
     };
 
 
-    class Sigmoid_CrossEntropy : public ErrorFunction
+    template <typename dtype = double>
+    class Sigmoid_CrossEntropy : public ErrorFunction<dtype>
     {
     private:
-        // mutable TMatrix<> m_sigmoid;
+        // mutable TMatrix<dtype> m_sigmoid;
 
     public:
         Sigmoid_CrossEntropy();
 
-        virtual std::unique_ptr<ErrorFunction> clone();
+        virtual std::unique_ptr<ErrorFunction<dtype>> clone();
 
-        virtual double operator () (TMatrix<> & diff, const TMatrix<> & target, const TMatrix<> & input);
-        virtual double operator () (TMatrix<> & pred, TMatrix<> & diff, const TMatrix<> & target, const TMatrix<> & input);
+        virtual double operator () (TMatrix<dtype> & diff, const TMatrix<dtype> & target, const TMatrix<dtype> & input);
+        virtual double operator () (TMatrix<dtype> & pred, TMatrix<dtype> & diff, const TMatrix<dtype> & target, const TMatrix<dtype> & input);
 
-        virtual TMatrix<> & get_activation() const;
+        virtual TMatrix<dtype> & get_activation() const;
 
         virtual std::string to_string() const;
     };
 
 
-    class Softmax_CrossEntropy : public ErrorFunction
+    template <typename dtype = double>
+    class Softmax_CrossEntropy : public ErrorFunction<dtype>
     {
     private:
-        // mutable TMatrix<> m_softmax;
+        // mutable TMatrix<dtype> m_softmax;
 
     public:
         Softmax_CrossEntropy();
 
-        virtual std::unique_ptr<ErrorFunction> clone();
+        virtual std::unique_ptr<ErrorFunction<dtype>> clone();
 
-        virtual double operator () (TMatrix<> & diff, const TMatrix<> & target, const TMatrix<> & input);
-        virtual double operator () (TMatrix<> & pred, TMatrix<> & diff, const TMatrix<> & target, const TMatrix<> & input);
+        virtual double operator () (TMatrix<dtype> & diff, const TMatrix<dtype> & target, const TMatrix<dtype> & input);
+        virtual double operator () (TMatrix<dtype> & pred, TMatrix<dtype> & diff, const TMatrix<dtype> & target, const TMatrix<dtype> & input);
 
-        virtual TMatrix<> & get_activation() const;
+        virtual TMatrix<dtype> & get_activation() const;
 
         virtual std::string to_string() const;
     };
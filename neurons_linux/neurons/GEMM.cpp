@@ -0,0 +1,603 @@
+#include "GEMM.h"
+#include "Thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NEURONS_GEMM_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and clang only emit AVX instructions inside functions explicitly marked for them,
+// while MSVC accepts the intrinsics anywhere.
+#if defined(NEURONS_GEMM_X86) && (defined(__GNUC__) || defined(__clang__))
+#define NEURONS_TARGET(isa) __attribute__((target(isa)))
+#else
+#define NEURONS_TARGET(isa)
+#endif
+
+namespace
+{
+    // Depth of a packed block, a KC x NR panel of B should stay in L1 cache
+    const lint KC = 256;
+    // Width of a packed block of B, which should stay in L3 cache
+    const lint NC = 4096;
+
+    // Matrices with fewer elements than this are not worth packing
+    const lint SMALL_GEMM = 4096;
+
+    // Products of fewer floating point operations than this are not worth splitting over threads
+    const double PARALLEL_GEMM = 4e6;
+
+    // Scalar micro kernel: C[MR x NR] += A_panel[kc x MR] * B_panel[kc x NR]
+    template <typename dtype, lint MR, lint NR>
+    void kernel_scalar(lint kc, const dtype *a, const dtype *b, dtype *c, lint ldc)
+    {
+        dtype acc[MR * NR] = { 0 };
+
+        for (lint p = 0; p < kc; ++p)
+        {
+            for (lint i = 0; i < MR; ++i)
+            {
+                dtype a_i = a[i];
+                for (lint j = 0; j < NR; ++j)
+                {
+                    acc[i * NR + j] += a_i * b[j];
+                }
+            }
+
+            a += MR;
+            b += NR;
+        }
+
+        for (lint i = 0; i < MR; ++i)
+        {
+            for (lint j = 0; j < NR; ++j)
+            {
+                c[i * ldc + j] += acc[i * NR + j];
+            }
+        }
+    }
+
+#ifdef NEURONS_GEMM_X86
+
+    // Each micro kernel keeps its whole C tile in registers: one row of the tile is
+    // two vector registers wide, every step of p loads one row of the B panel and
+    // broadcasts one element of the A panel per row of the tile.
+
+#define GEMM_ROW_DECL(VEC, ZERO, i) \
+    VEC c##i##0 = ZERO(); \
+    VEC c##i##1 = ZERO();
+
+#define GEMM_ROW_FMA(VEC, SET1, FMA, i) \
+    { \
+        VEC a_i = SET1(a[i]); \
+        c##i##0 = FMA(a_i, b0, c##i##0); \
+        c##i##1 = FMA(a_i, b1, c##i##1); \
+    }
+
+#define GEMM_ROW_STORE(LOAD, ADD, STORE, WIDTH, i) \
+    STORE(c + i * ldc, ADD(LOAD(c + i * ldc), c##i##0)); \
+    STORE(c + i * ldc + WIDTH, ADD(LOAD(c + i * ldc + WIDTH), c##i##1));
+
+    // AVX2 + FMA, double precision, 6 x 8 tile
+    NEURONS_TARGET("avx2,fma")
+    void kernel_avx2_d(lint kc, const double *a, const double *b, double *c, lint ldc)
+    {
+#define ROWS(OP, ...) OP(__VA_ARGS__, 0) OP(__VA_ARGS__, 1) OP(__VA_ARGS__, 2) \
+    OP(__VA_ARGS__, 3) OP(__VA_ARGS__, 4) OP(__VA_ARGS__, 5)
+
+        ROWS(GEMM_ROW_DECL, __m256d, _mm256_setzero_pd)
+
+        for (lint p = 0; p < kc; ++p)
+        {
+            __m256d b0 = _mm256_loadu_pd(b);
+            __m256d b1 = _mm256_loadu_pd(b + 4);
+            ROWS(GEMM_ROW_FMA, __m256d, _mm256_set1_pd, _mm256_fmadd_pd)
+            a += 6;
+            b += 8;
+        }
+
+        ROWS(GEMM_ROW_STORE, _mm256_loadu_pd, _mm256_add_pd, _mm256_storeu_pd, 4)
+#undef ROWS
+    }
+
+    // AVX2 + FMA, single precision, 6 x 16 tile
+    NEURONS_TARGET("avx2,fma")
+    void kernel_avx2_f(lint kc, const float *a, const float *b, float *c, lint ldc)
+    {
+#define ROWS(OP, ...) OP(__VA_ARGS__, 0) OP(__VA_ARGS__, 1) OP(__VA_ARGS__, 2) \
+    OP(__VA_ARGS__, 3) OP(__VA_ARGS__, 4) OP(__VA_ARGS__, 5)
+
+        ROWS(GEMM_ROW_DECL, __m256, _mm256_setzero_ps)
+
+        for (lint p = 0; p < kc; ++p)
+        {
+            __m256 b0 = _mm256_loadu_ps(b);
+            __m256 b1 = _mm256_loadu_ps(b + 8);
+            ROWS(GEMM_ROW_FMA, __m256, _mm256_set1_ps, _mm256_fmadd_ps)
+            a += 6;
+            b += 16;
+        }
+
+        ROWS(GEMM_ROW_STORE, _mm256_loadu_ps, _mm256_add_ps, _mm256_storeu_ps, 8)
+#undef ROWS
+    }
+
+    // AVX-512, double precision, 12 x 16 tile
+    NEURONS_TARGET("avx512f")
+    void kernel_avx512_d(lint kc, const double *a, const double *b, double *c, lint ldc)
+    {
+#define ROWS(OP, ...) OP(__VA_ARGS__, 0) OP(__VA_ARGS__, 1) OP(__VA_ARGS__, 2) \
+    OP(__VA_ARGS__, 3) OP(__VA_ARGS__, 4) OP(__VA_ARGS__, 5) OP(__VA_ARGS__, 6) \
+    OP(__VA_ARGS__, 7) OP(__VA_ARGS__, 8) OP(__VA_ARGS__, 9) OP(__VA_ARGS__, 10) OP(__VA_ARGS__, 11)
+
+        ROWS(GEMM_ROW_DECL, __m512d, _mm512_setzero_pd)
+
+        for (lint p = 0; p < kc; ++p)
+        {
+            __m512d b0 = _mm512_loadu_pd(b);
+            __m512d b1 = _mm512_loadu_pd(b + 8);
+            ROWS(GEMM_ROW_FMA, __m512d, _mm512_set1_pd, _mm512_fmadd_pd)
+            a += 12;
+            b += 16;
+        }
+
+        ROWS(GEMM_ROW_STORE, _mm512_loadu_pd, _mm512_add_pd, _mm512_storeu_pd, 8)
+#undef ROWS
+    }
+
+    // AVX-512, single precision, 12 x 32 tile
+    NEURONS_TARGET("avx512f")
+    void kernel_avx512_f(lint kc, const float *a, const float *b, float *c, lint ldc)
+    {
+#define ROWS(OP, ...) OP(__VA_ARGS__, 0) OP(__VA_ARGS__, 1) OP(__VA_ARGS__, 2) \
+    OP(__VA_ARGS__, 3) OP(__VA_ARGS__, 4) OP(__VA_ARGS__, 5) OP(__VA_ARGS__, 6) \
+    OP(__VA_ARGS__, 7) OP(__VA_ARGS__, 8) OP(__VA_ARGS__, 9) OP(__VA_ARGS__, 10) OP(__VA_ARGS__, 11)
+
+        ROWS(GEMM_ROW_DECL, __m512, _mm512_setzero_ps)
+
+        for (lint p = 0; p < kc; ++p)
+        {
+            __m512 b0 = _mm512_loadu_ps(b);
+            __m512 b1 = _mm512_loadu_ps(b + 16);
+            ROWS(GEMM_ROW_FMA, __m512, _mm512_set1_ps, _mm512_fmadd_ps)
+            a += 12;
+            b += 32;
+        }
+
+        ROWS(GEMM_ROW_STORE, _mm512_loadu_ps, _mm512_add_ps, _mm512_storeu_ps, 16)
+#undef ROWS
+    }
+
+#undef GEMM_ROW_DECL
+#undef GEMM_ROW_FMA
+#undef GEMM_ROW_STORE
+
+#endif // NEURONS_GEMM_X86
+
+    // Copy an mc x kc block of op(A) into panels of MR rows, each panel is stored
+    // column by column so that the micro kernel reads it sequentially.
+    // Rows beyond mc are padded with zeros, alpha is folded in here.
+    template <typename dtype, lint MR>
+    void pack_a(bool trans_a, lint mc, lint kc, dtype alpha, const dtype *a, lint lda, dtype *a_pack)
+    {
+        for (lint ir = 0; ir < mc; ir += MR)
+        {
+            lint mr = std::min(MR, mc - ir);
+            dtype *panel = a_pack + ir * kc;
+
+            if (trans_a)
+            {
+                for (lint p = 0; p < kc; ++p)
+                {
+                    const dtype *a_p = a + p * lda + ir;
+                    dtype *panel_p = panel + p * MR;
+                    for (lint i = 0; i < mr; ++i)
+                    {
+                        panel_p[i] = alpha * a_p[i];
+                    }
+                    for (lint i = mr; i < MR; ++i)
+                    {
+                        panel_p[i] = 0;
+                    }
+                }
+            }
+            else
+            {
+                for (lint i = 0; i < mr; ++i)
+                {
+                    const dtype *a_i = a + (ir + i) * lda;
+                    for (lint p = 0; p < kc; ++p)
+                    {
+                        panel[p * MR + i] = alpha * a_i[p];
+                    }
+                }
+                for (lint i = mr; i < MR; ++i)
+                {
+                    for (lint p = 0; p < kc; ++p)
+                    {
+                        panel[p * MR + i] = 0;
+                    }
+                }
+            }
+        }
+    }
+
+    // Copy a kc x nc block of op(B) into panels of NR columns, each panel is stored
+    // row by row. Columns beyond nc are padded with zeros.
+    template <typename dtype, lint NR>
+    void pack_b(bool trans_b, lint kc, lint nc, const dtype *b, lint ldb, dtype *b_pack)
+    {
+        for (lint jr = 0; jr < nc; jr += NR)
+        {
+            lint nr = std::min(NR, nc - jr);
+            dtype *panel = b_pack + jr * kc;
+
+            if (trans_b)
+            {
+                for (lint j = 0; j < nr; ++j)
+                {
+                    const dtype *b_j = b + (jr + j) * ldb;
+                    for (lint p = 0; p < kc; ++p)
+                    {
+                        panel[p * NR + j] = b_j[p];
+                    }
+                }
+                for (lint j = nr; j < NR; ++j)
+                {
+                    for (lint p = 0; p < kc; ++p)
+                    {
+                        panel[p * NR + j] = 0;
+                    }
+                }
+            }
+            else
+            {
+                for (lint p = 0; p < kc; ++p)
+                {
+                    const dtype *b_p = b + p * ldb + jr;
+                    dtype *panel_p = panel + p * NR;
+                    for (lint j = 0; j < nr; ++j)
+                    {
+                        panel_p[j] = b_p[j];
+                    }
+                    for (lint j = nr; j < NR; ++j)
+                    {
+                        panel_p[j] = 0;
+                    }
+                }
+            }
+        }
+    }
+
+    template <typename dtype>
+    void scale_c(lint m, lint n, dtype beta, dtype *c, lint ldc)
+    {
+        if (1 == beta)
+        {
+            return;
+        }
+
+        for (lint i = 0; i < m; ++i)
+        {
+            dtype *c_row = c + i * ldc;
+            for (lint j = 0; j < n; ++j)
+            {
+                // beta == 0 should overwrite C even if it contains NaN
+                c_row[j] = 0 == beta ? 0 : beta * c_row[j];
+            }
+        }
+    }
+
+    // Packing buffers of a thread are reused between calls and handed out as a stack:
+    // a thread waiting for its GEMM tiles may execute other pool tasks that run
+    // another GEMM, which must not overwrite the blocks still being used.
+    template <typename dtype>
+    class Pack_buffer
+    {
+    private:
+        size_t m_depth;
+
+        static std::vector<std::vector<dtype>> & stack()
+        {
+            thread_local std::vector<std::vector<dtype>> buffers;
+            return buffers;
+        }
+
+        static size_t & depth()
+        {
+            thread_local size_t d = 0;
+            return d;
+        }
+
+    public:
+        explicit Pack_buffer(lint size)
+            : m_depth{ depth()++ }
+        {
+            if (stack().size() <= this->m_depth)
+            {
+                stack().resize(this->m_depth + 1);
+            }
+
+            if (stack()[this->m_depth].size() < static_cast<size_t>(size))
+            {
+                stack()[this->m_depth].resize(size);
+            }
+        }
+
+        ~Pack_buffer()
+        {
+            --depth();
+        }
+
+        Pack_buffer(const Pack_buffer & other) = delete;
+        Pack_buffer & operator = (const Pack_buffer & other) = delete;
+
+        dtype * data()
+        {
+            return stack()[this->m_depth].data();
+        }
+    };
+
+    // Blocked GEMM driver shared by all micro kernels.
+    // Loops from outside to inside: NC columns of B, KC depth, MC rows of A, then
+    // NR x MR register tiles computed by the micro kernel.
+    // Blocks of MC rows (and groups of NR columns if there are few row blocks) are
+    // distributed over the threads of the process pool given to this operation for large products.
+    template <typename dtype, lint MR, lint NR, lint MC>
+    void gemm_blocked(void(*kernel)(lint, const dtype *, const dtype *, dtype *, lint),
+        bool trans_a, bool trans_b, lint m, lint n, lint k,
+        dtype alpha, const dtype *a, lint lda, const dtype *b, lint ldb,
+        dtype beta, dtype *c, lint ldc)
+    {
+        scale_c(m, n, beta, c, ldc);
+
+        if (0 == k || 0 == alpha)
+        {
+            return;
+        }
+
+        std::shared_ptr<neurons::Thread_pool> pool;
+        if (2.0 * m * n * k >= PARALLEL_GEMM)
+        {
+            pool = neurons::Thread_pool::current();
+        }
+        lint concurrency = pool ? pool->intra_op_threads() : 1;
+
+        Pack_buffer<dtype> b_pack{ ((std::min(NC, n) + NR - 1) / NR) * NR * KC };
+
+        for (lint jc = 0; jc < n; jc += NC)
+        {
+            lint nc = std::min(NC, n - jc);
+
+            for (lint pc = 0; pc < k; pc += KC)
+            {
+                lint kc = std::min(KC, k - pc);
+
+                const dtype *b_block = trans_b ? b + jc * ldb + pc : b + pc * ldb + jc;
+                pack_b<dtype, NR>(trans_b, kc, nc, b_block, ldb, b_pack.data());
+
+                lint row_blocks = (m + MC - 1) / MC;
+                lint col_panels = (nc + NR - 1) / NR;
+                lint col_splits = std::max<lint>(1, std::min(col_panels, concurrency / row_blocks));
+                lint panels_per_split = (col_panels + col_splits - 1) / col_splits;
+                const dtype *b_packed = b_pack.data();
+
+                // Compute blocks [begin, end), each block is MC rows by a group of NR panels
+                auto compute_blocks = [&](lint begin, lint end)
+                {
+                    Pack_buffer<dtype> a_pack{ ((MC + MR - 1) / MR) * MR * KC };
+                    dtype tile[MR * NR];
+
+                    for (lint block = begin; block < end; ++block)
+                    {
+                        lint ic = (block / col_splits) * MC;
+                        lint mc = std::min(MC, m - ic);
+                        lint jr_begin = (block % col_splits) * panels_per_split * NR;
+                        lint jr_end = std::min(nc, jr_begin + panels_per_split * NR);
+
+                        const dtype *a_block = trans_a ? a + pc * lda + ic : a + ic * lda + pc;
+                        pack_a<dtype, MR>(trans_a, mc, kc, alpha, a_block, lda, a_pack.data());
+
+                        for (lint jr = jr_begin; jr < jr_end; jr += NR)
+                        {
+                            lint nr = std::min(NR, nc - jr);
+                            const dtype *b_panel = b_packed + jr * kc;
+
+                            for (lint ir = 0; ir < mc; ir += MR)
+                            {
+                                lint mr = std::min(MR, mc - ir);
+                                const dtype *a_panel = a_pack.data() + ir * kc;
+                                dtype *c_tile = c + (ic + ir) * ldc + jc + jr;
+
+                                if (MR == mr && NR == nr)
+                                {
+                                    kernel(kc, a_panel, b_panel, c_tile, ldc);
+                                }
+                                else
+                                {
+                                    // Edge tiles are computed in a local buffer first
+                                    std::fill(tile, tile + MR * NR, dtype(0));
+                                    kernel(kc, a_panel, b_panel, tile, NR);
+
+                                    for (lint i = 0; i < mr; ++i)
+                                    {
+                                        for (lint j = 0; j < nr; ++j)
+                                        {
+                                            c_tile[i * ldc + j] += tile[i * NR + j];
+                                        }
+                                    }
+                                }
+                            }
+                        }
+                    }
+                };
+
+                lint blocks = row_blocks * col_splits;
+                if (pool && blocks > 1)
+                {
+                    pool->parallel_for(0, blocks, compute_blocks);
+                }
+                else
+                {
+                    compute_blocks(0, blocks);
+                }
+            }
+        }
+    }
+
+    bool cpu_supports(neurons::GEMM_kernel kernel)
+    {
+        if (neurons::GEMM_kernel::scalar == kernel)
+        {
+            return true;
+        }
+
+#if defined(NEURONS_GEMM_X86) && (defined(__GNUC__) || defined(__clang__))
+        __builtin_cpu_init();
+        if (neurons::GEMM_kernel::avx2 == kernel)
+        {
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        }
+        return __builtin_cpu_supports("avx512f");
+#elif defined(NEURONS_GEMM_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+        {
+            return false;
+        }
+
+        __cpuid(info, 1);
+        bool osxsave = 0 != (info[2] & (1 << 27));
+        bool avx = 0 != (info[2] & (1 << 28));
+        bool fma = 0 != (info[2] & (1 << 12));
+        if (!osxsave || !avx)
+        {
+            return false;
+        }
+
+        // The OS should save YMM (and ZMM) registers on context switches
+        unsigned long long xcr0 = _xgetbv(0);
+        __cpuidex(info, 7, 0);
+        if (neurons::GEMM_kernel::avx2 == kernel)
+        {
+            return fma && 0x6 == (xcr0 & 0x6) && 0 != (info[1] & (1 << 5));
+        }
+        return 0xe6 == (xcr0 & 0xe6) && 0 != (info[1] & (1 << 16));
+#else
+        return false;
+#endif
+    }
+
+    std::atomic<neurons::GEMM_kernel> & current_kernel()
+    {
+        static std::atomic<neurons::GEMM_kernel> kernel{ neurons::gemm_best_kernel() };
+        return kernel;
+    }
+
+    bool is_small(lint m, lint n, lint k)
+    {
+        // Vector-matrix products are memory bound, padding them into register tiles only wastes work
+        return 1 == m || 1 == n || m * n * k < SMALL_GEMM;
+    }
+}
+
+
+neurons::GEMM_kernel neurons::gemm_best_kernel()
+{
+    static GEMM_kernel best =
+        cpu_supports(GEMM_kernel::avx512) ? GEMM_kernel::avx512 :
+        cpu_supports(GEMM_kernel::avx2) ? GEMM_kernel::avx2 : GEMM_kernel::scalar;
+
+    return best;
+}
+
+neurons::GEMM_kernel neurons::gemm_kernel()
+{
+    return current_kernel().load();
+}
+
+void neurons::gemm_set_kernel(GEMM_kernel kernel)
+{
+    if (!cpu_supports(kernel))
+    {
+        throw std::invalid_argument(std::string("neurons::gemm_set_kernel: ")
+            + gemm_kernel_name(kernel) + " is not supported by this CPU");
+    }
+
+    current_kernel().store(kernel);
+}
+
+std::string neurons::gemm_kernel_name(GEMM_kernel kernel)
+{
+    switch (kernel)
+    {
+    case GEMM_kernel::avx512:
+        return "avx512";
+    case GEMM_kernel::avx2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+template <>
+void neurons::gemm<double>(bool trans_a, bool trans_b, lint m, lint n, lint k,
+    double alpha, const double *a, lint lda, const double *b, lint ldb,
+    double beta, double *c, lint ldc)
+{
+    if (is_small(m, n, k))
+    {
+        gemm_plain(trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+        return;
+    }
+
+    switch (gemm_kernel())
+    {
+#ifdef NEURONS_GEMM_X86
+    case GEMM_kernel::avx512:
+        gemm_blocked<double, 12, 16, 96>(kernel_avx512_d, trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+        break;
+    case GEMM_kernel::avx2:
+        gemm_blocked<double, 6, 8, 96>(kernel_avx2_d, trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+        break;
+#endif
+    default:
+        gemm_blocked<double, 4, 4, 64>(kernel_scalar<double, 4, 4>, trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+        break;
+    }
+}
+
+template <>
+void neurons::gemm<float>(bool trans_a, bool trans_b, lint m, lint n, lint k,
+    float alpha, const float *a, lint lda, const float *b, lint ldb,
+    float beta, float *c, lint ldc)
+{
+    if (is_small(m, n, k))
+    {
+        gemm_plain(trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+        return;
+    }
+
+    switch (gemm_kernel())
+    {
+#ifdef NEURONS_GEMM_X86
+    case GEMM_kernel::avx512:
+        gemm_blocked<float, 12, 32, 96>(kernel_avx512_f, trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+        break;
+    case GEMM_kernel::avx2:
+        gemm_blocked<float, 6, 16, 96>(kernel_avx2_f, trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+        break;
+#endif
+    default:
+        gemm_blocked<float, 4, 4, 64>(kernel_scalar<float, 4, 4>, trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+        break;
+    }
+}
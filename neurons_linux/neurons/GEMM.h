@@ -0,0 +1,96 @@
+#pragma once
+#include "Shape.h"
+#include <string>
+
+namespace neurons
+{
+    /*
+    General matrix multiplication of row-major buffers:
+
+        C = alpha * op(A) * op(B) + beta * C
+
+    op(A) is of m rows and k columns, op(B) is of k rows and n columns, C is of m rows and n columns.
+    op(X) is X itself or the transpose of X depending on trans_a / trans_b.
+    lda, ldb and ldc are row strides (number of elements between two adjacent rows) of the buffers
+    as they are stored in memory, not as they are seen after transposing.
+
+    Single and double precision are packed into cache sized blocks and computed by register tiled
+    micro kernels. The widest instruction set supported by the CPU (AVX-512, AVX2 + FMA or scalar)
+    is selected at runtime. Large products are split over the process thread pool (see Thread_pool).
+    */
+
+    enum class GEMM_kernel
+    {
+        scalar,
+        avx2,
+        avx512
+    };
+
+    // The widest kernel this CPU supports
+    GEMM_kernel gemm_best_kernel();
+
+    // The kernel currently used by gemm
+    GEMM_kernel gemm_kernel();
+
+    // Select the kernel used by gemm, an exception is thrown if the CPU does not support it.
+    // This is mostly useful for tests and benchmarks.
+    void gemm_set_kernel(GEMM_kernel kernel);
+
+    std::string gemm_kernel_name(GEMM_kernel kernel);
+
+    // Plain loop version of gemm without any blocking.
+    // The i-p-j order keeps both B and C accessed row by row.
+    template <typename dtype>
+    void gemm_plain(bool trans_a, bool trans_b, lint m, lint n, lint k,
+        dtype alpha, const dtype *a, lint lda, const dtype *b, lint ldb,
+        dtype beta, dtype *c, lint ldc)
+    {
+        for (lint i = 0; i < m; ++i)
+        {
+            dtype *c_row = c + i * ldc;
+            for (lint j = 0; j < n; ++j)
+            {
+                c_row[j] = 0 == beta ? 0 : beta * c_row[j];
+            }
+
+            for (lint p = 0; p < k; ++p)
+            {
+                dtype a_ip = alpha * (trans_a ? a[p * lda + i] : a[i * lda + p]);
+                if (trans_b)
+                {
+                    for (lint j = 0; j < n; ++j)
+                    {
+                        c_row[j] += a_ip * b[j * ldb + p];
+                    }
+                }
+                else
+                {
+                    const dtype *b_row = b + p * ldb;
+                    for (lint j = 0; j < n; ++j)
+                    {
+                        c_row[j] += a_ip * b_row[j];
+                    }
+                }
+            }
+        }
+    }
+
+    // Data types other than float and double go through the plain loop
+    template <typename dtype>
+    void gemm(bool trans_a, bool trans_b, lint m, lint n, lint k,
+        dtype alpha, const dtype *a, lint lda, const dtype *b, lint ldb,
+        dtype beta, dtype *c, lint ldc)
+    {
+        gemm_plain(trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+    }
+
+    template <>
+    void gemm<double>(bool trans_a, bool trans_b, lint m, lint n, lint k,
+        double alpha, const double *a, lint lda, const double *b, lint ldb,
+        double beta, double *c, lint ldc);
+
+    template <>
+    void gemm<float>(bool trans_a, bool trans_b, lint m, lint n, lint k,
+        float alpha, const float *a, lint lda, const float *b, lint ldb,
+        float beta, float *c, lint ldc);
+}
@@ -1,4 +1,5 @@
 #include "LinearRegression.h"
+#include "TMatrix_View.h"
 
 
 neurons::Linear_Regression::Linear_Regression(const std::vector<Vector> & x, const Vector & y)
@@ -30,7 +31,7 @@ void neurons::Linear_Regression::fit(double accuracy)
     {
         // Linear multiplication which resembles Forward propagation
         // of neural network
-        TMatrix<> y = transpose(this->m_train_x * transpose(this->m_w));
+        TMatrix<> y = this->m_w * transposed(this->m_train_x);
 
         // Calculate dE/dy
         TMatrix<> diff_E_to_y = 2.0 * (y - this->m_train_y);
@@ -55,7 +56,7 @@ void neurons::Linear_Regression::fit(double accuracy)
 neurons::Vector neurons::Linear_Regression::predict(const std::vector<Vector>& x)
 {
     TMatrix<> test_x = this->copy_input_into_mat(x);
-    TMatrix<> y = transpose(test_x * transpose(this->m_w));
+    TMatrix<> y = this->m_w * transposed(test_x);
 
     return y.flaten();
 }
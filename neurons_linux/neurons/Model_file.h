@@ -0,0 +1,156 @@
+#pragma once
+#include "TMatrix.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace neurons
+{
+    /*
+    Model files which can be memory-mapped and used in place.
+
+    Structure of a model file, integers are little-endian:
+    <
+        <file header, 64 bytes>
+            <magic "NEURONSM", 8 bytes><version, 32 bit><size of the file header, 32 bit>
+            <number of layers, 64 bit><size of the file, 64 bit><zeros>
+
+        <layer record> for each layer, records start at offsets aligned to 64 bytes
+            <size of the record including its padding, 64 bit>
+            <layer type len, 8 bit><layer type>
+            <act function name len, 8 bit><act function name>
+            <error function name len, 8 bit><error function name>
+            <number of parameters, 64 bit><parameters, 64 bit each> (stride and padding of CNN layers, etc)
+            <number of tensors, 64 bit>
+            <tensor header> for each tensor (weights, bias, etc)
+                <element size, 64 bit><number of dimensions, 64 bit><dimensions, 64 bit each>
+                <offset of elements from the beginning of the file, 64 bit>
+            <elements of each tensor, starting at offsets aligned to 64 bytes>
+
+        <training state record> (version 2, checkpoints only) a record of the type "STATE" after the layers,
+            its parameters are the step and the steps of the training run, its tensor of bytes (if any) is the
+            state of random engines and samplers
+    >
+
+    Elements are float or double, whatever precision the layer is trained in, and they are aligned
+    like storage of matrices (see Allocator), so matrices can borrow them from the mapping directly
+    (see TMatrix::borrow). Pages of the mapping are shared by all processes which map the file.
+    Weights and bias are the first two tensors of a layer, checkpoints add momentum of weights and bias.
+
+    Files are written into a temporary file which is flushed to disk and renamed over the file,
+    so a crash leaves either the old or the new file. On POSIX systems processes which mapped the
+    old file keep reading it. On Windows a file cannot be replaced while a process maps it (mappings
+    only share it for reading): writing fails and leaves the old file, so processes serving a model
+    while it is trained should map checkpoints of their own names instead.
+    */
+    const char MODEL_FILE_MAGIC[] = "NEURONSM";
+    const std::uint32_t MODEL_FILE_VERSION = 2;
+    const lint MODEL_FILE_ALIGNMENT = 64;
+
+    // A tensor of a layer, m_data are its elements of m_element_size bytes each
+    struct Model_tensor
+    {
+        Shape m_shape;
+        lint m_element_size;
+        const char *m_data;
+    };
+
+    // A layer of a model file
+    struct Model_layer
+    {
+        std::string m_type;
+        std::string m_act_func;
+        std::string m_err_func;
+        std::vector<lint> m_params;
+        std::vector<Model_tensor> m_tensors;
+    };
+
+    // State of a training run saved with a checkpoint besides momentum of layers, so that the run resumes exactly
+    struct Training_state
+    {
+        // Steps trained so far and steps of the whole run
+        lint m_step;
+        lint m_steps;
+        // Random engines and positions of samplers, as the network writes them
+        std::string m_random_state;
+    };
+
+    // Write layers (and the state of training of a checkpoint if state is not nullptr) into a model file,
+    // false if the file cannot be written (on Windows also if a process maps the file)
+    bool write_model_file(
+        const std::string & file_name, const std::vector<Model_layer> & layers, const Training_state *state = nullptr);
+
+    /*
+    A model file mapped into memory read-only.
+    Tensors of its layers point into the mapping, which is valid as long as the Model_file object lives.
+    */
+    class Model_file
+    {
+    private:
+        const char *m_data;
+        lint m_size;
+        std::vector<Model_layer> m_layers;
+        bool m_has_training_state;
+        Training_state m_training_state;
+
+#ifdef _WIN32
+        void *m_file_handle;
+        void *m_mapping_handle;
+#endif
+
+    public:
+        // True if the file begins with the magic of model files, otherwise it may be of the legacy format
+        static bool is_model_file(const std::string & file_name);
+
+        // Map a model file, std::invalid_argument is thrown if it cannot be mapped,
+        // if its version is not supported or if it is corrupted
+        explicit Model_file(const std::string & file_name);
+
+        Model_file(const Model_file & other) = delete;
+
+        Model_file & operator = (const Model_file & other) = delete;
+
+        ~Model_file();
+
+        const std::vector<Model_layer> & layers() const;
+
+        // True if the file is a checkpoint
+        bool has_training_state() const;
+
+        const Training_state & training_state() const;
+
+    private:
+        void parse();
+
+        void unmap();
+    };
+
+    // A tensor of the elements of a matrix, it is valid as long as the matrix is not changed
+    template <typename dtype>
+    Model_tensor matrix_to_tensor(const TMatrix<dtype> & mat)
+    {
+        return Model_tensor{ mat.shape(), static_cast<lint>(sizeof(dtype)), reinterpret_cast<const char *>(mat.m_data) };
+    }
+
+    // A matrix of the elements of a tensor. If borrow is true and elements of the tensor are of dtype,
+    // the matrix borrows them, otherwise they are copied (and converted to dtype).
+    template <typename dtype>
+    TMatrix<dtype> tensor_to_matrix(const Model_tensor & tensor, bool borrow)
+    {
+        if (sizeof(dtype) == tensor.m_element_size)
+        {
+            TMatrix<dtype> mat = TMatrix<dtype>::borrow(tensor.m_shape, reinterpret_cast<const dtype *>(tensor.m_data));
+            return borrow ? std::move(mat) : TMatrix<dtype>{ mat };
+        }
+        else if (sizeof(float) == tensor.m_element_size)
+        {
+            return TMatrix<dtype>{ TMatrix<float>::borrow(tensor.m_shape, reinterpret_cast<const float *>(tensor.m_data)) };
+        }
+        else if (sizeof(double) == tensor.m_element_size)
+        {
+            return TMatrix<dtype>{ TMatrix<double>::borrow(tensor.m_shape, reinterpret_cast<const double *>(tensor.m_data)) };
+        }
+
+        throw std::invalid_argument(std::string("neurons::tensor_to_matrix: elements are neither float nor double"));
+    }
+}
@@ -3,14 +3,90 @@
 #include "Functions.h"
 #include "NN_layer.h"
 #include "Dataset.h"
+#include "Thread_pool.h"
+#include "Prefetch_pipeline.h"
+#include "Checkpoint.h"
+#include "Inference_session.h"
+#include <algorithm>
 #include <iostream>
 #include <random>
+#include <sstream>
 
+// Networks are templates of the element type of their layers, so they can be trained in single
+// or double precision. Data sets are loaded in double and converted to dtype.
+template <typename dtype = double>
 class NN
 {
+public:
+    // The way samples of mini batches are drawn from a data set
+    enum class Sampling
+    {
+        // Each sample is drawn uniformly at random, a sample may appear more than once in a batch
+        with_replacement,
+        // Samples are drawn in the order of a random permutation of the data set,
+        // which is shuffled again after all samples have been drawn (an epoch)
+        epoch_shuffle
+    };
+
+    // The way threads of the pool are shared between the per-thread tasks of a batch (each one
+    // runs its share of the samples with its own layer operations, see thread_id) and the
+    // operations inside them (convolutions, matrix products, ...)
+    enum class Parallelism
+    {
+        // Tasks run at the same time and operations of each task split their work over
+        // the threads left to it (threads of the pool / tasks). Batches of fewer samples
+        // than threads still keep all threads busy.
+        balanced,
+        // Tasks run at the same time and operations are single-threaded
+        inter_sample,
+        // Tasks run one after another, operations split their work over all threads of the pool.
+        // This gives the lowest latency for a single sample.
+        intra_op
+    };
+
 private:
-    std::uniform_int_distribution<size_t> m_train_distribution;
-    std::uniform_int_distribution<size_t> m_test_distribution;
+    // Draws indices of samples of a data set.
+    // Each sampler has its own engine, so batches can be drawn by prefetch workers.
+    // The engine is seeded with m_seed, so a sampler is repositioned by drawing m_drawn samples again.
+    struct Sampler
+    {
+        std::default_random_engine m_engine;
+        std::uniform_int_distribution<size_t> m_distribution;
+        std::vector<size_t> m_order;
+        size_t m_next;
+        unsigned int m_seed;
+        size_t m_drawn;
+    };
+
+    // A mini batch split over threads
+    struct Batch
+    {
+        std::vector<size_t> m_indices;
+        // Samples drawn from the sampler once this batch was drawn
+        size_t m_drawn;
+        std::vector<std::vector<const neurons::TMatrix<dtype> *>> m_inputs;
+        std::vector<std::vector<const neurons::TMatrix<dtype> *>> m_targets;
+        // Samples materialized from raw images
+        std::vector<neurons::TMatrix<dtype>> m_samples;
+        // Samples drawn from a stream and their labels materialized
+        dataset::Image_store m_images;
+        std::vector<neurons::TMatrix<dtype>> m_labels;
+    };
+
+    Sampling m_sampling;
+    Parallelism m_parallelism;
+    Sampler m_train_sampler;
+    Sampler m_test_sampler;
+
+    // Batches are prepared by m_prefetch_workers threads up to m_prefetch_depth batches ahead
+    lint m_prefetch_workers;
+    lint m_prefetch_depth;
+
+    // Checkpoints of train_network are written in the background
+    neurons::Checkpoint_writer m_checkpoints;
+    // The training state of a checkpoint the network was loaded from, which the next train_network resumes
+    bool m_resume;
+    neurons::Training_state m_resume_state;
 
 protected:
 
@@ -18,19 +94,43 @@ protected:
     double m_mmt_rate;
     lint m_threads;
 
+    // Persistent workers running per-thread optimise/test/predict tasks, it is also the
+    // process pool used by layers for intra-op parallelism
+    std::shared_ptr<neurons::Thread_pool> m_pool;
+
     std::string m_model_file;
 
     // The training set
-    std::vector<neurons::TMatrix<>> m_train_set;
+    std::vector<neurons::TMatrix<dtype>> m_train_set;
     // The training label
-    std::vector<neurons::TMatrix<>> m_train_labels;
+    std::vector<neurons::TMatrix<dtype>> m_train_labels;
     // The test set
-    std::vector<neurons::TMatrix<>> m_test_set;
+    std::vector<neurons::TMatrix<dtype>> m_test_set;
     // The test label
-    std::vector<neurons::TMatrix<>> m_test_labels;
+    std::vector<neurons::TMatrix<dtype>> m_test_labels;
+
+    // If the data set supports Image_store, images are kept as raw pixels in m_train_images and
+    // m_test_images, and m_train_set and m_test_set are empty. Samples are converted to matrices
+    // (and normalized) only when they are drawn into a batch.
+    bool m_raw_images;
+    dataset::Image_store m_train_images;
+    dataset::Image_store m_test_images;
+    dataset::Image_store::Scaling m_scaling;
+
+    // If the data set is set to be streamed, training samples are drawn from this buffer
+    // instead of m_train_images, which is empty as well as m_train_labels then.
+    std::unique_ptr<dataset::Shuffle_buffer> m_train_stream;
+
+    // Shape of a sample and a label as they are fed to the layers
+    neurons::Shape m_sample_shape;
+    neurons::Shape m_label_shape;
+
+    // The model file layers borrow their weights from (see Multi_Layer_NN::load_mapped), if any.
+    // It is declared before m_layers, so the mapping outlives the layers.
+    std::shared_ptr<neurons::Model_file> m_mapped_model;
 
     // The layers of neural network
-    std::vector<std::shared_ptr<neurons::NN_layer>> m_layers;
+    std::vector<std::shared_ptr<neurons::NN_layer<dtype>>> m_layers;
 
 public:
     NN(double l_rate, double mmt_rate, lint threads, const std::string & model_file, const dataset::Dataset &d_set);
@@ -50,6 +150,14 @@ public:
 
     lint n_layers() const;
 
+    void set_sampling(Sampling sampling);
+
+    // Prepare batches on workers while the network is trained or tested on the batches before them.
+    // With 0 workers batches are prepared on the training thread when they are needed.
+    void set_prefetch(lint workers, lint depth);
+
+    void set_parallelism(Parallelism parallelism);
+
     void print_train_set(std::ostream & os) const;
 
     void print_train_label(std::ostream & os) const;
@@ -58,6 +166,11 @@ public:
 
     void print_test_label(std::ostream & os) const;
 
+protected:
+    // Reshape all samples and labels, and normalize samples to mean == 0 and variance == 1.
+    // Raw images are reshaped and normalized when they are drawn into a batch.
+    void prepare_samples(const neurons::Shape & sample_shape, const neurons::Shape & label_shape, bool normalize);
+
 public:
     void train_network(
         lint batch_size,
@@ -68,7 +181,12 @@ public:
 
     void test_network(lint batch_size, lint epoch_size);
 
-    std::vector<neurons::TMatrix<>> network_predict(lint batch_size, const std::vector<neurons::TMatrix<>> & inputs) const;
+    std::vector<neurons::TMatrix<dtype>> network_predict(lint batch_size, const std::vector<neurons::TMatrix<dtype>> & inputs) const;
+
+    // A read-only session predicting samples the way network_predict does, without the layer operations
+    // of training (see neurons::Inference_session). Weights are copied, so the network may be trained
+    // on while the session serves; weights of a mapped model file are borrowed from its mapping instead.
+    std::shared_ptr<neurons::Inference_session<dtype>> inference_session(lint threads = 1) const;
 
     virtual bool load(const std::string & file_name) = 0;
 
@@ -78,57 +196,130 @@ public:
 
     virtual void save(const std::string & file_name) const = 0;
 
+protected:
+    // Layers of the network as they are written to model files, with their momentum for checkpoints
+    virtual std::vector<neurons::Model_layer> model_layers(bool momentum) const;
+
+    // True if samples are normalized before they are predicted
+    virtual bool normalizes_inputs() const;
+
+    // True if the network is saved in model files and restores the checkpoints it loads,
+    // train_network writes checkpoints in the background then. Otherwise it saves the network with save().
+    virtual bool writes_model_files() const;
+
+    // Called by load with the training state of a checkpoint: the next train_network of as many steps
+    // as the run of the checkpoint continues after its step, with samplers and random engines where
+    // they were (the training set must not be streamed).
+    void restore_training_state(const neurons::Training_state & state);
+
 private:
 
-    void get_batch(
-        lint batch_size,
-        std::vector<std::vector<neurons::TMatrix<>>> & data_batch,
-        std::vector<std::vector<neurons::TMatrix<>>> & label_batch,
-        const std::vector<neurons::TMatrix<>> & data,
-        const std::vector<neurons::TMatrix<>> & label,
-        std::uniform_int_distribution<size_t> & distribution);
+    size_t n_train_samples() const;
+
+    size_t n_test_samples() const;
+
+    // Initialize a sampler of a data set of the size
+    void reset_sampler(Sampler & sampler, size_t size);
+
+    void seed_sampler(Sampler & sampler, size_t size, unsigned int seed);
+
+    // State of training after a step, train_drawn is the position of the training sampler after the step
+    neurons::Training_state training_state(lint step, lint steps, size_t train_drawn) const;
+
+    // Reposition samplers and random engines as a training state says, false if it does not apply
+    bool resume_training(const neurons::Training_state & state, lint steps);
+
+    size_t next_sample(Sampler & sampler);
+
+    // Draw indices of samples of a batch, batches have to be drawn one by one
+    void draw_batch(lint batch_size, Batch & batch, Sampler & sampler);
+
+    // Copy samples of a batch from the training stream, their indices are those in batch.m_images
+    void draw_streamed_batch(lint batch_size, Batch & batch);
+
+    // Split a batch over threads. Batches refer to samples resident in data and label, nothing is copied.
+    // With raw images, samples are materialized from images into the batch instead of referring to data,
+    // and so are labels if label is empty (the training set is streamed).
+    // Memory of batches is reused from batch to batch.
+    void fill_batch(
+        Batch & batch,
+        const std::vector<neurons::TMatrix<dtype>> & data,
+        const dataset::Image_store & images,
+        const std::vector<neurons::TMatrix<dtype>> & label) const;
+
+
+    // Run task(thread_id) for each thread of a batch as the parallelism says
+    template <typename Func>
+    void run_thread_tasks(size_t tasks, Func task) const
+    {
+        lint threads = this->m_pool->concurrency();
+
+        if (Parallelism::intra_op == this->m_parallelism || tasks <= 1)
+        {
+            neurons::Intra_op_scope scope{ threads };
+            for (size_t thread_id = 0; thread_id < tasks; ++thread_id)
+            {
+                task(thread_id);
+            }
+            return;
+        }
+
+        lint task_threads = Parallelism::balanced == this->m_parallelism ? threads / static_cast<lint>(tasks) : 1;
+        neurons::Task_group group;
 
+        // Tasks of all threads are submitted to the pool, the calling thread helps while waiting
+        for (size_t thread_id = 0; thread_id < tasks; ++thread_id)
+        {
+            this->m_pool->run(group, [&task, thread_id, task_threads]
+            {
+                neurons::Intra_op_scope scope{ task_threads };
+                task(thread_id);
+            });
+        }
+        this->m_pool->wait(group);
+    }
 
     double train_step(
         lint batch_size,
-        const std::vector<std::vector<neurons::TMatrix<>>> & inputs,
-        const std::vector<std::vector<neurons::TMatrix<>>> & targets,
-        std::vector<std::vector<neurons::TMatrix<>>> & preds);
+        const std::vector<std::vector<const neurons::TMatrix<dtype> *>> & inputs,
+        const std::vector<std::vector<const neurons::TMatrix<dtype> *>> & targets,
+        std::vector<std::vector<neurons::TMatrix<dtype>>> & preds);
 
     double test_step(
         lint batch_size,
-        const std::vector<std::vector<neurons::TMatrix<>>> & inputs,
-        const std::vector<std::vector<neurons::TMatrix<>>> & targets,
-        std::vector<std::vector<neurons::TMatrix<>>> & preds);
+        const std::vector<std::vector<const neurons::TMatrix<dtype> *>> & inputs,
+        const std::vector<std::vector<const neurons::TMatrix<dtype> *>> & targets,
+        std::vector<std::vector<neurons::TMatrix<dtype>>> & preds);
 
-    std::vector<std::vector<neurons::TMatrix<>>> predict_step(
+    std::vector<std::vector<neurons::TMatrix<dtype>>> predict_step(
         lint batch_size,
-        const std::vector<std::vector<neurons::TMatrix<>>> & inputs) const;
+        const std::vector<std::vector<const neurons::TMatrix<dtype> *>> & inputs) const;
 
     double get_accuracy(
-        const neurons::TMatrix<> & pred, const neurons::TMatrix<> & target);
+        const neurons::TMatrix<dtype> & pred, const neurons::TMatrix<dtype> & target);
 
     double get_accuracy(
         lint batch_size,
-        const std::vector<std::vector<neurons::TMatrix<>>> & preds,
-        const std::vector<std::vector<neurons::TMatrix<>>> & targets);
+        const std::vector<std::vector<neurons::TMatrix<dtype>>> & preds,
+        const std::vector<std::vector<const neurons::TMatrix<dtype> *>> & targets);
 
-    virtual std::vector<neurons::TMatrix<>> test(
-        const std::vector<neurons::TMatrix<>> & inputs,
-        const std::vector<neurons::TMatrix<>> & targets,
+    virtual std::vector<neurons::TMatrix<dtype>> test(
+        const std::vector<const neurons::TMatrix<dtype> *> & inputs,
+        const std::vector<const neurons::TMatrix<dtype> *> & targets,
         lint thread_id) = 0;
 
-    virtual std::vector<neurons::TMatrix<>> optimise(
-        const std::vector<neurons::TMatrix<>> & inputs,
-        const std::vector<neurons::TMatrix<>> & targets,
+    virtual std::vector<neurons::TMatrix<dtype>> optimise(
+        const std::vector<const neurons::TMatrix<dtype> *> & inputs,
+        const std::vector<const neurons::TMatrix<dtype> *> & targets,
         lint thread_id) = 0;
 
-    virtual std::vector<neurons::TMatrix<>> predict(
-        const std::vector<neurons::TMatrix<>> & inputs,
+    virtual std::vector<neurons::TMatrix<dtype>> predict(
+        const std::vector<const neurons::TMatrix<dtype> *> & inputs,
         lint thread_id) const = 0;
 
 };
 
-std::ostream & operator << (std::ostream & os, const NN & nn);
+template <typename dtype>
+std::ostream & operator << (std::ostream & os, const NN<dtype> & nn);
 
 
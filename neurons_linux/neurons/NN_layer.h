@@ -1,10 +1,21 @@
 #pragma once
 #include "TMatrix.h"
+#include "Model_file.h"
 
 namespace neurons
 {
+    template <typename dtype>
     class NN_layer_op;
 
+    // Pointers to matrices of a batch, which is how samples resident in a data set are passed to
+    // ops without copying them
+    template <typename dtype>
+    std::vector<const TMatrix<dtype> *> matrix_pointers(const std::vector<TMatrix<dtype>> & batch);
+
+    // Layers and their ops are templates of the element type of matrices they work on,
+    // so a whole network can be trained in single or double precision.
+    // They are instantiated for float and double.
+    template <typename dtype = double>
     class NN_layer
     {
     public:
@@ -15,7 +26,7 @@ namespace neurons
 
     protected:
 
-        mutable std::vector<std::shared_ptr<NN_layer_op>> m_ops;
+        mutable std::vector<std::shared_ptr<NN_layer_op<dtype>>> m_ops;
 
     public:
         NN_layer();
@@ -30,7 +41,7 @@ namespace neurons
 
         NN_layer & operator = (NN_layer && other);
 
-        std::vector<std::shared_ptr<NN_layer_op>>& operation_instances() const;
+        std::vector<std::shared_ptr<NN_layer_op<dtype>>>& operation_instances() const;
 
         virtual double commit_training();
 
@@ -40,9 +51,19 @@ namespace neurons
 
         virtual std::unique_ptr<char[]> to_binary_data(lint & data_size) const = 0;
 
+        // The layer as a layer of model files, its tensors point to matrices of the layer
+        virtual Model_layer to_model_layer() const = 0;
+
+        // Checkpoints keep the momentum of layers after their weights, so training resumes exactly.
+        // Layers without momentum add nothing and restore nothing.
+        virtual void add_momentum(Model_layer & /*layer*/) const {}
+
+        virtual void restore_momentum(const Model_layer & /*layer*/) {}
+
         virtual std::string nn_type() const = 0;
     };
 
+    template <typename dtype = double>
     class NN_layer_op
     {
     protected:
@@ -67,35 +88,47 @@ namespace neurons
         // Forward propagation
         //--------------------------------------------
 
-        virtual TMatrix<> forward_propagate(const TMatrix<> &input) = 0;
+        virtual TMatrix<dtype> forward_propagate(const TMatrix<dtype> &input) = 0;
 
-        virtual TMatrix<> forward_propagate(const TMatrix<> &input, const TMatrix<> &target) = 0;
+        virtual TMatrix<dtype> forward_propagate(const TMatrix<dtype> &input, const TMatrix<dtype> &target) = 0;
 
         //--------------------------------------------
         // Back propagation
         //--------------------------------------------
 
-        virtual TMatrix<> back_propagate(double l_rate, const TMatrix<> & E_to_y_diff) = 0;
+        virtual TMatrix<dtype> back_propagate(double l_rate, const TMatrix<dtype> & E_to_y_diff) = 0;
 
-        virtual TMatrix<> back_propagate(double l_rate) = 0;
+        virtual TMatrix<dtype> back_propagate(double l_rate) = 0;
 
         
         //--------------------------------------------
         // Forward propagation via batch learning
         //--------------------------------------------
 
-        virtual std::vector<TMatrix<>> batch_forward_propagate(const std::vector<TMatrix<>> & inputs) = 0;
+        virtual std::vector<TMatrix<dtype>> batch_forward_propagate(const std::vector<TMatrix<dtype>> & inputs) = 0;
+
+        virtual std::vector<TMatrix<dtype>> batch_forward_propagate(
+            const std::vector<TMatrix<dtype>> & inputs, const std::vector<TMatrix<dtype>> & targets) = 0;
+
+        //--------------------------------------------
+        // Forward propagation via batch learning of samples referred to by pointers,
+        // for example samples resident in a data set.
+        // Ops that copy their inputs anyway should override these to read samples directly,
+        // the default versions copy samples into a batch of matrices.
+        //--------------------------------------------
+
+        virtual std::vector<TMatrix<dtype>> batch_forward_propagate(const std::vector<const TMatrix<dtype> *> & inputs);
 
-        virtual std::vector<TMatrix<>> batch_forward_propagate(
-            const std::vector<TMatrix<>> & inputs, const std::vector<TMatrix<>> & targets) = 0;
+        virtual std::vector<TMatrix<dtype>> batch_forward_propagate(
+            const std::vector<const TMatrix<dtype> *> & inputs, const std::vector<const TMatrix<dtype> *> & targets);
 
         //--------------------------------------------
         // Back propagation via batch learning
         //--------------------------------------------
 
-        virtual std::vector<TMatrix<>> batch_back_propagate(double l_rate, const std::vector<TMatrix<>> & E_to_y_diffs) = 0;
+        virtual std::vector<TMatrix<dtype>> batch_back_propagate(double l_rate, const std::vector<TMatrix<dtype>> & E_to_y_diffs) = 0;
 
-        virtual std::vector<TMatrix<>> batch_back_propagate(double l_rate) = 0;
+        virtual std::vector<TMatrix<dtype>> batch_back_propagate(double l_rate) = 0;
 
         virtual Shape output_shape() const = 0;
 
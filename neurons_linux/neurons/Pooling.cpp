@@ -1,8 +1,11 @@
 #include "Pooling.h"
+#include <algorithm>
+#include <limits>
 
 
-neurons::Pooling_2d::Pooling_2d(const Shape &input_sh, const Shape &kernel_sh)
-    : m_input_sh{ input_sh }, m_kernel_sh{ kernel_sh }
+template <typename dtype>
+neurons::Pooling_2d<dtype>::Pooling_2d(const Shape &input_sh, const Shape &kernel_sh, lint stride_rows, lint stride_cols)
+    : m_input_sh{ input_sh }, m_kernel_sh{ kernel_sh }, m_stride_rows{ stride_rows }, m_stride_cols{ stride_cols }
 {
     if (kernel_sh.dim() != 4)
     {
@@ -16,16 +19,38 @@ neurons::Pooling_2d::Pooling_2d(const Shape &input_sh, const Shape &kernel_sh)
             std::string("neurons::Pooling_2d: Numbers of channels should be the same for inputs and filters."));
     }
 
+    if (input_sh[1] < kernel_sh[1] || input_sh[2] < kernel_sh[2])
+    {
+        throw std::invalid_argument(
+            std::string("neurons::Pooling_2d: The pooling kernel should not be larger than inputs."));
+    }
+
+    if (input_sh.size() > INT32_MAX)
+    {
+        throw std::invalid_argument(
+            std::string("neurons::Pooling_2d: Inputs should have less than 2^31 elements."));
+    }
+
+    // Windows do not overlap by default
+    if (this->m_stride_rows < 1)
+    {
+        this->m_stride_rows = kernel_sh[1];
+    }
+
+    if (this->m_stride_cols < 1)
+    {
+        this->m_stride_cols = kernel_sh[2];
+    }
+
     this->m_output_sh = Shape{
         input_sh[0],
-        input_sh[1] / kernel_sh[1],
-        input_sh[2] / kernel_sh[2],
+        (input_sh[1] - kernel_sh[1]) / this->m_stride_rows + 1,
+        (input_sh[2] - kernel_sh[2]) / this->m_stride_cols + 1,
         input_sh[3] };
-
-    this->m_diff_y_to_x = TMatrix<>{ this->m_input_sh };
 }
 
-neurons::TMatrix<> neurons::Pooling_2d::operator()(const TMatrix<> & in)
+template <typename dtype>
+neurons::TMatrix<dtype> neurons::Pooling_2d<dtype>::operator()(const TMatrix<dtype> & in)
 {
     if (in.m_shape != this->m_input_sh)
     {
@@ -34,74 +59,20 @@ neurons::TMatrix<> neurons::Pooling_2d::operator()(const TMatrix<> & in)
         );
     }
 
-    TMatrix<> output{ this->m_output_sh };
-    m_diff_y_to_x = 0;
-
-    lint batch_size = this->m_input_sh[0];
-
-    lint in_rows = this->m_input_sh[1];
-    lint in_cols = this->m_input_sh[2];
-
-    lint k_rows = this->m_kernel_sh[1];
-    lint k_cols = this->m_kernel_sh[2];
-
-    lint r_stride = k_rows;
-    lint c_stride = k_cols;
-
-    lint o_rows = this->m_output_sh[1];
-    lint o_cols = this->m_output_sh[2];
-
-    lint chls = this->m_input_sh[3];
-
-    lint in_size = in_rows * in_cols * chls;
-    // lint in_r_size = in_cols * chls;
-    lint in_r_stride_size = in_cols * chls * r_stride;
-    lint in_c_stride_size = chls * c_stride;
-
-    lint o_size = o_rows * o_cols * chls;
-    lint o_r_stride_size = o_cols * chls;
-
-    double *in_start = in.m_data;
-    double *diff_start = this->m_diff_y_to_x.m_data;
-    double *o_start = output.m_data;
-
-    for (lint i = 0; i < batch_size; ++i)
-    {
-        double *in_r_stride_start = in_start;
-        double *diff_r_stride_start = diff_start;
-        double *o_r_stride_start = o_start;
-
-        for (lint o_r = 0; o_r < o_rows; ++o_r)
-        {
-            double *in_c_stride_start = in_r_stride_start;
-            double *diff_c_stride_start = diff_r_stride_start;
-            double *o_c_stride_start = o_r_stride_start;
-
-            for (lint o_c = 0; o_c < o_cols; ++o_c)
-            {
-                this->pooling_func(in_c_stride_start, diff_c_stride_start, o_c_stride_start, in_cols, chls, k_cols, k_rows);
-
-                in_c_stride_start += in_c_stride_size;
-                diff_c_stride_start += in_c_stride_size;
-                o_c_stride_start += chls;
-            }
-
-            in_r_stride_start += in_r_stride_size;
-            diff_r_stride_start += in_r_stride_size;
-            o_r_stride_start += o_r_stride_size;
-        }
-
-        in_start += in_size;
-        diff_start += in_size;
-        o_start += o_size;
-    }
-
-    // std::cout << diff_x << '\n';
+    TMatrix<dtype> output{ this->m_output_sh };
+    this->pooling_func(in.m_data, output.m_data);
 
     return output;
 }
 
-neurons::TMatrix<> neurons::Pooling_2d::back_propagate(const TMatrix<> & diff_E_to_output) const
+template <typename dtype>
+void neurons::Pooling_2d<dtype>::infer(const dtype *input_data, dtype *output_data) const
+{
+    this->inference_func(input_data, output_data);
+}
+
+template <typename dtype>
+neurons::TMatrix<dtype> neurons::Pooling_2d<dtype>::back_propagate(const TMatrix<dtype> & diff_E_to_output) const
 {
     if (diff_E_to_output.m_shape != this->m_output_sh)
     {
@@ -110,206 +81,258 @@ neurons::TMatrix<> neurons::Pooling_2d::back_propagate(const TMatrix<> & diff_E_
         );
     }
 
-    // diff_E_to_input should be initialized with zero
-    TMatrix<> diff_E_to_input{ this->m_input_sh, 0 };
-
-    lint batch_size = this->m_input_sh[0];
+    // Elements out of all windows get no derivative
+    TMatrix<dtype> diff_E_to_input{ this->m_input_sh, 0 };
+    this->back_propagate_func(diff_E_to_output.m_data, diff_E_to_input.m_data);
 
-    lint in_rows = this->m_input_sh[1];
-    lint in_cols = this->m_input_sh[2];
+    return diff_E_to_input;
+}
 
-    lint k_rows = this->m_kernel_sh[1];
-    lint k_cols = this->m_kernel_sh[2];
+template <typename dtype>
+neurons::Shape neurons::Pooling_2d<dtype>::get_output_shape() const
+{
+    return this->m_output_sh;
+}
 
-    lint r_stride = k_rows;
-    lint c_stride = k_cols;
+template <typename dtype>
+neurons::MaxPooling_2d<dtype>::MaxPooling_2d(const Shape & input_sh, const Shape & kernel_sh, lint stride_rows, lint stride_cols)
+    : Pooling_2d<dtype>(input_sh, kernel_sh, stride_rows, stride_cols)
+{}
 
-    lint o_rows = this->m_output_sh[1];
-    lint o_cols = this->m_output_sh[2];
+template <typename dtype>
+std::unique_ptr<neurons::Pooling_2d<dtype>> neurons::MaxPooling_2d<dtype>::clone()
+{
+    return std::make_unique<MaxPooling_2d<dtype>>(*this);
+}
 
-    lint chls = this->m_input_sh[3];
+template <typename dtype>
+void neurons::MaxPooling_2d<dtype>::pooling_func(const dtype *input_data, dtype *output_data)
+{
+    this->m_argmax.resize(this->m_output_sh.size());
+    this->max_of_windows(input_data, output_data, this->m_argmax.data());
+}
 
-    lint in_size = in_rows * in_cols * chls;
-    // lint in_r_size = in_cols * chls;
-    lint in_r_stride_size = in_cols * chls * r_stride;
-    lint in_c_stride_size = chls * c_stride;
+template <typename dtype>
+void neurons::MaxPooling_2d<dtype>::inference_func(const dtype *input_data, dtype *output_data) const
+{
+    this->max_of_windows(input_data, output_data, nullptr);
+}
 
-    lint o_size = o_rows * o_cols * chls;
-    lint o_r_stride_size = o_cols * chls;
+template <typename dtype>
+void neurons::MaxPooling_2d<dtype>::max_of_windows(const dtype *input_data, dtype *output_data, std::int32_t *argmax) const
+{
+    lint k_rows = this->m_kernel_sh[1];
+    lint k_cols = this->m_kernel_sh[2];
+    lint chls = this->m_input_sh[3];
+    lint in_r_size = this->m_input_sh[2] * chls;
 
-    double *diff_E_to_x_start = diff_E_to_input.m_data;
-    double *diff_x_start = this->m_diff_y_to_x.m_data;
-    double *diff_E_to_y_start = diff_E_to_output.m_data;
+    dtype lowest = std::numeric_limits<dtype>::max() * (-1);
 
-    for (lint i = 0; i < batch_size; ++i)
+    this->for_each_window([&](lint window_offset, lint output_offset)
     {
-        double *diff_E_to_x_r_stride_start = diff_E_to_x_start;
-        double *diff_x_r_stride_start = diff_x_start;
-        double *diff_E_to_y_r_stride_start = diff_E_to_y_start;
+        dtype *max = output_data + output_offset;
 
-        for (lint o_r = 0; o_r < o_rows; ++o_r)
+        if (nullptr == argmax)
         {
-            double *diff_E_to_x_c_stride_start = diff_E_to_x_r_stride_start;
-            double *diff_x_c_stride_start = diff_x_r_stride_start;
-            double *diff_E_to_y_c_stride_start = diff_E_to_y_r_stride_start;
-
-            for (lint o_c = 0; o_c < o_cols; ++o_c)
+            std::fill(max, max + chls, lowest);
+            for (lint k_r = 0; k_r < k_rows; ++k_r)
             {
-                this->back_propagate_func(
-                    diff_x_c_stride_start,
-                    diff_E_to_y_c_stride_start,
-                    diff_E_to_x_c_stride_start,
-                    in_cols, chls, k_cols, k_rows);
-
-                diff_E_to_x_c_stride_start += in_c_stride_size;
-                diff_x_c_stride_start += in_c_stride_size;
-                diff_E_to_y_c_stride_start += chls;
+                const dtype *ele = input_data + window_offset + k_r * in_r_size;
+                for (lint k_c = 0; k_c < k_cols; ++k_c)
+                {
+                    for (lint ch = 0; ch < chls; ++ch)
+                    {
+                        max[ch] = std::max(max[ch], ele[ch]);
+                    }
+                    ele += chls;
+                }
             }
-
-            diff_E_to_x_r_stride_start += in_r_stride_size;
-            diff_x_r_stride_start += in_r_stride_size;
-            diff_E_to_y_r_stride_start += o_r_stride_size;
+            return;
         }
 
-        diff_E_to_x_start += in_size;
-        diff_x_start += in_size;
-        diff_E_to_y_start += o_size;
-    }
+        std::int32_t *arg = argmax + output_offset;
 
-    return diff_E_to_input;
+        for (lint ch = 0; ch < chls; ++ch)
+        {
+            max[ch] = lowest;
+            arg[ch] = static_cast<std::int32_t>(window_offset + ch);
+        }
+
+        // Channels are contiguous, so all of them are compared element after element of the window.
+        // The first of equal elements is kept.
+        for (lint k_r = 0; k_r < k_rows; ++k_r)
+        {
+            lint offset = window_offset + k_r * in_r_size;
+            for (lint k_c = 0; k_c < k_cols; ++k_c)
+            {
+                const dtype *ele = input_data + offset;
+                for (lint ch = 0; ch < chls; ++ch)
+                {
+                    if (ele[ch] > max[ch])
+                    {
+                        max[ch] = ele[ch];
+                        arg[ch] = static_cast<std::int32_t>(offset + ch);
+                    }
+                }
+                offset += chls;
+            }
+        }
+    });
 }
 
-neurons::Shape neurons::Pooling_2d::get_output_shape() const
+template <typename dtype>
+void neurons::MaxPooling_2d<dtype>::back_propagate_func(const dtype *diff_E_to_y_data, dtype *diff_E_to_x_data) const
 {
-    return this->m_output_sh;
+    // Each output only depends on the largest element of its window
+    lint size = this->m_output_sh.size();
+    const std::int32_t *argmax = this->m_argmax.data();
+
+    for (lint i = 0; i < size; ++i)
+    {
+        diff_E_to_x_data[argmax[i]] += diff_E_to_y_data[i];
+    }
 }
 
-neurons::MaxPooling_2d::MaxPooling_2d(const Shape & input_sh, const Shape & kernel_sh)
-    : Pooling_2d(input_sh, kernel_sh)
+template <typename dtype>
+neurons::AveragePooling_2d<dtype>::AveragePooling_2d(const Shape & input_sh, const Shape & kernel_sh, lint stride_rows, lint stride_cols)
+    : Pooling_2d<dtype>(input_sh, kernel_sh, stride_rows, stride_cols)
 {}
 
-std::unique_ptr<neurons::Pooling_2d> neurons::MaxPooling_2d::clone()
+template <typename dtype>
+std::unique_ptr<neurons::Pooling_2d<dtype>> neurons::AveragePooling_2d<dtype>::clone()
 {
-    return std::make_unique<MaxPooling_2d>(*this);
+    return std::make_unique<AveragePooling_2d<dtype>>(*this);
 }
 
-void neurons::MaxPooling_2d::pooling_func(const double *input_data, double *diff_data, double *output_data, lint in_cols, lint chls, lint k_cols, lint k_rows)
+template <typename dtype>
+void neurons::AveragePooling_2d<dtype>::pooling_func(const dtype *input_data, dtype *output_data)
 {
-    const double *k_ch_start = input_data;
-    double *k_d_ch_start = diff_data;
-
-    double lowest = std::numeric_limits<double>::max() * (-1);
+    // Nothing is kept for back propagation of averages
+    this->inference_func(input_data, output_data);
+}
 
-    lint in_r_size = in_cols * chls;
+template <typename dtype>
+void neurons::AveragePooling_2d<dtype>::inference_func(const dtype *input_data, dtype *output_data) const
+{
+    lint k_rows = this->m_kernel_sh[1];
+    lint k_cols = this->m_kernel_sh[2];
+    lint chls = this->m_input_sh[3];
+    lint in_r_size = this->m_input_sh[2] * chls;
+    dtype area = static_cast<dtype>(k_rows * k_cols);
 
-    for (lint ch = 0; ch < chls; ++ch)
+    this->for_each_window([&](lint window_offset, lint output_offset)
     {
-        double max = lowest;
-        lint argmax_r = 0, argmax_c = 0;
-
-        const double *k_r_start = k_ch_start;
+        dtype *mean = output_data + output_offset;
+        std::fill(mean, mean + chls, static_cast<dtype>(0));
 
         for (lint k_r = 0; k_r < k_rows; ++k_r)
         {
-            const double *k_c_start = k_r_start;
-
+            const dtype *ele = input_data + window_offset + k_r * in_r_size;
             for (lint k_c = 0; k_c < k_cols; ++k_c)
             {
-                // std::cout << *k_c_start << "  ";
-                if (*k_c_start > max)
+                for (lint ch = 0; ch < chls; ++ch)
                 {
-                    max = *k_c_start;
-                    argmax_r = k_r;
-                    argmax_c = k_c;
+                    mean[ch] += ele[ch];
                 }
-                k_c_start += chls;
+                ele += chls;
             }
-
-            k_r_start += in_r_size;
         }
 
-        // std::cout << max << '\n';
-        output_data[ch] = max;
-        *(k_d_ch_start + argmax_r * in_r_size + argmax_c * chls) = 1;
-
-        ++k_ch_start;
-        ++k_d_ch_start;
-    }
+        for (lint ch = 0; ch < chls; ++ch)
+        {
+            mean[ch] /= area;
+        }
+    });
 }
 
-void neurons::MaxPooling_2d::back_propagate_func(
-    const double * diff_y_to_x_data,
-    const double * diff_E_to_y_data,
-    double * diff_E_to_x_data,
-    lint in_cols, lint chls, lint k_cols, lint k_rows) const
+template <typename dtype>
+void neurons::AveragePooling_2d<dtype>::back_propagate_func(const dtype *diff_E_to_y_data, dtype *diff_E_to_x_data) const
 {
-    const double *d_y_to_x_ch_start = diff_y_to_x_data;
-    double *d_E_to_x_ch_start = diff_E_to_x_data;
-
-    lint in_r_size = in_cols * chls;
+    lint k_rows = this->m_kernel_sh[1];
+    lint k_cols = this->m_kernel_sh[2];
+    lint chls = this->m_input_sh[3];
+    lint in_r_size = this->m_input_sh[2] * chls;
+    dtype area = static_cast<dtype>(k_rows * k_cols);
 
-    for (lint ch = 0; ch < chls; ++ch)
+    this->for_each_window([&](lint window_offset, lint output_offset)
     {
-        const double *k_r_y_to_x_start = d_y_to_x_ch_start;
-        double *k_r_E_to_x_start = d_E_to_x_ch_start;
+        const dtype *diff_E_to_y = diff_E_to_y_data + output_offset;
 
         for (lint k_r = 0; k_r < k_rows; ++k_r)
         {
-            const double *k_c_y_to_x_start = k_r_y_to_x_start;
-            double *k_c_E_to_x_start = k_r_E_to_x_start;
-
+            dtype *diff_E_to_x = diff_E_to_x_data + window_offset + k_r * in_r_size;
             for (lint k_c = 0; k_c < k_cols; ++k_c)
             {
-                /*
-                if (0 != *k_c_y_to_x_start)
-                {
-                    *k_c_E_to_x_start = diff_E_to_y_data[ch];
-                }
-                else
+                for (lint ch = 0; ch < chls; ++ch)
                 {
-                    *k_c_E_to_x_start = 0;
+                    diff_E_to_x[ch] += diff_E_to_y[ch] / area;
                 }
-                */
-
-                *k_c_E_to_x_start = *k_c_y_to_x_start * diff_E_to_y_data[ch];
-                
-                k_c_y_to_x_start += chls;
-                k_c_E_to_x_start += chls;
+                diff_E_to_x += chls;
             }
-
-            k_r_y_to_x_start += in_r_size;
-            k_r_E_to_x_start += in_r_size;
         }
+    });
+}
 
-        ++d_y_to_x_ch_start;
-        ++d_E_to_x_ch_start;
+template <typename dtype>
+std::unique_ptr<neurons::Pooling_2d<dtype>> neurons::make_pooling_2d(
+    Pooling_type type, const Shape &input_sh, const Shape &kernel_sh, lint stride_rows, lint stride_cols)
+{
+    switch (type)
+    {
+    case Pooling_type::max:
+        return std::make_unique<MaxPooling_2d<dtype>>(input_sh, kernel_sh, stride_rows, stride_cols);
+    case Pooling_type::average:
+        return std::make_unique<AveragePooling_2d<dtype>>(input_sh, kernel_sh, stride_rows, stride_cols);
+    default:
+        throw std::invalid_argument(std::string("neurons::make_pooling_2d: unknown type of pooling"));
     }
 }
 
 
 
-neurons::Pooling_layer::Pooling_layer()
+template <typename dtype>
+const std::string neurons::Pooling_layer<dtype>::POOLING{ "POOLING" };
+
+template <typename dtype>
+neurons::Pooling_layer<dtype>::Pooling_layer()
+    : m_type{ Pooling_type::max }, m_stride_rows{ 0 }, m_stride_cols{ 0 }
 {}
 
-neurons::Pooling_layer::Pooling_layer(const Shape & input_sh, const Shape & kernel_sh, lint threads)
-    : m_input_sh{ input_sh }, m_kernel_sh{ kernel_sh }, m_ops{ static_cast<size_t>(threads) }
+template <typename dtype>
+neurons::Pooling_layer<dtype>::Pooling_layer(const Shape & input_sh, const Shape & kernel_sh, lint threads,
+    Pooling_type type, lint stride_rows, lint stride_cols)
+    :
+    m_input_sh{ input_sh },
+    m_kernel_sh{ kernel_sh },
+    m_type{ type },
+    m_stride_rows{ stride_rows },
+    m_stride_cols{ stride_cols },
+    m_ops{ static_cast<size_t>(threads) }
 {
     for (lint i = 0; i < threads; ++i)
     {
-        this->m_ops[i] = std::make_shared<Pooling_layer_op>(input_sh, kernel_sh);
+        this->m_ops[i] = std::make_shared<Pooling_layer_op<dtype>>(input_sh, kernel_sh, type, stride_rows, stride_cols);
     }
 }
 
-std::vector<std::shared_ptr<neurons::Pooling_layer_op>>& neurons::Pooling_layer::operation_instances() const
+template <typename dtype>
+neurons::Pooling_layer<dtype>::Pooling_layer(const Shape & input_sh, Pooling_type type, lint threads)
+    : Pooling_layer(input_sh, Shape{ 1, input_sh[1], input_sh[2], input_sh[3] }, threads, type)
+{}
+
+template <typename dtype>
+std::vector<std::shared_ptr<neurons::Pooling_layer_op<dtype>>>& neurons::Pooling_layer<dtype>::operation_instances() const
 {
     return this->m_ops;
 }
 
-neurons::Shape neurons::Pooling_layer::output_shape() const
+template <typename dtype>
+neurons::Shape neurons::Pooling_layer<dtype>::output_shape() const
 {
     if (this->m_ops.empty())
     {
-        return MaxPooling_2d{ this->m_input_sh, this->m_kernel_sh }.get_output_shape();
+        return make_pooling_2d<dtype>(
+            this->m_type, this->m_input_sh, this->m_kernel_sh, this->m_stride_rows, this->m_stride_cols)->get_output_shape();
     }
     else
     {
@@ -317,56 +340,121 @@ neurons::Shape neurons::Pooling_layer::output_shape() const
     }
 }
 
+template <typename dtype>
+std::unique_ptr<neurons::Pooling_2d<dtype>> neurons::Pooling_layer<dtype>::pooling_2d() const
+{
+    return neurons::make_pooling_2d<dtype>(
+        this->m_type, this->m_input_sh, this->m_kernel_sh, this->m_stride_rows, this->m_stride_cols);
+}
+
+template <typename dtype>
+neurons::Model_layer neurons::Pooling_layer<dtype>::to_model_layer() const
+{
+    Model_layer layer;
+    layer.m_type = POOLING;
+    layer.m_params = {
+        static_cast<lint>(this->m_type), this->m_kernel_sh[1], this->m_kernel_sh[2], this->m_stride_rows, this->m_stride_cols };
 
-neurons::Pooling_layer_op::Pooling_layer_op()
+    return layer;
+}
+
+template <typename dtype>
+neurons::Pooling_layer<dtype> neurons::Pooling_layer<dtype>::from_model_layer(
+    const Model_layer & layer, const Shape & input_sh, lint threads)
+{
+    if (POOLING != layer.m_type || 5 != layer.m_params.size() ||
+        (static_cast<lint>(Pooling_type::max) != layer.m_params[0] && static_cast<lint>(Pooling_type::average) != layer.m_params[0]))
+    {
+        throw std::invalid_argument(std::string("neurons::Pooling_layer::from_model_layer: not a pooling layer: ") + layer.m_type);
+    }
+
+    // Kernels cover all channels of the input
+    return Pooling_layer{
+        input_sh,
+        Shape{ 1, layer.m_params[1], layer.m_params[2], input_sh[input_sh.dim() - 1] },
+        threads,
+        static_cast<Pooling_type>(layer.m_params[0]),
+        layer.m_params[3],
+        layer.m_params[4] };
+}
+
+
+template <typename dtype>
+neurons::Pooling_layer_op<dtype>::Pooling_layer_op()
+    : m_type{ Pooling_type::max }, m_stride_rows{ 0 }, m_stride_cols{ 0 }, m_samples{ 0 }
 {}
 
-neurons::Pooling_layer_op::Pooling_layer_op(const Shape & input_sh, const Shape & kernel_sh)
-    : m_input_sh{ input_sh }, m_kernel_sh{ kernel_sh }
+template <typename dtype>
+neurons::Pooling_layer_op<dtype>::Pooling_layer_op(const Shape & input_sh, const Shape & kernel_sh,
+    Pooling_type type, lint stride_rows, lint stride_cols)
+    :
+    m_input_sh{ input_sh },
+    m_kernel_sh{ kernel_sh },
+    m_type{ type },
+    m_stride_rows{ stride_rows },
+    m_stride_cols{ stride_cols },
+    m_samples{ 0 }
 {}
 
-std::vector<neurons::TMatrix<>> neurons::Pooling_layer_op::forward_propagate(const std::vector<TMatrix<>>& inputs)
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> neurons::Pooling_layer_op<dtype>::forward_propagate(const std::vector<TMatrix<dtype>>& inputs)
 {
-    size_t samples = inputs.size();
-    // this->m_pools.resize(samples);
-    this->m_pools.clear();
+    this->m_samples = inputs.size();
+    while (this->m_pools.size() < this->m_samples)
+    {
+        this->m_pools.push_back(make_pooling_2d<dtype>(
+            this->m_type, this->m_input_sh, this->m_kernel_sh, this->m_stride_rows, this->m_stride_cols));
+    }
 
-    std::vector<TMatrix<>> output{ samples };
+    std::vector<TMatrix<dtype>> output{ this->m_samples };
 
-    for (size_t i = 0; i < samples; ++i)
+    for (size_t i = 0; i < this->m_samples; ++i)
     {
-        this->m_pools.push_back(MaxPooling_2d{ this->m_input_sh, this->m_kernel_sh });
-        
         // Get output of pooling and feed it to nn layer
-        output[i] = this->m_pools[i](inputs[i]);
-        // std::cout << inputs[i];
+        output[i] = (*this->m_pools[i])(inputs[i]);
     }
 
     return output;
 }
 
-std::vector<neurons::TMatrix<>> neurons::Pooling_layer_op::back_propagate(const std::vector<TMatrix<>>& E_to_y_diffs)
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> neurons::Pooling_layer_op<dtype>::back_propagate(const std::vector<TMatrix<dtype>>& E_to_y_diffs)
 {
-    size_t samples = this->m_pools.size();
-    std::vector<TMatrix<>> E_to_x_diffs{ samples };
+    std::vector<TMatrix<dtype>> E_to_x_diffs{ this->m_samples };
 
-    for (size_t i = 0; i < samples; ++i)
+    for (size_t i = 0; i < this->m_samples; ++i)
     {
-        E_to_x_diffs[i] = this->m_pools[i].back_propagate(E_to_y_diffs[i]);
+        E_to_x_diffs[i] = this->m_pools[i]->back_propagate(E_to_y_diffs[i]);
     }
 
     return E_to_x_diffs;
 }
 
-neurons::Shape neurons::Pooling_layer_op::output_shape() const
+template <typename dtype>
+neurons::Shape neurons::Pooling_layer_op<dtype>::output_shape() const
 {
     if (this->m_pools.empty())
     {
-        return MaxPooling_2d{ this->m_input_sh, this->m_kernel_sh }.get_output_shape();
+        return make_pooling_2d<dtype>(
+            this->m_type, this->m_input_sh, this->m_kernel_sh, this->m_stride_rows, this->m_stride_cols)->get_output_shape();
     }
     else
     {
-        return this->m_pools[0].get_output_shape();
+        return this->m_pools[0]->get_output_shape();
     }
 }
 
+template class neurons::Pooling_2d<float>;
+template class neurons::Pooling_2d<double>;
+template class neurons::MaxPooling_2d<float>;
+template class neurons::MaxPooling_2d<double>;
+template class neurons::AveragePooling_2d<float>;
+template class neurons::AveragePooling_2d<double>;
+template std::unique_ptr<neurons::Pooling_2d<float>> neurons::make_pooling_2d<float>(
+    Pooling_type type, const Shape &input_sh, const Shape &kernel_sh, lint stride_rows, lint stride_cols);
+template std::unique_ptr<neurons::Pooling_2d<double>> neurons::make_pooling_2d<double>(
+    Pooling_type type, const Shape &input_sh, const Shape &kernel_sh, lint stride_rows, lint stride_cols);
+template class neurons::Pooling_layer<float>;
+template class neurons::Pooling_layer<double>;
+template class neurons::Pooling_layer_op<float>;
+template class neurons::Pooling_layer_op<double>;
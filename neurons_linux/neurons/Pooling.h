@@ -1,8 +1,25 @@
 #pragma once
 #include "TMatrix.h"
+#include "Model_file.h"
+#include <cstdint>
 
 namespace neurons
 {
+    enum class Pooling_type
+    {
+        // The largest element of each window
+        max,
+        // The mean of each window
+        average
+    };
+
+    /*
+    Pooling of matrices of dtype, instantiated for float and double.
+    Inputs are of shape [batch, rows, cols, channels], kernels are of shape [1, rows, cols, channels].
+    Windows move by stride_rows and stride_cols, which are the kernel size by default
+    (non-overlapping windows). Windows which would go past the input are not pooled.
+    */
+    template <typename dtype = double>
     class Pooling_2d
     {
     protected:
@@ -10,78 +27,188 @@ namespace neurons
         Shape m_kernel_sh;
         Shape m_output_sh;
 
-        mutable TMatrix<> m_diff_y_to_x;
+        lint m_stride_rows;
+        lint m_stride_cols;
 
     public:
         Pooling_2d() {}
-        Pooling_2d(const Shape &input_sh, const Shape &kernel_sh);
+        Pooling_2d(const Shape &input_sh, const Shape &kernel_sh, lint stride_rows = 0, lint stride_cols = 0);
+
+        virtual ~Pooling_2d() {}
 
         Shape get_output_shape() const;
 
-        virtual std::unique_ptr<Pooling_2d> clone() = 0;
+        virtual std::unique_ptr<Pooling_2d<dtype>> clone() = 0;
 
-        TMatrix<> operator () (const TMatrix<> & in);
+        TMatrix<dtype> operator () (const TMatrix<dtype> & in);
 
-        TMatrix<> back_propagate(const TMatrix<> & diff_E_to_output) const;
+        // Pooling of inference: the input of the input shape is pooled into output, a buffer of the caller
+        // of as many elements as the output shape. Nothing is kept for back propagation, so a single
+        // instance may serve many threads at the same time.
+        void infer(const dtype *input_data, dtype *output_data) const;
+
+        TMatrix<dtype> back_propagate(const TMatrix<dtype> & diff_E_to_output) const;
+
+    protected:
+        // Call func(window_offset, output_offset) for each window: window_offset is the offset of the
+        // first element of the window in the input, output_offset the offset of its channels in the output.
+        template <typename Func>
+        void for_each_window(Func func) const
+        {
+            lint batch_size = this->m_input_sh[0];
+            lint in_cols = this->m_input_sh[2];
+            lint chls = this->m_input_sh[3];
+            lint o_rows = this->m_output_sh[1];
+            lint o_cols = this->m_output_sh[2];
+
+            lint in_size = this->m_input_sh.size() / batch_size;
+            lint in_r_stride_size = in_cols * chls * this->m_stride_rows;
+            lint in_c_stride_size = chls * this->m_stride_cols;
+
+            lint output_offset = 0;
+            for (lint i = 0; i < batch_size; ++i)
+            {
+                for (lint o_r = 0; o_r < o_rows; ++o_r)
+                {
+                    lint window_offset = i * in_size + o_r * in_r_stride_size;
+                    for (lint o_c = 0; o_c < o_cols; ++o_c)
+                    {
+                        func(window_offset, output_offset);
+
+                        window_offset += in_c_stride_size;
+                        output_offset += chls;
+                    }
+                }
+            }
+        }
 
     private:
-        virtual void pooling_func(const double *input_data, double *diff_data,
-            double *output_data, lint in_cols, lint chls, lint k_cols, lint k_rows) = 0;
+        // Pool all windows of the input into the output
+        virtual void pooling_func(const dtype *input_data, dtype *output_data) = 0;
+
+        // Pool all windows of the input into the output without keeping anything
+        virtual void inference_func(const dtype *input_data, dtype *output_data) const = 0;
 
-        virtual void back_propagate_func(const double *diff_y_to_x_data, const double *diff_E_to_y_data,
-            double *diff_E_to_x_data, lint in_cols, lint chls, lint k_cols, lint k_rows) const = 0;
+        // Add derivatives of the input of all windows to diff_E_to_x_data, which is zero-filled
+        virtual void back_propagate_func(const dtype *diff_E_to_y_data, dtype *diff_E_to_x_data) const = 0;
     };
 
 
-    class MaxPooling_2d : public Pooling_2d
+    /*
+    Max pooling keeps the offset in the input of the largest element of each window and channel
+    (an int32 per output element), back propagation scatters derivatives of the output to them.
+    */
+    template <typename dtype = double>
+    class MaxPooling_2d : public Pooling_2d<dtype>
     {
+    private:
+        std::vector<std::int32_t> m_argmax;
+
     public:
         MaxPooling_2d() {}
-        MaxPooling_2d(const Shape &input_sh, const Shape &kernel_sh);
+        MaxPooling_2d(const Shape &input_sh, const Shape &kernel_sh, lint stride_rows = 0, lint stride_cols = 0);
 
-        virtual std::unique_ptr<Pooling_2d> clone();
+        virtual std::unique_ptr<Pooling_2d<dtype>> clone();
 
     private:
-        virtual void pooling_func(const double *input_data, double *diff_data,
-            double *output_data, lint in_cols, lint chls, lint k_cols, lint k_rows);
+        virtual void pooling_func(const dtype *input_data, dtype *output_data);
+
+        virtual void inference_func(const dtype *input_data, dtype *output_data) const;
+
+        virtual void back_propagate_func(const dtype *diff_E_to_y_data, dtype *diff_E_to_x_data) const;
 
-        virtual void back_propagate_func(const double *diff_y_to_x_data, const double *diff_E_to_y_data,
-            double *diff_E_to_x_data, lint in_cols, lint chls, lint k_cols, lint k_rows) const;
+        // Largest elements of all windows, their offsets are written into argmax unless it is nullptr
+        void max_of_windows(const dtype *input_data, dtype *output_data, std::int32_t *argmax) const;
     };
 
+
+    // Average pooling, back propagation spreads derivatives of the output evenly over their windows
+    template <typename dtype = double>
+    class AveragePooling_2d : public Pooling_2d<dtype>
+    {
+    public:
+        AveragePooling_2d() {}
+        AveragePooling_2d(const Shape &input_sh, const Shape &kernel_sh, lint stride_rows = 0, lint stride_cols = 0);
+
+        virtual std::unique_ptr<Pooling_2d<dtype>> clone();
+
+    private:
+        virtual void pooling_func(const dtype *input_data, dtype *output_data);
+
+        virtual void inference_func(const dtype *input_data, dtype *output_data) const;
+
+        virtual void back_propagate_func(const dtype *diff_E_to_y_data, dtype *diff_E_to_x_data) const;
+    };
+
+    // Pooling of a type
+    template <typename dtype>
+    std::unique_ptr<Pooling_2d<dtype>> make_pooling_2d(
+        Pooling_type type, const Shape &input_sh, const Shape &kernel_sh, lint stride_rows = 0, lint stride_cols = 0);
+
+    template <typename dtype>
     class Pooling_layer_op;
+
+    template <typename dtype = double>
     class Pooling_layer
     {
+    public:
+        static const std::string POOLING;
+
     private:
         Shape m_input_sh;
         Shape m_kernel_sh;
+        Pooling_type m_type;
+        lint m_stride_rows;
+        lint m_stride_cols;
+
+        mutable std::vector<std::shared_ptr<Pooling_layer_op<dtype>>> m_ops;
 
-        mutable std::vector<std::shared_ptr<Pooling_layer_op>> m_ops;
-    
     public:
         Pooling_layer();
-        Pooling_layer(const Shape &input_sh, const Shape &kernel_sh, lint threads);
+        Pooling_layer(const Shape &input_sh, const Shape &kernel_sh, lint threads,
+            Pooling_type type = Pooling_type::max, lint stride_rows = 0, lint stride_cols = 0);
+
+        // Global pooling: one window covers all rows and columns of each channel,
+        // the output is of shape [batch, 1, 1, channels]
+        Pooling_layer(const Shape &input_sh, Pooling_type type, lint threads);
 
-        std::vector<std::shared_ptr<Pooling_layer_op>>& operation_instances() const;
+        std::vector<std::shared_ptr<Pooling_layer_op<dtype>>>& operation_instances() const;
 
         Shape output_shape() const;
+
+        // Pooling of a single input of the input shape, as the operations of this layer pool each sample
+        std::unique_ptr<Pooling_2d<dtype>> pooling_2d() const;
+
+        // A pooling layer of a model file has no tensors, its parameters are the type of pooling,
+        // rows and columns of the kernel and strides of rows and columns
+        Model_layer to_model_layer() const;
+
+        // The pooling layer of a model layer, which pools inputs of input_sh
+        static Pooling_layer from_model_layer(const Model_layer & layer, const Shape & input_sh, lint threads);
     };
 
+    template <typename dtype = double>
     class Pooling_layer_op
     {
     private:
         Shape m_input_sh;
         Shape m_kernel_sh;
+        Pooling_type m_type;
+        lint m_stride_rows;
+        lint m_stride_cols;
 
-        std::vector<MaxPooling_2d> m_pools;
+        // Pools of the samples of the last batch, they are kept for following batches
+        std::vector<std::unique_ptr<Pooling_2d<dtype>>> m_pools;
+        size_t m_samples;
 
     public:
         Pooling_layer_op();
-        Pooling_layer_op(const Shape &input_sh, const Shape &kernel_sh);
+        Pooling_layer_op(const Shape &input_sh, const Shape &kernel_sh,
+            Pooling_type type = Pooling_type::max, lint stride_rows = 0, lint stride_cols = 0);
 
-        std::vector<TMatrix<>> forward_propagate(const std::vector<TMatrix<>> &inputs);
+        std::vector<TMatrix<dtype>> forward_propagate(const std::vector<TMatrix<dtype>> &inputs);
 
-        virtual std::vector<TMatrix<>> back_propagate(const std::vector<TMatrix<>> & E_to_y_diffs);
+        virtual std::vector<TMatrix<dtype>> back_propagate(const std::vector<TMatrix<dtype>> & E_to_y_diffs);
 
         Shape output_shape() const;
     };
@@ -0,0 +1,229 @@
+#pragma once
+#include "Shape.h"
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace neurons
+{
+    /*
+    A bounded producer / consumer stage preparing batches ahead of their use.
+
+    Preparing a batch is split into two steps:
+    plan(batch) is called for one batch at a time in the order of batches, so it can draw random
+    numbers or advance a sampler; fill(batch) does the heavy work (such as converting and normalizing
+    samples) and runs on several workers at the same time.
+
+    There are (depth + 1) batch slots: while the consumer works on one batch, workers fill up to
+    depth batches ahead and then wait for the consumer to release a slot (backpressure).
+    Slots are reused, so memory of batches is allocated only for the first few of them.
+    With no workers, batches are prepared on the consumer thread when they are asked for.
+    */
+    template <typename Batch>
+    class Prefetch_pipeline
+    {
+    private:
+        enum class Slot_state
+        {
+            free,
+            filling,
+            ready,
+            in_use
+        };
+
+        struct Slot
+        {
+            Batch m_batch;
+            Slot_state m_state;
+            std::exception_ptr m_error;
+        };
+
+        std::function<void(Batch &)> m_plan;
+        std::function<void(Batch &)> m_fill;
+
+        std::vector<Slot> m_slots;
+        std::vector<std::thread> m_workers;
+
+        // Total number of batches to prepare
+        lint m_batches;
+        // Number of batches planned by workers
+        lint m_planned;
+        // Number of batches handed to the consumer
+        lint m_consumed;
+        bool m_stop;
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+
+    public:
+        Prefetch_pipeline(
+            lint workers,
+            lint depth,
+            lint batches,
+            std::function<void(Batch &)> plan,
+            std::function<void(Batch &)> fill);
+
+        ~Prefetch_pipeline();
+
+        Prefetch_pipeline(const Prefetch_pipeline & other) = delete;
+        Prefetch_pipeline(Prefetch_pipeline && other) = delete;
+        Prefetch_pipeline & operator = (const Prefetch_pipeline & other) = delete;
+        Prefetch_pipeline & operator = (Prefetch_pipeline && other) = delete;
+
+    public:
+        // Get the next batch, waiting until it is ready. The batch stays valid until next() is called again.
+        // An exception thrown while the batch was prepared is rethrown here.
+        Batch & next();
+
+    private:
+        void worker_loop();
+    };
+}
+
+
+template <typename Batch>
+neurons::Prefetch_pipeline<Batch>::Prefetch_pipeline(
+    lint workers,
+    lint depth,
+    lint batches,
+    std::function<void(Batch &)> plan,
+    std::function<void(Batch &)> fill)
+    :
+    m_plan{ plan },
+    m_fill{ fill },
+    m_slots(workers > 0 ? (depth > 0 ? depth : 1) + 1 : 1),
+    m_batches{ batches },
+    m_planned{ 0 },
+    m_consumed{ 0 },
+    m_stop{ false }
+{
+    for (Slot & slot : this->m_slots)
+    {
+        slot.m_state = Slot_state::free;
+    }
+
+    for (lint i = 0; i < workers; ++i)
+    {
+        this->m_workers.push_back(std::thread{ &Prefetch_pipeline::worker_loop, this });
+    }
+}
+
+
+template <typename Batch>
+neurons::Prefetch_pipeline<Batch>::~Prefetch_pipeline()
+{
+    {
+        std::lock_guard<std::mutex> lock{ this->m_mutex };
+        this->m_stop = true;
+    }
+    this->m_cv.notify_all();
+
+    for (std::thread & worker : this->m_workers)
+    {
+        worker.join();
+    }
+}
+
+
+template <typename Batch>
+Batch & neurons::Prefetch_pipeline<Batch>::next()
+{
+    if (this->m_consumed >= this->m_batches)
+    {
+        throw std::invalid_argument(std::string("neurons::Prefetch_pipeline::next: all batches have been consumed."));
+    }
+
+    // Prepare the batch on this thread
+    if (this->m_workers.empty())
+    {
+        Batch & batch = this->m_slots[0].m_batch;
+        ++this->m_consumed;
+        this->m_plan(batch);
+        this->m_fill(batch);
+        return batch;
+    }
+
+    std::unique_lock<std::mutex> lock{ this->m_mutex };
+
+    // The previous batch is no longer used, its slot can be filled again
+    if (this->m_consumed > 0)
+    {
+        this->m_slots[(this->m_consumed - 1) % this->m_slots.size()].m_state = Slot_state::free;
+        this->m_cv.notify_all();
+    }
+
+    // Batches are planned in the order of slots, so the next batch is always in the next slot
+    Slot & slot = this->m_slots[this->m_consumed % this->m_slots.size()];
+    this->m_cv.wait(lock, [&slot] { return Slot_state::ready == slot.m_state; });
+
+    slot.m_state = Slot_state::in_use;
+    ++this->m_consumed;
+
+    if (slot.m_error)
+    {
+        std::exception_ptr error = slot.m_error;
+        slot.m_error = nullptr;
+        std::rethrow_exception(error);
+    }
+
+    return slot.m_batch;
+}
+
+
+template <typename Batch>
+void neurons::Prefetch_pipeline<Batch>::worker_loop()
+{
+    std::unique_lock<std::mutex> lock{ this->m_mutex };
+
+    while (true)
+    {
+        this->m_cv.wait(lock, [this]
+        {
+            return this->m_stop || (
+                this->m_planned < this->m_batches &&
+                Slot_state::free == this->m_slots[this->m_planned % this->m_slots.size()].m_state);
+        });
+
+        if (this->m_stop)
+        {
+            return;
+        }
+
+        Slot & slot = this->m_slots[this->m_planned % this->m_slots.size()];
+        slot.m_state = Slot_state::filling;
+        ++this->m_planned;
+
+        // Batches are planned one by one while holding the lock, so they are planned in order
+        try
+        {
+            this->m_plan(slot.m_batch);
+        }
+        catch (...)
+        {
+            slot.m_error = std::current_exception();
+        }
+
+        // Batches are filled at the same time
+        lock.unlock();
+        if (!slot.m_error)
+        {
+            try
+            {
+                this->m_fill(slot.m_batch);
+            }
+            catch (...)
+            {
+                slot.m_error = std::current_exception();
+            }
+        }
+        lock.lock();
+
+        slot.m_state = Slot_state::ready;
+        this->m_cv.notify_all();
+    }
+}
@@ -4,26 +4,27 @@
 #include <cstring>
 #include <algorithm>
 
+const lint neurons::Shape::INLINE_DIMS;
+
 neurons::Shape::Shape()
-    : m_dim{ 0 }, m_size{ 0 }, m_data{ nullptr }
+    : m_dim{ 0 }, m_size{ 0 }, m_data{ this->m_inline }
 {}
 
 neurons::Shape::Shape(std::initializer_list<lint> list)
-    : m_dim{ list.end() - list.begin() }, m_size{ 1 }
+    : m_dim{ 0 }, m_size{ 1 }, m_data{ this->m_inline }
 {
+    this->allocate(list.end() - list.begin());
     if (this->m_dim < 1)
     {
-        this->m_dim = 0;
         this->m_size = 0;
-        this->m_data = nullptr;
     }
 
-    this->m_data = new lint[this->m_dim];
     lint *p = this->m_data;
     for (auto itr = list.begin(); itr != list.end(); ++itr, ++p)
     {
         if (*itr <= 0)
         {
+            this->release();
             throw std::invalid_argument(invalid_shape_val);
         }
         *p = *itr;
@@ -36,21 +37,20 @@ neurons::Shape::Shape(std::initializer_list<lint> list)
 }
 
 neurons::Shape::Shape(std::vector<lint>& list)
-    : m_dim{ list.end() - list.begin() }, m_size{ 1 }
+    : m_dim{ 0 }, m_size{ 1 }, m_data{ this->m_inline }
 {
+    this->allocate(list.end() - list.begin());
     if (this->m_dim < 1)
     {
-        this->m_dim = 0;
         this->m_size = 0;
-        this->m_data = nullptr;
     }
 
-    this->m_data = new lint[this->m_dim];
     lint *p = this->m_data;
     for (auto itr = list.begin(); itr != list.end(); ++itr, ++p)
     {
         if (*itr <= 0)
         {
+            this->release();
             throw std::invalid_argument(invalid_shape_val);
         }
         *p = *itr;
@@ -63,50 +63,91 @@ neurons::Shape::Shape(std::vector<lint>& list)
 }
 
 neurons::Shape::Shape(const Shape & other)
-    : m_dim{ other.m_dim }, m_size(other.m_size)
+    : m_dim{ 0 }, m_size(other.m_size), m_data{ this->m_inline }
 {
-    this->m_data = new lint[this->m_dim];
+    this->allocate(other.m_dim);
 
     std::memcpy(this->m_data, other.m_data, this->m_dim * sizeof(lint));
 }
 
 neurons::Shape::Shape(Shape && other)
-    : m_dim{ other.m_dim }, m_size(other.m_size), m_data{ other.m_data }
+    : m_dim{ 0 }, m_size{ 0 }, m_data{ this->m_inline }
 {
-    other.m_dim = 0;
-    other.m_size = 0;
-    other.m_data = nullptr;
+    this->move_from(other);
 }
 
 neurons::Shape::~Shape()
 {
-    delete[]this->m_data;
+    this->release();
 }
 
 neurons::Shape & neurons::Shape::operator = (const Shape & other)
 {
-    delete[]m_data;
-    this->m_dim = other.m_dim;
-    this->m_size = other.m_size;
+    if (this == &other)
+    {
+        return *this;
+    }
 
-    this->m_data = new lint[m_dim];
-    std::memcpy(this->m_data, other.m_data, m_dim * sizeof(lint));
+    this->allocate(other.m_dim);
+    this->m_size = other.m_size;
+    std::memcpy(this->m_data, other.m_data, this->m_dim * sizeof(lint));
 
     return *this;
 }
 
 neurons::Shape & neurons::Shape::operator = (Shape && other)
 {
-    delete[]m_data;
+    if (this != &other)
+    {
+        this->move_from(other);
+    }
+
+    return *this;
+}
+
+void neurons::Shape::allocate(lint dim)
+{
+    dim = std::max<lint>(dim, 0);
+    if (dim <= INLINE_DIMS)
+    {
+        this->release();
+    }
+    else if (dim != this->m_dim)
+    {
+        this->release();
+        this->m_data = new lint[dim];
+    }
+    this->m_dim = dim;
+}
+
+void neurons::Shape::release()
+{
+    if (this->m_data != this->m_inline)
+    {
+        delete[]this->m_data;
+        this->m_data = this->m_inline;
+    }
+}
+
+void neurons::Shape::move_from(Shape & other)
+{
+    this->release();
     this->m_dim = other.m_dim;
     this->m_size = other.m_size;
-    this->m_data = other.m_data;
+
+    if (other.m_data == other.m_inline)
+    {
+        std::memcpy(this->m_inline, other.m_inline, other.m_dim * sizeof(lint));
+    }
+    else
+    {
+        // Heap storage changes hands
+        this->m_data = other.m_data;
+        other.m_data = other.m_inline;
+    }
 
     other.m_dim = 0;
     other.m_size = 0;
-    other.m_data = nullptr;
-
-    return *this;
 }
 
 lint neurons::Shape::operator [] (lint index) const
@@ -138,16 +179,12 @@ neurons::Shape & neurons::Shape::left_extend()
         throw std::bad_function_call();
     }
 
-    ++this->m_dim;
-    lint *new_data = new lint[this->m_dim];
-    *new_data = 1;
-
-    for (lint i = 1; i < this->m_dim; ++i)
-    {
-        new_data[i] = this->m_data[i - 1];
-    }
-    delete[]this->m_data;
-    this->m_data = new_data;
+    Shape extended;
+    extended.allocate(this->m_dim + 1);
+    extended.m_size = this->m_size;
+    extended.m_data[0] = 1;
+    std::memcpy(extended.m_data + 1, this->m_data, this->m_dim * sizeof(lint));
+    this->move_from(extended);
 
     return *this;
 }
@@ -159,16 +196,12 @@ neurons::Shape & neurons::Shape::right_extend()
         throw std::bad_function_call();
     }
 
-    ++this->m_dim;
-    lint *new_data = new lint[this->m_dim];
-
-    for (lint i = 0; i < this->m_dim - 1; ++i)
-    {
-        new_data[i] = this->m_data[i];
-    }
-    new_data[this->m_dim - 1] = 1;
-    delete[]this->m_data;
-    this->m_data = new_data;
+    Shape extended;
+    extended.allocate(this->m_dim + 1);
+    extended.m_size = this->m_size;
+    std::memcpy(extended.m_data, this->m_data, this->m_dim * sizeof(lint));
+    extended.m_data[this->m_dim] = 1;
+    this->move_from(extended);
 
     return *this;
 }
@@ -201,8 +234,7 @@ neurons::Shape neurons::Shape::sub_shape(lint dim_first, lint dim_last) const
         );
     }
 
-    sub_shape.m_dim = dim_last - dim_first + 1;
-    sub_shape.m_data = new lint[sub_shape.m_dim];
+    sub_shape.allocate(dim_last - dim_first + 1);
     sub_shape.m_size = 1;
 
     for (lint i = dim_first; i <= dim_last; ++i)
@@ -246,9 +278,8 @@ bool neurons::operator != (const Shape &left, const Shape &right)
 neurons::Shape neurons::operator + (const Shape & left, const Shape & right)
 {
     Shape merged;
-    merged.m_dim = left.m_dim + right.m_dim;
+    merged.allocate(left.m_dim + right.m_dim);
     merged.m_size = std::max<lint>(left.m_size, 1) * std::max<lint>(right.m_size, 1);
-    merged.m_data = new lint[merged.m_dim];
 
     for (lint i = 0; i < left.m_dim; ++i)
     {
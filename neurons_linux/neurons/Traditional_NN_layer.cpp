@@ -1,17 +1,21 @@
 #include "Traditional_NN_layer.h"
 
 
-neurons::Traditional_NN_layer::Traditional_NN_layer()
+template <typename dtype>
+neurons::Traditional_NN_layer<dtype>::Traditional_NN_layer()
 {}
 
-neurons::Traditional_NN_layer::Traditional_NN_layer(
-    double mmt_rate, lint threads, const TMatrix<>& w, const TMatrix<>& b,
-    std::unique_ptr<Activation>& act_func, std::unique_ptr<ErrorFunction>& err_func)
+template <typename dtype>
+neurons::Traditional_NN_layer<dtype>::Traditional_NN_layer(
+    double mmt_rate, lint threads, TMatrix<dtype> w, TMatrix<dtype> b,
+    std::unique_ptr<Activation<dtype>>& act_func, std::unique_ptr<ErrorFunction<dtype>>& err_func)
     :
-    NN_layer( threads ),
+    NN_layer<dtype>( threads ),
     m_mmt_rate{ mmt_rate },
-    m_w{ w }, m_b{ b },
-    m_w_mmt{ w.shape(), 0 }, m_b_mmt{ b.shape(), 0 },
+    m_w{ std::move(w) }, m_b{ std::move(b) },
+    // Layers of borrowed weights are not trained, momentum is allocated if they ever own their weights
+    m_w_mmt{ m_w.borrowed() ? TMatrix<dtype>{} : TMatrix<dtype>{ m_w.shape(), 0 } },
+    m_b_mmt{ m_b.borrowed() ? TMatrix<dtype>{} : TMatrix<dtype>{ m_b.shape(), 0 } },
     m_act_func{ std::move(act_func) },
     m_err_func{ std::move(err_func) }
 {
@@ -30,6 +34,7 @@ Structure of a neural network layer:
 
 <weight matrix data>
 <bias matrix data>
+(weights and bias are always stored in double, whatever precision the layer is trained in)
 
 <act function name len, 8 bit><act function name>
 
@@ -37,9 +42,10 @@ Structure of a neural network layer:
 >
 */
 
-std::string neurons::Traditional_NN_layer::from_binary_data(
-    char * binary_data, lint & data_size, TMatrix<> & w, TMatrix<> & b,
-    std::unique_ptr<Activation> & act_func, std::unique_ptr<ErrorFunction> & err_func,
+template <typename dtype>
+std::string neurons::Traditional_NN_layer<dtype>::from_binary_data(
+    char * binary_data, lint & data_size, TMatrix<dtype> & w, TMatrix<dtype> & b,
+    std::unique_ptr<Activation<dtype>> & act_func, std::unique_ptr<ErrorFunction<dtype>> & err_func,
     char *& residual_data, lint & residual_len
 )
 {
@@ -58,14 +64,14 @@ std::string neurons::Traditional_NN_layer::from_binary_data(
     // Get weight matrix from binary data
     position += len;
     lint w_size;
-    w = TMatrix<>{ position, w_size };
+    w = TMatrix<dtype>{ TMatrix<>{ position, w_size } };
 
     real_size += w_size;
 
     // Get bias matrix from binary data
     position += w_size;
     lint b_size;
-    b = TMatrix<>{ position, b_size };
+    b = TMatrix<dtype>{ TMatrix<>{ position, b_size } };
 
     real_size += b_size;
 
@@ -75,7 +81,7 @@ std::string neurons::Traditional_NN_layer::from_binary_data(
 
     position += sizeof(uint8_t);
     std::string act_name{ position, len };
-    act_func = Activation::get_function_by_name(act_name);
+    act_func = Activation<dtype>::get_function_by_name(act_name);
 
     real_size += sizeof(uint8_t) + len;
     
@@ -85,7 +91,7 @@ std::string neurons::Traditional_NN_layer::from_binary_data(
 
     position += sizeof(uint8_t);
     std::string err_name{ position, len };
-    err_func = ErrorFunction::get_function_by_name(err_name);
+    err_func = ErrorFunction<dtype>::get_function_by_name(err_name);
 
     real_size += sizeof(uint8_t) + len;
 
@@ -98,16 +104,38 @@ std::string neurons::Traditional_NN_layer::from_binary_data(
     return nn_type;
 }
 
+template <typename dtype>
+std::string neurons::Traditional_NN_layer<dtype>::from_model_layer(
+    const Model_layer & layer, bool borrow, TMatrix<dtype> & w, TMatrix<dtype> & b,
+    std::unique_ptr<Activation<dtype>> & act_func, std::unique_ptr<ErrorFunction<dtype>> & err_func)
+{
+    if (layer.m_tensors.size() < 2)
+    {
+        throw std::invalid_argument(
+            std::string("neurons::Traditional_NN_layer::from_model_layer: weights or bias missing in a layer of ") + layer.m_type);
+    }
+
+    w = tensor_to_matrix<dtype>(layer.m_tensors[0], borrow);
+    b = tensor_to_matrix<dtype>(layer.m_tensors[1], borrow);
+
+    std::string err_name = layer.m_err_func;
+    act_func = Activation<dtype>::get_function_by_name(layer.m_act_func);
+    err_func = ErrorFunction<dtype>::get_function_by_name(err_name);
+
+    return layer.m_type;
+}
+
 
-neurons::Traditional_NN_layer::Traditional_NN_layer(
+template <typename dtype>
+neurons::Traditional_NN_layer<dtype>::Traditional_NN_layer(
     double mmt_rate,
     const Shape & w_sh,
     const Shape & b_sh,
     lint threads,
-    Activation *act_func,
-    ErrorFunction *err_func)
+    Activation<dtype> *act_func,
+    ErrorFunction<dtype> *err_func)
     :
-    NN_layer( threads ),
+    NN_layer<dtype>( threads ),
     m_mmt_rate{ mmt_rate },
     m_w{ w_sh },
     m_b{ b_sh },
@@ -122,9 +150,10 @@ neurons::Traditional_NN_layer::Traditional_NN_layer(
     }
 }
 
-neurons::Traditional_NN_layer::Traditional_NN_layer(const Traditional_NN_layer & other)
+template <typename dtype>
+neurons::Traditional_NN_layer<dtype>::Traditional_NN_layer(const Traditional_NN_layer & other)
     : 
-    NN_layer(other),
+    NN_layer<dtype>(other),
     m_mmt_rate(other.m_mmt_rate),
     m_w{ other.m_w }, m_b{ other.m_b },
     m_w_mmt{ other.m_w_mmt },
@@ -133,9 +162,10 @@ neurons::Traditional_NN_layer::Traditional_NN_layer(const Traditional_NN_layer &
     m_err_func{ other.m_err_func ? other.m_err_func->clone() : nullptr }
 {}
 
-neurons::Traditional_NN_layer::Traditional_NN_layer(Traditional_NN_layer && other)
+template <typename dtype>
+neurons::Traditional_NN_layer<dtype>::Traditional_NN_layer(Traditional_NN_layer && other)
     : 
-    NN_layer(other),
+    NN_layer<dtype>(other),
     m_mmt_rate(other.m_mmt_rate),
     m_w{ std::move(other.m_w) }, m_b{ std::move(other.m_b) },
     m_w_mmt{ std::move(other.m_w_mmt) },
@@ -144,9 +174,10 @@ neurons::Traditional_NN_layer::Traditional_NN_layer(Traditional_NN_layer && othe
     m_err_func{ std::move(other.m_err_func) }
 {}
 
-neurons::Traditional_NN_layer & neurons::Traditional_NN_layer::operator = (const Traditional_NN_layer & other)
+template <typename dtype>
+neurons::Traditional_NN_layer<dtype> & neurons::Traditional_NN_layer<dtype>::operator = (const Traditional_NN_layer & other)
 {
-    NN_layer::operator=(other);
+    NN_layer<dtype>::operator=(other);
     this->m_mmt_rate = other.m_mmt_rate;
     this->m_w = other.m_w;
     this->m_b = other.m_b;
@@ -159,63 +190,136 @@ neurons::Traditional_NN_layer & neurons::Traditional_NN_layer::operator = (const
 }
 
 
-neurons::Traditional_NN_layer & neurons::Traditional_NN_layer::operator = (Traditional_NN_layer && other)
+template <typename dtype>
+neurons::Traditional_NN_layer<dtype> & neurons::Traditional_NN_layer<dtype>::operator = (Traditional_NN_layer && other)
 {
-    NN_layer::operator=(other);
+    NN_layer<dtype>::operator=(other);
     this->m_mmt_rate = other.m_mmt_rate;
     this->m_w = std::move(other.m_w);
     this->m_b = std::move(other.m_b);
     this->m_w_mmt = std::move(other.m_w_mmt);
-    this->m_b_mmt = std::move(other.m_w_mmt);
+    this->m_b_mmt = std::move(other.m_b_mmt);
     this->m_act_func = std::move(other.m_act_func);
     this->m_err_func = std::move(other.m_err_func);
 
     return *this;
 }
 
-neurons::TMatrix<> neurons::Traditional_NN_layer::weights() const
+template <typename dtype>
+neurons::TMatrix<dtype> neurons::Traditional_NN_layer<dtype>::weights() const
 {
     return this->m_w;
 }
 
-neurons::TMatrix<> neurons::Traditional_NN_layer::bias() const
+template <typename dtype>
+neurons::TMatrix<dtype> neurons::Traditional_NN_layer<dtype>::bias() const
 {
     return this->m_b;
 }
 
-double neurons::Traditional_NN_layer::commit_training()
+template <typename dtype>
+double neurons::Traditional_NN_layer<dtype>::commit_training()
 {
-    TMatrix<> w_gradient_sum{ this->m_w.shape(), 0 };
-    TMatrix<> b_gradient_sum{ this->m_b.shape(), 0 };
+    std::vector<TMatrix<dtype> *> w_gradients{ this->m_ops.size() };
+    std::vector<TMatrix<dtype> *> b_gradients{ this->m_ops.size() };
     double loss = 0;
 
     for (size_t i = 0; i < this->m_ops.size(); ++i)
     {
-        auto op = dynamic_cast<Traditional_NN_layer_op*>(this->m_ops[i].get());
+        auto op = dynamic_cast<Traditional_NN_layer_op<dtype>*>(this->m_ops[i].get());
 
-        w_gradient_sum += op->get_weight_gradient();
-        b_gradient_sum += op->get_bias_gradient();
+        w_gradients[i] = &op->get_weight_gradient();
+        b_gradients[i] = &op->get_bias_gradient();
 
         loss += this->m_ops[i]->get_loss();
         this->m_ops[i]->clear_loss();
     }
 
-    this->m_w_mmt = this->m_mmt_rate * this->m_w_mmt + (1 - this->m_mmt_rate) * w_gradient_sum;
-    this->m_b_mmt = this->m_mmt_rate * this->m_b_mmt + (1 - this->m_mmt_rate) * b_gradient_sum;
-
-    this->m_w -= this->m_w_mmt;
-    this->m_b -= this->m_b_mmt;
+    if (this->m_w.borrowed() || this->m_b.borrowed())
+    {
+        throw std::invalid_argument(
+            std::string("neurons::Traditional_NN_layer::commit_training: weights are borrowed read-only from a model file"));
+    }
 
-    for (size_t i = 0; i < this->m_ops.size(); ++i)
+    if (this->m_w_mmt.shape() != this->m_w.shape() || this->m_b_mmt.shape() != this->m_b.shape())
     {
-        auto op = dynamic_cast<Traditional_NN_layer_op*>(this->m_ops[i].get());
-        op->update_w_and_b(this->m_w, this->m_b);
+        this->m_w_mmt = TMatrix<dtype>{ this->m_w.shape(), 0 };
+        this->m_b_mmt = TMatrix<dtype>{ this->m_b.shape(), 0 };
     }
 
+    // Ops read m_w and m_b directly, so there is nothing to copy back to them
+    this->reduce_and_update(w_gradients, this->m_w_mmt, this->m_w);
+    this->reduce_and_update(b_gradients, this->m_b_mmt, this->m_b);
+
     return loss;
 }
 
-double neurons::Traditional_NN_layer::commit_testing()
+template <typename dtype>
+void neurons::Traditional_NN_layer<dtype>::reduce_and_update(
+    const std::vector<TMatrix<dtype> *> & gradients, TMatrix<dtype> & mmt, TMatrix<dtype> & param)
+{
+    const lint grain = 4096;
+
+    lint size = param.shape().size();
+    lint n_gradients = gradients.size();
+    double mmt_rate = this->m_mmt_rate;
+
+    auto reduce_chunk = [&gradients, &mmt, &param, n_gradients, mmt_rate](lint begin, lint end)
+    {
+        // Pairwise tree over gradients of this chunk: gradient[i] += gradient[i + step]
+        for (lint step = 1; step < n_gradients; step *= 2)
+        {
+            for (lint i = 0; i + step < n_gradients; i += 2 * step)
+            {
+                dtype *dst = gradients[i]->m_data;
+                const dtype *src = gradients[i + step]->m_data;
+
+                for (lint j = begin; j < end; ++j)
+                {
+                    dst[j] += src[j];
+                }
+            }
+        }
+
+        // Fused momentum and parameter update
+        const dtype *sum = n_gradients > 0 ? gradients[0]->m_data : nullptr;
+        dtype *mmt_data = mmt.m_data;
+        dtype *param_data = param.m_data;
+
+        for (lint j = begin; j < end; ++j)
+        {
+            mmt_data[j] = mmt_rate * mmt_data[j] + (1 - mmt_rate) * (sum ? sum[j] : 0);
+            param_data[j] -= mmt_data[j];
+        }
+    };
+
+    std::shared_ptr<Thread_pool> pool = Thread_pool::current();
+    if (pool && size > grain)
+    {
+        pool->parallel_for(0, size, reduce_chunk, grain);
+    }
+    else
+    {
+        reduce_chunk(0, size);
+    }
+}
+
+template <typename dtype>
+void neurons::Traditional_NN_layer<dtype>::share_w_and_b_with_ops()
+{
+    for (size_t i = 0; i < this->m_ops.size(); ++i)
+    {
+        auto op = dynamic_cast<Traditional_NN_layer_op<dtype>*>(this->m_ops[i].get());
+
+        if (op)
+        {
+            op->share_w_and_b(this->m_w, this->m_b);
+        }
+    }
+}
+
+template <typename dtype>
+double neurons::Traditional_NN_layer<dtype>::commit_testing()
 {
     double loss = 0;
 
@@ -244,11 +348,12 @@ Structure of a neural network layer:
     <error function name len, 8 bit><error function name>
 >
 */
-std::unique_ptr<char[]> neurons::Traditional_NN_layer::to_binary_data(lint & data_size) const
+template <typename dtype>
+std::unique_ptr<char[]> neurons::Traditional_NN_layer<dtype>::to_binary_data(lint & data_size) const
 {
     lint w_size, b_size;
-    auto w_data = this->m_w.to_binary_data(w_size);
-    auto b_data = this->m_b.to_binary_data(b_size);
+    auto w_data = TMatrix<>{ this->m_w }.to_binary_data(w_size);
+    auto b_data = TMatrix<>{ this->m_b }.to_binary_data(b_size);
 
     std::string nn_type = this->nn_type();
 
@@ -305,25 +410,62 @@ std::unique_ptr<char[]> neurons::Traditional_NN_layer::to_binary_data(lint & dat
     return std::unique_ptr<char[]>(layer_data);
 }
 
-neurons::Traditional_NN_layer_op::Traditional_NN_layer_op(
-    const TMatrix<> & w,
-    const TMatrix<> & b,
-    const std::unique_ptr<Activation> &act_func,
-    const std::unique_ptr<ErrorFunction> &err_func)
+template <typename dtype>
+neurons::Model_layer neurons::Traditional_NN_layer<dtype>::to_model_layer() const
+{
+    Model_layer layer;
+    layer.m_type = this->nn_type();
+    layer.m_act_func = this->m_act_func ? this->m_act_func->to_string() : "NULL";
+    layer.m_err_func = this->m_err_func ? this->m_err_func->to_string() : "NULL";
+    layer.m_tensors.push_back(matrix_to_tensor(this->m_w));
+    layer.m_tensors.push_back(matrix_to_tensor(this->m_b));
+
+    return layer;
+}
+
+template <typename dtype>
+void neurons::Traditional_NN_layer<dtype>::add_momentum(Model_layer & layer) const
+{
+    // Momentum is only allocated once the layer is trained
+    if (this->m_w_mmt.shape() == this->m_w.shape() && this->m_b_mmt.shape() == this->m_b.shape())
+    {
+        layer.m_tensors.push_back(matrix_to_tensor(this->m_w_mmt));
+        layer.m_tensors.push_back(matrix_to_tensor(this->m_b_mmt));
+    }
+}
+
+template <typename dtype>
+void neurons::Traditional_NN_layer<dtype>::restore_momentum(const Model_layer & layer)
+{
+    if (layer.m_tensors.size() >= 4 &&
+        layer.m_tensors[2].m_shape == this->m_w.shape() && layer.m_tensors[3].m_shape == this->m_b.shape())
+    {
+        this->m_w_mmt = tensor_to_matrix<dtype>(layer.m_tensors[2], false);
+        this->m_b_mmt = tensor_to_matrix<dtype>(layer.m_tensors[3], false);
+    }
+}
+
+template <typename dtype>
+neurons::Traditional_NN_layer_op<dtype>::Traditional_NN_layer_op(
+    const TMatrix<dtype> & w,
+    const TMatrix<dtype> & b,
+    const std::unique_ptr<Activation<dtype>> &act_func,
+    const std::unique_ptr<ErrorFunction<dtype>> &err_func)
     :
-    NN_layer_op(),
-    m_w{ w }, m_b{ b },
+    NN_layer_op<dtype>(),
+    m_w{ &w }, m_b{ &b },
     m_act_func{ act_func ? act_func->clone() : nullptr },
     m_err_func{ err_func ? err_func->clone() : nullptr },
-    m_w_gradient{ m_w.shape(), 0 },
-    m_b_gradient{ m_b.shape(), 0 }
+    m_w_gradient{ w.borrowed() ? TMatrix<dtype>{} : TMatrix<dtype>{ w.shape(), 0 } },
+    m_b_gradient{ b.borrowed() ? TMatrix<dtype>{} : TMatrix<dtype>{ b.shape(), 0 } }
 {
 }
 
 
-neurons::Traditional_NN_layer_op::Traditional_NN_layer_op(const Traditional_NN_layer_op & other)
+template <typename dtype>
+neurons::Traditional_NN_layer_op<dtype>::Traditional_NN_layer_op(const Traditional_NN_layer_op & other)
     :
-    NN_layer_op(other),
+    NN_layer_op<dtype>(other),
     m_w{ other.m_w },
     m_b{ other.m_b },
     m_act_func{ other.m_act_func ? other.m_act_func->clone() : nullptr },
@@ -334,11 +476,12 @@ neurons::Traditional_NN_layer_op::Traditional_NN_layer_op(const Traditional_NN_l
 {}
 
 
-neurons::Traditional_NN_layer_op::Traditional_NN_layer_op(Traditional_NN_layer_op && other)
+template <typename dtype>
+neurons::Traditional_NN_layer_op<dtype>::Traditional_NN_layer_op(Traditional_NN_layer_op && other)
     :
-    NN_layer_op(other),
-    m_w{ std::move(other.m_w) },
-    m_b{ std::move(other.m_b) },
+    NN_layer_op<dtype>(other),
+    m_w{ other.m_w },
+    m_b{ other.m_b },
     m_act_func{ std::move(other.m_act_func) },
     m_err_func{ std::move(other.m_err_func) },
     m_w_gradient{ std::move(other.m_w_gradient) },
@@ -347,9 +490,10 @@ neurons::Traditional_NN_layer_op::Traditional_NN_layer_op(Traditional_NN_layer_o
 {}
 
 
-neurons::Traditional_NN_layer_op & neurons::Traditional_NN_layer_op::operator = (const Traditional_NN_layer_op & other)
+template <typename dtype>
+neurons::Traditional_NN_layer_op<dtype> & neurons::Traditional_NN_layer_op<dtype>::operator = (const Traditional_NN_layer_op & other)
 {
-    NN_layer_op::operator=(other);
+    NN_layer_op<dtype>::operator=(other);
     this->m_w = other.m_w;
     this->m_b = other.m_b;
     this->m_act_func = other.m_act_func ? other.m_act_func->clone() : nullptr;
@@ -361,11 +505,12 @@ neurons::Traditional_NN_layer_op & neurons::Traditional_NN_layer_op::operator =
     return *this;
 }
 
-neurons::Traditional_NN_layer_op & neurons::Traditional_NN_layer_op::operator = (Traditional_NN_layer_op && other)
+template <typename dtype>
+neurons::Traditional_NN_layer_op<dtype> & neurons::Traditional_NN_layer_op<dtype>::operator = (Traditional_NN_layer_op && other)
 {
-    NN_layer_op::operator=(other);
-    this->m_w = std::move(other.m_w);
-    this->m_b = std::move(other.m_b);
+    NN_layer_op<dtype>::operator=(other);
+    this->m_w = other.m_w;
+    this->m_b = other.m_b;
     this->m_act_func = std::move(other.m_act_func);
     this->m_err_func = std::move(other.m_err_func);
     this->m_w_gradient = std::move(other.m_w_gradient);
@@ -375,48 +520,76 @@ neurons::Traditional_NN_layer_op & neurons::Traditional_NN_layer_op::operator =
     return *this;
 }
 
-neurons::TMatrix<> neurons::Traditional_NN_layer_op::forward_propagate(const TMatrix<> & input)
+template <typename dtype>
+neurons::TMatrix<dtype> neurons::Traditional_NN_layer_op<dtype>::forward_propagate(const TMatrix<dtype> & input)
 {
-    std::vector<TMatrix<>> inputs;
+    std::vector<TMatrix<dtype>> inputs;
     inputs.push_back(input);
 
     return this->batch_forward_propagate(inputs)[0];
 }
 
-neurons::TMatrix<> neurons::Traditional_NN_layer_op::forward_propagate(const TMatrix<> & input, const TMatrix<> & target)
+template <typename dtype>
+neurons::TMatrix<dtype> neurons::Traditional_NN_layer_op<dtype>::forward_propagate(const TMatrix<dtype> & input, const TMatrix<dtype> & target)
 {
-    std::vector<TMatrix<>> inputs, targets;
+    std::vector<TMatrix<dtype>> inputs, targets;
     inputs.push_back(input);
     targets.push_back(target);
 
     return this->batch_forward_propagate(inputs, targets)[0];
 }
 
-neurons::TMatrix<> neurons::Traditional_NN_layer_op::back_propagate(double l_rate, const TMatrix<> & E_to_y_diff)
+template <typename dtype>
+neurons::TMatrix<dtype> neurons::Traditional_NN_layer_op<dtype>::back_propagate(double l_rate, const TMatrix<dtype> & E_to_y_diff)
 {
-    std::vector<TMatrix<>> E_to_y_diffs;
+    std::vector<TMatrix<dtype>> E_to_y_diffs;
     E_to_y_diffs.push_back(E_to_y_diff);
 
     return this->batch_back_propagate(l_rate, E_to_y_diffs)[0];
 }
 
-neurons::TMatrix<> neurons::Traditional_NN_layer_op::back_propagate(double l_rate)
+template <typename dtype>
+neurons::TMatrix<dtype> neurons::Traditional_NN_layer_op<dtype>::back_propagate(double l_rate)
 {
     return this->batch_back_propagate(l_rate)[0];
 }
 
-neurons::TMatrix<>& neurons::Traditional_NN_layer_op::get_weight_gradient() const
+template <typename dtype>
+neurons::TMatrix<dtype>& neurons::Traditional_NN_layer_op<dtype>::get_weight_gradient() const
 {
     return this->m_w_gradient;
 }
 
-neurons::TMatrix<>& neurons::Traditional_NN_layer_op::get_bias_gradient() const
+template <typename dtype>
+neurons::TMatrix<dtype>& neurons::Traditional_NN_layer_op<dtype>::get_bias_gradient() const
 {
     return this->m_b_gradient;
 }
 
-void neurons::Traditional_NN_layer_op::update_w_and_b(const TMatrix<> & w, const TMatrix<> & b)
+template <typename dtype>
+void neurons::Traditional_NN_layer_op<dtype>::share_w_and_b(const TMatrix<dtype> & w, const TMatrix<dtype> & b)
+{
+    this->m_w = &w;
+    this->m_b = &b;
+}
+
+template <typename dtype>
+void neurons::Traditional_NN_layer_op<dtype>::prepare_gradients()
 {
-    this->m_w = w;
-    this->m_b = b;
-}
\ No newline at end of file
+    if (this->m_w->borrowed() || this->m_b->borrowed())
+    {
+        throw std::invalid_argument(
+            std::string("neurons::Traditional_NN_layer_op::prepare_gradients: weights are borrowed read-only from a model file"));
+    }
+
+    if (this->m_w_gradient.shape() != this->m_w->shape() || this->m_b_gradient.shape() != this->m_b->shape())
+    {
+        this->m_w_gradient = TMatrix<dtype>{ this->m_w->shape(), 0 };
+        this->m_b_gradient = TMatrix<dtype>{ this->m_b->shape(), 0 };
+    }
+}
+
+template class neurons::Traditional_NN_layer<float>;
+template class neurons::Traditional_NN_layer<double>;
+template class neurons::Traditional_NN_layer_op<float>;
+template class neurons::Traditional_NN_layer_op<double>;
@@ -2,44 +2,56 @@
 #include "TMatrix.h"
 #include "Functions.h"
 #include "NN_layer.h"
+#include "Thread_pool.h"
 
 namespace neurons
 {
-    class FCNN_layer;
-    class CNN_layer;
+    template <typename dtype>
     class Traditional_NN_layer_op;
 
-    class Traditional_NN_layer : public NN_layer
+    template <typename dtype = double>
+    class Traditional_NN_layer : public NN_layer<dtype>
     {
     protected:
         double m_mmt_rate;
 
-        TMatrix<> m_w;
-        TMatrix<> m_b;
+        TMatrix<dtype> m_w;
+        TMatrix<dtype> m_b;
 
-        TMatrix<> m_w_mmt;
-        TMatrix<> m_b_mmt;
+        TMatrix<dtype> m_w_mmt;
+        TMatrix<dtype> m_b_mmt;
 
         // The pointer of activation function (logist, softmax, etc)
-        std::unique_ptr<Activation> m_act_func;
+        std::unique_ptr<Activation<dtype>> m_act_func;
         // The pointer of error function (sigmoid_crossentropy, softmax_crossentropy, etc)
-        std::unique_ptr<ErrorFunction> m_err_func;
+        std::unique_ptr<ErrorFunction<dtype>> m_err_func;
 
     public:
         static std::string from_binary_data(
-            char * binary_data, lint & data_size, TMatrix<> & w, TMatrix<> & b,
-            std::unique_ptr<Activation> & act_func, std::unique_ptr<ErrorFunction> & err_func,
+            char * binary_data, lint & data_size, TMatrix<dtype> & w, TMatrix<dtype> & b,
+            std::unique_ptr<Activation<dtype>> & act_func, std::unique_ptr<ErrorFunction<dtype>> & err_func,
             char *& residual_data, lint & residual_len
         );
 
+        // Weights, bias and functions of a layer of a model file, and the type of the layer.
+        // If borrow is true, weights and bias borrow their elements from the model file
+        // when they are of dtype (see tensor_to_matrix).
+        static std::string from_model_layer(
+            const Model_layer & layer, bool borrow, TMatrix<dtype> & w, TMatrix<dtype> & b,
+            std::unique_ptr<Activation<dtype>> & act_func, std::unique_ptr<ErrorFunction<dtype>> & err_func
+        );
+
         Traditional_NN_layer();
 
-        Traditional_NN_layer(double mmt_rate, lint threads, const TMatrix<> & w, const TMatrix<> & b,
-            std::unique_ptr<Activation> & act_func, std::unique_ptr<ErrorFunction> & err_func);
+        // Weights and bias are taken by value, so a borrowed matrix that is moved in stays borrowed.
+        // A layer of borrowed weights can only be used for inference: it has no momentum,
+        // its ops have no gradients, and training it throws std::invalid_argument.
+        Traditional_NN_layer(double mmt_rate, lint threads, TMatrix<dtype> w, TMatrix<dtype> b,
+            std::unique_ptr<Activation<dtype>> & act_func, std::unique_ptr<ErrorFunction<dtype>> & err_func);
 
         Traditional_NN_layer(
             double mmt_rate, const Shape &w_sh, const Shape &b_sh, lint threads, 
-            Activation *act_func, ErrorFunction *err_func = nullptr);
+            Activation<dtype> *act_func, ErrorFunction<dtype> *err_func = nullptr);
 
         Traditional_NN_layer(const Traditional_NN_layer & other);
 
@@ -49,9 +61,9 @@ namespace neurons
 
         Traditional_NN_layer & operator = (Traditional_NN_layer && other);
 
-        TMatrix<> weights() const;
+        TMatrix<dtype> weights() const;
 
-        TMatrix<> bias() const;
+        TMatrix<dtype> bias() const;
 
         virtual double commit_training();
 
@@ -60,34 +72,56 @@ namespace neurons
         virtual Shape output_shape() const = 0;
 
         virtual std::unique_ptr<char[]> to_binary_data(lint & data_size) const;
+
+        virtual Model_layer to_model_layer() const;
+
+        virtual void add_momentum(Model_layer & layer) const;
+
+        virtual void restore_momentum(const Model_layer & layer);
+
+    protected:
+        // Let all ops read weights and bias of this layer, this should be called
+        // whenever ops are created or weights and bias of this layer are moved.
+        void share_w_and_b_with_ops();
+
+    private:
+        // Sum gradients of all ops in place via a tree reduction into the first gradient,
+        // then update momentum and parameters in the same pass:
+        //     mmt = mmt_rate * mmt + (1 - mmt_rate) * gradient
+        //     param -= mmt
+        // Elements are split into chunks that run in parallel on the thread pool.
+        void reduce_and_update(const std::vector<TMatrix<dtype> *> & gradients, TMatrix<dtype> & mmt, TMatrix<dtype> & param);
     };
 
-    class Traditional_NN_layer_op : public NN_layer_op
+    template <typename dtype = double>
+    class Traditional_NN_layer_op : public NN_layer_op<dtype>
     {
     protected:
-        TMatrix<> m_w;
-        TMatrix<> m_b;
+        // Read-only views of weights and bias of the layer, which are shared by ops of all threads.
+        // They are updated by the layer in commit_training only when no op is running.
+        const TMatrix<dtype> *m_w;
+        const TMatrix<dtype> *m_b;
 
         // The pointer of activation function (logist, softmax, etc)
-        std::unique_ptr<Activation> m_act_func;
+        std::unique_ptr<Activation<dtype>> m_act_func;
         // The pointer of error function (sigmoid_crossentropy, softmax_crossentropy, etc)
-        std::unique_ptr<ErrorFunction> m_err_func;
+        std::unique_ptr<ErrorFunction<dtype>> m_err_func;
 
-        mutable TMatrix<> m_w_gradient;
-        mutable TMatrix<> m_b_gradient;
+        mutable TMatrix<dtype> m_w_gradient;
+        mutable TMatrix<dtype> m_b_gradient;
 
         // Differentiation of the activation function dy/dz
         // in which y is output of activation, z is x * w  + b
-        std::vector<TMatrix<>> m_act_diffs;
+        std::vector<TMatrix<dtype>> m_act_diffs;
 
     public:
-        Traditional_NN_layer_op() {}
+        Traditional_NN_layer_op() : m_w{ nullptr }, m_b{ nullptr } {}
 
         Traditional_NN_layer_op(
-            const TMatrix<> &w,
-            const TMatrix<> &b,
-            const std::unique_ptr<Activation> &act_func,
-            const std::unique_ptr<ErrorFunction> &err_func);
+            const TMatrix<dtype> &w,
+            const TMatrix<dtype> &b,
+            const std::unique_ptr<Activation<dtype>> &act_func,
+            const std::unique_ptr<ErrorFunction<dtype>> &err_func);
 
         Traditional_NN_layer_op(const Traditional_NN_layer_op & other);
 
@@ -105,9 +139,9 @@ namespace neurons
         // forward propagation via a batch of training samples where size of this batch is 1
         //--------------------------------------------
 
-        virtual TMatrix<> forward_propagate(const TMatrix<> &input);
+        virtual TMatrix<dtype> forward_propagate(const TMatrix<dtype> &input);
 
-        virtual TMatrix<> forward_propagate(const TMatrix<> &input, const TMatrix<> &target);
+        virtual TMatrix<dtype> forward_propagate(const TMatrix<dtype> &input, const TMatrix<dtype> &target);
 
         //--------------------------------------------
         // Back propagation
@@ -115,15 +149,20 @@ namespace neurons
         // back propagation via a batch of training samples where size of this batch is 1
         //--------------------------------------------
 
-        virtual TMatrix<> back_propagate(double l_rate, const TMatrix<> & E_to_y_diff);
+        virtual TMatrix<dtype> back_propagate(double l_rate, const TMatrix<dtype> & E_to_y_diff);
 
-        virtual TMatrix<> back_propagate(double l_rate);
+        virtual TMatrix<dtype> back_propagate(double l_rate);
 
-        TMatrix<>& get_weight_gradient() const;
+        TMatrix<dtype>& get_weight_gradient() const;
 
-        TMatrix<>& get_bias_gradient() const;
+        TMatrix<dtype>& get_bias_gradient() const;
 
-        void update_w_and_b(const TMatrix<> &w, const TMatrix<> &b);
+        void share_w_and_b(const TMatrix<dtype> &w, const TMatrix<dtype> &b);
+
+    protected:
+        // Gradients are allocated for weights of the layer before back propagation,
+        // weights borrowed read-only cannot be trained.
+        void prepare_gradients();
     };
 }
 
@@ -0,0 +1,138 @@
+#include "Transpose.h"
+#include "GEMM.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NEURONS_TRANSPOSE_X86
+#include <immintrin.h>
+#endif
+
+// GCC and clang only emit AVX instructions inside functions explicitly marked for them,
+// while MSVC accepts the intrinsics anywhere.
+#if defined(NEURONS_TRANSPOSE_X86) && (defined(__GNUC__) || defined(__clang__))
+#define NEURONS_TARGET(isa) __attribute__((target(isa)))
+#else
+#define NEURONS_TARGET(isa)
+#endif
+
+namespace
+{
+#ifdef NEURONS_TRANSPOSE_X86
+
+    // Transpose of 4 x 4 doubles, r0 to r3 are rows in and columns out
+    NEURONS_TARGET("avx")
+    inline void transpose_4x4(__m256d & r0, __m256d & r1, __m256d & r2, __m256d & r3)
+    {
+        __m256d t0 = _mm256_unpacklo_pd(r0, r1);
+        __m256d t1 = _mm256_unpackhi_pd(r0, r1);
+        __m256d t2 = _mm256_unpacklo_pd(r2, r3);
+        __m256d t3 = _mm256_unpackhi_pd(r2, r3);
+
+        r0 = _mm256_permute2f128_pd(t0, t2, 0x20);
+        r1 = _mm256_permute2f128_pd(t1, t3, 0x20);
+        r2 = _mm256_permute2f128_pd(t0, t2, 0x31);
+        r3 = _mm256_permute2f128_pd(t1, t3, 0x31);
+    }
+
+    // 8 x 8 doubles as four 4 x 4 quarters, the two off-diagonal quarters swap places
+    NEURONS_TARGET("avx")
+    void tile_avx_d(const double *a, lint lda, double *b, lint ldb)
+    {
+        for (int qi = 0; qi < 8; qi += 4)
+        {
+            for (int qj = 0; qj < 8; qj += 4)
+            {
+                const double *a_q = a + qi * lda + qj;
+                __m256d r0 = _mm256_loadu_pd(a_q);
+                __m256d r1 = _mm256_loadu_pd(a_q + lda);
+                __m256d r2 = _mm256_loadu_pd(a_q + 2 * lda);
+                __m256d r3 = _mm256_loadu_pd(a_q + 3 * lda);
+
+                transpose_4x4(r0, r1, r2, r3);
+
+                double *b_q = b + qj * ldb + qi;
+                _mm256_storeu_pd(b_q, r0);
+                _mm256_storeu_pd(b_q + ldb, r1);
+                _mm256_storeu_pd(b_q + 2 * ldb, r2);
+                _mm256_storeu_pd(b_q + 3 * ldb, r3);
+            }
+        }
+    }
+
+    NEURONS_TARGET("avx")
+    void tile_avx_f(const float *a, lint lda, float *b, lint ldb)
+    {
+        __m256 r0 = _mm256_loadu_ps(a);
+        __m256 r1 = _mm256_loadu_ps(a + lda);
+        __m256 r2 = _mm256_loadu_ps(a + 2 * lda);
+        __m256 r3 = _mm256_loadu_ps(a + 3 * lda);
+        __m256 r4 = _mm256_loadu_ps(a + 4 * lda);
+        __m256 r5 = _mm256_loadu_ps(a + 5 * lda);
+        __m256 r6 = _mm256_loadu_ps(a + 6 * lda);
+        __m256 r7 = _mm256_loadu_ps(a + 7 * lda);
+
+        // Pairs of rows interleaved
+        __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+        __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+        __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+        __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+        __m256 t4 = _mm256_unpacklo_ps(r4, r5);
+        __m256 t5 = _mm256_unpackhi_ps(r4, r5);
+        __m256 t6 = _mm256_unpacklo_ps(r6, r7);
+        __m256 t7 = _mm256_unpackhi_ps(r6, r7);
+
+        // Columns of 4 rows in each 128 bit lane
+        __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+        // Lanes of rows 0 - 3 and rows 4 - 7 joined
+        _mm256_storeu_ps(b, _mm256_permute2f128_ps(s0, s4, 0x20));
+        _mm256_storeu_ps(b + ldb, _mm256_permute2f128_ps(s1, s5, 0x20));
+        _mm256_storeu_ps(b + 2 * ldb, _mm256_permute2f128_ps(s2, s6, 0x20));
+        _mm256_storeu_ps(b + 3 * ldb, _mm256_permute2f128_ps(s3, s7, 0x20));
+        _mm256_storeu_ps(b + 4 * ldb, _mm256_permute2f128_ps(s0, s4, 0x31));
+        _mm256_storeu_ps(b + 5 * ldb, _mm256_permute2f128_ps(s1, s5, 0x31));
+        _mm256_storeu_ps(b + 6 * ldb, _mm256_permute2f128_ps(s2, s6, 0x31));
+        _mm256_storeu_ps(b + 7 * ldb, _mm256_permute2f128_ps(s3, s7, 0x31));
+    }
+
+    // Every AVX kernel of gemm implies AVX
+    bool use_avx()
+    {
+        return neurons::GEMM_kernel::scalar != neurons::gemm_kernel();
+    }
+
+#endif // NEURONS_TRANSPOSE_X86
+}
+
+
+void neurons::transpose_2d(lint rows, lint cols, const double *a, lint lda, double *b, lint ldb)
+{
+    Transpose_tile<double> tile = nullptr;
+#ifdef NEURONS_TRANSPOSE_X86
+    if (use_avx())
+    {
+        tile = tile_avx_d;
+    }
+#endif
+
+    transpose_blocked(rows, cols, a, lda, b, ldb, tile);
+}
+
+void neurons::transpose_2d(lint rows, lint cols, const float *a, lint lda, float *b, lint ldb)
+{
+    Transpose_tile<float> tile = nullptr;
+#ifdef NEURONS_TRANSPOSE_X86
+    if (use_avx())
+    {
+        tile = tile_avx_f;
+    }
+#endif
+
+    transpose_blocked(rows, cols, a, lda, b, ldb, tile);
+}
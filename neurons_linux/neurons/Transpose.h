@@ -0,0 +1,79 @@
+#pragma once
+#include "Shape.h"
+#include <algorithm>
+
+namespace neurons
+{
+    /*
+    Transpose of a block of a row-major buffer:
+
+        b[j * ldb + i] = a[i * lda + j]    for i < rows, j < cols
+
+    lda and ldb are row strides of a and b. The block is split recursively in halves of its
+    longer side until pieces fit the L1 cache (cache-oblivious), and pieces are transposed
+    in tiles of 8 x 8 elements.
+    Single and double precision tiles are transposed in AVX registers when gemm uses an AVX
+    kernel (see gemm_kernel), other types and the remaining elements element by element.
+    */
+
+    // Tiles are transposed by a kernel of 8 x 8 elements, or element by element if it is nullptr
+    template <typename dtype>
+    using Transpose_tile = void (*)(const dtype *a, lint lda, dtype *b, lint ldb);
+
+    const lint TRANSPOSE_TILE = 8;
+    // Longest side of pieces which are not split any more, 32 x 32 doubles of a and b fit L1
+    const lint TRANSPOSE_BLOCK = 32;
+
+    template <typename dtype>
+    void transpose_blocked(lint rows, lint cols, const dtype *a, lint lda, dtype *b, lint ldb, Transpose_tile<dtype> tile)
+    {
+        if (rows > TRANSPOSE_BLOCK || cols > TRANSPOSE_BLOCK)
+        {
+            // Halves are rounded to whole tiles
+            if (rows >= cols)
+            {
+                lint half = (rows / 2 + TRANSPOSE_TILE - 1) / TRANSPOSE_TILE * TRANSPOSE_TILE;
+                transpose_blocked(half, cols, a, lda, b, ldb, tile);
+                transpose_blocked(rows - half, cols, a + half * lda, lda, b + half, ldb, tile);
+            }
+            else
+            {
+                lint half = (cols / 2 + TRANSPOSE_TILE - 1) / TRANSPOSE_TILE * TRANSPOSE_TILE;
+                transpose_blocked(rows, half, a, lda, b, ldb, tile);
+                transpose_blocked(rows, cols - half, a + half, lda, b + half * ldb, ldb, tile);
+            }
+            return;
+        }
+
+        lint full_rows = tile ? rows / TRANSPOSE_TILE * TRANSPOSE_TILE : 0;
+        lint full_cols = tile ? cols / TRANSPOSE_TILE * TRANSPOSE_TILE : 0;
+
+        for (lint i = 0; i < full_rows; i += TRANSPOSE_TILE)
+        {
+            for (lint j = 0; j < full_cols; j += TRANSPOSE_TILE)
+            {
+                tile(a + i * lda + j, lda, b + j * ldb + i, ldb);
+            }
+        }
+
+        // Elements out of whole tiles: the right columns of the tiled rows, then the bottom rows
+        for (lint i = 0; i < rows; ++i)
+        {
+            const dtype *a_row = a + i * lda;
+            for (lint j = i < full_rows ? full_cols : 0; j < cols; ++j)
+            {
+                b[j * ldb + i] = a_row[j];
+            }
+        }
+    }
+
+    template <typename dtype>
+    void transpose_2d(lint rows, lint cols, const dtype *a, lint lda, dtype *b, lint ldb)
+    {
+        transpose_blocked<dtype>(rows, cols, a, lda, b, ldb, nullptr);
+    }
+
+    void transpose_2d(lint rows, lint cols, const double *a, lint lda, double *b, lint ldb);
+
+    void transpose_2d(lint rows, lint cols, const float *a, lint lda, float *b, lint ldb);
+}
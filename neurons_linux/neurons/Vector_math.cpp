@@ -0,0 +1,555 @@
+#include "Vector_math.h"
+#include "GEMM.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NEURONS_VECTOR_X86
+#include <immintrin.h>
+#endif
+
+// GCC and clang only emit AVX instructions inside functions explicitly marked for them,
+// while MSVC accepts the intrinsics anywhere.
+#if defined(NEURONS_VECTOR_X86) && (defined(__GNUC__) || defined(__clang__))
+#define NEURONS_TARGET(isa) __attribute__((target(isa)))
+#else
+#define NEURONS_TARGET(isa)
+#endif
+
+namespace
+{
+    enum class Function
+    {
+        exp,
+        log,
+        sigmoid,
+        tanh,
+        atan
+    };
+
+    // Adding this to a double of magnitude below 2^51 rounds it to an integer,
+    // which then sits in the lowest bits of the sum.
+    const double ROUNDING = 6755399441055744.0;
+    // 2^52 + 1023, a biased exponent ORed into the mantissa of 2^52 minus this is the exponent
+    const double EXPONENT_BIAS = 4503599627370496.0 + 1023;
+
+    const double LOG2_E = 1.4426950408889634;
+    // ln(2) split so that k * LN2_HI is exact for any exponent k
+    const double LN2_HI = 6.93147180369123816490e-01;
+    const double LN2_LO = 1.90821492927058770002e-10;
+    const double SQRT_2 = 1.4142135623730951;
+
+    const double EXP_MIN = -708;
+    const double EXP_MAX = 709;
+
+    // 1 / k! for k = 13 down to 0
+    const double EXP_POLY[] = {
+        1.0 / 6227020800, 1.0 / 479001600, 1.0 / 39916800, 1.0 / 3628800, 1.0 / 362880,
+        1.0 / 40320, 1.0 / 5040, 1.0 / 720, 1.0 / 120, 1.0 / 24, 1.0 / 6, 1.0 / 2, 1, 1 };
+    const int EXP_TERMS = 14;
+
+    // 1 / (2k + 1) for k = 10 down to 0
+    const double LOG_POLY[] = {
+        1.0 / 21, 1.0 / 19, 1.0 / 17, 1.0 / 15, 1.0 / 13, 1.0 / 11, 1.0 / 9, 1.0 / 7, 1.0 / 5, 1.0 / 3, 1 };
+    const int LOG_TERMS = 11;
+
+    const double ATAN_P[] = {
+        -8.750608600031904122785e-01, -1.615753718733365076637e+01, -7.500855792314704667340e+01,
+        -1.228866684490136173410e+02, -6.485021904942025371773e+01 };
+    const double ATAN_Q[] = {
+        2.485846490142306297962e+01, 1.650270098316988542046e+02, 4.328810604912902668951e+02,
+        4.853903996359136964868e+02, 1.945506571482613964425e+02 };
+    // tan(3 pi / 8)
+    const double ATAN_T3P8 = 2.41421356237309504880;
+    const double ATAN_T1 = 0.66;
+    const double PI_2 = 1.57079632679489661923;
+    const double PI_4 = 0.78539816339744830962;
+    // Lowest bits of pi / 2 which do not fit into PI_2
+    const double ATAN_MOREBITS = 6.123233995736765886130e-17;
+
+
+    // Without vectors the libm functions are faster than the polynomials,
+    // they are only saturated the same way as the vector versions.
+    double exp_scalar(double x)
+    {
+        // NaN fails both comparisons and goes through
+        return std::exp(x < EXP_MIN ? EXP_MIN : (x > EXP_MAX ? EXP_MAX : x));
+    }
+
+    double log_scalar(double x)
+    {
+        return std::log(x < DBL_MIN ? DBL_MIN : x);
+    }
+
+    void map_scalar(Function func, lint begin, lint n, const double *x, double *y, double *dy)
+    {
+        switch (func)
+        {
+        case Function::exp:
+            for (lint i = begin; i < n; ++i)
+            {
+                y[i] = exp_scalar(x[i]);
+            }
+            break;
+        case Function::log:
+            for (lint i = begin; i < n; ++i)
+            {
+                y[i] = log_scalar(x[i]);
+            }
+            break;
+        case Function::sigmoid:
+            for (lint i = begin; i < n; ++i)
+            {
+                double r = 1 / (1 + exp_scalar(-x[i]));
+                y[i] = r;
+                if (dy)
+                {
+                    dy[i] = r * (1 - r);
+                }
+            }
+            break;
+        case Function::tanh:
+            for (lint i = begin; i < n; ++i)
+            {
+                double r = std::tanh(x[i]);
+                y[i] = r;
+                if (dy)
+                {
+                    dy[i] = 1 - r * r;
+                }
+            }
+            break;
+        case Function::atan:
+            for (lint i = begin; i < n; ++i)
+            {
+                double v = x[i];
+                y[i] = std::atan(v);
+                if (dy)
+                {
+                    dy[i] = 1 / (1 + v * v);
+                }
+            }
+            break;
+        }
+    }
+
+#ifdef NEURONS_VECTOR_X86
+
+    // Branches of the range reductions become blends.
+
+    NEURONS_TARGET("avx2,fma")
+    inline __m256d exp_avx2(__m256d x)
+    {
+        // The constant is the first operand so NaN goes through
+        x = _mm256_min_pd(_mm256_set1_pd(EXP_MAX), _mm256_max_pd(_mm256_set1_pd(EXP_MIN), x));
+
+        __m256d t = _mm256_fmadd_pd(x, _mm256_set1_pd(LOG2_E), _mm256_set1_pd(ROUNDING));
+        __m256d k = _mm256_sub_pd(t, _mm256_set1_pd(ROUNDING));
+        __m256d r = _mm256_fnmadd_pd(k, _mm256_set1_pd(LN2_HI), x);
+        r = _mm256_fnmadd_pd(k, _mm256_set1_pd(LN2_LO), r);
+
+        __m256d p = _mm256_set1_pd(EXP_POLY[0]);
+        for (int i = 1; i < EXP_TERMS; ++i)
+        {
+            p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(EXP_POLY[i]));
+        }
+
+        __m256i bits = _mm256_add_epi64(_mm256_castpd_si256(t), _mm256_set1_epi64x(1023));
+        return _mm256_mul_pd(p, _mm256_castsi256_pd(_mm256_slli_epi64(bits, 52)));
+    }
+
+    NEURONS_TARGET("avx2,fma")
+    inline __m256d log_avx2(__m256d x)
+    {
+        __m256d special = _mm256_cmp_pd(x, _mm256_set1_pd(DBL_MAX), _CMP_NLE_UQ);
+        __m256d in = x;
+        x = _mm256_max_pd(_mm256_set1_pd(DBL_MIN), x);
+
+        __m256i bits = _mm256_castpd_si256(x);
+        __m256d k = _mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(bits, 52),
+            _mm256_castpd_si256(_mm256_set1_pd(4503599627370496.0))));
+        k = _mm256_sub_pd(k, _mm256_set1_pd(EXPONENT_BIAS));
+        __m256d m = _mm256_castsi256_pd(_mm256_or_si256(
+            _mm256_and_si256(bits, _mm256_set1_epi64x(0x000FFFFFFFFFFFFFLL)),
+            _mm256_set1_epi64x(0x3FF0000000000000LL)));
+
+        __m256d big = _mm256_cmp_pd(m, _mm256_set1_pd(SQRT_2), _CMP_GT_OQ);
+        m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), big);
+        k = _mm256_add_pd(k, _mm256_and_pd(big, _mm256_set1_pd(1)));
+
+        __m256d one = _mm256_set1_pd(1);
+        __m256d s = _mm256_div_pd(_mm256_sub_pd(m, one), _mm256_add_pd(m, one));
+        __m256d z = _mm256_mul_pd(s, s);
+        __m256d p = _mm256_set1_pd(LOG_POLY[0]);
+        for (int i = 1; i < LOG_TERMS; ++i)
+        {
+            p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(LOG_POLY[i]));
+        }
+
+        __m256d r = _mm256_fmadd_pd(k, _mm256_set1_pd(LN2_LO), _mm256_mul_pd(_mm256_add_pd(s, s), p));
+        r = _mm256_fmadd_pd(k, _mm256_set1_pd(LN2_HI), r);
+        return _mm256_blendv_pd(r, in, special);
+    }
+
+    NEURONS_TARGET("avx2,fma")
+    inline __m256d atan_avx2(__m256d x)
+    {
+        __m256d sign_mask = _mm256_set1_pd(-0.0);
+        __m256d sign = _mm256_and_pd(x, sign_mask);
+        __m256d a = _mm256_andnot_pd(sign_mask, x);
+        __m256d one = _mm256_set1_pd(1);
+
+        __m256d big = _mm256_cmp_pd(a, _mm256_set1_pd(ATAN_T3P8), _CMP_GT_OQ);
+        __m256d mid = _mm256_cmp_pd(a, _mm256_set1_pd(ATAN_T1), _CMP_GT_OQ);
+
+        __m256d y = _mm256_blendv_pd(_mm256_setzero_pd(), _mm256_set1_pd(PI_4), mid);
+        y = _mm256_blendv_pd(y, _mm256_set1_pd(PI_2), big);
+        __m256d more = _mm256_blendv_pd(_mm256_setzero_pd(), _mm256_set1_pd(0.5 * ATAN_MOREBITS), mid);
+        more = _mm256_blendv_pd(more, _mm256_set1_pd(ATAN_MOREBITS), big);
+
+        __m256d reduced = _mm256_div_pd(_mm256_sub_pd(a, one), _mm256_add_pd(a, one));
+        __m256d inverse = _mm256_div_pd(_mm256_set1_pd(-1), a);
+        a = _mm256_blendv_pd(a, reduced, mid);
+        a = _mm256_blendv_pd(a, inverse, big);
+
+        __m256d z = _mm256_mul_pd(a, a);
+        __m256d num = _mm256_set1_pd(ATAN_P[0]);
+        __m256d den = _mm256_add_pd(z, _mm256_set1_pd(ATAN_Q[0]));
+        for (int i = 1; i < 5; ++i)
+        {
+            num = _mm256_fmadd_pd(num, z, _mm256_set1_pd(ATAN_P[i]));
+            den = _mm256_fmadd_pd(den, z, _mm256_set1_pd(ATAN_Q[i]));
+        }
+
+        __m256d r = _mm256_fmadd_pd(a, _mm256_div_pd(_mm256_mul_pd(z, num), den), a);
+        y = _mm256_add_pd(y, _mm256_add_pd(r, more));
+        return _mm256_xor_pd(y, sign);
+    }
+
+    // Returns the number of elements done, the rest is left to the scalar version
+    NEURONS_TARGET("avx2,fma")
+    lint map_avx2(Function func, lint n, const double *x, double *y, double *dy)
+    {
+        const __m256d one = _mm256_set1_pd(1);
+        lint end = n - n % 4;
+
+        switch (func)
+        {
+        case Function::exp:
+            for (lint i = 0; i < end; i += 4)
+            {
+                _mm256_storeu_pd(y + i, exp_avx2(_mm256_loadu_pd(x + i)));
+            }
+            break;
+        case Function::log:
+            for (lint i = 0; i < end; i += 4)
+            {
+                _mm256_storeu_pd(y + i, log_avx2(_mm256_loadu_pd(x + i)));
+            }
+            break;
+        case Function::sigmoid:
+            for (lint i = 0; i < end; i += 4)
+            {
+                __m256d v = _mm256_loadu_pd(x + i);
+                __m256d r = _mm256_div_pd(one, _mm256_add_pd(one, exp_avx2(_mm256_sub_pd(_mm256_setzero_pd(), v))));
+                _mm256_storeu_pd(y + i, r);
+                if (dy)
+                {
+                    _mm256_storeu_pd(dy + i, _mm256_fnmadd_pd(r, r, r));
+                }
+            }
+            break;
+        case Function::tanh:
+            for (lint i = 0; i < end; i += 4)
+            {
+                __m256d v = _mm256_loadu_pd(x + i);
+                __m256d r = exp_avx2(_mm256_mul_pd(_mm256_set1_pd(-2), v));
+                r = _mm256_div_pd(_mm256_sub_pd(one, r), _mm256_add_pd(one, r));
+                _mm256_storeu_pd(y + i, r);
+                if (dy)
+                {
+                    _mm256_storeu_pd(dy + i, _mm256_fnmadd_pd(r, r, one));
+                }
+            }
+            break;
+        case Function::atan:
+            for (lint i = 0; i < end; i += 4)
+            {
+                __m256d v = _mm256_loadu_pd(x + i);
+                _mm256_storeu_pd(y + i, atan_avx2(v));
+                if (dy)
+                {
+                    _mm256_storeu_pd(dy + i, _mm256_div_pd(one, _mm256_fmadd_pd(v, v, one)));
+                }
+            }
+            break;
+        }
+
+        return end;
+    }
+
+
+    // GCC 12 warns about the deliberately undefined pass-through operand of some AVX-512 intrinsics
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+    NEURONS_TARGET("avx512f")
+    inline __m512d exp_avx512(__m512d x)
+    {
+        __m512d low = _mm512_set1_pd(EXP_MIN);
+        __m512d high = _mm512_set1_pd(EXP_MAX);
+        x = _mm512_mask_mov_pd(x, _mm512_cmp_pd_mask(x, low, _CMP_LT_OQ), low);
+        x = _mm512_mask_mov_pd(x, _mm512_cmp_pd_mask(x, high, _CMP_GT_OQ), high);
+
+        __m512d t = _mm512_fmadd_pd(x, _mm512_set1_pd(LOG2_E), _mm512_set1_pd(ROUNDING));
+        __m512d k = _mm512_sub_pd(t, _mm512_set1_pd(ROUNDING));
+        __m512d r = _mm512_fnmadd_pd(k, _mm512_set1_pd(LN2_HI), x);
+        r = _mm512_fnmadd_pd(k, _mm512_set1_pd(LN2_LO), r);
+
+        __m512d p = _mm512_set1_pd(EXP_POLY[0]);
+        for (int i = 1; i < EXP_TERMS; ++i)
+        {
+            p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(EXP_POLY[i]));
+        }
+
+        __m512i bits = _mm512_add_epi64(_mm512_castpd_si512(t), _mm512_set1_epi64(1023));
+        return _mm512_mul_pd(p, _mm512_castsi512_pd(_mm512_slli_epi64(bits, 52)));
+    }
+
+    NEURONS_TARGET("avx512f")
+    inline __m512d log_avx512(__m512d x)
+    {
+        __mmask8 special = _mm512_cmp_pd_mask(x, _mm512_set1_pd(DBL_MAX), _CMP_NLE_UQ);
+        __m512d in = x;
+        __m512d low = _mm512_set1_pd(DBL_MIN);
+        x = _mm512_mask_mov_pd(x, _mm512_cmp_pd_mask(x, low, _CMP_LT_OQ), low);
+
+        __m512i bits = _mm512_castpd_si512(x);
+        __m512d k = _mm512_castsi512_pd(_mm512_or_si512(_mm512_srli_epi64(bits, 52),
+            _mm512_castpd_si512(_mm512_set1_pd(4503599627370496.0))));
+        k = _mm512_sub_pd(k, _mm512_set1_pd(EXPONENT_BIAS));
+        __m512d m = _mm512_castsi512_pd(_mm512_or_si512(
+            _mm512_and_si512(bits, _mm512_set1_epi64(0x000FFFFFFFFFFFFFLL)),
+            _mm512_set1_epi64(0x3FF0000000000000LL)));
+
+        __mmask8 big = _mm512_cmp_pd_mask(m, _mm512_set1_pd(SQRT_2), _CMP_GT_OQ);
+        m = _mm512_mask_mul_pd(m, big, m, _mm512_set1_pd(0.5));
+        k = _mm512_mask_add_pd(k, big, k, _mm512_set1_pd(1));
+
+        __m512d one = _mm512_set1_pd(1);
+        __m512d s = _mm512_div_pd(_mm512_sub_pd(m, one), _mm512_add_pd(m, one));
+        __m512d z = _mm512_mul_pd(s, s);
+        __m512d p = _mm512_set1_pd(LOG_POLY[0]);
+        for (int i = 1; i < LOG_TERMS; ++i)
+        {
+            p = _mm512_fmadd_pd(p, z, _mm512_set1_pd(LOG_POLY[i]));
+        }
+
+        __m512d r = _mm512_fmadd_pd(k, _mm512_set1_pd(LN2_LO), _mm512_mul_pd(_mm512_add_pd(s, s), p));
+        r = _mm512_fmadd_pd(k, _mm512_set1_pd(LN2_HI), r);
+        return _mm512_mask_blend_pd(special, r, in);
+    }
+
+    NEURONS_TARGET("avx512f")
+    inline __m512d atan_avx512(__m512d x)
+    {
+        __m512i sign_mask = _mm512_set1_epi64(static_cast<long long>(0x8000000000000000ULL));
+        __m512i sign = _mm512_and_si512(_mm512_castpd_si512(x), sign_mask);
+        __m512d a = _mm512_castsi512_pd(_mm512_andnot_si512(sign_mask, _mm512_castpd_si512(x)));
+        __m512d one = _mm512_set1_pd(1);
+
+        __mmask8 big = _mm512_cmp_pd_mask(a, _mm512_set1_pd(ATAN_T3P8), _CMP_GT_OQ);
+        __mmask8 mid = _mm512_cmp_pd_mask(a, _mm512_set1_pd(ATAN_T1), _CMP_GT_OQ);
+
+        __m512d y = _mm512_maskz_mov_pd(mid, _mm512_set1_pd(PI_4));
+        y = _mm512_mask_mov_pd(y, big, _mm512_set1_pd(PI_2));
+        __m512d more = _mm512_maskz_mov_pd(mid, _mm512_set1_pd(0.5 * ATAN_MOREBITS));
+        more = _mm512_mask_mov_pd(more, big, _mm512_set1_pd(ATAN_MOREBITS));
+
+        __m512d reduced = _mm512_div_pd(_mm512_sub_pd(a, one), _mm512_add_pd(a, one));
+        __m512d inverse = _mm512_div_pd(_mm512_set1_pd(-1), a);
+        a = _mm512_mask_mov_pd(a, mid, reduced);
+        a = _mm512_mask_mov_pd(a, big, inverse);
+
+        __m512d z = _mm512_mul_pd(a, a);
+        __m512d num = _mm512_set1_pd(ATAN_P[0]);
+        __m512d den = _mm512_add_pd(z, _mm512_set1_pd(ATAN_Q[0]));
+        for (int i = 1; i < 5; ++i)
+        {
+            num = _mm512_fmadd_pd(num, z, _mm512_set1_pd(ATAN_P[i]));
+            den = _mm512_fmadd_pd(den, z, _mm512_set1_pd(ATAN_Q[i]));
+        }
+
+        __m512d r = _mm512_fmadd_pd(a, _mm512_div_pd(_mm512_mul_pd(z, num), den), a);
+        y = _mm512_add_pd(y, _mm512_add_pd(r, more));
+        return _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(y), sign));
+    }
+
+    NEURONS_TARGET("avx512f")
+    lint map_avx512(Function func, lint n, const double *x, double *y, double *dy)
+    {
+        const __m512d one = _mm512_set1_pd(1);
+        lint end = n - n % 8;
+
+        switch (func)
+        {
+        case Function::exp:
+            for (lint i = 0; i < end; i += 8)
+            {
+                _mm512_storeu_pd(y + i, exp_avx512(_mm512_loadu_pd(x + i)));
+            }
+            break;
+        case Function::log:
+            for (lint i = 0; i < end; i += 8)
+            {
+                _mm512_storeu_pd(y + i, log_avx512(_mm512_loadu_pd(x + i)));
+            }
+            break;
+        case Function::sigmoid:
+            for (lint i = 0; i < end; i += 8)
+            {
+                __m512d v = _mm512_loadu_pd(x + i);
+                __m512d r = _mm512_div_pd(one, _mm512_add_pd(one, exp_avx512(_mm512_sub_pd(_mm512_setzero_pd(), v))));
+                _mm512_storeu_pd(y + i, r);
+                if (dy)
+                {
+                    _mm512_storeu_pd(dy + i, _mm512_fnmadd_pd(r, r, r));
+                }
+            }
+            break;
+        case Function::tanh:
+            for (lint i = 0; i < end; i += 8)
+            {
+                __m512d v = _mm512_loadu_pd(x + i);
+                __m512d r = exp_avx512(_mm512_mul_pd(_mm512_set1_pd(-2), v));
+                r = _mm512_div_pd(_mm512_sub_pd(one, r), _mm512_add_pd(one, r));
+                _mm512_storeu_pd(y + i, r);
+                if (dy)
+                {
+                    _mm512_storeu_pd(dy + i, _mm512_fnmadd_pd(r, r, one));
+                }
+            }
+            break;
+        case Function::atan:
+            for (lint i = 0; i < end; i += 8)
+            {
+                __m512d v = _mm512_loadu_pd(x + i);
+                _mm512_storeu_pd(y + i, atan_avx512(v));
+                if (dy)
+                {
+                    _mm512_storeu_pd(dy + i, _mm512_div_pd(one, _mm512_fmadd_pd(v, v, one)));
+                }
+            }
+            break;
+        }
+
+        return end;
+    }
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
+
+    void map(Function func, lint n, const double *x, double *y, double *dy)
+    {
+        lint done = 0;
+
+#ifdef NEURONS_VECTOR_X86
+        switch (neurons::gemm_kernel())
+        {
+        case neurons::GEMM_kernel::avx512:
+            done = map_avx512(func, n, x, y, dy);
+            break;
+        case neurons::GEMM_kernel::avx2:
+            done = map_avx2(func, n, x, y, dy);
+            break;
+        default:
+            break;
+        }
+#endif
+
+        map_scalar(func, done, n, x, y, dy);
+    }
+
+    // Elements per block of the single precision versions, which are widened to double on the stack
+    const lint FLOAT_BLOCK = 256;
+
+    // Single precision elements are evaluated by the double kernels block by block,
+    // so float buffers get the same accuracy (rounded once to float) without kernels of their own
+    void map(Function func, lint n, const float *x, float *y, float *dy)
+    {
+        double x_block[FLOAT_BLOCK];
+        double y_block[FLOAT_BLOCK];
+        double dy_block[FLOAT_BLOCK];
+
+        for (lint begin = 0; begin < n; begin += FLOAT_BLOCK)
+        {
+            lint size = std::min(FLOAT_BLOCK, n - begin);
+
+            std::copy(x + begin, x + begin + size, x_block);
+            map(func, size, x_block, y_block, dy ? dy_block : nullptr);
+            std::copy(y_block, y_block + size, y + begin);
+
+            if (dy)
+            {
+                std::copy(dy_block, dy_block + size, dy + begin);
+            }
+        }
+    }
+}
+
+
+void neurons::vector_exp(lint n, const double *x, double *y)
+{
+    map(Function::exp, n, x, y, nullptr);
+}
+
+void neurons::vector_log(lint n, const double *x, double *y)
+{
+    map(Function::log, n, x, y, nullptr);
+}
+
+void neurons::vector_sigmoid(lint n, const double *x, double *y, double *dy)
+{
+    map(Function::sigmoid, n, x, y, dy);
+}
+
+void neurons::vector_tanh(lint n, const double *x, double *y, double *dy)
+{
+    map(Function::tanh, n, x, y, dy);
+}
+
+void neurons::vector_atan(lint n, const double *x, double *y, double *dy)
+{
+    map(Function::atan, n, x, y, dy);
+}
+
+void neurons::vector_exp(lint n, const float *x, float *y)
+{
+    map(Function::exp, n, x, y, nullptr);
+}
+
+void neurons::vector_log(lint n, const float *x, float *y)
+{
+    map(Function::log, n, x, y, nullptr);
+}
+
+void neurons::vector_sigmoid(lint n, const float *x, float *y, float *dy)
+{
+    map(Function::sigmoid, n, x, y, dy);
+}
+
+void neurons::vector_tanh(lint n, const float *x, float *y, float *dy)
+{
+    map(Function::tanh, n, x, y, dy);
+}
+
+void neurons::vector_atan(lint n, const float *x, float *y, float *dy)
+{
+    map(Function::atan, n, x, y, dy);
+}
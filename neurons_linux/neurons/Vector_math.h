@@ -0,0 +1,51 @@
+#pragma once
+#include "Shape.h"
+
+namespace neurons
+{
+    /*
+    Element-wise math functions over double buffers, used by activation and error functions.
+
+    exp, log and atan are evaluated with range reduction and polynomials instead of libm calls,
+    so they can be vectorized:
+        exp:  x = k * ln2 + r with |r| <= ln2 / 2, a degree 13 Taylor polynomial of r,
+              inputs are saturated to [-708, 709] so the result is always a normal number.
+        log:  x = 2^k * m with m in [sqrt(1/2), sqrt(2)), 2 * atanh((m - 1) / (m + 1)) as a series,
+              inputs below the smallest normal double are clamped to it.
+        atan: reduction to [0, 0.66] and a rational approximation (Cephes).
+    The relative error of all of them is below 1e-15 over their whole range (a few ulp);
+    sigmoid and tanh are built on exp with an absolute error below 1e-15.
+
+    The widest instruction set selected for gemm (see gemm_kernel / gemm_set_kernel) is used.
+    The scalar version, which also takes the elements that do not fill a whole vector, calls libm
+    with the same saturation of inputs.
+    Output buffers may be the same as the input buffer, derivative buffers may be nullptr.
+
+    The float versions widen blocks of elements to double and use the same kernels.
+    */
+
+    // y = exp(x)
+    void vector_exp(lint n, const double *x, double *y);
+
+    // y = log(x)
+    void vector_log(lint n, const double *x, double *y);
+
+    // y = 1 / (1 + exp(-x)), dy = y * (1 - y)
+    void vector_sigmoid(lint n, const double *x, double *y, double *dy);
+
+    // y = tanh(x), dy = 1 - y * y
+    void vector_tanh(lint n, const double *x, double *y, double *dy);
+
+    // y = atan(x), dy = 1 / (1 + x * x)
+    void vector_atan(lint n, const double *x, double *y, double *dy);
+
+    void vector_exp(lint n, const float *x, float *y);
+
+    void vector_log(lint n, const float *x, float *y);
+
+    void vector_sigmoid(lint n, const float *x, float *y, float *dy);
+
+    void vector_tanh(lint n, const float *x, float *y, float *dy);
+
+    void vector_atan(lint n, const float *x, float *y, float *dy);
+}
@@ -1,31 +1,19 @@
 #include "Conv_NN.h"
 #include <fstream>
 
-Conv_NN::Conv_NN(
+template <typename dtype>
+Conv_NN<dtype>::Conv_NN(
     double l_rate,
     double mmt_rate,
     lint threads,
     const std::string & model_file,
     const dataset::Dataset &d_set)
-    : NN(l_rate, mmt_rate, threads, model_file, d_set)
+    : NN<dtype>(l_rate, mmt_rate, threads, model_file, d_set)
 {
     // reshape all inputs and labels so that they are suitable for matrix multiplication
-    // lint input_size = this->m_train_set[0].shape().size();
-    lint output_size = this->m_train_labels[0].shape().size();
-
-    for (size_t i = 0; i < this->m_train_set.size(); ++i)
-    {
-        this->m_train_set[i].left_extend_shape();
-        this->m_train_set[i].normalize();
-        this->m_train_labels[i].reshape(neurons::Shape{ 1, output_size });
-    }
-
-    for (size_t i = 0; i < this->m_test_set.size(); ++i)
-    {
-        this->m_test_set[i].left_extend_shape();
-        this->m_test_set[i].normalize();
-        this->m_test_labels[i].reshape(neurons::Shape{ 1, output_size });
-    }
+    neurons::Shape input_shape{ this->m_sample_shape };
+    input_shape.left_extend();
+    this->prepare_samples(input_shape, neurons::Shape{ 1, this->m_label_shape.size() }, true);
 
     // Initialize all layers
     if (!this->load(this->m_model_file))
@@ -34,12 +22,13 @@ Conv_NN::Conv_NN(
     }
 }
 
-void Conv_NN::print_layers(std::ostream & os) const
+template <typename dtype>
+void Conv_NN<dtype>::print_layers(std::ostream & os) const
 {
     for (size_t i = 0; i < this->m_layers.size(); ++i)
     {
-        neurons::TMatrix<> w = (dynamic_cast<neurons::Traditional_NN_layer *>(this->m_layers[i].get()))->weights();
-        neurons::TMatrix<> b = (dynamic_cast<neurons::Traditional_NN_layer *>(this->m_layers[i].get()))->bias();
+        neurons::TMatrix<dtype> w = (dynamic_cast<neurons::Traditional_NN_layer<dtype> *>(this->m_layers[i].get()))->weights();
+        neurons::TMatrix<dtype> b = (dynamic_cast<neurons::Traditional_NN_layer<dtype> *>(this->m_layers[i].get()))->bias();
 
         os << "=================== Layer: " << i << " ====================\n";
         os << "Weights:\n";
@@ -49,19 +38,20 @@ void Conv_NN::print_layers(std::ostream & os) const
     }
 }
 
-void Conv_NN::save_layers_as_images() const
+template <typename dtype>
+void Conv_NN<dtype>::save_layers_as_images() const
 {
     for (size_t i = 0; i < this->m_layers.size(); ++i)
     {
-        neurons::TMatrix<> w = (dynamic_cast<neurons::Traditional_NN_layer *>(this->m_layers[i].get()))->weights();
-        neurons::TMatrix<> b = (dynamic_cast<neurons::Traditional_NN_layer *>(this->m_layers[i].get()))->bias();
+        neurons::TMatrix<dtype> w = (dynamic_cast<neurons::Traditional_NN_layer<dtype> *>(this->m_layers[i].get()))->weights();
+        neurons::TMatrix<dtype> b = (dynamic_cast<neurons::Traditional_NN_layer<dtype> *>(this->m_layers[i].get()))->bias();
 
         w.normalize(0, 255);
-        std::vector<neurons::TMatrix<>> kernel_list = w.collapse(w.shape().dim() - 1);
+        std::vector<neurons::TMatrix<dtype>> kernel_list = w.collapse(w.shape().dim() - 1);
 
         for (size_t j = 0; j < kernel_list.size(); ++j)
         {
-            std::vector<neurons::TMatrix<>> kernel_ch = kernel_list[j].collapse(kernel_list[j].shape().dim() - 1);
+            std::vector<neurons::TMatrix<dtype>> kernel_ch = kernel_list[j].collapse(kernel_list[j].shape().dim() - 1);
             
             for (size_t k = 0; k < kernel_ch.size(); ++k)
             {
@@ -72,11 +62,31 @@ void Conv_NN::save_layers_as_images() const
     }
 }
 
-bool Conv_NN::load(const std::string & file_name)
+template <typename dtype>
+bool Conv_NN<dtype>::load(const std::string & file_name)
 {
     //Do not forget to clear all layers of this network
     this->m_layers.clear();
+    this->m_mapped_model.reset();
+
+    if (neurons::Model_file::is_model_file(file_name))
+    {
+        neurons::Model_file model{ file_name };
+        this->add_layers(model, model.layers().size(), false);
 
+        // A checkpoint restores momentum of the layers and the training run it was saved by
+        for (size_t i = 0; i < this->m_layers.size(); ++i)
+        {
+            this->m_layers[i]->restore_momentum(model.layers()[i]);
+        }
+        if (model.has_training_state())
+        {
+            this->restore_training_state(model.training_state());
+        }
+        return true;
+    }
+
+    // Files of the legacy format
     lint data_size = 0;
 
     std::ifstream in_file;
@@ -98,19 +108,19 @@ bool Conv_NN::load(const std::string & file_name)
     char * position = buffer.get();
 
     // Always cache shape of the previous layer
-    neurons::Shape input_shape{ this->m_train_set[0].shape() };
+    neurons::Shape input_shape{ this->m_sample_shape };
 
     while (len_left > 0)
     {
         lint size;
-        neurons::TMatrix<> w, b;
+        neurons::TMatrix<dtype> w, b;
         lint stride, padding;
-        std::unique_ptr<neurons::Activation> act_func;
-        std::unique_ptr<neurons::ErrorFunction> err_func;
+        std::unique_ptr<neurons::Activation<dtype>> act_func;
+        std::unique_ptr<neurons::ErrorFunction<dtype>> err_func;
         char * re; lint re_len;
 
         std::string nn_type = 
-            neurons::CNN_layer::from_binary_data(
+            neurons::CNN_layer<dtype>::from_binary_data(
                 position, size, w, b, stride, padding, act_func, err_func, re, re_len);
         len_left -= size;
         position += size;
@@ -118,7 +128,7 @@ bool Conv_NN::load(const std::string & file_name)
         if ("FCNN" == nn_type)
         {
             this->m_layers.push_back(
-                std::make_shared<neurons::FCNN_layer>(this->m_mmt_rate, this->m_threads, w, b, act_func, err_func));
+                std::make_shared<neurons::FCNN_layer<dtype>>(this->m_mmt_rate, this->m_threads, w, b, act_func, err_func));
 
             input_shape = b.shape();
         }
@@ -126,12 +136,12 @@ bool Conv_NN::load(const std::string & file_name)
         {
             /*
             lint rows, lint cols, lint chls, lint stride, lint padding, lint threads,
-                TMatrix<>& w, TMatrix<>& b,
+                TMatrix<dtype>& w, TMatrix<dtype>& b,
                 std::unique_ptr<Activation>& act_func, std::unique_ptr<ErrorFunction>& err_func)
             */
 
             this->m_layers.push_back(
-                std::make_shared<neurons::CNN_layer>(
+                std::make_shared<neurons::CNN_layer<dtype>>(
                     this->m_mmt_rate,
                     input_shape[1],
                     input_shape[2],
@@ -151,11 +161,22 @@ bool Conv_NN::load(const std::string & file_name)
     return true;
 }
 
-bool Conv_NN::load_until(const std::string & file_name, lint layer_index)
+template <typename dtype>
+bool Conv_NN<dtype>::load_until(const std::string & file_name, lint layer_index)
 {
         //Do not forget to clear all layers of this network
     this->m_layers.clear();
+    this->m_mapped_model.reset();
+
+    if (neurons::Model_file::is_model_file(file_name))
+    {
+        neurons::Model_file model{ file_name };
+        this->add_layers(model, layer_index, false);
+        this->add_output_layer();
+        return true;
+    }
 
+    // Files of the legacy format
     lint data_size = 0;
 
     std::ifstream in_file;
@@ -177,20 +198,20 @@ bool Conv_NN::load_until(const std::string & file_name, lint layer_index)
     char * position = buffer.get();
 
     // Always cache shape of the previous layer
-    neurons::Shape input_shape{ this->m_train_set[0].shape() };
+    neurons::Shape input_shape{ this->m_sample_shape };
 
     lint index = 0;
     while (len_left > 0 && index < layer_index)
     {
         lint size;
-        neurons::TMatrix<> w, b;
+        neurons::TMatrix<dtype> w, b;
         lint stride, padding;
-        std::unique_ptr<neurons::Activation> act_func;
-        std::unique_ptr<neurons::ErrorFunction> err_func;
+        std::unique_ptr<neurons::Activation<dtype>> act_func;
+        std::unique_ptr<neurons::ErrorFunction<dtype>> err_func;
         char * re; lint re_len;
 
         std::string nn_type = 
-            neurons::CNN_layer::from_binary_data(
+            neurons::CNN_layer<dtype>::from_binary_data(
                 position, size, w, b, stride, padding, act_func, err_func, re, re_len);
         len_left -= size;
         position += size;
@@ -198,7 +219,7 @@ bool Conv_NN::load_until(const std::string & file_name, lint layer_index)
         if ("FCNN" == nn_type)
         {
             this->m_layers.push_back(
-                std::make_shared<neurons::FCNN_layer>(this->m_mmt_rate, this->m_threads, w, b, act_func, err_func));
+                std::make_shared<neurons::FCNN_layer<dtype>>(this->m_mmt_rate, this->m_threads, w, b, act_func, err_func));
 
             input_shape = b.shape();
         }
@@ -206,12 +227,12 @@ bool Conv_NN::load_until(const std::string & file_name, lint layer_index)
         {
             /*
             lint rows, lint cols, lint chls, lint stride, lint padding, lint threads,
-                TMatrix<>& w, TMatrix<>& b,
+                TMatrix<dtype>& w, TMatrix<dtype>& b,
                 std::unique_ptr<Activation>& act_func, std::unique_ptr<ErrorFunction>& err_func)
             */
 
             this->m_layers.push_back(
-                std::make_shared<neurons::CNN_layer>(
+                std::make_shared<neurons::CNN_layer<dtype>>(
                     this->m_mmt_rate,
                     input_shape[1],
                     input_shape[2],
@@ -228,47 +249,111 @@ bool Conv_NN::load_until(const std::string & file_name, lint layer_index)
 
     }
 
+    this->add_output_layer();
 
+    return true;
+}
+
+template <typename dtype>
+bool Conv_NN<dtype>::load_mapped(const std::string & file_name)
+{
+    this->m_layers.clear();
+    this->m_mapped_model.reset();
+
+    if (!neurons::Model_file::is_model_file(file_name))
+    {
+        return false;
+    }
+
+    std::shared_ptr<neurons::Model_file> model = std::make_shared<neurons::Model_file>(file_name);
+    this->add_layers(*model, model->layers().size(), true);
+    this->m_mapped_model = model;
+
+    return true;
+}
+
+template <typename dtype>
+void Conv_NN<dtype>::add_layers(const neurons::Model_file & model, lint n_layers, bool borrow)
+{
+    // Always cache shape of the previous layer
+    neurons::Shape input_shape{ this->m_sample_shape };
+
+    for (lint i = 0; i < n_layers && i < static_cast<lint>(model.layers().size()); ++i)
+    {
+        const neurons::Model_layer & layer = model.layers()[i];
+        neurons::TMatrix<dtype> w, b;
+        std::unique_ptr<neurons::Activation<dtype>> act_func;
+        std::unique_ptr<neurons::ErrorFunction<dtype>> err_func;
+
+        std::string nn_type = neurons::Traditional_NN_layer<dtype>::from_model_layer(layer, borrow, w, b, act_func, err_func);
+
+        if (neurons::NN_layer<dtype>::FCNN == nn_type)
+        {
+            this->m_layers.push_back(std::make_shared<neurons::FCNN_layer<dtype>>(
+                this->m_mmt_rate, this->m_threads, std::move(w), std::move(b), act_func, err_func));
+        }
+        else if (neurons::NN_layer<dtype>::CNN == nn_type && 2 == layer.m_params.size())
+        {
+            this->m_layers.push_back(std::make_shared<neurons::CNN_layer<dtype>>(
+                this->m_mmt_rate,
+                input_shape[1],
+                input_shape[2],
+                input_shape[3],
+                layer.m_params[0], // stride
+                layer.m_params[1], // padding
+                this->m_threads,
+                std::move(w), std::move(b), act_func, err_func));
+        }
+        else
+        {
+            throw std::invalid_argument(std::string("Conv_NN::add_layers: unexpected layer of ") + nn_type);
+        }
+
+        input_shape = this->m_layers[this->m_layers.size() - 1]->output_shape();
+    }
+}
+
+template <typename dtype>
+void Conv_NN<dtype>::add_output_layer()
+{
     if (this->m_layers.empty())
     {
-        this->m_layers.push_back(std::make_shared<neurons::FCNN_layer>(
+        this->m_layers.push_back(std::make_shared<neurons::FCNN_layer<dtype>>(
             this->m_mmt_rate,
-            this->m_train_set[0].shape().size(),
-            this->m_train_labels[0].shape().size(),
-            this->m_threads, nullptr, new neurons::Softmax_CrossEntropy));
+            this->m_sample_shape.size(),
+            this->m_label_shape.size(),
+            this->m_threads, nullptr, new neurons::Softmax_CrossEntropy<dtype>));
     }
     else
     {
-        this->m_layers.push_back(std::make_shared<neurons::FCNN_layer>(
+        this->m_layers.push_back(std::make_shared<neurons::FCNN_layer<dtype>>(
             this->m_mmt_rate,
             this->m_layers[this->m_layers.size() - 1]->output_shape().size(),
-            this->m_train_labels[0].shape().size(),
-            this->m_threads, nullptr, new neurons::Softmax_CrossEntropy));
+            this->m_label_shape.size(),
+            this->m_threads, nullptr, new neurons::Softmax_CrossEntropy<dtype>));
     }
-
-
-    return true;
 }
 
-void Conv_NN::initialize_model()
+template <typename dtype>
+void Conv_NN<dtype>::initialize_model()
 {
-    lint output_size = this->m_train_labels[0].shape().size();
+    lint output_size = this->m_label_shape.size();
     this->m_layers.push_back(
-        std::make_shared<neurons::CNN_layer>(
+        std::make_shared<neurons::CNN_layer<dtype>>(
             this->m_mmt_rate,
-            this->m_train_set[0].shape()[1],
-            this->m_train_set[0].shape()[2],
-            this->m_train_set[0].shape()[3],
+            this->m_sample_shape[1],
+            this->m_sample_shape[2],
+            this->m_sample_shape[3],
             6, // filters 
             6, // filter rows
             6, // filter cols
             2, // stride
             0, // padding
             this->m_threads,
-            new neurons::Tanh));
+            new neurons::Tanh<dtype>));
 
     this->m_layers.push_back(
-        std::make_shared<neurons::CNN_layer>(
+        std::make_shared<neurons::CNN_layer<dtype>>(
             this->m_mmt_rate,
             this->m_layers[0]->output_shape()[1],
             this->m_layers[0]->output_shape()[2],
@@ -279,10 +364,10 @@ void Conv_NN::initialize_model()
             1, // stride
             0, // padding
             this->m_threads,
-            new neurons::Tanh));
+            new neurons::Tanh<dtype>));
 
     this->m_layers.push_back(
-        std::make_shared<neurons::CNN_layer>(
+        std::make_shared<neurons::CNN_layer<dtype>>(
             this->m_mmt_rate,
             this->m_layers[1]->output_shape()[1],
             this->m_layers[1]->output_shape()[2],
@@ -293,10 +378,10 @@ void Conv_NN::initialize_model()
             1, // stride
             0, // padding
             this->m_threads,
-            new neurons::Tanh));
+            new neurons::Tanh<dtype>));
 
     this->m_layers.push_back(
-        std::make_shared<neurons::CNN_layer>(
+        std::make_shared<neurons::CNN_layer<dtype>>(
             this->m_mmt_rate,
             this->m_layers[2]->output_shape()[1],
             this->m_layers[2]->output_shape()[2],
@@ -307,43 +392,39 @@ void Conv_NN::initialize_model()
             1, // stride
             0, // padding
             this->m_threads,
-            new neurons::Tanh));
+            new neurons::Tanh<dtype>));
 
     this->m_layers.push_back(
-        std::make_shared<neurons::FCNN_layer>(
+        std::make_shared<neurons::FCNN_layer<dtype>>(
             this->m_mmt_rate,
             this->m_layers[3]->output_shape().size(),
             output_size,
             this->m_threads,
             nullptr,
-            new neurons::Softmax_CrossEntropy));
+            new neurons::Softmax_CrossEntropy<dtype>));
 }
 
-void Conv_NN::save(const std::string & file_name) const
+template <typename dtype>
+void Conv_NN<dtype>::save(const std::string & file_name) const
 {
-    lint data_size = 0;
-
-    std::ofstream out_file;
-    out_file.open(file_name, std::ios::out | std::ios::binary);
-
-    for (size_t i = 0; i < this->m_layers.size(); ++i)
-    {
-        lint size;
-        std::unique_ptr<char[]> data = this->m_layers[i]->to_binary_data(size);
-
-        out_file.write(data.get(), size);
-    }
+    neurons::write_model_file(file_name, this->model_layers(false));
+}
 
-    out_file.close();
+template <typename dtype>
+bool Conv_NN<dtype>::writes_model_files() const
+{
+    return true;
 }
 
 
-std::vector<neurons::TMatrix<>> Conv_NN::predict(
-    const std::vector<neurons::TMatrix<>>& inputs, lint thread_id) const
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> Conv_NN<dtype>::predict(
+    const std::vector<const neurons::TMatrix<dtype> *> & inputs, lint thread_id) const
 {
-    std::vector<neurons::TMatrix<>> l_inputs = inputs;
+    std::vector<neurons::TMatrix<dtype>> l_inputs{ inputs.size() };
     for (size_t i = 0; i < l_inputs.size(); ++i)
     {
+        l_inputs[i] = *inputs[i];
         l_inputs[i].left_extend_shape();
         l_inputs[i].normalize();
     }
@@ -358,7 +439,7 @@ std::vector<neurons::TMatrix<>> Conv_NN::predict(
         l_inputs[i].reshape(neurons::Shape{ 1, l_inputs[i].shape().size() });
     }
 
-    std::vector<neurons::TMatrix<>> preds =
+    std::vector<neurons::TMatrix<dtype>> preds =
         this->m_layers[this->m_layers.size() - 1]->operation_instances()[thread_id]->batch_forward_propagate(l_inputs);
 
     for (size_t i = 0; i < preds.size(); ++i)
@@ -370,14 +451,17 @@ std::vector<neurons::TMatrix<>> Conv_NN::predict(
 }
 
 
-std::vector<neurons::TMatrix<>> Conv_NN::test(
-    const std::vector<neurons::TMatrix<>>& inputs,
-    const std::vector<neurons::TMatrix<>>& targets,
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> Conv_NN<dtype>::test(
+    const std::vector<const neurons::TMatrix<dtype> *> & inputs,
+    const std::vector<const neurons::TMatrix<dtype> *> & targets,
     lint thread_id)
 {
-    std::vector<neurons::TMatrix<>> l_inputs = inputs;
+    // The first layer reads samples directly from the data set
+    std::vector<neurons::TMatrix<dtype>> l_inputs =
+        this->m_layers[0]->operation_instances()[thread_id]->batch_forward_propagate(inputs);
 
-    for (size_t i = 0; i < this->m_layers.size() - 1; ++i)
+    for (size_t i = 1; i < this->m_layers.size() - 1; ++i)
     {
         l_inputs = this->m_layers[i]->operation_instances()[thread_id]->batch_forward_propagate(l_inputs);
     }
@@ -387,20 +471,22 @@ std::vector<neurons::TMatrix<>> Conv_NN::test(
         l_inputs[i].reshape(neurons::Shape{ 1, l_inputs[i].shape().size() });
     }
 
-    std::vector<neurons::TMatrix<>> preds =
-        this->m_layers[this->m_layers.size() - 1]->operation_instances()[thread_id]->batch_forward_propagate(l_inputs, targets);
+    std::vector<neurons::TMatrix<dtype>> preds =
+        this->m_layers[this->m_layers.size() - 1]->operation_instances()[thread_id]->batch_forward_propagate(
+            neurons::matrix_pointers(l_inputs), targets);
 
     return preds;
 }
 
-std::vector<neurons::TMatrix<>> Conv_NN::optimise(
-    const std::vector<neurons::TMatrix<>>& inputs,
-    const std::vector<neurons::TMatrix<>>& targets,
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> Conv_NN<dtype>::optimise(
+    const std::vector<const neurons::TMatrix<dtype> *> & inputs,
+    const std::vector<const neurons::TMatrix<dtype> *> & targets,
     lint thread_id)
 {
-    std::vector<neurons::TMatrix<>> preds = this->test(inputs, targets, thread_id);
+    std::vector<neurons::TMatrix<dtype>> preds = this->test(inputs, targets, thread_id);
 
-    std::vector<neurons::TMatrix<>> E_to_x_diffs =
+    std::vector<neurons::TMatrix<dtype>> E_to_x_diffs =
         this->m_layers[this->m_layers.size() - 1]->operation_instances()[thread_id]->batch_back_propagate(this->m_l_rate);
 
     for (size_t i = 0; i < E_to_x_diffs.size(); ++i)
@@ -417,5 +503,5 @@ std::vector<neurons::TMatrix<>> Conv_NN::optimise(
 }
 
 
-
-
+template class Conv_NN<float>;
+template class Conv_NN<double>;
@@ -12,12 +12,13 @@ Programmed by Chunnan Sheng
 #include <iostream>
 
 
-class Conv_NN : public NN
+template <typename dtype = double>
+class Conv_NN : public NN<dtype>
 {
 private:
 
-    // std::vector<neurons::CNN_layer> m_conv_layers;
-    // neurons::FCNN_layer m_nn_layer;
+    // std::vector<neurons::CNN_layer<dtype>> m_conv_layers;
+    // neurons::FCNN_layer<dtype> m_nn_layer;
 
 public:
     Conv_NN(
@@ -44,24 +45,39 @@ public:
 
     virtual bool load_until(const std::string & file_name, lint layer_index);
 
+    // Load a model file for inference only, weights are borrowed from a read-only mapping of the file
+    // (see Multi_Layer_NN::load_mapped). False if the file is not a model file.
+    bool load_mapped(const std::string & file_name);
+
     virtual void initialize_model();
 
     virtual void save(const std::string & file_name) const;
 
+protected:
+
+    virtual bool writes_model_files() const;
+
 private:
 
-    virtual std::vector<neurons::TMatrix<>> test(
-        const std::vector<neurons::TMatrix<>> & inputs,
-        const std::vector<neurons::TMatrix<>> & targets,
+    // Append the first n_layers layers of a model file, their weights are borrowed if borrow is true.
+    // Inputs of convolution layers are outputs of the layers before them.
+    void add_layers(const neurons::Model_file & model, lint n_layers, bool borrow);
+
+    // Append the softmax layer which load_until puts after the loaded layers
+    void add_output_layer();
+
+    virtual std::vector<neurons::TMatrix<dtype>> test(
+        const std::vector<const neurons::TMatrix<dtype> *> & inputs,
+        const std::vector<const neurons::TMatrix<dtype> *> & targets,
         lint thread_id);
 
-    virtual std::vector<neurons::TMatrix<>> optimise(
-        const std::vector<neurons::TMatrix<>> & inputs,
-        const std::vector<neurons::TMatrix<>> & targets,
+    virtual std::vector<neurons::TMatrix<dtype>> optimise(
+        const std::vector<const neurons::TMatrix<dtype> *> & inputs,
+        const std::vector<const neurons::TMatrix<dtype> *> & targets,
         lint thread_id);
 
-    virtual std::vector<neurons::TMatrix<>> predict(
-        const std::vector<neurons::TMatrix<>> & inputs,
+    virtual std::vector<neurons::TMatrix<dtype>> predict(
+        const std::vector<const neurons::TMatrix<dtype> *> & inputs,
         lint thread_id) const;
 
 };
@@ -1,10 +1,58 @@
 #pragma once
 #include "Dataset.h"
+#include "Mapped_file.h"
+#include <fstream>
 #include <string>
 #include <vector>
 
 namespace dataset
 {
+    // Samples of CIFAR binary files read chunk by chunk
+    class CIFAR_10_stream : public Sample_stream
+    {
+    private:
+        std::vector<std::string> m_files;
+        // Number of records in m_files[0] ~ m_files[i]
+        std::vector<lint> m_file_ends;
+
+        neurons::Shape m_image_shape;
+        lint m_classes;
+
+        // Records [m_first, m_end) of all files are in the stream
+        lint m_first;
+        lint m_end;
+        lint m_next;
+
+        std::ifstream m_file;
+        lint m_file_index;
+
+        std::vector<char> m_record_buffer;
+
+    public:
+        CIFAR_10_stream(
+            const std::vector<std::string> & files,
+            const std::vector<lint> & file_ends,
+            const neurons::Shape & image_shape,
+            lint classes,
+            lint first,
+            lint end);
+
+    public:
+        virtual neurons::Shape image_shape() const;
+
+        virtual lint classes() const;
+
+        virtual lint size() const;
+
+        virtual lint read(Image_store & images, lint max_images);
+
+        virtual void rewind();
+
+    private:
+        // Open the file of record m_next and seek to the record
+        void seek_next();
+    };
+
     class CIFAR_10 : public Dataset
     {
     private:
@@ -18,13 +66,15 @@ namespace dataset
         std::string m_dir;
 
     private:
-        std::unique_ptr<char[]> read_cifar_file(lint & file_len, const std::string & path) const;
+        // Map a CIFAR binary file into memory, nullptr is returned if its size is wrong
+        std::shared_ptr<Mapped_file> map_cifar_file(const std::string & path) const;
 
-        void cifar_binary_to_dataset(
-            std::vector<neurons::TMatrix<>> & images,
-            std::vector<neurons::TMatrix<>> & labels,
-            const std::unique_ptr<char[]> & binary,
-            lint binary_len, lint limit = 0) const;
+        // Images of the file are appended to the store, nothing is copied.
+        // Each record is a label followed by red, green and blue planes of the image.
+        void cifar_file_to_store(
+            Image_store & images,
+            const std::shared_ptr<Mapped_file> & file,
+            lint limit = 0) const;
 
     public:
         CIFAR_10(const std::string & dir);
@@ -35,6 +85,12 @@ namespace dataset
 
         virtual void get_test_set(
             std::vector<neurons::TMatrix<>> & inputs, std::vector<neurons::TMatrix<>> & labels, lint limit = 0) const;
+
+        virtual bool get_training_store(Image_store & images, lint limit = 0) const;
+
+        virtual bool get_test_store(Image_store & images, lint limit = 0) const;
+
+        virtual std::unique_ptr<Sample_stream> open_training_stream(lint shard, lint shards) const;
     };
 }
 
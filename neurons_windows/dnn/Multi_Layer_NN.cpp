@@ -1,16 +1,17 @@
 #include "Multi_Layer_NN.h"
 #include <fstream>
 
-Multi_Layer_NN::Multi_Layer_NN(
+template <typename dtype>
+Multi_Layer_NN<dtype>::Multi_Layer_NN(
     double l_rate,
     double mmt_rate,
     lint threads,
     const std::string & model_file,
     const dataset::Dataset &d_set)
     : 
-    NN(l_rate, mmt_rate, threads, model_file, d_set),
-    m_input_size{m_train_set[0].shape().size()},
-    m_output_size{m_train_labels[0].shape().size()}
+    NN<dtype>(l_rate, mmt_rate, threads, model_file, d_set),
+    m_input_size{ this->m_sample_shape.size() },
+    m_output_size{ this->m_label_shape.size() }
 {
     // Initialize all layers
     if (!this->load(this->m_model_file))
@@ -19,30 +20,19 @@ Multi_Layer_NN::Multi_Layer_NN(
     }
 
     // Reshape all the training set and labels
-    for (size_t i = 0; i < this->m_train_set.size(); ++i)
-    {
-        this->m_train_set[i].reshape(neurons::Shape{ 1, m_input_size });
-        this->m_train_set[i].normalize();
-        this->m_train_labels[i].reshape(neurons::Shape{ 1, m_output_size });
-    }
-
-    // Reshape all the test set and labels
-    for (size_t i = 0; i < this->m_test_set.size(); ++i)
-    {
-        this->m_test_set[i].reshape(neurons::Shape{ 1, m_input_size });
-        this->m_test_set[i].normalize();
-        this->m_test_labels[i].reshape(neurons::Shape{ 1, m_output_size });
-    }
+    this->prepare_samples(neurons::Shape{ 1, m_input_size }, neurons::Shape{ 1, m_output_size }, true);
 }
 
 
-std::vector<neurons::TMatrix<>> Multi_Layer_NN::predict(
-    const std::vector<neurons::TMatrix<>>& inputs, lint thread_id) const
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> Multi_Layer_NN<dtype>::predict(
+    const std::vector<const neurons::TMatrix<dtype> *> & inputs, lint thread_id) const
 {
-    std::vector<neurons::TMatrix<>> l_inputs = inputs;
+    std::vector<neurons::TMatrix<dtype>> l_inputs{ inputs.size() };
     // Reshape all the input
     for (size_t i = 0; i < l_inputs.size(); ++i)
     {
+        l_inputs[i] = *inputs[i];
         l_inputs[i].reshape(neurons::Shape{ 1, this->m_input_size });
         l_inputs[i].normalize();
     }
@@ -61,32 +51,37 @@ std::vector<neurons::TMatrix<>> Multi_Layer_NN::predict(
 }
 
 
-std::vector<neurons::TMatrix<>> Multi_Layer_NN::test(
-    const std::vector<neurons::TMatrix<>>& inputs,
-    const std::vector<neurons::TMatrix<>>& targets,
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> Multi_Layer_NN<dtype>::test(
+    const std::vector<const neurons::TMatrix<dtype> *> & inputs,
+    const std::vector<const neurons::TMatrix<dtype> *> & targets,
     lint thread_id)
 {
-    std::vector<neurons::TMatrix<>> l_inputs = inputs;
+    // The first layer reads samples directly from the data set
+    std::vector<neurons::TMatrix<dtype>> l_inputs =
+        this->m_layers[0]->operation_instances()[thread_id]->batch_forward_propagate(inputs);
     
-    for (size_t i = 0; i < this->m_layers.size() - 1; ++i)
+    for (size_t i = 1; i < this->m_layers.size() - 1; ++i)
     {
         l_inputs = this->m_layers[i]->operation_instances()[thread_id]->batch_forward_propagate(l_inputs);
     }
 
-    std::vector<neurons::TMatrix<>> preds = 
-        this->m_layers[this->m_layers.size() - 1]->operation_instances()[thread_id]->batch_forward_propagate(l_inputs, targets);
+    std::vector<neurons::TMatrix<dtype>> preds = 
+        this->m_layers[this->m_layers.size() - 1]->operation_instances()[thread_id]->batch_forward_propagate(
+            neurons::matrix_pointers(l_inputs), targets);
     return preds;
 }
 
 
-std::vector<neurons::TMatrix<>> Multi_Layer_NN::optimise(
-    const std::vector<neurons::TMatrix<>>& inputs,
-    const std::vector<neurons::TMatrix<>>& targets,
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> Multi_Layer_NN<dtype>::optimise(
+    const std::vector<const neurons::TMatrix<dtype> *> & inputs,
+    const std::vector<const neurons::TMatrix<dtype> *> & targets,
     lint thread_id)
 {
-    std::vector<neurons::TMatrix<>> preds = this->test(inputs, targets, thread_id);
+    std::vector<neurons::TMatrix<dtype>> preds = this->test(inputs, targets, thread_id);
 
-    std::vector<neurons::TMatrix<>> E_to_x_diffs =
+    std::vector<neurons::TMatrix<dtype>> E_to_x_diffs =
         this->m_layers[this->m_layers.size() - 1]->operation_instances()[thread_id]->batch_back_propagate(this->m_l_rate);
 
     for (lint i = this->m_layers.size() - 2; i >= 0; --i)
@@ -98,12 +93,13 @@ std::vector<neurons::TMatrix<>> Multi_Layer_NN::optimise(
 }
 
 
-void Multi_Layer_NN::print_layers(std::ostream & os) const
+template <typename dtype>
+void Multi_Layer_NN<dtype>::print_layers(std::ostream & os) const
 {
     for (size_t i = 0; i < this->m_layers.size(); ++i)
     {
-        neurons::TMatrix<> w = (dynamic_cast<neurons::Traditional_NN_layer *>(this->m_layers[i].get()))->weights();
-        neurons::TMatrix<> b = (dynamic_cast<neurons::Traditional_NN_layer *>(this->m_layers[i].get()))->bias();
+        neurons::TMatrix<dtype> w = (dynamic_cast<neurons::Traditional_NN_layer<dtype> *>(this->m_layers[i].get()))->weights();
+        neurons::TMatrix<dtype> b = (dynamic_cast<neurons::Traditional_NN_layer<dtype> *>(this->m_layers[i].get()))->bias();
 
         os << "=================== Layer: " << i << " ====================\n";
         os << "Weights:\n";
@@ -113,23 +109,44 @@ void Multi_Layer_NN::print_layers(std::ostream & os) const
     }
 }
 
-void Multi_Layer_NN::save_layers_as_images() const
+template <typename dtype>
+void Multi_Layer_NN<dtype>::save_layers_as_images() const
 {
     for (size_t i = 0; i < this->m_layers.size(); ++i)
     {
-        neurons::TMatrix<> w = (dynamic_cast<neurons::Traditional_NN_layer *>(this->m_layers[i].get()))->weights();
-        neurons::TMatrix<> b = (dynamic_cast<neurons::Traditional_NN_layer *>(this->m_layers[i].get()))->bias();
+        neurons::TMatrix<dtype> w = (dynamic_cast<neurons::Traditional_NN_layer<dtype> *>(this->m_layers[i].get()))->weights();
+        neurons::TMatrix<dtype> b = (dynamic_cast<neurons::Traditional_NN_layer<dtype> *>(this->m_layers[i].get()))->bias();
 
         w.normalize(0, 255);
         w.save_matrix_as_image(this->m_model_file + "_layer_" + std::to_string(i) + ".pgm");
     }
 }
 
-bool Multi_Layer_NN::load(const std::string & file_name)
+template <typename dtype>
+bool Multi_Layer_NN<dtype>::load(const std::string & file_name)
 {
     //Do not forget to clear all layers of this network
     this->m_layers.clear();
+    this->m_mapped_model.reset();
+
+    if (neurons::Model_file::is_model_file(file_name))
+    {
+        neurons::Model_file model{ file_name };
+        this->add_layers(model, model.layers().size(), false);
+
+        // A checkpoint restores momentum of the layers and the training run it was saved by
+        for (size_t i = 0; i < this->m_layers.size(); ++i)
+        {
+            this->m_layers[i]->restore_momentum(model.layers()[i]);
+        }
+        if (model.has_training_state())
+        {
+            this->restore_training_state(model.training_state());
+        }
+        return true;
+    }
 
+    // Files of the legacy format
     lint data_size = 0;
 
     std::ifstream in_file;
@@ -153,27 +170,77 @@ bool Multi_Layer_NN::load(const std::string & file_name)
     while (len_left > 0)
     {
         lint size;
-        neurons::TMatrix<> w, b;
-        std::unique_ptr<neurons::Activation> act_func;
-        std::unique_ptr<neurons::ErrorFunction> err_func;
+        neurons::TMatrix<dtype> w, b;
+        std::unique_ptr<neurons::Activation<dtype>> act_func;
+        std::unique_ptr<neurons::ErrorFunction<dtype>> err_func;
         char * re; lint re_len;
 
-        neurons::Traditional_NN_layer::from_binary_data(position, size, w, b, act_func, err_func, re, re_len);
+        neurons::Traditional_NN_layer<dtype>::from_binary_data(position, size, w, b, act_func, err_func, re, re_len);
         len_left -= size;
         position += size;
 
-        this->m_layers.push_back(
-            std::make_shared<neurons::FCNN_layer>(this->m_mmt_rate, this->m_threads, w, b, act_func, err_func));
+        this->m_layers.push_back(std::make_shared<neurons::FCNN_layer<dtype>>(
+            this->m_mmt_rate, this->m_threads, std::move(w), std::move(b), act_func, err_func));
     }
 
     return true;
 }
 
-bool Multi_Layer_NN::load_until(const std::string & file_name, lint layer_index)
+template <typename dtype>
+bool Multi_Layer_NN<dtype>::load_mapped(const std::string & file_name)
+{
+    this->m_layers.clear();
+    this->m_mapped_model.reset();
+
+    if (!neurons::Model_file::is_model_file(file_name))
+    {
+        return false;
+    }
+
+    std::shared_ptr<neurons::Model_file> model = std::make_shared<neurons::Model_file>(file_name);
+    this->add_layers(*model, model->layers().size(), true);
+    this->m_mapped_model = model;
+
+    return true;
+}
+
+template <typename dtype>
+void Multi_Layer_NN<dtype>::add_layers(const neurons::Model_file & model, lint n_layers, bool borrow)
+{
+    for (lint i = 0; i < n_layers && i < static_cast<lint>(model.layers().size()); ++i)
+    {
+        neurons::TMatrix<dtype> w, b;
+        std::unique_ptr<neurons::Activation<dtype>> act_func;
+        std::unique_ptr<neurons::ErrorFunction<dtype>> err_func;
+
+        std::string nn_type = neurons::Traditional_NN_layer<dtype>::from_model_layer(
+            model.layers()[i], borrow, w, b, act_func, err_func);
+        if (neurons::NN_layer<dtype>::FCNN != nn_type)
+        {
+            throw std::invalid_argument(std::string("Multi_Layer_NN::add_layers: unexpected layer of ") + nn_type);
+        }
+
+        this->m_layers.push_back(std::make_shared<neurons::FCNN_layer<dtype>>(
+            this->m_mmt_rate, this->m_threads, std::move(w), std::move(b), act_func, err_func));
+    }
+}
+
+template <typename dtype>
+bool Multi_Layer_NN<dtype>::load_until(const std::string & file_name, lint layer_index)
 {
     //Do not forget to clear all layers of this network
     this->m_layers.clear();
+    this->m_mapped_model.reset();
+
+    if (neurons::Model_file::is_model_file(file_name))
+    {
+        neurons::Model_file model{ file_name };
+        this->add_layers(model, layer_index, false);
+        this->add_output_layer();
+        return true;
+    }
 
+    // Files of the legacy format
     lint data_size = 0;
 
     std::ifstream in_file;
@@ -198,82 +265,84 @@ bool Multi_Layer_NN::load_until(const std::string & file_name, lint layer_index)
     while (len_left > 0 && index < layer_index)
     {
         lint size;
-        neurons::TMatrix<> w, b;
-        std::unique_ptr<neurons::Activation> act_func;
-        std::unique_ptr<neurons::ErrorFunction> err_func;
+        neurons::TMatrix<dtype> w, b;
+        std::unique_ptr<neurons::Activation<dtype>> act_func;
+        std::unique_ptr<neurons::ErrorFunction<dtype>> err_func;
         char * re; lint re_len;
 
-        neurons::Traditional_NN_layer::from_binary_data(position, size, w, b, act_func, err_func, re, re_len);
+        neurons::Traditional_NN_layer<dtype>::from_binary_data(position, size, w, b, act_func, err_func, re, re_len);
         len_left -= size;
         position += size;
 
-        this->m_layers.push_back(
-            std::make_shared<neurons::FCNN_layer>(this->m_mmt_rate, this->m_threads, w, b, act_func, err_func));
+        this->m_layers.push_back(std::make_shared<neurons::FCNN_layer<dtype>>(
+            this->m_mmt_rate, this->m_threads, std::move(w), std::move(b), act_func, err_func));
 
         ++index;
     }
 
+    this->add_output_layer();
+
+    return true;
+}
+
+template <typename dtype>
+void Multi_Layer_NN<dtype>::add_output_layer()
+{
     if (this->m_layers.empty())
     {
-        this->m_layers.push_back(std::make_shared<neurons::FCNN_layer>(
+        this->m_layers.push_back(std::make_shared<neurons::FCNN_layer<dtype>>(
             this->m_mmt_rate,
             this->m_input_size,
             m_output_size,
-            this->m_threads, nullptr, new neurons::Softmax_CrossEntropy));
+            this->m_threads, nullptr, new neurons::Softmax_CrossEntropy<dtype>));
     }
     else
     {
-        this->m_layers.push_back(std::make_shared<neurons::FCNN_layer>(
+        this->m_layers.push_back(std::make_shared<neurons::FCNN_layer<dtype>>(
             this->m_mmt_rate,
             this->m_layers[this->m_layers.size() - 1]->output_shape().size(),
             m_output_size,
-            this->m_threads, nullptr, new neurons::Softmax_CrossEntropy));
+            this->m_threads, nullptr, new neurons::Softmax_CrossEntropy<dtype>));
     }
-
-    return true;
 }
 
-void Multi_Layer_NN::save(const std::string & file_name) const
+template <typename dtype>
+void Multi_Layer_NN<dtype>::save(const std::string & file_name) const
 {
-    lint data_size = 0;
-
-    std::ofstream out_file;
-    out_file.open(file_name, std::ios::out | std::ios::binary);
+    neurons::write_model_file(file_name, this->model_layers(false));
+}
 
-    for (size_t i = 0; i < this->m_layers.size(); ++i)
-    {
-        lint size;
-        std::unique_ptr<char[]> data = this->m_layers[i]->to_binary_data(size);
 
-        out_file.write(data.get(), size);
-    }
-
-    out_file.close();
+template <typename dtype>
+bool Multi_Layer_NN<dtype>::writes_model_files() const
+{
+    return true;
 }
 
 
-void Multi_Layer_NN::initialize_model()
+template <typename dtype>
+void Multi_Layer_NN<dtype>::initialize_model()
 {
     // Add layers to the network
-    this->m_layers.push_back(std::make_shared<neurons::FCNN_layer>(
-        this->m_mmt_rate, m_input_size, 100, this->m_threads, new neurons::Arctan));
+    this->m_layers.push_back(std::make_shared<neurons::FCNN_layer<dtype>>(
+        this->m_mmt_rate, m_input_size, 100, this->m_threads, new neurons::Arctan<dtype>));
 
-    this->m_layers.push_back(std::make_shared<neurons::FCNN_layer>(
-        this->m_mmt_rate, 100, 100, this->m_threads, new neurons::LeakyRelu));
+    this->m_layers.push_back(std::make_shared<neurons::FCNN_layer<dtype>>(
+        this->m_mmt_rate, 100, 100, this->m_threads, new neurons::LeakyRelu<dtype>));
 
-    this->m_layers.push_back(std::make_shared<neurons::FCNN_layer>(
-        this->m_mmt_rate, 100, 100, this->m_threads, new neurons::Sin));
+    this->m_layers.push_back(std::make_shared<neurons::FCNN_layer<dtype>>(
+        this->m_mmt_rate, 100, 100, this->m_threads, new neurons::Sin<dtype>));
 
-    this->m_layers.push_back(std::make_shared<neurons::FCNN_layer>(
-        this->m_mmt_rate, 100, 100, this->m_threads, new neurons::Tanh));
+    this->m_layers.push_back(std::make_shared<neurons::FCNN_layer<dtype>>(
+        this->m_mmt_rate, 100, 100, this->m_threads, new neurons::Tanh<dtype>));
 
-    this->m_layers.push_back(std::make_shared<neurons::FCNN_layer>(
-        this->m_mmt_rate, 100, m_output_size, this->m_threads, nullptr, new neurons::Softmax_CrossEntropy));
+    this->m_layers.push_back(std::make_shared<neurons::FCNN_layer<dtype>>(
+        this->m_mmt_rate, 100, m_output_size, this->m_threads, nullptr, new neurons::Softmax_CrossEntropy<dtype>));
 
-    // this->m_layers.push_back(std::make_shared<neurons::FCNN_layer>(
-    // this->m_mmt_rate, 100, m_output_size, this->m_threads, nullptr, new neurons::HalfSquareError(new neurons::Relu)));
+    // this->m_layers.push_back(std::make_shared<neurons::FCNN_layer<dtype>>(
+    // this->m_mmt_rate, 100, m_output_size, this->m_threads, nullptr, new neurons::HalfSquareError<dtype>(new neurons::Relu<dtype>)));
 }
 
 
-
-
+template class Multi_Layer_NN<float>;
+template class Multi_Layer_NN<double>;
@@ -10,7 +10,8 @@ Programmed by Chunnan Sheng
 #include <iostream>
 
 
-class Multi_Layer_NN : public NN
+template <typename dtype = double>
+class Multi_Layer_NN : public NN<dtype>
 {
 private:
 
@@ -43,24 +44,40 @@ public:
 
     virtual bool load_until(const std::string & file_name, lint layer_index);
 
+    // Load a model file for inference only: weights are borrowed from a read-only mapping of the file
+    // instead of being copied, so the network starts without reading the file, and processes which map
+    // the same file share its pages. Training the network afterwards throws std::invalid_argument.
+    // False if the file is not a model file (files of the legacy format cannot be mapped).
+    bool load_mapped(const std::string & file_name);
+
     virtual void initialize_model();
 
     virtual void save(const std::string & file_name) const;
 
+protected:
+
+    virtual bool writes_model_files() const;
+
 private:
 
-    virtual std::vector<neurons::TMatrix<>> test(
-        const std::vector<neurons::TMatrix<>> & inputs,
-        const std::vector<neurons::TMatrix<>> & targets,
+    // Append the first n_layers layers of a model file, their weights are borrowed if borrow is true
+    void add_layers(const neurons::Model_file & model, lint n_layers, bool borrow);
+
+    // Append the softmax layer which load_until puts after the loaded layers
+    void add_output_layer();
+
+    virtual std::vector<neurons::TMatrix<dtype>> test(
+        const std::vector<const neurons::TMatrix<dtype> *> & inputs,
+        const std::vector<const neurons::TMatrix<dtype> *> & targets,
         lint thread_id);
 
-    virtual std::vector<neurons::TMatrix<>> optimise(
-        const std::vector<neurons::TMatrix<>> & inputs,
-        const std::vector<neurons::TMatrix<>> & targets,
+    virtual std::vector<neurons::TMatrix<dtype>> optimise(
+        const std::vector<const neurons::TMatrix<dtype> *> & inputs,
+        const std::vector<const neurons::TMatrix<dtype> *> & targets,
         lint thread_id);
 
-    virtual std::vector<neurons::TMatrix<>> predict(
-        const std::vector<neurons::TMatrix<>> & inputs,
+    virtual std::vector<neurons::TMatrix<dtype>> predict(
+        const std::vector<const neurons::TMatrix<dtype> *> & inputs,
         lint thread_id) const;
 };
 
@@ -0,0 +1,635 @@
+#include "Batching_server.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const lint NO_SOCKET = -1;
+
+    // Milliseconds the acceptor waits for a connection before it checks whether the server stops
+    const int ACCEPT_POLL_MS = 100;
+
+#ifdef _WIN32
+    typedef SOCKET Socket_handle;
+
+    Socket_handle handle_of(lint socket)
+    {
+        return static_cast<Socket_handle>(socket);
+    }
+
+    lint socket_of(Socket_handle handle)
+    {
+        return INVALID_SOCKET == handle ? NO_SOCKET : static_cast<lint>(handle);
+    }
+
+    bool start_sockets()
+    {
+        static bool started = [] { WSADATA data; return 0 == WSAStartup(MAKEWORD(2, 2), &data); }();
+        return started;
+    }
+
+    void close_socket(lint socket)
+    {
+        closesocket(handle_of(socket));
+    }
+
+    void shutdown_socket(lint socket)
+    {
+        shutdown(handle_of(socket), SD_BOTH);
+    }
+
+    int poll_socket(lint socket, int timeout_ms)
+    {
+        WSAPOLLFD fd{ handle_of(socket), POLLIN, 0 };
+        return WSAPoll(&fd, 1, timeout_ms);
+    }
+
+    const int SEND_FLAGS = 0;
+#else
+    typedef int Socket_handle;
+
+    Socket_handle handle_of(lint socket)
+    {
+        return static_cast<Socket_handle>(socket);
+    }
+
+    lint socket_of(Socket_handle handle)
+    {
+        return handle < 0 ? NO_SOCKET : static_cast<lint>(handle);
+    }
+
+    bool start_sockets()
+    {
+        return true;
+    }
+
+    void close_socket(lint socket)
+    {
+        close(handle_of(socket));
+    }
+
+    void shutdown_socket(lint socket)
+    {
+        shutdown(handle_of(socket), SHUT_RDWR);
+    }
+
+    int poll_socket(lint socket, int timeout_ms)
+    {
+        pollfd fd{ handle_of(socket), POLLIN, 0 };
+        return poll(&fd, 1, timeout_ms);
+    }
+
+    // A peer which has gone away is an error of send rather than a signal
+#ifdef MSG_NOSIGNAL
+    const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+    const int SEND_FLAGS = 0;
+#endif
+#endif
+
+    // The address of a Unix domain socket, false if the path does not fit in it
+    bool socket_address(const std::string & path, sockaddr_un & address)
+    {
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path))
+        {
+            return false;
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size());
+        return true;
+    }
+
+    // Send or receive all bytes, false if the connection is closed or broken
+    bool send_all(lint socket, const void *data, lint bytes)
+    {
+        const char *p = static_cast<const char *>(data);
+        while (bytes > 0)
+        {
+            int n = static_cast<int>(std::min<lint>(bytes, 1 << 20));
+            int sent = static_cast<int>(send(handle_of(socket), p, n, SEND_FLAGS));
+            if (sent <= 0)
+            {
+                return false;
+            }
+            p += sent;
+            bytes -= sent;
+        }
+        return true;
+    }
+
+    bool receive_all(lint socket, void *data, lint bytes)
+    {
+        char *p = static_cast<char *>(data);
+        while (bytes > 0)
+        {
+            int n = static_cast<int>(std::min<lint>(bytes, 1 << 20));
+            int received = static_cast<int>(recv(handle_of(socket), p, n, 0));
+            if (received <= 0)
+            {
+                return false;
+            }
+            p += received;
+            bytes -= received;
+        }
+        return true;
+    }
+
+    // Receive and drop the elements of a refused request
+    bool skip(lint socket, lint bytes)
+    {
+        char buffer[4096];
+        while (bytes > 0)
+        {
+            lint n = std::min<lint>(bytes, sizeof(buffer));
+            if (!receive_all(socket, buffer, n))
+            {
+                return false;
+            }
+            bytes -= n;
+        }
+        return true;
+    }
+
+    // The element at rank (elements - 1) * fraction of latencies
+    double percentile(std::vector<double> & latencies, double fraction)
+    {
+        if (latencies.empty())
+        {
+            return 0;
+        }
+        size_t rank = static_cast<size_t>((latencies.size() - 1) * fraction + 0.5);
+        std::nth_element(latencies.begin(), latencies.begin() + rank, latencies.end());
+        return latencies[rank];
+    }
+}
+
+template <typename dtype>
+neurons::Batching_server<dtype>::Batching_server(std::shared_ptr<const Inference_session<dtype>> session,
+    lint max_batch_size, lint latency_budget_us, lint workers)
+    :
+    m_session{ session },
+    m_max_batch_size{ max_batch_size },
+    m_latency_budget{ std::max<lint>(0, latency_budget_us) },
+    m_stop{ false },
+    m_stats_start{ std::chrono::steady_clock::now() },
+    m_requests{ 0 },
+    m_batches{ 0 },
+    m_refused{ 0 },
+    m_next_latency{ 0 },
+    m_listener{ NO_SOCKET },
+    m_listening{ false }
+{
+    if (nullptr == session || max_batch_size < 1 || workers < 1)
+    {
+        throw std::invalid_argument(
+            std::string("neurons::Batching_server: a session, batches of at least a sample and a worker are expected"));
+    }
+
+    for (lint i = 0; i < workers; ++i)
+    {
+        this->m_workers.emplace_back([this] { this->run_batches(); });
+    }
+}
+
+template <typename dtype>
+neurons::Batching_server<dtype>::~Batching_server()
+{
+    this->stop();
+}
+
+template <typename dtype>
+std::future<neurons::TMatrix<dtype>> neurons::Batching_server<dtype>::submit(const TMatrix<dtype> & input)
+{
+    if (input.shape().size() != this->m_session->input_size())
+    {
+        throw std::invalid_argument(std::string("neurons::Batching_server::submit: size of the sample does not match the network"));
+    }
+
+    std::unique_ptr<Request> request = std::make_unique<Request>();
+    request->m_input = input;
+    std::future<TMatrix<dtype>> prediction = request->m_prediction.get_future();
+
+    {
+        std::lock_guard<std::mutex> lock{ this->m_mutex };
+        if (this->m_stop)
+        {
+            throw std::invalid_argument(std::string("neurons::Batching_server::submit: the server is stopped"));
+        }
+
+        request->m_submitted = std::chrono::steady_clock::now();
+        this->m_queue.push_back(std::move(request));
+
+        // A worker starts waiting for the first request of a batch, and takes the batch once it is full
+        lint queued = this->m_queue.size();
+        if (1 == queued || this->m_max_batch_size == queued)
+        {
+            this->m_cv.notify_all();
+        }
+    }
+
+    return prediction;
+}
+
+template <typename dtype>
+neurons::TMatrix<dtype> neurons::Batching_server<dtype>::predict(const TMatrix<dtype> & input)
+{
+    return this->submit(input).get();
+}
+
+template <typename dtype>
+void neurons::Batching_server<dtype>::run_batches()
+{
+    lint in_size = this->m_session->input_size();
+    lint out_size = this->m_session->output_size();
+
+    // Buffers of batches, they are reused from batch to batch
+    std::vector<std::unique_ptr<Request>> batch;
+    std::vector<dtype> inputs;
+    std::vector<dtype> outputs;
+
+    while (true)
+    {
+        batch.clear();
+        {
+            std::unique_lock<std::mutex> lock{ this->m_mutex };
+            while (true)
+            {
+                if (this->m_queue.empty())
+                {
+                    if (this->m_stop)
+                    {
+                        return;
+                    }
+                    this->m_cv.wait(lock);
+                    continue;
+                }
+
+                // Requests left when the server stops are answered without waiting
+                if (this->m_stop || static_cast<lint>(this->m_queue.size()) >= this->m_max_batch_size)
+                {
+                    break;
+                }
+
+                std::chrono::steady_clock::time_point deadline = this->m_queue.front()->m_submitted + this->m_latency_budget;
+                if (std::chrono::steady_clock::now() >= deadline)
+                {
+                    break;
+                }
+                this->m_cv.wait_until(lock, deadline);
+            }
+
+            lint samples = std::min<lint>(this->m_queue.size(), this->m_max_batch_size);
+            for (lint i = 0; i < samples; ++i)
+            {
+                batch.push_back(std::move(this->m_queue.front()));
+                this->m_queue.pop_front();
+            }
+
+            // Requests beyond a full batch are left to another worker
+            if (!this->m_queue.empty())
+            {
+                this->m_cv.notify_one();
+            }
+        }
+
+        lint samples = batch.size();
+        inputs.resize(samples * in_size);
+        outputs.resize(samples * out_size);
+        for (lint i = 0; i < samples; ++i)
+        {
+            std::copy(batch[i]->m_input.m_data, batch[i]->m_input.m_data + in_size, inputs.data() + i * in_size);
+        }
+
+        try
+        {
+            this->m_session->predict(samples, inputs.data(), outputs.data());
+        }
+        catch (...)
+        {
+            for (std::unique_ptr<Request> & request : batch)
+            {
+                request->m_prediction.set_exception(std::current_exception());
+            }
+            continue;
+        }
+
+        // Counted before callers get their answers, so the counters include every request answered
+        this->record_batch(batch, std::chrono::steady_clock::now());
+
+        for (lint i = 0; i < samples; ++i)
+        {
+            TMatrix<dtype> prediction{ Shape{ out_size } };
+            std::copy(outputs.data() + i * out_size, outputs.data() + (i + 1) * out_size, prediction.m_data);
+            batch[i]->m_prediction.set_value(std::move(prediction));
+        }
+    }
+}
+
+template <typename dtype>
+void neurons::Batching_server<dtype>::record_batch(
+    const std::vector<std::unique_ptr<Request>> & batch, std::chrono::steady_clock::time_point answered)
+{
+    std::lock_guard<std::mutex> lock{ this->m_stats_mutex };
+
+    ++this->m_batches;
+    this->m_requests += batch.size();
+
+    for (const std::unique_ptr<Request> & request : batch)
+    {
+        double latency = std::chrono::duration<double, std::micro>(answered - request->m_submitted).count();
+        if (static_cast<lint>(this->m_latencies.size()) < LATENCY_WINDOW)
+        {
+            this->m_latencies.push_back(latency);
+        }
+        else
+        {
+            this->m_latencies[this->m_next_latency] = latency;
+        }
+        this->m_next_latency = (this->m_next_latency + 1) % LATENCY_WINDOW;
+    }
+}
+
+template <typename dtype>
+neurons::Batching_stats neurons::Batching_server<dtype>::stats() const
+{
+    std::vector<double> latencies;
+    Batching_stats stats;
+    {
+        std::lock_guard<std::mutex> lock{ this->m_stats_mutex };
+        latencies = this->m_latencies;
+        stats.m_requests = this->m_requests;
+        stats.m_batches = this->m_batches;
+        stats.m_refused = this->m_refused;
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->m_stats_start).count();
+        stats.m_throughput = seconds > 0 ? this->m_requests / seconds : 0;
+    }
+
+    stats.m_mean_batch_size = stats.m_batches > 0 ? static_cast<double>(stats.m_requests) / stats.m_batches : 0;
+    stats.m_p50_us = percentile(latencies, 0.5);
+    stats.m_p99_us = percentile(latencies, 0.99);
+
+    return stats;
+}
+
+template <typename dtype>
+void neurons::Batching_server<dtype>::reset_stats()
+{
+    std::lock_guard<std::mutex> lock{ this->m_stats_mutex };
+    this->m_stats_start = std::chrono::steady_clock::now();
+    this->m_requests = 0;
+    this->m_batches = 0;
+    this->m_refused = 0;
+    this->m_latencies.clear();
+    this->m_next_latency = 0;
+}
+
+template <typename dtype>
+bool neurons::Batching_server<dtype>::listen(const std::string & socket_path)
+{
+    {
+        std::lock_guard<std::mutex> lock{ this->m_mutex };
+        if (this->m_stop || this->m_listening || this->m_acceptor.joinable())
+        {
+            return false;
+        }
+    }
+
+    sockaddr_un address;
+    if (!start_sockets() || !socket_address(socket_path, address))
+    {
+        return false;
+    }
+
+    lint listener = socket_of(socket(AF_UNIX, SOCK_STREAM, 0));
+    if (NO_SOCKET == listener)
+    {
+        return false;
+    }
+
+    // A socket left by a server before is replaced
+    std::remove(socket_path.c_str());
+    if (0 != bind(handle_of(listener), reinterpret_cast<const sockaddr *>(&address), sizeof(address)) ||
+        0 != ::listen(handle_of(listener), SOMAXCONN))
+    {
+        close_socket(listener);
+        return false;
+    }
+
+    this->m_socket_path = socket_path;
+    this->m_listener = listener;
+    this->m_listening = true;
+    this->m_acceptor = std::thread{ [this] { this->accept_connections(); } };
+
+    return true;
+}
+
+template <typename dtype>
+void neurons::Batching_server<dtype>::accept_connections()
+{
+    while (this->m_listening)
+    {
+        // Wait for connections a while at a time, so the acceptor notices the server stopping
+        if (poll_socket(this->m_listener, ACCEPT_POLL_MS) <= 0)
+        {
+            continue;
+        }
+
+        lint connection = socket_of(accept(handle_of(this->m_listener), nullptr, nullptr));
+        if (NO_SOCKET == connection)
+        {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock{ this->m_connections_mutex };
+        if (!this->m_listening)
+        {
+            close_socket(connection);
+            break;
+        }
+        this->m_connections.insert(connection);
+        std::thread{ [this, connection] { this->serve_connection(connection); } }.detach();
+    }
+}
+
+template <typename dtype>
+void neurons::Batching_server<dtype>::serve_connection(lint connection)
+{
+    lint in_size = this->m_session->input_size();
+    TMatrix<dtype> input{ this->m_session->input_shape() };
+
+    while (true)
+    {
+        std::uint64_t elements;
+        if (!receive_all(connection, &elements, sizeof(elements)))
+        {
+            break;
+        }
+
+        if (static_cast<lint>(elements) != in_size)
+        {
+            {
+                std::lock_guard<std::mutex> lock{ this->m_stats_mutex };
+                ++this->m_refused;
+            }
+
+            // Elements of a count this large cannot be skipped, and the next request would be read
+            // from the middle of them: the connection is closed instead
+            if (elements > static_cast<std::uint64_t>(std::numeric_limits<lint>::max()) / sizeof(dtype))
+            {
+                break;
+            }
+
+            std::uint64_t none = 0;
+            if (!skip(connection, static_cast<lint>(elements * sizeof(dtype))) || !send_all(connection, &none, sizeof(none)))
+            {
+                break;
+            }
+            continue;
+        }
+
+        if (!receive_all(connection, input.m_data, in_size * sizeof(dtype)))
+        {
+            break;
+        }
+
+        TMatrix<dtype> prediction;
+        try
+        {
+            prediction = this->predict(input);
+        }
+        catch (std::exception &)
+        {
+            // The server is stopped
+            break;
+        }
+
+        std::uint64_t out_elements = prediction.shape().size();
+        if (!send_all(connection, &out_elements, sizeof(out_elements)) ||
+            !send_all(connection, prediction.m_data, out_elements * sizeof(dtype)))
+        {
+            break;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock{ this->m_connections_mutex };
+    this->m_connections.erase(connection);
+    close_socket(connection);
+    this->m_connections_cv.notify_all();
+}
+
+template <typename dtype>
+void neurons::Batching_server<dtype>::stop()
+{
+    // No connections are accepted any more
+    if (this->m_acceptor.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock{ this->m_connections_mutex };
+            this->m_listening = false;
+        }
+        this->m_acceptor.join();
+        close_socket(this->m_listener);
+        this->m_listener = NO_SOCKET;
+        std::remove(this->m_socket_path.c_str());
+    }
+
+    // Connections are closed, requests they are waiting for are answered by the workers still running
+    {
+        std::unique_lock<std::mutex> lock{ this->m_connections_mutex };
+        for (lint connection : this->m_connections)
+        {
+            shutdown_socket(connection);
+        }
+        this->m_connections_cv.wait(lock, [this] { return this->m_connections.empty(); });
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{ this->m_mutex };
+        this->m_stop = true;
+    }
+    this->m_cv.notify_all();
+
+    for (std::thread & worker : this->m_workers)
+    {
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+    }
+}
+
+
+template <typename dtype>
+neurons::Batching_client<dtype>::Batching_client(const std::string & socket_path)
+    : m_socket{ NO_SOCKET }
+{
+    sockaddr_un address;
+    if (!start_sockets() || !socket_address(socket_path, address))
+    {
+        throw std::invalid_argument(std::string("neurons::Batching_client: not a socket path: ") + socket_path);
+    }
+
+    this->m_socket = socket_of(socket(AF_UNIX, SOCK_STREAM, 0));
+    if (NO_SOCKET == this->m_socket ||
+        0 != connect(handle_of(this->m_socket), reinterpret_cast<const sockaddr *>(&address), sizeof(address)))
+    {
+        if (NO_SOCKET != this->m_socket)
+        {
+            close_socket(this->m_socket);
+        }
+        throw std::invalid_argument(std::string("neurons::Batching_client: no server listens on ") + socket_path);
+    }
+}
+
+template <typename dtype>
+neurons::Batching_client<dtype>::~Batching_client()
+{
+    close_socket(this->m_socket);
+}
+
+template <typename dtype>
+neurons::TMatrix<dtype> neurons::Batching_client<dtype>::predict(const TMatrix<dtype> & input)
+{
+    std::uint64_t elements = input.shape().size();
+    if (!send_all(this->m_socket, &elements, sizeof(elements)) ||
+        !send_all(this->m_socket, input.m_data, elements * sizeof(dtype)) ||
+        !receive_all(this->m_socket, &elements, sizeof(elements)))
+    {
+        throw std::invalid_argument(std::string("neurons::Batching_client::predict: connection to the server lost"));
+    }
+
+    if (0 == elements)
+    {
+        throw std::invalid_argument(std::string("neurons::Batching_client::predict: size of the sample does not match the network"));
+    }
+
+    TMatrix<dtype> prediction{ Shape{ static_cast<lint>(elements) } };
+    if (!receive_all(this->m_socket, prediction.m_data, elements * sizeof(dtype)))
+    {
+        throw std::invalid_argument(std::string("neurons::Batching_client::predict: connection to the server lost"));
+    }
+
+    return prediction;
+}
+
+template class neurons::Batching_server<float>;
+template class neurons::Batching_server<double>;
+template class neurons::Batching_client<float>;
+template class neurons::Batching_client<double>;
@@ -0,0 +1,153 @@
+#pragma once
+#include "Inference_session.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace neurons
+{
+    // Counters of a batching server since it started or since they were reset
+    struct Batching_stats
+    {
+        // Requests answered and the batches they were answered in
+        lint m_requests;
+        lint m_batches;
+        double m_mean_batch_size;
+        // Requests of the socket refused because their size does not match the network
+        lint m_refused;
+        // Latency of requests from their submission to their answer, over the latest requests (see LATENCY_WINDOW)
+        double m_p50_us;
+        double m_p99_us;
+        // Requests answered per second
+        double m_throughput;
+    };
+
+    /*
+    A front-end of an inference session which coalesces single samples predicted by many callers into batches.
+
+    Requests wait in a queue until they are taken into a batch: a batch is run as soon as it has max_batch_size
+    requests, or once its first request has waited the latency budget for others to join it. Batches are run
+    on the shared session by workers threads (each one with its own workspace, see Inference_session) and
+    predictions are handed back to the callers of each request.
+
+    Callers in the process submit samples directly (submit and predict). Other processes connect to a Unix
+    domain socket the server listens on (see listen and Batching_client). Each connection is served by a
+    thread which submits its requests one after another, so requests of concurrent connections are batched
+    together. Integers of the socket are 64 bit in the byte order of the host:
+        request: <number of elements><elements of dtype>
+        answer:  <number of elements><elements of dtype>, no elements if the request is refused
+    A request of more elements than a 64 bit signed integer can count the bytes of is not answered,
+    the connection is closed.
+    */
+    template <typename dtype = double>
+    class Batching_server
+    {
+    public:
+        // Number of latest requests percentiles of latency are taken over
+        static const lint LATENCY_WINDOW = 65536;
+
+    private:
+        struct Request
+        {
+            TMatrix<dtype> m_input;
+            std::promise<TMatrix<dtype>> m_prediction;
+            std::chrono::steady_clock::time_point m_submitted;
+        };
+
+        std::shared_ptr<const Inference_session<dtype>> m_session;
+        lint m_max_batch_size;
+        std::chrono::microseconds m_latency_budget;
+
+        // Requests not taken into a batch yet
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::deque<std::unique_ptr<Request>> m_queue;
+        bool m_stop;
+        std::vector<std::thread> m_workers;
+
+        mutable std::mutex m_stats_mutex;
+        std::chrono::steady_clock::time_point m_stats_start;
+        lint m_requests;
+        lint m_batches;
+        lint m_refused;
+        // Latencies in microseconds of the latest requests, a ring of up to LATENCY_WINDOW elements
+        std::vector<double> m_latencies;
+        size_t m_next_latency;
+
+        // The socket listened on, its connections and the threads serving them
+        std::string m_socket_path;
+        lint m_listener;
+        std::atomic<bool> m_listening;
+        std::thread m_acceptor;
+        std::mutex m_connections_mutex;
+        std::condition_variable m_connections_cv;
+        std::set<lint> m_connections;
+
+    public:
+        // A server of the session, a request waits at most latency_budget_us microseconds for its batch to fill up
+        Batching_server(std::shared_ptr<const Inference_session<dtype>> session,
+            lint max_batch_size, lint latency_budget_us, lint workers = 1);
+
+        // Requests submitted before are answered before the server is destroyed
+        ~Batching_server();
+
+        Batching_server(const Batching_server & other) = delete;
+        Batching_server & operator = (const Batching_server & other) = delete;
+
+        // Submit a sample of the input size of the session, its prediction is a vector of the output size.
+        // std::invalid_argument is thrown if the size does not match or the server is stopped.
+        std::future<TMatrix<dtype>> submit(const TMatrix<dtype> & input);
+
+        // Submit a sample and wait for its prediction
+        TMatrix<dtype> predict(const TMatrix<dtype> & input);
+
+        // Serve requests on a Unix domain socket created at socket_path (a file there is replaced) until
+        // the server stops, false if the server is listening already or the socket cannot be created
+        bool listen(const std::string & socket_path);
+
+        // Stop listening, close connections and answer the requests submitted so far
+        void stop();
+
+        Batching_stats stats() const;
+
+        void reset_stats();
+
+    private:
+        // Take batches from the queue and run them until the server stops and the queue is empty
+        void run_batches();
+
+        void record_batch(const std::vector<std::unique_ptr<Request>> & batch, std::chrono::steady_clock::time_point answered);
+
+        void accept_connections();
+
+        void serve_connection(lint connection);
+    };
+
+    // A connection to a batching server listening on a Unix domain socket, its requests are sent one after another
+    template <typename dtype = double>
+    class Batching_client
+    {
+    private:
+        lint m_socket;
+
+    public:
+        // std::invalid_argument is thrown if the server cannot be connected to
+        explicit Batching_client(const std::string & socket_path);
+
+        ~Batching_client();
+
+        Batching_client(const Batching_client & other) = delete;
+        Batching_client & operator = (const Batching_client & other) = delete;
+
+        // Prediction of a sample by the server.
+        // std::invalid_argument is thrown if the server refuses the sample or the connection is lost.
+        TMatrix<dtype> predict(const TMatrix<dtype> & input);
+    };
+}
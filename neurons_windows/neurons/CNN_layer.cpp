@@ -1,13 +1,15 @@
 #include "CNN_layer.h"
+#include "TMatrix_View.h"
 
 
-std::string neurons::CNN_layer::from_binary_data(
-    char * binary_data, lint & data_size, TMatrix<>& w, TMatrix<>& b, lint & stride, lint & padding,
-    std::unique_ptr<Activation>& act_func, std::unique_ptr<ErrorFunction>& err_func, char *& residual_data, lint & residual_len)
+template <typename dtype>
+std::string neurons::CNN_layer<dtype>::from_binary_data(
+    char * binary_data, lint & data_size, TMatrix<dtype>& w, TMatrix<dtype>& b, lint & stride, lint & padding,
+    std::unique_ptr<Activation<dtype>>& act_func, std::unique_ptr<ErrorFunction<dtype>>& err_func, char *& residual_data, lint & residual_len)
 {
     char * position;
     lint re_len;
-    std::string nn_type = neurons::Traditional_NN_layer::from_binary_data(binary_data, data_size, w, b, act_func, err_func, position, re_len);
+    std::string nn_type = neurons::Traditional_NN_layer<dtype>::from_binary_data(binary_data, data_size, w, b, act_func, err_func, position, re_len);
 
     if ("FCNN" == nn_type)
     {
@@ -28,10 +30,12 @@ std::string neurons::CNN_layer::from_binary_data(
 
 }
 
-neurons::CNN_layer::CNN_layer()
+template <typename dtype>
+neurons::CNN_layer<dtype>::CNN_layer()
 {}
 
-neurons::CNN_layer::CNN_layer(
+template <typename dtype>
+neurons::CNN_layer<dtype>::CNN_layer(
     double mmt_rate,
     lint rows,
     lint cols,
@@ -42,81 +46,94 @@ neurons::CNN_layer::CNN_layer(
     lint stride,
     lint padding,
     lint threads,
-    neurons::Activation *act_func,
-    neurons::ErrorFunction *err_func)
+    neurons::Activation<dtype> *act_func,
+    neurons::ErrorFunction<dtype> *err_func)
     :
-    Traditional_NN_layer(mmt_rate, neurons::Shape{ filter_rows, filter_cols, chls, filters }, neurons::Shape{ 1, filters }, threads, act_func, err_func ),
+    Traditional_NN_layer<dtype>(mmt_rate, neurons::Shape{ filter_rows, filter_cols, chls, filters }, neurons::Shape{ 1, filters }, threads, act_func, err_func ),
     m_conv2d{ neurons::Shape{ 1, rows, cols, chls }, neurons::Shape{ filter_rows, filter_cols, chls, filters }, stride, stride, padding, padding }
 {
     double var = static_cast<double>(100) / this->m_w.shape().size();
-    this->m_w.gaussian_random(0, var);
-    this->m_b.gaussian_random(0, var);
+    // Drawn in double, so layers of any precision start from the same weights with the same seed
+    this->m_w = TMatrix<dtype>{ TMatrix<>{ this->m_w.shape() }.gaussian_random(0, var) };
+    this->m_b = TMatrix<dtype>{ TMatrix<>{ this->m_b.shape() }.gaussian_random(0, var) };
 
     for (lint i = 0; i < threads; ++i)
     {
-        this->m_ops[i] = std::make_shared<CNN_layer_op>(this->m_conv2d, this->m_w, this->m_b, this->m_act_func, this->m_err_func);
+        this->m_ops[i] = std::make_shared<CNN_layer_op<dtype>>(this->m_conv2d, this->m_w, this->m_b, this->m_act_func, this->m_err_func);
     }
 }
 
-neurons::CNN_layer::CNN_layer(
+template <typename dtype>
+neurons::CNN_layer<dtype>::CNN_layer(
     double mmt_rate, lint rows, lint cols, lint chls, lint stride, lint padding, lint threads,
-    const TMatrix<>& w, const TMatrix<>& b, 
-    std::unique_ptr<Activation>& act_func, std::unique_ptr<ErrorFunction>& err_func)
+    TMatrix<dtype> w, TMatrix<dtype> b,
+    std::unique_ptr<Activation<dtype>>& act_func, std::unique_ptr<ErrorFunction<dtype>>& err_func)
     :
-    Traditional_NN_layer(mmt_rate, threads, w, b, act_func, err_func),
+    Traditional_NN_layer<dtype>(mmt_rate, threads, std::move(w), std::move(b), act_func, err_func),
     m_conv2d{
         neurons::Shape{ 1, rows, cols, chls },
-        neurons::Shape{ w.shape()[0], w.shape()[1], w.shape()[2], w.shape()[3] }, stride, stride, padding, padding }
+        neurons::Shape{ this->m_w.shape()[0], this->m_w.shape()[1], this->m_w.shape()[2], this->m_w.shape()[3] },
+        stride, stride, padding, padding }
 {
     for (lint i = 0; i < threads; ++i)
     {
-        this->m_ops[i] = std::make_shared<CNN_layer_op>(this->m_conv2d, this->m_w, this->m_b, this->m_act_func, this->m_err_func);
+        this->m_ops[i] = std::make_shared<CNN_layer_op<dtype>>(this->m_conv2d, this->m_w, this->m_b, this->m_act_func, this->m_err_func);
     }
 }
 
 
-neurons::CNN_layer::CNN_layer(const CNN_layer & other)
+template <typename dtype>
+neurons::CNN_layer<dtype>::CNN_layer(const CNN_layer & other)
     : 
-    Traditional_NN_layer(other),
+    Traditional_NN_layer<dtype>(other),
     m_conv2d{ other.m_conv2d }
 {
     for (size_t i = 0; i < other.m_ops.size(); ++i)
     {
-        this->m_ops[i] = std::make_shared<CNN_layer_op>(
-            *(dynamic_cast<CNN_layer_op*>(other.m_ops[i].get())));
+        this->m_ops[i] = std::make_shared<CNN_layer_op<dtype>>(
+            *(dynamic_cast<CNN_layer_op<dtype>*>(other.m_ops[i].get())));
     }
+
+    this->share_w_and_b_with_ops();
 }
 
 
-neurons::CNN_layer::CNN_layer(CNN_layer && other)
-    : Traditional_NN_layer(other),
+template <typename dtype>
+neurons::CNN_layer<dtype>::CNN_layer(CNN_layer && other)
+    : Traditional_NN_layer<dtype>(other),
     m_conv2d{ std::move(other.m_conv2d) }
 {
     for (size_t i = 0; i < other.m_ops.size(); ++i)
     {
         this->m_ops[i] = std::move(other.m_ops[i]);
     }
+
+    this->share_w_and_b_with_ops();
 }
 
 
-neurons::CNN_layer & neurons::CNN_layer::operator = (const CNN_layer & other)
+template <typename dtype>
+neurons::CNN_layer<dtype> & neurons::CNN_layer<dtype>::operator = (const CNN_layer & other)
 {
-    NN_layer::operator = (other);
+    Traditional_NN_layer<dtype>::operator = (other);
     this->m_conv2d = other.m_conv2d;
 
     for (size_t i = 0; i < other.m_ops.size(); ++i)
     {
-        this->m_ops[i] = std::make_shared<CNN_layer_op>(
-            *(dynamic_cast<CNN_layer_op*>(other.m_ops[i].get())));
+        this->m_ops[i] = std::make_shared<CNN_layer_op<dtype>>(
+            *(dynamic_cast<CNN_layer_op<dtype>*>(other.m_ops[i].get())));
     }
 
+    this->share_w_and_b_with_ops();
+
     return *this;
 }
 
 
-neurons::CNN_layer & neurons::CNN_layer::operator = (CNN_layer && other)
+template <typename dtype>
+neurons::CNN_layer<dtype> & neurons::CNN_layer<dtype>::operator = (CNN_layer && other)
 {
-    NN_layer::operator=(other);
+    Traditional_NN_layer<dtype>::operator=(std::move(other));
     this->m_conv2d = std::move(other.m_conv2d);
 
     for (size_t i = 0; i < other.m_ops.size(); ++i)
@@ -124,19 +141,23 @@ neurons::CNN_layer & neurons::CNN_layer::operator = (CNN_layer && other)
         this->m_ops[i] = std::move(other.m_ops[i]);
     }
 
+    this->share_w_and_b_with_ops();
+
     return *this;
 }
 
 
-neurons::Shape neurons::CNN_layer::output_shape() const
+template <typename dtype>
+neurons::Shape neurons::CNN_layer<dtype>::output_shape() const
 {
     return this->m_conv2d.get_output_shape();
 }
 
-std::unique_ptr<char[]> neurons::CNN_layer::to_binary_data(lint & data_size) const
+template <typename dtype>
+std::unique_ptr<char[]> neurons::CNN_layer<dtype>::to_binary_data(lint & data_size) const
 {
     lint size;
-    std::unique_ptr<char[]> l_d = Traditional_NN_layer::to_binary_data(size);
+    std::unique_ptr<char[]> l_d = Traditional_NN_layer<dtype>::to_binary_data(size);
 
     char * layer_data = new char[size + 2 * sizeof(lint)];
     memcpy(layer_data, l_d.get(), size);
@@ -155,50 +176,79 @@ std::unique_ptr<char[]> neurons::CNN_layer::to_binary_data(lint & data_size) con
     return std::unique_ptr<char[]>(layer_data);
 }
 
+template <typename dtype>
+neurons::Model_layer neurons::CNN_layer<dtype>::to_model_layer() const
+{
+    Model_layer layer = Traditional_NN_layer<dtype>::to_model_layer();
+    layer.m_params = { this->m_conv2d.r_stride(), this->m_conv2d.r_zero_p() };
+
+    return layer;
+}
+
 //////////////////////////////////////////////////
-neurons::CNN_layer_op::CNN_layer_op()
+template <typename dtype>
+neurons::CNN_layer_op<dtype>::CNN_layer_op()
 {}
 
-neurons::CNN_layer_op::CNN_layer_op(
-    const Conv_2d & conv2d,
-    const TMatrix<> & w,
-    const TMatrix<> & b,
-    const std::unique_ptr<Activation>& act_func,
-    const std::unique_ptr<ErrorFunction>& err_func)
+template <typename dtype>
+neurons::CNN_layer_op<dtype>::CNN_layer_op(
+    const Conv_2d<dtype> & conv2d,
+    const TMatrix<dtype> & w,
+    const TMatrix<dtype> & b,
+    const std::unique_ptr<Activation<dtype>>& act_func,
+    const std::unique_ptr<ErrorFunction<dtype>>& err_func)
     :
-    Traditional_NN_layer_op(w, b, act_func, err_func),
+    Traditional_NN_layer_op<dtype>(w, b, act_func, err_func),
     m_conv2d{ conv2d }
 {}
 
-neurons::CNN_layer_op::CNN_layer_op(const CNN_layer_op & other)
+template <typename dtype>
+neurons::CNN_layer_op<dtype>::CNN_layer_op(const CNN_layer_op & other)
     :
-    Traditional_NN_layer_op(other),
+    Traditional_NN_layer_op<dtype>(other),
     m_conv2d{ other.m_conv2d }
 {}
 
-neurons::CNN_layer_op::CNN_layer_op(CNN_layer_op && other)
+template <typename dtype>
+neurons::CNN_layer_op<dtype>::CNN_layer_op(CNN_layer_op && other)
     :
-    Traditional_NN_layer_op(other),
+    Traditional_NN_layer_op<dtype>(other),
     m_conv2d{ std::move(other.m_conv2d) }
 {}
 
-neurons::CNN_layer_op & neurons::CNN_layer_op::operator = (const CNN_layer_op & other)
+template <typename dtype>
+neurons::CNN_layer_op<dtype> & neurons::CNN_layer_op<dtype>::operator = (const CNN_layer_op & other)
 {
-    NN_layer_op::operator = (other);
+    NN_layer_op<dtype>::operator = (other);
     this->m_conv2d = other.m_conv2d;
 
     return *this;
 }
 
-neurons::CNN_layer_op & neurons::CNN_layer_op::operator = (CNN_layer_op && other)
+template <typename dtype>
+neurons::CNN_layer_op<dtype> & neurons::CNN_layer_op<dtype>::operator = (CNN_layer_op && other)
 {
-    NN_layer_op::operator = (other);
+    NN_layer_op<dtype>::operator = (other);
     this->m_conv2d = std::move(other.m_conv2d);
 
     return *this;
 }
 
-std::vector<neurons::TMatrix<>> neurons::CNN_layer_op::batch_forward_propagate(const std::vector<TMatrix<>>& inputs)
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> neurons::CNN_layer_op<dtype>::batch_forward_propagate(const std::vector<TMatrix<dtype>>& inputs)
+{
+    return this->batch_forward_propagate(neurons::matrix_pointers(inputs));
+}
+
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> neurons::CNN_layer_op<dtype>::batch_forward_propagate(
+    const std::vector<TMatrix<dtype>>& inputs, const std::vector<TMatrix<dtype>>& targets)
+{
+    return this->batch_forward_propagate(neurons::matrix_pointers(inputs), neurons::matrix_pointers(targets));
+}
+
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> neurons::CNN_layer_op<dtype>::batch_forward_propagate(const std::vector<const TMatrix<dtype> *> & inputs)
 {
     if (nullptr == this->m_act_func)
     {
@@ -208,29 +258,30 @@ std::vector<neurons::TMatrix<>> neurons::CNN_layer_op::batch_forward_propagate(c
 
     size_t samples = inputs.size();
 
-    std::vector<neurons::TMatrix<>> outputs{ samples };
+    std::vector<neurons::TMatrix<dtype>> outputs{ samples };
     this->m_act_diffs.resize(samples);
-    this->m_conv_to_x_diffs.resize(samples);
-    this->m_conv_to_w_diffs.resize(samples);
+    this->m_x.resize(samples);
 
     for (size_t i = 0; i < samples; ++i)
     {
-        // Convolutional multiplication of this sample
-        TMatrix<> conv_product = this->m_conv2d(inputs[i], this->m_w, this->m_b);
+        // Keep the input for back propagation
+        this->m_x[i] = *inputs[i];
 
-        this->m_conv_to_x_diffs[i] = this->m_conv2d.get_diff_to_input();
-        this->m_conv_to_w_diffs[i] = this->m_conv2d.get_diff_to_weights();
+        // Convolutional multiplication of this sample
+        this->m_conv2d.product(this->m_product, this->m_x[i], *this->m_w);
 
-        // Execute activation function of this sample
-        this->m_act_func->operator()(outputs[i], this->m_act_diffs[i], conv_product);
+        // Add the bias and execute activation function of this sample
+        this->m_act_func->operator()(
+            outputs[i], this->m_act_diffs[i], this->m_product.shape(), this->m_product.m_data, *this->m_b);
     }
 
     // std::cout << outputs[0];
     return outputs;
 }
 
-std::vector<neurons::TMatrix<>> neurons::CNN_layer_op::batch_forward_propagate(
-    const std::vector<TMatrix<>>& inputs, const std::vector<TMatrix<>>& targets)
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> neurons::CNN_layer_op<dtype>::batch_forward_propagate(
+    const std::vector<const TMatrix<dtype> *> & inputs, const std::vector<const TMatrix<dtype> *> & targets)
 {
     if (nullptr == this->m_err_func)
     {
@@ -240,31 +291,34 @@ std::vector<neurons::TMatrix<>> neurons::CNN_layer_op::batch_forward_propagate(
 
     size_t samples = inputs.size();
 
-    std::vector<neurons::TMatrix<>> outputs{ samples };
+    std::vector<neurons::TMatrix<dtype>> outputs{ samples };
     this->m_act_diffs.resize(samples);
-    this->m_conv_to_x_diffs.resize(samples);
-    this->m_conv_to_w_diffs.resize(samples);
+    this->m_x.resize(samples);
 
     for (size_t i = 0; i < samples; ++i)
     {
-        // Convolutional multiplication of this sample
-        TMatrix<> conv_product = this->m_conv2d(inputs[i], this->m_w, this->m_b);
+        // Keep the input for back propagation
+        this->m_x[i] = *inputs[i];
 
-        this->m_conv_to_x_diffs[i] = this->m_conv2d.get_diff_to_input();
-        this->m_conv_to_w_diffs[i] = this->m_conv2d.get_diff_to_weights();
+        // Convolutional multiplication of this sample
+        this->m_conv2d.product(this->m_product, this->m_x[i], *this->m_w);
 
-        // Execute activation function of this sample
-        this->m_loss += this->m_err_func->operator()(outputs[i], this->m_act_diffs[i], targets[i], conv_product);
+        // Add the bias and execute activation function of this sample
+        this->m_loss += this->m_err_func->operator()(outputs[i], this->m_act_diffs[i], *targets[i],
+            this->m_product.shape(), this->m_product.m_data, *this->m_b);
     }
 
     return outputs;
 }
 
 
-std::vector<neurons::TMatrix<>> neurons::CNN_layer_op::batch_back_propagate(double l_rate, const std::vector<TMatrix<>> &E_to_y_diffs)
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> neurons::CNN_layer_op<dtype>::batch_back_propagate(double l_rate, const std::vector<TMatrix<dtype>> &E_to_y_diffs)
 {
+    this->prepare_gradients();
+
     size_t samples = E_to_y_diffs.size();
-    std::vector<TMatrix<>> E_to_x_diffs{ samples };
+    std::vector<TMatrix<dtype>> E_to_x_diffs{ samples };
 
     this->m_w_gradient = 0;
     this->m_b_gradient = 0;
@@ -273,17 +327,16 @@ std::vector<neurons::TMatrix<>> neurons::CNN_layer_op::batch_back_propagate(doub
     {
         // Multiply element by element
         // dE/dz = (dy/dz) * (dE/dy)
-        neurons::TMatrix<> diff_E_to_z = neurons::multiply(this->m_act_diffs[i], E_to_y_diffs[i]);
+        neurons::TMatrix<dtype> diff_E_to_z = neurons::multiply(this->m_act_diffs[i], E_to_y_diffs[i]);
 
         // dE/dx = (dz/dx) * (dE/dz) 
-        E_to_x_diffs[i] = neurons::matrix_multiply(this->m_conv_to_x_diffs[i], diff_E_to_z.right_extend_shape(), 3, 4);
-        E_to_x_diffs[i].reshape(E_to_x_diffs[i].shape().sub_shape(0, E_to_x_diffs[i].shape().dim() - 2));
+        E_to_x_diffs[i] = this->m_conv2d.diff_to_input(diff_E_to_z, *this->m_w);
         
         // Update weights
-        this->m_w_gradient += neurons::matrix_multiply(this->m_conv_to_w_diffs[i], diff_E_to_z, 2, 3);
+        this->m_conv2d.add_diff_to_weights(this->m_w_gradient, this->m_x[i], diff_E_to_z);
 
         // Update the bias
-        this->m_b_gradient += diff_E_to_z.reduce_mean(1).reduce_mean(1);
+        this->m_b_gradient += neurons::reduce_mean(neurons::view(diff_E_to_z), { 1, 2 });
     }
 
     this->m_w_gradient *= l_rate;
@@ -293,10 +346,13 @@ std::vector<neurons::TMatrix<>> neurons::CNN_layer_op::batch_back_propagate(doub
 }
 
 
-std::vector<neurons::TMatrix<>> neurons::CNN_layer_op::batch_back_propagate(double l_rate)
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> neurons::CNN_layer_op<dtype>::batch_back_propagate(double l_rate)
 {
-    size_t samples = this->m_conv_to_x_diffs.size();
-    std::vector<TMatrix<>> E_to_x_diffs{ samples };
+    this->prepare_gradients();
+
+    size_t samples = this->m_x.size();
+    std::vector<TMatrix<dtype>> E_to_x_diffs{ samples };
 
     this->m_w_gradient = 0;
     this->m_b_gradient = 0;
@@ -304,14 +360,13 @@ std::vector<neurons::TMatrix<>> neurons::CNN_layer_op::batch_back_propagate(doub
     for (size_t i = 0; i < samples; ++i)
     {
         // dE/dx = (dz/dx) * (dE/dz) 
-        E_to_x_diffs[i] = neurons::matrix_multiply(this->m_conv_to_x_diffs[i], this->m_act_diffs[i].right_extend_shape(), 3, 4);
-        E_to_x_diffs[i].reshape(E_to_x_diffs[i].shape().sub_shape(0, E_to_x_diffs[i].shape().dim() - 2));
+        E_to_x_diffs[i] = this->m_conv2d.diff_to_input(this->m_act_diffs[i], *this->m_w);
 
         // Update weights
-        this->m_w_gradient += neurons::matrix_multiply(this->m_conv_to_w_diffs[i], this->m_act_diffs[i], 2, 3);
+        this->m_conv2d.add_diff_to_weights(this->m_w_gradient, this->m_x[i], this->m_act_diffs[i]);
 
         // Update the bias
-        this->m_b_gradient += this->m_act_diffs[i].reduce_mean(1).reduce_mean(1);
+        this->m_b_gradient += neurons::reduce_mean(neurons::view(this->m_act_diffs[i]), { 1, 2 });
     }
 
     this->m_w_gradient *= l_rate;
@@ -320,7 +375,13 @@ std::vector<neurons::TMatrix<>> neurons::CNN_layer_op::batch_back_propagate(doub
     return E_to_x_diffs;
 }
 
-neurons::Shape neurons::CNN_layer_op::output_shape() const
+template <typename dtype>
+neurons::Shape neurons::CNN_layer_op<dtype>::output_shape() const
 {
     return this->m_conv2d.get_output_shape();
 }
+
+template class neurons::CNN_layer<float>;
+template class neurons::CNN_layer<double>;
+template class neurons::CNN_layer_op<float>;
+template class neurons::CNN_layer_op<double>;
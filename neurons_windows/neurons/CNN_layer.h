@@ -13,17 +13,18 @@ namespace neurons
     /*
     This is class definition of a convolutional neural network layer
     */
-    class CNN_layer : public Traditional_NN_layer
+    template <typename dtype = double>
+    class CNN_layer : public Traditional_NN_layer<dtype>
     {
     private:
         // A module of 2-dimensional convolution algorithm
-        Conv_2d m_conv2d;
+        Conv_2d<dtype> m_conv2d;
 
     public:
         static std::string from_binary_data(
-            char * binary_data, lint & data_size, TMatrix<> & w, TMatrix<> & b,
+            char * binary_data, lint & data_size, TMatrix<dtype> & w, TMatrix<dtype> & b,
             lint & stride, lint & padding,
-            std::unique_ptr<Activation> & act_func, std::unique_ptr<ErrorFunction> & err_func,
+            std::unique_ptr<Activation<dtype>> & act_func, std::unique_ptr<ErrorFunction<dtype>> & err_func,
             char *& residual_data, lint & residual_len
         );
 
@@ -46,15 +47,15 @@ namespace neurons
             lint stride,  // Stride size (>= 1) 
             lint padding,  // Zero padding size (>= 0)
             lint threads,  // Number of threads while training of the network layer
-            neurons::Activation *act_func,  // Activation function of this layer
-            neurons::ErrorFunction *err_func = nullptr // Cost function or error function of this layer
+            neurons::Activation<dtype> *act_func,  // Activation function of this layer
+            neurons::ErrorFunction<dtype> *err_func = nullptr // Cost function or error function of this layer
         );
 
         CNN_layer(
             double mmt_rate,
             lint rows, lint cols, lint chls, lint stride, lint padding, lint threads,
-            const TMatrix<> & w, const TMatrix<> & b,
-            std::unique_ptr<Activation> & act_func, std::unique_ptr<ErrorFunction> & err_func);
+            TMatrix<dtype> w, TMatrix<dtype> b,
+            std::unique_ptr<Activation<dtype>> & act_func, std::unique_ptr<ErrorFunction<dtype>> & err_func);
 
         CNN_layer(const CNN_layer & other);
 
@@ -66,31 +67,38 @@ namespace neurons
 
         Shape output_shape() const;
 
-        virtual std::string nn_type() const { return NN_layer::CNN; }
+        virtual std::string nn_type() const { return NN_layer<dtype>::CNN; }
 
         virtual std::unique_ptr<char[]> to_binary_data(lint & data_size) const;
+
+        // Stride and zero padding are parameters of the layer
+        virtual Model_layer to_model_layer() const;
     };
 
-    class CNN_layer_op : public Traditional_NN_layer_op
+    template <typename dtype = double>
+    class CNN_layer_op : public Traditional_NN_layer_op<dtype>
     {
     private:
 
-        std::vector<TMatrix<>> m_conv_to_x_diffs;
-        std::vector<TMatrix<>> m_conv_to_w_diffs;
-        std::vector<TMatrix<>> m_act_diffs;
+        // The input data, which is all the convolution needs for back propagation
+        std::vector<TMatrix<dtype>> m_x;
+        std::vector<TMatrix<dtype>> m_act_diffs;
+
+        // Convolutional product of the current sample, the bias is added by the activation function
+        TMatrix<dtype> m_product;
 
-        Conv_2d m_conv2d;
+        Conv_2d<dtype> m_conv2d;
 
     public:
 
         CNN_layer_op();
 
         CNN_layer_op(
-            const Conv_2d & conv2d,
-            const TMatrix<> &w,
-            const TMatrix<> &b,
-            const std::unique_ptr<Activation> &act_func,
-            const std::unique_ptr<ErrorFunction> &err_func);
+            const Conv_2d<dtype> & conv2d,
+            const TMatrix<dtype> &w,
+            const TMatrix<dtype> &b,
+            const std::unique_ptr<Activation<dtype>> &act_func,
+            const std::unique_ptr<ErrorFunction<dtype>> &err_func);
 
         CNN_layer_op(const CNN_layer_op & other);
 
@@ -104,18 +112,25 @@ namespace neurons
         // Forward propagation via batch learning
         //--------------------------------------------
 
-        virtual std::vector<TMatrix<>> batch_forward_propagate(const std::vector<TMatrix<>> & inputs);
+        virtual std::vector<TMatrix<dtype>> batch_forward_propagate(const std::vector<TMatrix<dtype>> & inputs);
+
+        virtual std::vector<TMatrix<dtype>> batch_forward_propagate(
+            const std::vector<TMatrix<dtype>> & inputs, const std::vector<TMatrix<dtype>> & targets);
+
+        // Samples are read directly while they are kept in m_x for back propagation
+
+        virtual std::vector<TMatrix<dtype>> batch_forward_propagate(const std::vector<const TMatrix<dtype> *> & inputs);
 
-        virtual std::vector<TMatrix<>> batch_forward_propagate(
-            const std::vector<TMatrix<>> & inputs, const std::vector<TMatrix<>> & targets);
+        virtual std::vector<TMatrix<dtype>> batch_forward_propagate(
+            const std::vector<const TMatrix<dtype> *> & inputs, const std::vector<const TMatrix<dtype> *> & targets);
 
         //--------------------------------------------
         // Back propagation via batch learning
         //--------------------------------------------
 
-        virtual std::vector<TMatrix<>> batch_back_propagate(double l_rate, const std::vector<TMatrix<>> & E_to_y_diffs);
+        virtual std::vector<TMatrix<dtype>> batch_back_propagate(double l_rate, const std::vector<TMatrix<dtype>> & E_to_y_diffs);
 
-        virtual std::vector<TMatrix<>> batch_back_propagate(double l_rate);
+        virtual std::vector<TMatrix<dtype>> batch_back_propagate(double l_rate);
 
         virtual Shape output_shape() const;
     };
@@ -0,0 +1,105 @@
+#include "Checkpoint.h"
+#include <cstring>
+
+neurons::Checkpoint_writer::Checkpoint_writer()
+    : m_state{ 0, 0, "" }, m_pending{ false }, m_stop{ false }, m_written{ 0 }, m_failed{ 0 }
+{}
+
+neurons::Checkpoint_writer::~Checkpoint_writer()
+{
+    {
+        std::unique_lock<std::mutex> lock{ this->m_mutex };
+        this->m_stop = true;
+    }
+    this->m_cv.notify_all();
+
+    if (this->m_thread.joinable())
+    {
+        this->m_thread.join();
+    }
+}
+
+void neurons::Checkpoint_writer::save(
+    const std::string & file_name, const std::vector<Model_layer> & layers, const Training_state & state)
+{
+    std::unique_lock<std::mutex> lock{ this->m_mutex };
+    this->m_cv.wait(lock, [this] { return !this->m_pending; });
+
+    if (!this->m_thread.joinable())
+    {
+        this->m_thread = std::thread{ [this] { this->write_checkpoints(); } };
+    }
+
+    lint bytes = 0;
+    for (const Model_layer & layer : layers)
+    {
+        for (const Model_tensor & tensor : layer.m_tensors)
+        {
+            bytes += tensor.m_shape.size() * tensor.m_element_size;
+        }
+    }
+
+    // The staging buffer keeps its capacity from checkpoint to checkpoint
+    this->m_staging.resize(bytes);
+    this->m_layers = layers;
+
+    char *position = this->m_staging.data();
+    for (Model_layer & layer : this->m_layers)
+    {
+        for (Model_tensor & tensor : layer.m_tensors)
+        {
+            lint size = tensor.m_shape.size() * tensor.m_element_size;
+            std::memcpy(position, tensor.m_data, size);
+            tensor.m_data = position;
+            position += size;
+        }
+    }
+
+    this->m_state = state;
+    this->m_file_name = file_name;
+    this->m_pending = true;
+
+    lock.unlock();
+    this->m_cv.notify_all();
+}
+
+void neurons::Checkpoint_writer::wait()
+{
+    std::unique_lock<std::mutex> lock{ this->m_mutex };
+    this->m_cv.wait(lock, [this] { return !this->m_pending; });
+}
+
+lint neurons::Checkpoint_writer::written()
+{
+    std::unique_lock<std::mutex> lock{ this->m_mutex };
+    return this->m_written;
+}
+
+lint neurons::Checkpoint_writer::failed()
+{
+    std::unique_lock<std::mutex> lock{ this->m_mutex };
+    return this->m_failed;
+}
+
+void neurons::Checkpoint_writer::write_checkpoints()
+{
+    std::unique_lock<std::mutex> lock{ this->m_mutex };
+
+    while (true)
+    {
+        this->m_cv.wait(lock, [this] { return this->m_pending || this->m_stop; });
+        if (!this->m_pending)
+        {
+            return;
+        }
+
+        // The staging buffer is not touched by save() until m_pending is cleared
+        lock.unlock();
+        bool written = write_model_file(this->m_file_name, this->m_layers, &this->m_state);
+        lock.lock();
+
+        ++(written ? this->m_written : this->m_failed);
+        this->m_pending = false;
+        this->m_cv.notify_all();
+    }
+}
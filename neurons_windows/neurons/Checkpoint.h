@@ -0,0 +1,63 @@
+#pragma once
+#include "Model_file.h"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace neurons
+{
+    /*
+    Checkpoints of training written on a background thread.
+
+    save() copies the tensors of the layers into a staging buffer, which is all the training thread
+    waits for (besides the previous checkpoint, if it is still being written: there is one staging
+    buffer, so memory does not grow with slow disks). The background thread then writes the checkpoint
+    as a model file with its training state (see write_model_file), which is flushed to disk and
+    renamed over the previous checkpoint.
+    The thread is started by the first checkpoint.
+    */
+    class Checkpoint_writer
+    {
+    private:
+        // Elements of all tensors of the checkpoint being written, tensors of m_layers point into it
+        std::vector<char> m_staging;
+        std::vector<Model_layer> m_layers;
+        Training_state m_state;
+        std::string m_file_name;
+
+        bool m_pending;
+        bool m_stop;
+        lint m_written;
+        lint m_failed;
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::thread m_thread;
+
+    public:
+        Checkpoint_writer();
+
+        // Checkpoints saved before are written before the writer is destroyed
+        ~Checkpoint_writer();
+
+        Checkpoint_writer(const Checkpoint_writer & other) = delete;
+        Checkpoint_writer & operator = (const Checkpoint_writer & other) = delete;
+
+        // Snapshot layers and the training state, and write them into file_name in the background.
+        // Tensors of layers are only read before save returns.
+        void save(const std::string & file_name, const std::vector<Model_layer> & layers, const Training_state & state);
+
+        // Wait until all checkpoints saved are written
+        void wait();
+
+        // Numbers of checkpoints written and of checkpoints which could not be written
+        lint written();
+
+        lint failed();
+
+    private:
+        void write_checkpoints();
+    };
+}
@@ -1,4 +1,191 @@
 #include "Convolution.h"
+#include "GEMM.h"
+#include "Thread_pool.h"
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NEURONS_CONV_X86
+#include <immintrin.h>
+#endif
+
+// GCC and clang only emit AVX instructions inside functions explicitly marked for them,
+// while MSVC accepts the intrinsics anywhere.
+#if defined(NEURONS_CONV_X86) && (defined(__GNUC__) || defined(__clang__))
+#define NEURONS_TARGET(isa) __attribute__((target(isa)))
+#else
+#define NEURONS_TARGET(isa)
+#endif
+
+namespace
+{
+    // Chunks of a convolution of fewer floating point operations than this are not worth a thread
+    const double PARALLEL_CONV = 2e5;
+
+    // Split rows [0, rows) of a convolution over the threads of the process pool given to this
+    // operation (see Thread_pool::intra_op_threads), a row costs row_work operations.
+    template <typename Body>
+    void parallel_for_rows(lint rows, lint row_work, Body body)
+    {
+        std::shared_ptr<neurons::Thread_pool> pool;
+        if (static_cast<double>(rows) * row_work >= 2 * PARALLEL_CONV)
+        {
+            pool = neurons::Thread_pool::current();
+        }
+
+        if (pool && pool->intra_op_threads() > 1)
+        {
+            lint grain = static_cast<lint>(PARALLEL_CONV / std::max<lint>(row_work, 1)) + 1;
+            pool->parallel_for(0, rows, body, grain);
+        }
+        else
+        {
+            body(0, rows);
+        }
+    }
+
+    // Transforms of Winograd convolution (Lavin and Gray, 2015), row-major.
+    // B^T is (m + 2) x (m + 2), G is (m + 2) x 3 and A^T is m x (m + 2).
+    const double WINOGRAD_2_BT[] = {
+        1,  0, -1,  0,
+        0,  1,  1,  0,
+        0, -1,  1,  0,
+        0,  1,  0, -1
+    };
+
+    const double WINOGRAD_2_G[] = {
+        1,    0,   0,
+        0.5,  0.5, 0.5,
+        0.5, -0.5, 0.5,
+        0,    0,   1
+    };
+
+    const double WINOGRAD_2_AT[] = {
+        1, 1,  1,  0,
+        0, 1, -1, -1
+    };
+
+    const double WINOGRAD_4_BT[] = {
+        4,  0, -5,  0, 1, 0,
+        0, -4, -4,  1, 1, 0,
+        0,  4, -4, -1, 1, 0,
+        0, -2, -1,  2, 1, 0,
+        0,  2, -1, -2, 1, 0,
+        0,  4,  0, -5, 0, 1
+    };
+
+    const double WINOGRAD_4_G[] = {
+        1.0 / 4,   0,          0,
+        -1.0 / 6,  -1.0 / 6,   -1.0 / 6,
+        -1.0 / 6,  1.0 / 6,    -1.0 / 6,
+        1.0 / 24,  1.0 / 12,   1.0 / 6,
+        1.0 / 24,  -1.0 / 12,  1.0 / 6,
+        0,         0,          1
+    };
+
+    const double WINOGRAD_4_AT[] = {
+        1, 1,  1, 1,  1, 0,
+        0, 1, -1, 2, -2, 0,
+        0, 1,  1, 4,  4, 0,
+        0, 1, -1, 8, -8, 1
+    };
+
+    struct Winograd_transforms
+    {
+        const double *m_bt;
+        const double *m_g;
+        const double *m_at;
+    };
+
+    Winograd_transforms winograd_transforms(lint tile)
+    {
+        if (2 == tile)
+        {
+            return Winograd_transforms{ WINOGRAD_2_BT, WINOGRAD_2_G, WINOGRAD_2_AT };
+        }
+        return Winograd_transforms{ WINOGRAD_4_BT, WINOGRAD_4_G, WINOGRAD_4_AT };
+    }
+
+    // Elements of transformed patches or products kept at a time by a thread, tiles are
+    // transformed in groups which fit the L2 cache
+    const lint WINOGRAD_BLOCK = 16384;
+
+    // dst[0, n) += coef * src[0, n)
+    template <typename dtype>
+    using Accumulate = void (*)(lint n, dtype coef, const dtype *src, dtype *dst);
+
+    template <typename dtype>
+    void accumulate_scalar(lint n, dtype coef, const dtype *src, dtype *dst)
+    {
+        for (lint j = 0; j < n; ++j)
+        {
+            dst[j] += coef * src[j];
+        }
+    }
+
+#ifdef NEURONS_CONV_X86
+
+    NEURONS_TARGET("avx")
+    void accumulate_avx(lint n, double coef, const double *src, double *dst)
+    {
+        __m256d c = _mm256_set1_pd(coef);
+        lint j = 0;
+        for (; j + 4 <= n; j += 4)
+        {
+            _mm256_storeu_pd(dst + j, _mm256_add_pd(_mm256_loadu_pd(dst + j), _mm256_mul_pd(c, _mm256_loadu_pd(src + j))));
+        }
+        for (; j < n; ++j)
+        {
+            dst[j] += coef * src[j];
+        }
+    }
+
+    NEURONS_TARGET("avx")
+    void accumulate_avx(lint n, float coef, const float *src, float *dst)
+    {
+        __m256 c = _mm256_set1_ps(coef);
+        lint j = 0;
+        for (; j + 8 <= n; j += 8)
+        {
+            _mm256_storeu_ps(dst + j, _mm256_add_ps(_mm256_loadu_ps(dst + j), _mm256_mul_ps(c, _mm256_loadu_ps(src + j))));
+        }
+        for (; j < n; ++j)
+        {
+            dst[j] += coef * src[j];
+        }
+    }
+
+#endif // NEURONS_CONV_X86
+
+    // Every AVX kernel of gemm implies AVX
+    template <typename dtype>
+    Accumulate<dtype> accumulate_kernel()
+    {
+#ifdef NEURONS_CONV_X86
+        if (neurons::GEMM_kernel::scalar != neurons::gemm_kernel())
+        {
+            return static_cast<Accumulate<dtype>>(accumulate_avx);
+        }
+#endif
+        return accumulate_scalar<dtype>;
+    }
+
+    // dst[0, n) = sum of coefs[i] * src[i * src_stride + (0, n)] for i < terms.
+    // Transforms are full of zeros, which are skipped.
+    template <typename dtype>
+    void linear_combination(Accumulate<dtype> accumulate,
+        lint n, lint terms, const double *coefs, const dtype *src, lint src_stride, dtype *dst)
+    {
+        std::fill(dst, dst + n, dtype{ 0 });
+
+        for (lint i = 0; i < terms; ++i)
+        {
+            if (0 != coefs[i])
+            {
+                accumulate(n, static_cast<dtype>(coefs[i]), src + i * src_stride, dst);
+            }
+        }
+    }
+}
 
 neurons::Conv_1d::Conv_1d(const Shape & input_shape, const Shape & weights_shape, lint stride)
     : m_input_sh{ input_shape }, m_weights_sh{ weights_shape }, m_stride{ stride }
@@ -172,7 +359,305 @@ neurons::TMatrix<> & neurons::Conv_1d::get_diff_to_weights() const
 }
 
 
-neurons::Conv_2d::Conv_2d(
+template <typename dtype>
+const lint neurons::Winograd_2d<dtype>::MIN_TILES;
+
+template <typename dtype>
+const lint neurons::Winograd_2d<dtype>::MIN_WORK;
+
+template <typename dtype>
+bool neurons::Winograd_2d<dtype>::supports(const Shape & weights_shape, lint r_stride, lint c_stride)
+{
+    return 4 == weights_shape.dim() && 3 == weights_shape[0] && 3 == weights_shape[1] && 1 == r_stride && 1 == c_stride;
+}
+
+template <typename dtype>
+neurons::Winograd_2d<dtype>::Winograd_2d()
+{}
+
+template <typename dtype>
+neurons::Winograd_2d<dtype>::Winograd_2d(
+    const Shape & input_shape, const Shape & weights_shape, lint r_zero_p, lint c_zero_p, lint tile)
+    :
+    m_input_sh{ input_shape },
+    m_r_zero_p{ r_zero_p > 0 ? r_zero_p : 0 }, m_c_zero_p{ c_zero_p > 0 ? c_zero_p : 0 }
+{
+    if (input_shape.dim() != 4 || !supports(weights_shape, 1, 1) || input_shape[3] != weights_shape[2])
+    {
+        throw std::invalid_argument(
+            std::string("neurons::Winograd_2d: Winograd convolution needs filters of 3 x 3 which are compatible with the input."));
+    }
+
+    lint out_rows = input_shape[1] + 2 * this->m_r_zero_p - 2;
+    lint out_cols = input_shape[2] + 2 * this->m_c_zero_p - 2;
+
+    if (out_rows < 1 || out_cols < 1)
+    {
+        throw std::invalid_argument(
+            std::string("neurons::Winograd_2d: size of input should be no less than size of the filter."));
+    }
+
+    if (0 == tile)
+    {
+        tile = out_rows >= 8 && out_cols >= 8 ? 4 : 2;
+    }
+    else if (2 != tile && 4 != tile)
+    {
+        throw std::invalid_argument(
+            std::string("neurons::Winograd_2d: tiles of the output should be of 2 x 2 or 4 x 4."));
+    }
+
+    this->m_tile = tile;
+    this->m_tile_rows = (out_rows + tile - 1) / tile;
+    this->m_tile_cols = (out_cols + tile - 1) / tile;
+    this->m_output_sh = Shape{ input_shape[0], out_rows, out_cols, weights_shape[3] };
+}
+
+template <typename dtype>
+bool neurons::Winograd_2d<dtype>::worthwhile() const
+{
+    lint tiles = this->m_input_sh[0] * this->m_tile_rows * this->m_tile_cols;
+    return tiles >= MIN_TILES && tiles * this->m_input_sh[3] * this->m_output_sh[3] >= MIN_WORK;
+}
+
+template <typename dtype>
+void neurons::Winograd_2d<dtype>::transform_filters(const TMatrix<dtype> & weights) const
+{
+    lint alpha = this->m_tile + 2;
+    const double *g = winograd_transforms(this->m_tile).m_g;
+    lint ck = weights.shape().size() / 9;
+
+    Shape u_sh{ alpha * alpha, ck };
+    if (this->m_u.shape() != u_sh)
+    {
+        this->m_u = TMatrix<dtype>{ u_sh };
+    }
+
+    // Filters are [3, 3, channels, filters], so each of the 9 taps is a block of channels x filters.
+    // G g first, then (G g) transpose(G).
+    Accumulate<dtype> accumulate = accumulate_kernel<dtype>();
+    std::vector<dtype> g_w(alpha * 3 * ck);
+    for (lint xi = 0; xi < alpha; ++xi)
+    {
+        for (lint j = 0; j < 3; ++j)
+        {
+            linear_combination(accumulate, ck, 3, g + xi * 3, weights.m_data + j * ck, 3 * ck, g_w.data() + (xi * 3 + j) * ck);
+        }
+    }
+
+    for (lint xi = 0; xi < alpha; ++xi)
+    {
+        for (lint nu = 0; nu < alpha; ++nu)
+        {
+            linear_combination(accumulate, ck, 3, g + nu * 3, g_w.data() + xi * 3 * ck, ck, this->m_u.m_data + (xi * alpha + nu) * ck);
+        }
+    }
+
+    this->m_transformed_w = weights;
+}
+
+template <typename dtype>
+void neurons::Winograd_2d<dtype>::transform_input(const TMatrix<dtype> & input, lint begin, lint end) const
+{
+    lint m = this->m_tile;
+    lint alpha = m + 2;
+    const double *bt = winograd_transforms(m).m_bt;
+    Accumulate<dtype> accumulate = accumulate_kernel<dtype>();
+
+    lint in_rows = this->m_input_sh[1];
+    lint in_cols = this->m_input_sh[2];
+    lint chls = this->m_input_sh[3];
+    lint tiles_of_sample = this->m_tile_rows * this->m_tile_cols;
+    lint tiles = this->m_input_sh[0] * tiles_of_sample;
+
+    // Patches of a group of tiles as [alpha, alpha, group, channels], so each element of the
+    // transform is a linear combination of long rows of group * channels
+    lint group = std::min(end - begin, std::max<lint>(1, WINOGRAD_BLOCK / (alpha * alpha * chls)));
+    std::vector<dtype> patches(alpha * alpha * group * chls);
+    std::vector<dtype> bt_patches(alpha * alpha * group * chls);
+
+    for (lint first = begin; first < end; first += group)
+    {
+        lint n_tiles = std::min(group, end - first);
+        lint row = n_tiles * chls;
+
+        // Patches of the (virtually) padded input, pixels past the input are zeros as well
+        for (lint tile = first; tile < first + n_tiles; ++tile)
+        {
+            lint i = tile / tiles_of_sample;
+            lint top = (tile % tiles_of_sample) / this->m_tile_cols * m - this->m_r_zero_p;
+            lint left = (tile % tiles_of_sample) % this->m_tile_cols * m - this->m_c_zero_p;
+            const dtype *in_start = input.m_data + i * in_rows * in_cols * chls;
+
+            for (lint r = 0; r < alpha; ++r)
+            {
+                for (lint c = 0; c < alpha; ++c)
+                {
+                    dtype *patch_p = patches.data() + (r * alpha + c) * row + (tile - first) * chls;
+                    lint in_r = top + r;
+                    lint in_c = left + c;
+
+                    if (in_r >= 0 && in_r < in_rows && in_c >= 0 && in_c < in_cols)
+                    {
+                        const dtype *in_p = in_start + (in_r * in_cols + in_c) * chls;
+                        std::copy(in_p, in_p + chls, patch_p);
+                    }
+                    else
+                    {
+                        std::fill(patch_p, patch_p + chls, dtype{ 0 });
+                    }
+                }
+            }
+        }
+
+        // transpose(B) d, then (transpose(B) d) B
+        for (lint xi = 0; xi < alpha; ++xi)
+        {
+            for (lint c = 0; c < alpha; ++c)
+            {
+                linear_combination(accumulate, row, alpha, bt + xi * alpha, patches.data() + c * row, alpha * row,
+                    bt_patches.data() + (xi * alpha + c) * row);
+            }
+        }
+
+        for (lint xi = 0; xi < alpha; ++xi)
+        {
+            for (lint nu = 0; nu < alpha; ++nu)
+            {
+                linear_combination(accumulate, row, alpha, bt + nu * alpha, bt_patches.data() + xi * alpha * row, row,
+                    this->m_v.m_data + ((xi * alpha + nu) * tiles + first) * chls);
+            }
+        }
+    }
+}
+
+template <typename dtype>
+void neurons::Winograd_2d<dtype>::transform_output(TMatrix<dtype> & out, lint begin, lint end) const
+{
+    lint m = this->m_tile;
+    lint alpha = m + 2;
+    const double *at = winograd_transforms(m).m_at;
+    Accumulate<dtype> accumulate = accumulate_kernel<dtype>();
+
+    lint out_rows = this->m_output_sh[1];
+    lint out_cols = this->m_output_sh[2];
+    lint filters = this->m_output_sh[3];
+    lint tiles_of_sample = this->m_tile_rows * this->m_tile_cols;
+    lint tiles = this->m_input_sh[0] * tiles_of_sample;
+
+    // Products of each element of a group of tiles are rows of group * filters in m_m
+    lint group = std::min(end - begin, std::max<lint>(1, WINOGRAD_BLOCK / (alpha * alpha * filters)));
+    std::vector<dtype> at_m(m * alpha * group * filters);
+    std::vector<dtype> pixels(m * m * group * filters);
+
+    for (lint first = begin; first < end; first += group)
+    {
+        lint n_tiles = std::min(group, end - first);
+        lint row = n_tiles * filters;
+
+        // transpose(A) M, then (transpose(A) M) A
+        for (lint a = 0; a < m; ++a)
+        {
+            for (lint nu = 0; nu < alpha; ++nu)
+            {
+                linear_combination(accumulate, row, alpha, at + a * alpha, this->m_m.m_data + (nu * tiles + first) * filters,
+                    alpha * tiles * filters, at_m.data() + (a * alpha + nu) * row);
+            }
+        }
+
+        for (lint a = 0; a < m; ++a)
+        {
+            for (lint b = 0; b < m; ++b)
+            {
+                linear_combination(accumulate, row, alpha, at + b * alpha, at_m.data() + a * alpha * row, row,
+                    pixels.data() + (a * m + b) * row);
+            }
+        }
+
+        // Pixels of tiles past the output are dropped
+        for (lint tile = first; tile < first + n_tiles; ++tile)
+        {
+            lint i = tile / tiles_of_sample;
+            lint top = (tile % tiles_of_sample) / this->m_tile_cols * m;
+            lint left = (tile % tiles_of_sample) % this->m_tile_cols * m;
+            dtype *out_start = out.m_data + i * out_rows * out_cols * filters;
+
+            for (lint a = 0; a < m && top + a < out_rows; ++a)
+            {
+                for (lint b = 0; b < m && left + b < out_cols; ++b)
+                {
+                    const dtype *pixel = pixels.data() + (a * m + b) * row + (tile - first) * filters;
+                    std::copy(pixel, pixel + filters, out_start + ((top + a) * out_cols + left + b) * filters);
+                }
+            }
+        }
+    }
+}
+
+template <typename dtype>
+void neurons::Winograd_2d<dtype>::product(TMatrix<dtype> & out, const TMatrix<dtype> & input, const TMatrix<dtype> & weights) const
+{
+    lint alpha = this->m_tile + 2;
+    lint chls = this->m_input_sh[3];
+    lint filters = this->m_output_sh[3];
+    lint tiles = this->m_input_sh[0] * this->m_tile_rows * this->m_tile_cols;
+
+    if (this->m_input_sh != input.shape() || weights.shape().size() != 9 * chls * filters)
+    {
+        throw std::invalid_argument(
+            std::string("neurons::Winograd_2d::product: Shape of inputs and weights should be compatible with the this convolution."));
+    }
+
+    Shape v_sh{ alpha * alpha, tiles, chls };
+    if (this->m_v.shape() != v_sh)
+    {
+        this->m_v = TMatrix<dtype>{ v_sh };
+    }
+
+    Shape m_sh{ alpha * alpha, tiles, filters };
+    if (this->m_m.shape() != m_sh)
+    {
+        this->m_m = TMatrix<dtype>{ m_sh };
+    }
+
+    if (out.shape() != this->m_output_sh)
+    {
+        out = TMatrix<dtype>{ this->m_output_sh };
+    }
+
+    // Layers multiply sample after sample by the same weights, which change only when they are trained
+    lint w_size = weights.shape().size();
+    if (this->m_transformed_w.shape().size() != w_size ||
+        !std::equal(weights.m_data, weights.m_data + w_size, this->m_transformed_w.m_data))
+    {
+        this->transform_filters(weights);
+    }
+
+    parallel_for_rows(tiles, 4 * alpha * alpha * alpha * chls, [&](lint begin, lint end)
+    {
+        this->transform_input(input, begin, end);
+    });
+
+    // One product [tiles, channels] x [channels, filters] for each element of the transforms
+    parallel_for_rows(alpha * alpha, 2 * tiles * chls * filters, [&](lint begin, lint end)
+    {
+        for (lint k = begin; k < end; ++k)
+        {
+            neurons::gemm<dtype>(false, false, tiles, filters, chls,
+                1, this->m_v.m_data + k * tiles * chls, chls, this->m_u.m_data + k * chls * filters, filters,
+                0, this->m_m.m_data + k * tiles * filters, filters);
+        }
+    });
+
+    parallel_for_rows(tiles, 4 * this->m_tile * alpha * alpha * filters, [&](lint begin, lint end)
+    {
+        this->transform_output(out, begin, end);
+    });
+}
+
+
+template <typename dtype>
+neurons::Conv_2d<dtype>::Conv_2d(
     const Shape & input_shape,
     const Shape & weights_shape,
     lint r_stride, lint c_stride,
@@ -180,7 +665,7 @@ neurons::Conv_2d::Conv_2d(
     :
     m_input_sh{ input_shape }, m_weights_sh{ weights_shape },
     m_r_stride{ r_stride }, m_c_stride{ c_stride },
-    m_r_zero_p{ r_zero_p }, m_c_zero_p{ c_zero_p }
+    m_r_zero_p{ r_zero_p > 0 ? r_zero_p : 0 }, m_c_zero_p{ c_zero_p > 0 ? c_zero_p : 0 }
 {
     if (input_shape.dim() != 4 || weights_shape.dim() != 4)
     {
@@ -202,417 +687,313 @@ neurons::Conv_2d::Conv_2d(
     in_rows += 2 * m_r_zero_p;
     in_cols += 2 * m_c_zero_p;
 
-    this->m_ex_in_sh = Shape{ in_batch_size, in_rows, in_cols } +
-        this->m_input_sh.sub_shape(3, this->m_input_sh.dim() - 1);
+    if (in_rows < this->m_weights_sh[0] || in_cols < this->m_weights_sh[1])
+    {
+        throw std::invalid_argument(
+            std::string("neurons::Conv_2d: size of input should be no less than size of the filter."));
+    }
 
     lint out_rows = (in_rows - this->m_weights_sh[0]) / this->m_r_stride + 1;
     lint out_cols = (in_cols - this->m_weights_sh[1]) / this->m_c_stride + 1;
 
     this->m_output_sh = Shape{ in_batch_size, out_rows, out_cols, this->m_weights_sh[this->m_weights_sh.dim() - 1] };
 
-    this->m_diff_to_w = TMatrix<>{ Shape{
-        this->m_input_sh[0],
-        this->m_weights_sh[0],
-        this->m_weights_sh[1],
-        this->m_weights_sh[2],
-        out_rows,
-        out_cols,
-    }, 0 };
-
-    this->m_diff_to_x = TMatrix<>{ Shape{
-        this->m_input_sh[0],
-        this->m_input_sh[1],
-        this->m_input_sh[2],
-        this->m_input_sh[3],
-        out_rows,
-        out_cols,
-        this->m_weights_sh[3] }, 0 };
+    this->set_winograd(true);
+    this->m_use_winograd = this->m_use_winograd && this->m_winograd.worthwhile();
 }
 
-neurons::Conv_2d::Conv_2d()
+template <typename dtype>
+neurons::Conv_2d<dtype>::Conv_2d()
+    : m_use_winograd{ false }
 {
 }
 
-neurons::Conv_2d::~Conv_2d()
-{}
-
-neurons::TMatrix<> neurons::Conv_2d::operator()(const TMatrix<> & input, const TMatrix<> & weights, const TMatrix<> & bias)
+template <typename dtype>
+void neurons::Conv_2d<dtype>::set_winograd(bool enabled)
 {
-    if (this->m_input_sh != input.shape() || this->m_weights_sh != weights.shape() || bias.m_shape.dim() < 2)
+    this->m_use_winograd = enabled && Winograd_2d<dtype>::supports(this->m_weights_sh, this->m_r_stride, this->m_c_stride);
+
+    if (this->m_use_winograd)
     {
-        throw std::invalid_argument(
-            std::string("neurons::Conv_1d: Shape of inputs and weights should be compatible with the this convolution."));
+        this->m_winograd = Winograd_2d<dtype>{ this->m_input_sh, this->m_weights_sh, this->m_r_zero_p, this->m_c_zero_p };
     }
+}
 
-    TMatrix<> ex_input = zero_padding(input);
-
-    lint in_dim = this->m_ex_in_sh.dim();
-    lint w_dim = this->m_ex_in_sh.dim();
-
-    Shape in_batch_sh = this->m_ex_in_sh.sub_shape(0, in_dim - 4);
-    Shape in_conv_sh = this->m_ex_in_sh.sub_shape(in_dim - 3, in_dim - 1);
-
-    Shape w_conv_sh = this->m_weights_sh.sub_shape(0, 2);
-    Shape w_batch_sh = this->m_weights_sh.sub_shape(3, w_dim - 1);
-
-    lint in_rows = in_conv_sh[0];
-    lint in_cols = in_conv_sh[1];
-    lint w_rows = w_conv_sh[0];
-    lint w_cols = w_conv_sh[1];
-
-    // lint in_size = in_rows * in_cols;
-    // lint w_size = w_rows * w_cols;
+template <typename dtype>
+neurons::Conv_2d<dtype>::~Conv_2d()
+{}
 
-    if (in_rows < w_rows || in_cols < w_cols)
+template <typename dtype>
+void neurons::Conv_2d<dtype>::prepare_cols() const
+{
+    Shape cols_sh{ this->m_output_sh.size() / this->m_weights_sh[3], this->m_weights_sh.size() / this->m_weights_sh[3] };
+    if (this->m_cols.shape() != cols_sh)
     {
-        throw std::invalid_argument(
-            std::string("neurons::Conv_1d: size of input should be no less than size of the filter."));
+        this->m_cols = TMatrix<dtype>{ cols_sh };
     }
+}
 
-    lint in_batch_size = in_batch_sh.size();
-    lint in_conv_size = in_conv_sh.size();
-
-    // lint w_conv_size = w_conv_sh.size();
-    lint w_batch_size = w_batch_sh.size();
-
-    lint chls = this->m_ex_in_sh[in_dim - 1];
-    lint out_rows = (in_rows - w_rows) / this->m_r_stride + 1;
-    lint out_cols = (in_cols - w_cols) / this->m_c_stride + 1;
-
-    TMatrix<> out{ in_batch_sh + Shape{ out_rows, out_cols } + w_batch_sh };
-    lint out_size = out_rows * out_cols * w_batch_size;
-
-    lint in_cols_chls = in_cols * chls;
-    lint w_cols_chls_w_batch_size = w_cols * chls * w_batch_size;
-    lint chls_w_batch_size = chls * w_batch_size;
-
-    lint chls_c_stride = chls * this->m_c_stride;
-    lint in_cols_chls_r_stride = in_cols_chls * this->m_r_stride;
-    lint out_cols_w_batch_size = out_cols * w_batch_size;
-
-    double *in_start = ex_input.m_data;
-    double *out_start = out.m_data;
-
-    double *w_start;
-    double *b_p;
-    double *out_l_start;
-
-    double *stride_row_start;
-    double *out_row_start;
-
-    double *stride_col_start;
-    double *out_col_start;
+template <typename dtype>
+void neurons::Conv_2d<dtype>::im2col(const TMatrix<dtype> & input, lint begin, lint end) const
+{
+    lint in_rows = this->m_input_sh[1];
+    lint in_cols = this->m_input_sh[2];
+    lint chls = this->m_input_sh[3];
 
-    double *in_row_start;
-    double *w_row_start;
-    double sum = 0;
+    lint w_rows = this->m_weights_sh[0];
+    lint w_cols = this->m_weights_sh[1];
 
-    double *in_col_start;
-    double *w_col_start;
+    lint out_rows = this->m_output_sh[1];
+    lint out_cols = this->m_output_sh[2];
 
-    double *in_p;
-    double *w_p;
+    lint in_size = in_rows * in_cols * chls;
+    dtype *col_p = this->m_cols.m_data + begin * out_cols * w_rows * w_cols * chls;
 
-    for (lint i = 0; i < in_batch_size; ++i)
+    for (lint row = begin; row < end; ++row)
     {
-        w_start = weights.m_data;
-        b_p = bias.m_data;
-        out_l_start = out_start;
+        lint i = row / out_rows;
+        lint out_r = row % out_rows;
+        const dtype *in_start = input.m_data + i * in_size;
 
-        // Go through each filter
-        for (lint m = 0; m < w_batch_size; ++m)
+        for (lint out_c = 0; out_c < out_cols; ++out_c)
         {
-            stride_row_start = in_start;
-            out_row_start = out_l_start;
-            // Next stride
-            for (lint stride_r_pos = 0; stride_r_pos < out_rows; ++stride_r_pos)
+            // One patch of the (virtually) padded input
+            for (lint w_r = 0; w_r < w_rows; ++w_r)
             {
-                stride_col_start = stride_row_start;
-                out_col_start = out_row_start;
+                lint in_r = out_r * this->m_r_stride + w_r - this->m_r_zero_p;
 
-                for (lint stride_c_pos = 0; stride_c_pos < out_cols; ++stride_c_pos)
+                for (lint w_c = 0; w_c < w_cols; ++w_c)
                 {
-                    in_row_start = stride_col_start;
-                    w_row_start = w_start;
-                    sum = 0;
+                    lint in_c = out_c * this->m_c_stride + w_c - this->m_c_zero_p;
 
-                    // Go through each pixel and each channel
-                    for (lint r = 0; r < w_rows; ++r)
+                    if (in_r >= 0 && in_r < in_rows && in_c >= 0 && in_c < in_cols)
                     {
-                        in_col_start = in_row_start;
-                        w_col_start = w_row_start;
-
-                        for (lint c = 0; c < w_cols; ++c)
-                        {
-                            in_p = in_col_start;
-                            w_p = w_col_start;
-
-                            for (lint j = 0; j < chls; ++j)
-                            {
-                                //std::cout << *in_p << '\t';
-                                sum += *in_p * *w_p;
-
-                                ++in_p;
-                                w_p += w_batch_size;
-                            }
-
-                            in_col_start += chls;
-                            w_col_start += chls_w_batch_size;
-                        }
-
-                        in_row_start += in_cols_chls;
-                        w_row_start += w_cols_chls_w_batch_size;
-                        //std::cout << '\n';
+                        const dtype *in_p = in_start + (in_r * in_cols + in_c) * chls;
+                        std::copy(in_p, in_p + chls, col_p);
+                    }
+                    else
+                    {
+                        std::fill(col_p, col_p + chls, dtype{ 0 });
                     }
 
-                    *out_col_start = sum + *b_p;
-                    out_col_start += w_batch_size;
-                    stride_col_start += chls_c_stride;
+                    col_p += chls;
                 }
-
-                out_row_start += out_cols_w_batch_size;
-                stride_row_start += in_cols_chls_r_stride;
-                //std::cout << '\n';
             }
-
-            ++w_start;
-            ++b_p;
-            ++out_l_start;
         }
-
-        in_start += in_conv_size;
-        out_start += out_size;
     }
+}
 
+template <typename dtype>
+void neurons::Conv_2d<dtype>::col2im(const TMatrix<dtype> & cols, TMatrix<dtype> & output, lint begin, lint end) const
+{
+    lint in_rows = this->m_input_sh[1];
+    lint in_cols = this->m_input_sh[2];
+    lint chls = this->m_input_sh[3];
 
-    {
-        // Calculate the Derivative [ d(conv_product) / d(w) ]
-        double *diff_start = this->m_diff_to_w.m_data;
-        lint diff_size = w_rows * w_cols * chls * out_rows * out_cols;
-        lint w_cols_chls_out_rows_out_cols = w_cols * chls * out_rows * out_cols;
-        lint chls_out_rows_out_cols = chls * out_rows * out_cols;
-        lint out_rows_out_cols = out_rows * out_cols;
-
-        in_start = ex_input.m_data;
-
-        double *stride_row_start;
-        double *diff_stride_r_start;
-
-        double *stride_col_start;
-        double *diff_stride_c_start;
+    lint w_rows = this->m_weights_sh[0];
+    lint w_cols = this->m_weights_sh[1];
 
-        double *in_row_start;
-        double *diff_w_r_start;
+    lint out_rows = this->m_output_sh[1];
+    lint out_cols = this->m_output_sh[2];
 
-        double *in_col_start;
-        double *diff_w_c_start;
+    lint patch_size = w_rows * w_cols * chls;
 
-        double *in_p;
-        double *diff_chls_start;
+    // Each input row gathers the patch rows lying on it, in the order of output rows and columns,
+    // so every element sums up its gradients in the same order however the rows are split.
+    for (lint row = begin; row < end; ++row)
+    {
+        lint i = row / in_rows;
+        lint in_r = row % in_rows;
+        dtype *out_row = output.m_data + row * in_cols * chls;
 
-        for (lint i = 0; i < in_batch_size; ++i)
+        for (lint out_r = 0; out_r < out_rows; ++out_r)
         {
-            stride_row_start = in_start;
-            diff_stride_r_start = diff_start;
-            // Next stride (row)
-            for (lint stride_r_pos = 0; stride_r_pos < out_rows; ++stride_r_pos)
+            lint w_r = in_r + this->m_r_zero_p - out_r * this->m_r_stride;
+            if (w_r < 0 || w_r >= w_rows)
             {
-                stride_col_start = stride_row_start;
-                diff_stride_c_start = diff_stride_r_start;
+                continue;
+            }
+
+            const dtype *col_p = cols.m_data + (i * out_rows + out_r) * out_cols * patch_size + w_r * w_cols * chls;
 
-                // Next stride (column)
-                for (lint stride_c_pos = 0; stride_c_pos < out_cols; ++stride_c_pos)
+            for (lint out_c = 0; out_c < out_cols; ++out_c)
+            {
+                for (lint w_c = 0; w_c < w_cols; ++w_c)
                 {
-                    in_row_start = stride_col_start;
-                    diff_w_r_start = diff_stride_c_start;
+                    lint in_c = out_c * this->m_c_stride + w_c - this->m_c_zero_p;
 
-                    // Go through each pixel and each channel
-                    for (lint r = 0; r < w_rows; ++r)
+                    // Gradients of the zero padding are dropped
+                    if (in_c >= 0 && in_c < in_cols)
                     {
-                        in_col_start = in_row_start;
-                        diff_w_c_start = diff_w_r_start;
-
-                        for (lint c = 0; c < w_cols; ++c)
+                        dtype *out_p = out_row + in_c * chls;
+                        const dtype *c_p = col_p + w_c * chls;
+                        for (lint j = 0; j < chls; ++j)
                         {
-                            in_p = in_col_start;
-                            diff_chls_start = diff_w_c_start;
-
-                            for (lint j = 0; j < chls; ++j)
-                            {
-                                *diff_chls_start = *in_p;
-
-                                ++in_p;
-                                diff_chls_start += out_rows_out_cols;
-                            }
-
-                            in_col_start += chls;
-                            diff_w_c_start += chls_out_rows_out_cols;
+                            out_p[j] += c_p[j];
                         }
-
-                        in_row_start += in_cols_chls;
-                        diff_w_r_start += w_cols_chls_out_rows_out_cols;
                     }
-
-                    stride_col_start += chls * this->m_c_stride;
-                    ++diff_stride_c_start;
                 }
 
-                stride_row_start += in_cols_chls * this->m_r_stride;
-                diff_stride_r_start += out_cols;
+                col_p += patch_size;
             }
-
-            in_start += in_conv_size;
-            diff_start += diff_size;
         }
     }
+}
 
+template <typename dtype>
+neurons::TMatrix<dtype> neurons::Conv_2d<dtype>::operator()(const TMatrix<dtype> & input, const TMatrix<dtype> & weights, const TMatrix<dtype> & bias)
+{
+    if (this->m_input_sh != input.shape() || this->m_weights_sh != weights.shape() || bias.m_shape.dim() < 2)
+    {
+        throw std::invalid_argument(
+            std::string("neurons::Conv_2d: Shape of inputs and weights should be compatible with the this convolution."));
+    }
+
+    TMatrix<dtype> out;
+    this->product(out, input, weights);
 
+    // Add the bias to each row of the output
+    lint filters = this->m_weights_sh[3];
+    lint positions = out.shape().size() / filters;
+    for (lint i = 0; i < positions; ++i)
     {
-        // Calculate the Derivative [ d(conv_product) / d(x) ]
-        double *diff_start = this->m_diff_to_x.m_data;
-        lint _in_rows = in_rows - 2 * this->m_r_zero_p;
-        lint _in_cols = in_cols - 2 * this->m_c_zero_p;
+        dtype *out_row = out.m_data + i * filters;
+        for (lint j = 0; j < filters; ++j)
+        {
+            out_row[j] += bias.m_data[j];
+        }
+    }
 
-        lint diff_size = _in_rows * _in_cols * chls * out_rows * out_cols * w_batch_size;
-        lint diff_r_size = _in_cols * chls * out_rows * out_cols * w_batch_size;
-        lint diff_c_size = chls * out_rows * out_cols * w_batch_size;
-        lint diff_ch_size = out_rows * out_cols * w_batch_size;
-        lint diff_o_r_size = out_cols * w_batch_size;
-        lint diff_o_c_size = w_batch_size;
+    return out;
+}
+
+template <typename dtype>
+void neurons::Conv_2d<dtype>::product(TMatrix<dtype> & out, const TMatrix<dtype> & input, const TMatrix<dtype> & weights)
+{
+    if (this->m_input_sh != input.shape() || this->m_weights_sh != weights.shape())
+    {
+        throw std::invalid_argument(
+            std::string("neurons::Conv_2d::product: Shape of inputs and weights should be compatible with the this convolution."));
+    }
 
-        lint in_rows_minus_padding = in_rows - this->m_r_zero_p;
-        lint in_cols_minus_padding = in_cols - this->m_c_zero_p;
+    if (this->m_use_winograd)
+    {
+        this->m_winograd.product(out, input, weights);
+        return;
+    }
 
-        double *w_start = weights.m_data;
+    this->prepare_cols();
 
-        double *diff_r_start;
-        double *w_in_r_start;
+    lint out_cols = this->m_output_sh[2];
+    lint patch_size = this->m_cols.shape()[1];
+    lint filters = this->m_weights_sh[3];
 
-        double *diff_c_start;
-        double *w_in_c_start;
+    if (out.shape() != this->m_output_sh)
+    {
+        out = TMatrix<dtype>{ this->m_output_sh };
+    }
 
-        double *diff_ch_start;
-        double *w_chls_start;
+    // Rows of the output of all samples are split over threads, each chunk unfolds its own
+    // patches and multiplies them while they are still in cache.
+    auto compute_rows = [&](lint begin, lint end)
+    {
+        this->im2col(input, begin, end);
 
-        double *diff_o_r_start;
-        double *w_r_start;
+        lint first = begin * out_cols;
+        neurons::gemm<dtype>(false, false, (end - begin) * out_cols, filters, patch_size,
+            1, this->m_cols.m_data + first * patch_size, patch_size, weights.m_data, filters, 0, out.m_data + first * filters, filters);
+    };
 
-        double *diff_o_c_start;
-        double *w_c_start;
+    parallel_for_rows(this->m_output_sh[0] * this->m_output_sh[1], 2 * out_cols * patch_size * filters, compute_rows);
+}
 
-        for (lint i = 0; i < in_batch_size; ++i)
-        {
-            diff_r_start = diff_start;
-            w_in_r_start = w_start;
+template <typename dtype>
+neurons::TMatrix<dtype> neurons::Conv_2d<dtype>::diff_to_input(const TMatrix<dtype> & diff_E_to_z, const TMatrix<dtype> & weights) const
+{
+    if (this->m_output_sh.size() != diff_E_to_z.shape().size() || this->m_weights_sh != weights.shape())
+    {
+        throw std::invalid_argument(
+            std::string("neurons::Conv_2d::diff_to_input: Shape of the derivative and weights should be compatible with the this convolution."));
+    }
 
-            for (lint in_r = 0; in_r < in_rows; ++in_r)
-            {
-                w_in_c_start = w_in_r_start;
+    lint filters = this->m_weights_sh[3];
+    lint positions = this->m_output_sh.size() / filters;
+    lint patch_size = this->m_weights_sh.size() / filters;
+    lint out_cols = this->m_output_sh[2];
 
-                if (in_r >= this->m_r_zero_p && in_r < in_rows_minus_padding)
-                {
-                    diff_c_start = diff_r_start;
+    Shape cols_sh{ positions, patch_size };
+    if (this->m_col_diffs.shape() != cols_sh)
+    {
+        this->m_col_diffs = TMatrix<dtype>{ cols_sh };
+    }
 
-                    for (lint in_c = 0; in_c < in_cols; ++in_c)
-                    {
-                        w_chls_start = w_in_c_start;
+    // Gradients of all patches: [positions, filters] x transpose([patch_size, filters]),
+    // split over rows of the output
+    auto compute_rows = [&](lint begin, lint end)
+    {
+        lint first = begin * out_cols;
+        neurons::gemm<dtype>(false, true, (end - begin) * out_cols, patch_size, filters,
+            1, diff_E_to_z.m_data + first * filters, filters, weights.m_data, filters, 0, this->m_col_diffs.m_data + first * patch_size, patch_size);
+    };
 
-                        if (in_c >= this->m_c_zero_p && in_c < in_cols_minus_padding)
-                        {
-                            diff_ch_start = diff_c_start;
-
-                            for (lint in_chls = 0; in_chls < chls; ++in_chls)
-                            {
-                                diff_o_r_start = diff_ch_start;
-                                w_r_start = w_chls_start;
-
-                                for (lint out_r = 0; out_r < out_rows; ++out_r)
-                                {
-                                    lint w_row = in_r - out_r;
-
-                                    if (w_row < 0 || w_row >= w_rows)
-                                    {
-                                        for (lint i = 0; i < diff_o_r_size; ++i)
-                                        {
-                                            diff_o_r_start[i] = 0;
-                                        }
-                                    }
-                                    else
-                                    {
-                                        diff_o_c_start = diff_o_r_start;
-                                        w_c_start = w_r_start;
-
-                                        for (lint out_c = 0; out_c < out_cols; ++out_c)
-                                        {
-                                            lint w_col = in_c - out_c;
-
-                                            if (w_col < 0 || w_col >= w_cols)
-                                            {
-                                                for (lint w = 0; w < w_batch_size; ++w)
-                                                {
-                                                    diff_o_c_start[w] = 0;
-                                                }
-                                            }
-                                            else
-                                            {
-                                                for (lint w = 0; w < w_batch_size; ++w)
-                                                {
-                                                    diff_o_c_start[w] = w_c_start[w];
-                                                }
-                                            }
-
-                                            diff_o_c_start += diff_o_c_size;
-                                            w_c_start -= chls_w_batch_size;
-                                        }
-                                    }
-
-                                    diff_o_r_start += diff_o_r_size;
-                                    w_r_start -= w_cols_chls_w_batch_size;
-                                }
-
-                                diff_ch_start += diff_ch_size;
-                                w_chls_start += w_batch_size;
-                            }
-
-                            diff_c_start += diff_c_size;
-                        }
+    parallel_for_rows(this->m_output_sh[0] * this->m_output_sh[1], 2 * out_cols * patch_size * filters, compute_rows);
 
-                        w_in_c_start += chls_w_batch_size;
-                    }
+    // Patches overlap, so they are folded back split over rows of the input
+    TMatrix<dtype> diff_E_to_x{ this->m_input_sh, 0 };
+    lint in_row_work = this->m_weights_sh[0] * this->m_weights_sh[1] * out_cols * this->m_input_sh[3];
 
-                    diff_r_start += diff_r_size;
-                }
+    parallel_for_rows(this->m_input_sh[0] * this->m_input_sh[1], in_row_work, [&](lint begin, lint end)
+    {
+        this->col2im(this->m_col_diffs, diff_E_to_x, begin, end);
+    });
 
-                w_in_r_start += w_cols_chls_w_batch_size;
-            }
+    return diff_E_to_x;
+}
 
-            diff_start += diff_size;
-        }
+template <typename dtype>
+void neurons::Conv_2d<dtype>::add_diff_to_weights(TMatrix<dtype> & diff_E_to_w, const TMatrix<dtype> & input, const TMatrix<dtype> & diff_E_to_z) const
+{
+    if (this->m_input_sh != input.shape() ||
+        this->m_output_sh.size() != diff_E_to_z.shape().size() ||
+        this->m_weights_sh.size() != diff_E_to_w.shape().size())
+    {
+        throw std::invalid_argument(
+            std::string("neurons::Conv_2d::add_diff_to_weights: Shape of the input and derivatives should be compatible with the this convolution."));
     }
 
-    return out;
-}
+    this->prepare_cols();
 
+    lint positions = this->m_cols.shape()[0];
+    lint patch_size = this->m_cols.shape()[1];
+    lint filters = this->m_weights_sh[3];
+    lint out_cols = this->m_output_sh[2];
 
-neurons::TMatrix<> & neurons::Conv_2d::get_diff_to_weights() const
-{
-    return this->m_diff_to_w;
-}
+    parallel_for_rows(this->m_output_sh[0] * this->m_output_sh[1], out_cols * patch_size, [&](lint begin, lint end)
+    {
+        this->im2col(input, begin, end);
+    });
 
+    // transpose([positions, patch_size]) x [positions, filters], the sum over positions
+    // stays in one product, so filters are split over threads
+    auto compute_filters = [&](lint begin, lint end)
+    {
+        neurons::gemm<dtype>(true, false, patch_size, end - begin, positions,
+            1, this->m_cols.m_data, patch_size, diff_E_to_z.m_data + begin, filters, 1, diff_E_to_w.m_data + begin, filters);
+    };
 
-neurons::TMatrix<> & neurons::Conv_2d::get_diff_to_input() const
-{
-    return this->m_diff_to_x;
+    parallel_for_rows(filters, 2 * patch_size * positions, compute_filters);
 }
 
 
-neurons::Shape neurons::Conv_2d::get_output_shape() const
+template <typename dtype>
+neurons::Shape neurons::Conv_2d<dtype>::get_output_shape() const
 {
     return this->m_output_sh;
 }
 
 
-neurons::TMatrix<> neurons::Conv_2d::zero_padding(const TMatrix<> & input)
+template <typename dtype>
+neurons::TMatrix<dtype> neurons::Conv_2d<dtype>::zero_padding(const TMatrix<dtype> & input)
 {
     if (this->m_r_zero_p < 0)
     {
@@ -632,12 +1013,12 @@ neurons::TMatrix<> neurons::Conv_2d::zero_padding(const TMatrix<> & input)
     lint ex_in_rows = in_rows + 2 * m_r_zero_p;
     lint ex_in_cols = in_cols + 2 * m_c_zero_p;
 
-    TMatrix<> ex_input{
+    TMatrix<dtype> ex_input{
         Shape{ in_batch_size, ex_in_rows, ex_in_cols } +
         this->m_input_sh.sub_shape(3, this->m_input_sh.dim() - 1) };
 
-    double *in_start = input.m_data;
-    double *ex_in_start = ex_input.m_data;
+    dtype *in_start = input.m_data;
+    dtype *ex_in_start = ex_input.m_data;
 
     lint in_size = in_rows * in_cols * chls;
     lint ex_in_size = ex_in_rows * ex_in_cols * chls;
@@ -647,15 +1028,15 @@ neurons::TMatrix<> neurons::Conv_2d::zero_padding(const TMatrix<> & input)
 
     for (lint i = 0; i < in_batch_size; ++i)
     {
-        double *in_r_start = in_start;
-        double *ex_in_r_start = ex_in_start;
+        dtype *in_r_start = in_start;
+        dtype *ex_in_r_start = ex_in_start;
         
         for (lint j = 0; j < ex_in_rows; ++j)
         {
             if (j >= m_r_zero_p && j < ex_in_rows - m_r_zero_p)
             {
-                double *in_c_start = in_r_start;
-                double *ex_in_c_start = ex_in_r_start;
+                dtype *in_c_start = in_r_start;
+                dtype *ex_in_c_start = ex_in_r_start;
 
                 for (lint k = 0; k < ex_in_cols; ++k)
                 {
@@ -700,3 +1081,8 @@ neurons::TMatrix<> neurons::Conv_2d::zero_padding(const TMatrix<> & input)
 
     return ex_input;
 }
+
+template class neurons::Winograd_2d<float>;
+template class neurons::Winograd_2d<double>;
+template class neurons::Conv_2d<float>;
+template class neurons::Conv_2d<double>;
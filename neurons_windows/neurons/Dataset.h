@@ -1,6 +1,10 @@
 #pragma once
 
 #include "TMatrix.h"
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
 #include <vector>
 
 
@@ -8,16 +12,345 @@ namespace dataset
 {
     typedef long long int lint;
 
+    /*
+    Images of a data set kept as raw uint8 pixels in one contiguous buffer, together with their class labels.
+
+    All images are of the same shape, pixels of an image are stored in the same order as elements of
+    a TMatrix of that shape. This takes 1/8 memory of TMatrix<double> images and needs no allocation
+    per image, images are converted (and scaled) to matrices only when they are needed.
+
+    Instead of owning the pixels, a store can also refer to spans of memory owned by others,
+    such as memory mapped data set files. Nothing is copied then, and images in a span may be
+    apart from each other or have their channels stored one after another.
+    */
+    class Image_store
+    {
+    public:
+        enum class Scaling
+        {
+            // Pixel values 0 ~ 255 are kept
+            none,
+            // Pixel values are scaled to 0 ~ 1
+            unit,
+            // Each image is normalized to mean == 0 and variance == 1 (the same as TMatrix::normalize)
+            standardize
+        };
+
+        // Images and labels in memory owned by someone else
+        struct Span
+        {
+            // Keep memory of pixels and labels alive as long as the store refers to it
+            std::shared_ptr<const void> m_pixel_owner;
+            std::shared_ptr<const void> m_label_owner;
+
+            const uint8_t *m_pixels;
+            const uint8_t *m_labels;
+            lint m_images;
+
+            // Number of bytes from an image (label) to the next one
+            lint m_image_stride;
+            lint m_label_stride;
+
+            // Channels of an image are stored one after another (channels, rows, columns)
+            // instead of being interleaved (rows, columns, channels)
+            bool m_planar;
+        };
+
+    private:
+        neurons::Shape m_image_shape;
+        lint m_image_size;
+        lint m_classes;
+
+        std::vector<uint8_t> m_pixels;
+        std::vector<uint8_t> m_labels;
+
+        std::vector<Span> m_spans;
+        // Number of images in m_spans[0] ~ m_spans[i]
+        std::vector<lint> m_span_ends;
+
+    public:
+        Image_store();
+
+        Image_store(const neurons::Shape & image_shape, lint classes);
+
+        // Number of images
+        lint size() const;
+
+        const neurons::Shape & image_shape() const;
+
+        lint classes() const;
+
+        void set_classes(lint classes);
+
+        // Change number of images, pixels and labels of new images are zero.
+        // Only stores owning their images can be resized.
+        void resize(lint images);
+
+        // Append images of a span to the store, nothing is copied.
+        // Only stores without images of their own can refer to spans.
+        void add_span(const Span & span);
+
+        // Pixels of an image owned by the store to be written
+        uint8_t * writable_pixels(lint index);
+
+        // Pixels of an image, channels of images in planar spans are not interleaved
+        const uint8_t * pixels(lint index) const;
+
+        uint8_t label(lint index) const;
+
+        void set_label(lint index, uint8_t label);
+
+        // Copy an image and its label of another store of the same image shape to index of this store
+        void copy_image(lint index, const Image_store & other, lint other_index);
+
+        // Convert an image to a matrix of the shape, which should be of the same size as the image shape.
+        // Memory of the matrix is reused if it is already of this size.
+        template <typename dtype>
+        void materialize(neurons::TMatrix<dtype> & image, lint index, const neurons::Shape & shape, Scaling scaling) const;
+
+        // Convert a label to a one-hot matrix of the shape, which should be of the same size as number of classes
+        template <typename dtype>
+        void materialize_label(neurons::TMatrix<dtype> & label, lint index, const neurons::Shape & shape) const;
+
+        // Convert all images and labels to matrices of their own shapes without scaling.
+        // Matrices are appended to images and labels.
+        void to_matrices(std::vector<neurons::TMatrix<>> & images, std::vector<neurons::TMatrix<>> & labels) const;
+
+    private:
+        // Find the span of an image, offset is index of the image in the span
+        const Span & find_span(lint index, lint & offset) const;
+
+        // Pixels of an image, planar is set if its channels are stored one after another
+        const uint8_t * locate(lint index, bool & planar) const;
+
+        // Convert pixels to elements of a matrix, interleaving channels of planar pixels
+        template <typename dtype, typename Convert>
+        static void convert_pixels(dtype *elements, const uint8_t *pixels, lint channels, lint plane, Convert convert);
+    };
+
+    /*
+    Samples of a data set read from its files chunk by chunk, so the data set does not have to fit into memory.
+    A stream may cover only a part (a shard) of the data set.
+    */
+    class Sample_stream
+    {
+    public:
+        virtual ~Sample_stream();
+
+        virtual neurons::Shape image_shape() const = 0;
+
+        virtual lint classes() const = 0;
+
+        // Number of samples in the stream
+        virtual lint size() const = 0;
+
+        // Append up to max_images next samples of the stream to images.
+        // Number of samples read is returned, which is 0 at the end of the stream.
+        virtual lint read(Image_store & images, lint max_images) = 0;
+
+        // Start reading from the first sample of the stream again
+        virtual void rewind() = 0;
+    };
+
+    /*
+    Draws samples of a stream in random order with a buffer of bounded size.
+
+    The buffer is filled with the first samples of the stream. Each time a sample is drawn uniformly
+    at random from the buffer, its place is taken by the next sample of the stream. The stream is read
+    chunk by chunk and starts again at its end, so samples can be drawn endlessly over epochs.
+    Samples are shuffled better with a larger buffer, a buffer as large as the stream shuffles perfectly.
+    */
+    class Shuffle_buffer
+    {
+    private:
+        std::unique_ptr<Sample_stream> m_stream;
+        lint m_chunk_size;
+
+        Image_store m_buffer;
+        Image_store m_chunk;
+        // Index of the next sample in m_chunk
+        lint m_chunk_next;
+
+        std::default_random_engine m_engine;
+
+    public:
+        Shuffle_buffer(std::unique_ptr<Sample_stream> stream, lint buffer_size, lint chunk_size, unsigned int seed);
+
+        Shuffle_buffer(const Shuffle_buffer & other) = delete;
+        Shuffle_buffer & operator = (const Shuffle_buffer & other) = delete;
+
+    public:
+        const neurons::Shape & image_shape() const;
+
+        lint classes() const;
+
+        // Number of samples in the buffer
+        lint size() const;
+
+        // Copy a random sample of the buffer to index of images, the sample is replaced by the next one of the stream
+        void next(Image_store & images, lint index);
+
+    private:
+        // Copy the next sample of the stream to index of images
+        void next_of_stream(Image_store & images, lint index);
+    };
+
     /*
     This is an abstract interface of Dataset to read inputs and labels
     */
     class Dataset
     {
     public:
+        // How the training set is streamed instead of being loaded at once
+        struct Stream_settings
+        {
+            // Number of samples read from files at a time, 0 if the training set is not streamed
+            lint m_chunk_size;
+            // Number of samples in the shuffle buffer
+            lint m_buffer_size;
+            // Only the shard-th of shards parts of the training set is read,
+            // so that trainers sharing a data set can train on different parts of it
+            lint m_shard;
+            lint m_shards;
+        };
+
+    private:
+        Stream_settings m_stream_settings;
+
+    public:
+        Dataset();
+
+        virtual ~Dataset();
+
+        // Stream the training set through a shuffle buffer instead of loading it when a network is created
+        void set_streaming(lint chunk_size, lint buffer_size, lint shard = 0, lint shards = 1);
+
+        const Stream_settings & stream_settings() const;
+
+        // Open a part of the training set as a stream, nullptr is returned if the data set does not support this.
+        virtual std::unique_ptr<Sample_stream> open_training_stream(lint shard, lint shards) const;
+
         virtual void get_training_set(
             std::vector<neurons::TMatrix<>> & inputs, std::vector<neurons::TMatrix<>> & labels, lint limit = 0) const = 0;
 
         virtual void get_test_set(
             std::vector<neurons::TMatrix<>> & inputs, std::vector<neurons::TMatrix<>> & labels, lint limit = 0) const = 0;
+
+        // Data sets of images can keep them as raw pixels in an Image_store instead of matrices.
+        // false is returned if the data set does not support this.
+        virtual bool get_training_store(Image_store & images, lint limit = 0) const;
+
+        virtual bool get_test_store(Image_store & images, lint limit = 0) const;
     };
 }
+
+
+template <typename dtype>
+void dataset::Image_store::materialize(
+    neurons::TMatrix<dtype> & image, lint index, const neurons::Shape & shape, Scaling scaling) const
+{
+    if (shape.size() != this->m_image_size)
+    {
+        throw std::invalid_argument(
+            std::string("dataset::Image_store::materialize: the shape does not match size of images."));
+    }
+
+    if (image.shape().size() != this->m_image_size)
+    {
+        image = neurons::TMatrix<dtype>{ shape };
+    }
+    else
+    {
+        image.reshape(shape);
+    }
+
+    bool planar;
+    const uint8_t *pixels = this->locate(index, planar);
+
+    // All channels are in one plane if they are interleaved
+    lint channels = planar ? this->m_image_shape[this->m_image_shape.dim() - 1] : 1;
+    lint plane = this->m_image_size / channels;
+
+    if (Scaling::standardize == scaling)
+    {
+        // Statistics are calculated from the pixels directly, so the image is converted only once
+        double mean = 0;
+        for (lint i = 0; i < this->m_image_size; ++i)
+        {
+            mean += pixels[i];
+        }
+        mean /= this->m_image_size;
+
+        double var = 0;
+        for (lint i = 0; i < this->m_image_size; ++i)
+        {
+            double sub = pixels[i] - mean;
+            var += sub * sub;
+        }
+        var /= this->m_image_size;
+        var = sqrt(var);
+
+        if (0 == var)
+        {
+            image.gaussian_random(0, 1);
+        }
+        else
+        {
+            convert_pixels(image.m_data, pixels, channels, plane,
+                [mean, var](uint8_t pixel) { return static_cast<dtype>((pixel - mean) / var); });
+        }
+    }
+    else
+    {
+        double scale = Scaling::unit == scaling ? 1.0 / 255 : 1.0;
+        convert_pixels(image.m_data, pixels, channels, plane,
+            [scale](uint8_t pixel) { return static_cast<dtype>(pixel * scale); });
+    }
+}
+
+
+template <typename dtype>
+void dataset::Image_store::materialize_label(neurons::TMatrix<dtype> & label, lint index, const neurons::Shape & shape) const
+{
+    if (shape.size() != this->m_classes)
+    {
+        throw std::invalid_argument(
+            std::string("dataset::Image_store::materialize_label: the shape does not match number of classes."));
+    }
+
+    if (label.shape().size() != this->m_classes)
+    {
+        label = neurons::TMatrix<dtype>{ shape };
+    }
+    else
+    {
+        label.reshape(shape);
+    }
+
+    uint8_t label_val = this->label(index);
+    if (label_val >= this->m_classes)
+    {
+        throw std::invalid_argument(
+            std::string("dataset::Image_store::materialize_label: the label is out of range of classes."));
+    }
+
+    for (lint i = 0; i < this->m_classes; ++i)
+    {
+        label.m_data[i] = 0;
+    }
+    label.m_data[label_val] = 1;
+}
+
+
+template <typename dtype, typename Convert>
+void dataset::Image_store::convert_pixels(dtype *elements, const uint8_t *pixels, lint channels, lint plane, Convert convert)
+{
+    for (lint c = 0; c < channels; ++c)
+    {
+        const uint8_t *channel = pixels + c * plane;
+        for (lint i = 0; i < plane; ++i)
+        {
+            elements[i * channels + c] = convert(channel[i]);
+        }
+    }
+}
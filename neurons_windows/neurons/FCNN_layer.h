@@ -13,7 +13,8 @@ namespace neurons
     This is definition of a single layer of a fully connected neural network.
     FCNN stands for "Fully Connected Neural Networks"
     */
-    class FCNN_layer : public Traditional_NN_layer
+    template <typename dtype = double>
+    class FCNN_layer : public Traditional_NN_layer<dtype>
     {
     public:
         // Default constructor does almost nothing here.
@@ -29,13 +30,13 @@ namespace neurons
             lint input_size,     // Size of input
             lint output_size,    // Size of output
             lint threads,        // Number of threads while training this layer
-            neurons::Activation *act_func,    // Activation function of this layer
-            neurons::ErrorFunction *err_func = nullptr   // Cost function or error function of this layer
+            neurons::Activation<dtype> *act_func,    // Activation function of this layer
+            neurons::ErrorFunction<dtype> *err_func = nullptr   // Cost function or error function of this layer
         );
 
         // This is the constructor to create a functional FCNN layer from weight, bias and functions directly 
-        FCNN_layer(double mmt_rate, lint threads, TMatrix<> & w, TMatrix<> & b,
-            std::unique_ptr<Activation> & act_func, std::unique_ptr<ErrorFunction> & err_func);
+        FCNN_layer(double mmt_rate, lint threads, TMatrix<dtype> w, TMatrix<dtype> b,
+            std::unique_ptr<Activation<dtype>> & act_func, std::unique_ptr<ErrorFunction<dtype>> & err_func);
 
 
         FCNN_layer(const FCNN_layer & other);
@@ -48,23 +49,26 @@ namespace neurons
 
         virtual Shape output_shape() const;
 
-        virtual std::string nn_type() const { return NN_layer::FCNN; }
+        virtual std::string nn_type() const { return NN_layer<dtype>::FCNN; }
     };
 
-    class FCNN_layer_op : public Traditional_NN_layer_op
+    template <typename dtype = double>
+    class FCNN_layer_op : public Traditional_NN_layer_op<dtype>
     {
     private:
-        // The input data
-        std::vector<TMatrix<>> m_x;
+        // The input data of the whole batch stacked as [batch, input size]
+        TMatrix<dtype> m_x;
+        // x * w of the whole batch as [batch, output size], the bias is added by the activation function
+        TMatrix<dtype> m_product;
 
     public:
         FCNN_layer_op();
 
         FCNN_layer_op(
-            const TMatrix<> &w,
-            const TMatrix<> &b,
-            const std::unique_ptr<Activation> &act_func,
-            const std::unique_ptr<ErrorFunction> &err_func);
+            const TMatrix<dtype> &w,
+            const TMatrix<dtype> &b,
+            const std::unique_ptr<Activation<dtype>> &act_func,
+            const std::unique_ptr<ErrorFunction<dtype>> &err_func);
 
         //----------------------------
         // Copy and move operations
@@ -82,21 +86,34 @@ namespace neurons
         // Forward propagation via batch learning
         //--------------------------------------------
 
-        virtual std::vector<TMatrix<>> batch_forward_propagate(const std::vector<TMatrix<>> & inputs);
+        virtual std::vector<TMatrix<dtype>> batch_forward_propagate(const std::vector<TMatrix<dtype>> & inputs);
 
-        virtual std::vector<TMatrix<>> batch_forward_propagate(
-            const std::vector<TMatrix<>> & inputs, const std::vector<TMatrix<>> & targets);
+        virtual std::vector<TMatrix<dtype>> batch_forward_propagate(
+            const std::vector<TMatrix<dtype>> & inputs, const std::vector<TMatrix<dtype>> & targets);
+
+        // Samples are read directly while they are stacked into m_x
+
+        virtual std::vector<TMatrix<dtype>> batch_forward_propagate(const std::vector<const TMatrix<dtype> *> & inputs);
+
+        virtual std::vector<TMatrix<dtype>> batch_forward_propagate(
+            const std::vector<const TMatrix<dtype> *> & inputs, const std::vector<const TMatrix<dtype> *> & targets);
 
         //--------------------------------------------
         // Backward propagation via batch learning
         //--------------------------------------------
 
-        virtual std::vector<TMatrix<>> batch_back_propagate(double l_rate, const std::vector<TMatrix<>> & E_to_y_diffs);
+        virtual std::vector<TMatrix<dtype>> batch_back_propagate(double l_rate, const std::vector<TMatrix<dtype>> & E_to_y_diffs);
 
-        virtual std::vector<TMatrix<>> batch_back_propagate(double l_rate);
+        virtual std::vector<TMatrix<dtype>> batch_back_propagate(double l_rate);
 
         virtual Shape output_shape() const;
 
+    private:
+        // Stack inputs into m_x and calculate x * w of the whole batch into m_product
+        void linear_transform(const std::vector<const TMatrix<dtype> *> & inputs);
+
+        // Back propagate dE/dz of the whole batch, which is stacked as [batch, output size]
+        std::vector<TMatrix<dtype>> back_propagate_from_z(double l_rate, const TMatrix<dtype> & diff_E_to_z);
     };
 
 }
\ No newline at end of file
@@ -1,61 +1,126 @@
 #include "Functions.h"
+#include "Vector_math.h"
 #include <math.h>
+#include <algorithm>
 #include <iostream>
 #include <chrono>
 
-const std::string neurons::Activation::LINEAR{ "Linear" };
-const std::string neurons::Activation::SIGMOID{ "Sigmoid" };
-const std::string neurons::Activation::TANH{ "Tanh" };
-const std::string neurons::Activation::RELU{ "Relu" };
-const std::string neurons::Activation::LEAKYRELU{ "LeakyRelu" };
-const std::string neurons::Activation::ARCTAN{ "Arctan" };
-const std::string neurons::Activation::SIN{ "Sin" };
-const std::string neurons::Activation::SOFTSIGN{ "Softsign" };
-const std::string neurons::Activation::SOFTMAX{ "Softmax" };
-const std::string neurons::Activation::NULL_FUNC{ "NULL" };
+namespace
+{
+    // Activation and error functions write into buffers of their callers,
+    // the memory of a buffer is reused when it has as many elements as the shape.
+    template <typename dtype>
+    void prepare_buffer(neurons::TMatrix<dtype> & buffer, const neurons::Shape & shape)
+    {
+        if (buffer.m_shape.size() != shape.size())
+        {
+            buffer = neurons::TMatrix<dtype>{ shape };
+        }
+        else if (buffer.m_shape != shape)
+        {
+            buffer.reshape(shape);
+        }
+    }
+
+    // Elements per block of the fused epilogue, the blocks of product, output and diff stay in L1 cache together
+    const lint EPILOGUE_BLOCK = 512;
 
-const std::string neurons::ErrorFunction::HALF_SQUARE_ERROR{ "HalfSquareError" };
-const std::string neurons::ErrorFunction::SIGMOID_CROSS_ENTROPY{ "Sigmoid_CrossEntropy" };
-const std::string neurons::ErrorFunction::SOFTMAX_CROSS_ENTROPY{ "Softmax_CrossEntropy" };
-const std::string neurons::ErrorFunction::NULL_FUNC{ "NULL" };
+    template <typename dtype>
+    void check_bias(const neurons::Shape & shape, const neurons::TMatrix<dtype> & bias, const std::string & func_name)
+    {
+        if (0 == shape.dim() || bias.m_shape.size() != shape[shape.dim() - 1])
+        {
+            throw std::invalid_argument(
+                std::string("neurons::" + func_name + ": size of the bias should be the last dimension of the product."));
+        }
+    }
 
-std::unique_ptr<neurons::Activation> neurons::Activation::get_function_by_name(const std::string & func_name)
+    // z = product + bias of elements [begin, begin + n) of a sample, the bias repeats along the last dimension
+    template <typename dtype>
+    void add_bias(lint begin, lint n, const dtype *product, const neurons::TMatrix<dtype> & bias, dtype *z)
+    {
+        lint bias_size = bias.m_shape.size();
+        lint j = begin % bias_size;
+
+        for (lint i = 0; i < n; ++i)
+        {
+            z[i] = product[i] + bias.m_data[j];
+            if (++j == bias_size)
+            {
+                j = 0;
+            }
+        }
+    }
+}
+
+template <typename dtype>
+const std::string neurons::Activation<dtype>::LINEAR{ "Linear" };
+template <typename dtype>
+const std::string neurons::Activation<dtype>::SIGMOID{ "Sigmoid" };
+template <typename dtype>
+const std::string neurons::Activation<dtype>::TANH{ "Tanh" };
+template <typename dtype>
+const std::string neurons::Activation<dtype>::RELU{ "Relu" };
+template <typename dtype>
+const std::string neurons::Activation<dtype>::LEAKYRELU{ "LeakyRelu" };
+template <typename dtype>
+const std::string neurons::Activation<dtype>::ARCTAN{ "Arctan" };
+template <typename dtype>
+const std::string neurons::Activation<dtype>::SIN{ "Sin" };
+template <typename dtype>
+const std::string neurons::Activation<dtype>::SOFTSIGN{ "Softsign" };
+template <typename dtype>
+const std::string neurons::Activation<dtype>::SOFTMAX{ "Softmax" };
+template <typename dtype>
+const std::string neurons::Activation<dtype>::NULL_FUNC{ "NULL" };
+
+template <typename dtype>
+const std::string neurons::ErrorFunction<dtype>::HALF_SQUARE_ERROR{ "HalfSquareError" };
+template <typename dtype>
+const std::string neurons::ErrorFunction<dtype>::SIGMOID_CROSS_ENTROPY{ "Sigmoid_CrossEntropy" };
+template <typename dtype>
+const std::string neurons::ErrorFunction<dtype>::SOFTMAX_CROSS_ENTROPY{ "Softmax_CrossEntropy" };
+template <typename dtype>
+const std::string neurons::ErrorFunction<dtype>::NULL_FUNC{ "NULL" };
+
+template <typename dtype>
+std::unique_ptr<neurons::Activation<dtype>> neurons::Activation<dtype>::get_function_by_name(const std::string & func_name)
 {
     if (func_name == LINEAR)
     {
-        return std::make_unique<Linear>();
+        return std::make_unique<Linear<dtype>>();
     }
     else if (func_name == SIGMOID)
     {
-        return std::make_unique<Sigmoid>();
+        return std::make_unique<Sigmoid<dtype>>();
     }
     else if (func_name == TANH)
     {
-        return std::make_unique<Tanh>();
+        return std::make_unique<Tanh<dtype>>();
     }
     else if (func_name == RELU)
     {
-        return std::make_unique<Relu>();
+        return std::make_unique<Relu<dtype>>();
     }
     else if (func_name == LEAKYRELU)
     {
-        return std::make_unique<LeakyRelu>();
+        return std::make_unique<LeakyRelu<dtype>>();
     }
     else if (func_name == ARCTAN)
     {
-        return std::make_unique<Arctan>();
+        return std::make_unique<Arctan<dtype>>();
     }
     else if (func_name == SIN)
     {
-        return std::make_unique<Sin>();
+        return std::make_unique<Sin<dtype>>();
     }
     else if (func_name == SOFTSIGN)
     {
-        return std::make_unique<Softsign>();
+        return std::make_unique<Softsign<dtype>>();
     }
     else if (func_name == SOFTMAX)
     {
-        return std::make_unique<Softmax>();
+        return std::make_unique<Softmax<dtype>>();
     }
     else if (func_name == NULL_FUNC)
     {
@@ -63,261 +128,343 @@ std::unique_ptr<neurons::Activation> neurons::Activation::get_function_by_name(c
     }
     else
     {
-        return std::make_unique<Sigmoid>();
+        return std::make_unique<Sigmoid<dtype>>();
     }
 }
 
-std::unique_ptr<neurons::Activation> neurons::Linear::clone()
+template <typename dtype>
+void neurons::Activation<dtype>::operator () (TMatrix<dtype> & output, TMatrix<dtype> & diff, const TMatrix<dtype> & in)
 {
-    return std::make_unique<neurons::Linear>();
+    prepare_buffer(output, in.m_shape);
+    prepare_buffer(diff, in.m_shape);
+    this->activate(in.m_shape.size(), in.m_data, output.m_data, diff.m_data);
 }
 
-void neurons::Linear::operator () (TMatrix<> & output, TMatrix<> & diff, const TMatrix<> & in)
+template <typename dtype>
+void neurons::Activation<dtype>::operator () (TMatrix<dtype> & output, TMatrix<dtype> & diff,
+    const Shape & shape, const dtype *product, const TMatrix<dtype> & bias)
 {
-    TMatrix<> l_output{ in.m_shape };
-    TMatrix<> l_diff{ in.m_shape };
-    lint size = in.m_shape.size();
-    for (lint i = 0; i < size; ++i)
+    check_bias(shape, bias, "Activation");
+    prepare_buffer(output, shape);
+    prepare_buffer(diff, shape);
+
+    lint size = shape.size();
+    for (lint begin = 0; begin < size; begin += EPILOGUE_BLOCK)
     {
-        l_output.m_data[i] = in.m_data[i];
-        l_diff.m_data[i] = 1;
-    }
+        lint n = std::min(EPILOGUE_BLOCK, size - begin);
+        dtype *y = output.m_data + begin;
 
-    output = std::move(l_output);
-    diff = std::move(l_diff);
+        // z is kept in the output block and activated in place
+        add_bias(begin, n, product + begin, bias, y);
+        this->activate(n, y, y, diff.m_data + begin);
+    }
 }
 
-std::string neurons::Linear::to_string() const
+template <typename dtype>
+void neurons::Activation<dtype>::infer(const Shape & shape, const dtype *product, const TMatrix<dtype> & bias, dtype *output) const
 {
-    return Activation::LINEAR;
+    check_bias(shape, bias, "Activation");
+
+    lint size = shape.size();
+    for (lint begin = 0; begin < size; begin += EPILOGUE_BLOCK)
+    {
+        lint n = std::min(EPILOGUE_BLOCK, size - begin);
+        dtype *y = output + begin;
+
+        add_bias(begin, n, product + begin, bias, y);
+        this->activate(n, y, y, nullptr);
+    }
 }
 
 
-std::unique_ptr<neurons::Activation> neurons::Sigmoid::clone()
+template <typename dtype>
+std::unique_ptr<neurons::Activation<dtype>> neurons::Linear<dtype>::clone()
 {
-    return std::make_unique<neurons::Sigmoid>();
+    return std::make_unique<neurons::Linear<dtype>>();
 }
 
-void neurons::Sigmoid::operator () (TMatrix<> & output, TMatrix<> & diff, const TMatrix<> & in)
+template <typename dtype>
+void neurons::Linear<dtype>::activate(lint n, const dtype *z, dtype *y, dtype *dy) const
 {
-    TMatrix<> l_output{ in.m_shape };
-    TMatrix<> l_diff{ in.m_shape };
-    lint size = in.m_shape.size();
-    for (lint i = 0; i < size; ++i)
+    for (lint i = 0; i < n; ++i)
     {
-        double y = 1.0 / (1.0 + exp(-in.m_data[i]));
-        l_output.m_data[i] = y;
-        l_diff.m_data[i] = y * (1 - y);
+        y[i] = z[i];
     }
+    if (dy)
+    {
+        std::fill(dy, dy + n, static_cast<dtype>(1));
+    }
+}
 
-    output = std::move(l_output);
-    diff = std::move(l_diff);
+template <typename dtype>
+std::string neurons::Linear<dtype>::to_string() const
+{
+    return Activation<dtype>::LINEAR;
 }
 
-std::string neurons::Sigmoid::to_string() const
+
+template <typename dtype>
+std::unique_ptr<neurons::Activation<dtype>> neurons::Sigmoid<dtype>::clone()
 {
-    return Activation::SIGMOID;
+    return std::make_unique<neurons::Sigmoid<dtype>>();
 }
 
+template <typename dtype>
+void neurons::Sigmoid<dtype>::activate(lint n, const dtype *z, dtype *y, dtype *dy) const
+{
+    vector_sigmoid(n, z, y, dy);
+}
 
-std::unique_ptr<neurons::Activation> neurons::Tanh::clone()
+template <typename dtype>
+std::string neurons::Sigmoid<dtype>::to_string() const
 {
-    return std::make_unique<neurons::Tanh>();
+    return Activation<dtype>::SIGMOID;
 }
 
-void neurons::Tanh::operator () (TMatrix<> & output, TMatrix<> & diff, const TMatrix<> & in)
+
+template <typename dtype>
+std::unique_ptr<neurons::Activation<dtype>> neurons::Tanh<dtype>::clone()
 {
-    output = TMatrix<>{ in.m_shape };
-    diff = TMatrix<>{ in.m_shape };
-    lint size = in.m_shape.size();
-    for (lint i = 0; i < size; ++i)
-    {
-        double y = tanh(in.m_data[i]);
-        output.m_data[i] = y;
-        diff.m_data[i] = 1 - y * y;
-    }
+    return std::make_unique<neurons::Tanh<dtype>>();
 }
 
-std::string neurons::Tanh::to_string() const
+template <typename dtype>
+void neurons::Tanh<dtype>::activate(lint n, const dtype *z, dtype *y, dtype *dy) const
 {
-    return Activation::TANH;
+    vector_tanh(n, z, y, dy);
 }
 
+template <typename dtype>
+std::string neurons::Tanh<dtype>::to_string() const
+{
+    return Activation<dtype>::TANH;
+}
 
-std::unique_ptr<neurons::Activation> neurons::Relu::clone()
+
+template <typename dtype>
+std::unique_ptr<neurons::Activation<dtype>> neurons::Relu<dtype>::clone()
 {
-    return std::make_unique<neurons::Relu>();
+    return std::make_unique<neurons::Relu<dtype>>();
 }
 
 
-void neurons::Relu::operator () (TMatrix<> & output, TMatrix<> & diff, const TMatrix<> & in)
+template <typename dtype>
+void neurons::Relu<dtype>::activate(lint n, const dtype *z, dtype *y, dtype *dy) const
 {
-    output = TMatrix<>{ in.m_shape };
-    diff = TMatrix<>{ in.m_shape };
-    lint size = in.m_shape.size();
-    for (lint i = 0; i < size; ++i)
+    for (lint i = 0; i < n; ++i)
     {
-        double x = in.m_data[i];
+        dtype x = z[i];
 
         if (x >= 0)
         {
-            output.m_data[i] = x;
-            diff.m_data[i] = 1;
+            y[i] = x;
         }
         else
         {
-            output.m_data[i] = 0;
-            diff.m_data[i] = 0;
+            y[i] = 0;
+        }
+        if (dy)
+        {
+            dy[i] = x >= 0 ? 1 : 0;
         }
     }
 }
 
-std::string neurons::Relu::to_string() const
+template <typename dtype>
+std::string neurons::Relu<dtype>::to_string() const
 {
-    return Activation::RELU;
+    return Activation<dtype>::RELU;
 }
 
 
-std::unique_ptr<neurons::Activation> neurons::LeakyRelu::clone()
+template <typename dtype>
+std::unique_ptr<neurons::Activation<dtype>> neurons::LeakyRelu<dtype>::clone()
 {
-    return std::make_unique<neurons::LeakyRelu>();
+    return std::make_unique<neurons::LeakyRelu<dtype>>();
 }
 
 
-void neurons::LeakyRelu::operator () (TMatrix<> & output, TMatrix<> & diff, const TMatrix<> & in)
+template <typename dtype>
+void neurons::LeakyRelu<dtype>::activate(lint n, const dtype *z, dtype *y, dtype *dy) const
 {
-    output = TMatrix<>{ in.m_shape };
-    diff = TMatrix<>{ in.m_shape };
-    lint size = in.m_shape.size();
-    for (lint i = 0; i < size; ++i)
+    for (lint i = 0; i < n; ++i)
     {
-        double x = in.m_data[i];
+        dtype x = z[i];
 
         if (x >= 0)
         {
-            output.m_data[i] = x;
-            diff.m_data[i] = 1;
+            y[i] = x;
         }
         else
         {
-            output.m_data[i] = 0.01 * x;
-            diff.m_data[i] = 0.01;
+            y[i] = 0.01 * x;
+        }
+        if (dy)
+        {
+            dy[i] = x >= 0 ? 1 : 0.01;
         }
     }
 }
 
-std::string neurons::LeakyRelu::to_string() const
+template <typename dtype>
+std::string neurons::LeakyRelu<dtype>::to_string() const
 {
-    return Activation::LEAKYRELU;
+    return Activation<dtype>::LEAKYRELU;
 }
 
 
 
-std::unique_ptr<neurons::Activation> neurons::Arctan::clone()
+template <typename dtype>
+std::unique_ptr<neurons::Activation<dtype>> neurons::Arctan<dtype>::clone()
 {
-    return std::make_unique<neurons::Arctan>();
+    return std::make_unique<neurons::Arctan<dtype>>();
 }
 
-void neurons::Arctan::operator()(TMatrix<>& output, TMatrix<>& diff, const TMatrix<>& in)
+template <typename dtype>
+void neurons::Arctan<dtype>::activate(lint n, const dtype *z, dtype *y, dtype *dy) const
 {
-    output = TMatrix<>{ in.m_shape };
-    diff = TMatrix<>{ in.m_shape };
-    lint size = in.m_shape.size();
-    for (lint i = 0; i < size; ++i)
-    {
-        output.m_data[i] = atan(in.m_data[i]);
-        diff.m_data[i] = 1 / (1 + in.m_data[i] * in.m_data[i]);
-    }
+    vector_atan(n, z, y, dy);
 }
 
 
-std::string neurons::Arctan::to_string() const
+template <typename dtype>
+std::string neurons::Arctan<dtype>::to_string() const
 {
-    return Activation::ARCTAN;
+    return Activation<dtype>::ARCTAN;
 }
 
 
-std::unique_ptr<neurons::Activation> neurons::Sin::clone()
+template <typename dtype>
+std::unique_ptr<neurons::Activation<dtype>> neurons::Sin<dtype>::clone()
 {
-    return std::make_unique<neurons::Sin>();
+    return std::make_unique<neurons::Sin<dtype>>();
 }
 
-void neurons::Sin::operator()(TMatrix<>& output, TMatrix<>& diff, const TMatrix<>& in)
+template <typename dtype>
+void neurons::Sin<dtype>::activate(lint n, const dtype *z, dtype *y, dtype *dy) const
 {
-    output = TMatrix<>{ in.m_shape };
-    diff = TMatrix<>{ in.m_shape };
-    lint size = in.m_shape.size();
-    for (lint i = 0; i < size; ++i)
+    for (lint i = 0; i < n; ++i)
     {
-        output.m_data[i] = sin(in.m_data[i]);
-        diff.m_data[i] = cos(in.m_data[i]);
+        dtype x = z[i];
+        y[i] = sin(x);
+        if (dy)
+        {
+            dy[i] = cos(x);
+        }
     }
 }
 
 
-std::string neurons::Sin::to_string() const
+template <typename dtype>
+std::string neurons::Sin<dtype>::to_string() const
 {
-    return Activation::SIN;
+    return Activation<dtype>::SIN;
 }
 
 
-std::unique_ptr<neurons::Activation> neurons::Softsign::clone()
+template <typename dtype>
+std::unique_ptr<neurons::Activation<dtype>> neurons::Softsign<dtype>::clone()
 {
-    return std::make_unique<neurons::Softsign>();
+    return std::make_unique<neurons::Softsign<dtype>>();
 }
 
-void neurons::Softsign::operator()(TMatrix<>& output, TMatrix<>& diff, const TMatrix<>& in)
+template <typename dtype>
+void neurons::Softsign<dtype>::activate(lint n, const dtype *z, dtype *y, dtype *dy) const
 {
-    output = TMatrix<>{ in.m_shape };
-    diff = TMatrix<>{ in.m_shape };
-    lint size = in.m_shape.size();
-    for (lint i = 0; i < size; ++i)
+    for (lint i = 0; i < n; ++i)
     {
-        double d = 1 + fabs(in.m_data[i]);
-        output.m_data[i] = in.m_data[i] / d;
-        diff.m_data[i] = 1 / (d * d);
+        dtype x = z[i];
+        dtype d = 1 + fabs(x);
+        y[i] = x / d;
+        if (dy)
+        {
+            dy[i] = 1 / (d * d);
+        }
     }
 }
 
 
-std::string neurons::Softsign::to_string() const
+template <typename dtype>
+std::string neurons::Softsign<dtype>::to_string() const
 {
-    return Activation::SOFTSIGN;
+    return Activation<dtype>::SOFTSIGN;
 }
 
 
-std::unique_ptr<neurons::Activation> neurons::Softmax::clone()
+template <typename dtype>
+std::unique_ptr<neurons::Activation<dtype>> neurons::Softmax<dtype>::clone()
 {
-    return std::make_unique<neurons::Softmax>();
+    return std::make_unique<neurons::Softmax<dtype>>();
 }
 
 
-void neurons::Softmax::operator () (TMatrix<> & output, TMatrix<> & diff, const TMatrix<> & in)
+template <typename dtype>
+void neurons::Softmax<dtype>::activate(lint n, const dtype *z, dtype *y, dtype *dy) const
 {
-    output = TMatrix<>{ in.m_shape };
-    diff = TMatrix<>{ in.m_shape };
-    lint size = in.m_shape.size();
+    if (0 == n)
+    {
+        return;
+    }
+
+    // Shifting by the maximum keeps exp from overflowing and does not change the result
+    dtype max = *std::max_element(z, z + n);
+    for (lint i = 0; i < n; ++i)
+    {
+        y[i] = z[i] - max;
+    }
+    vector_exp(n, y, y);
 
     double sum = 0;
-    for (lint i = 0; i < size; ++i)
+    for (lint i = 0; i < n; ++i)
     {
-        output.m_data[i] = exp(in.m_data[i]);
-        sum += output.m_data[i];
+        sum += y[i];
     }
 
-    for (lint i = 0; i < size; ++i)
+    double scale = 1 / sum;
+    for (lint i = 0; i < n; ++i)
+    {
+        y[i] *= scale;
+    }
+    if (dy)
     {
-        output.m_data[i] /= sum;
-        diff.m_data[i] = output.m_data[i] * (1 - output.m_data[i]);
+        for (lint i = 0; i < n; ++i)
+        {
+            dy[i] = y[i] * (1 - y[i]);
+        }
     }
 }
 
-std::string neurons::Softmax::to_string() const
+template <typename dtype>
+void neurons::Softmax<dtype>::operator () (TMatrix<dtype> & output, TMatrix<dtype> & diff,
+    const Shape & shape, const dtype *product, const TMatrix<dtype> & bias)
+{
+    check_bias(shape, bias, "Softmax");
+    prepare_buffer(output, shape);
+    prepare_buffer(diff, shape);
+
+    lint size = shape.size();
+    add_bias(0, size, product, bias, output.m_data);
+    this->activate(size, output.m_data, output.m_data, diff.m_data);
+}
+
+template <typename dtype>
+void neurons::Softmax<dtype>::infer(const Shape & shape, const dtype *product, const TMatrix<dtype> & bias, dtype *output) const
+{
+    check_bias(shape, bias, "Softmax");
+
+    lint size = shape.size();
+    add_bias(0, size, product, bias, output);
+    this->activate(size, output, output, nullptr);
+}
+
+template <typename dtype>
+std::string neurons::Softmax<dtype>::to_string() const
 {
-    return Activation::SOFTMAX;
+    return Activation<dtype>::SOFTMAX;
 }
 
-std::unique_ptr<neurons::ErrorFunction> neurons::ErrorFunction::get_function_by_name(std::string & func_name)
+template <typename dtype>
+std::unique_ptr<neurons::ErrorFunction<dtype>> neurons::ErrorFunction<dtype>::get_function_by_name(std::string & func_name)
 {
     std::istringstream buf(func_name);
     std::istream_iterator<std::string> beg(buf), end;
@@ -326,15 +473,15 @@ std::unique_ptr<neurons::ErrorFunction> neurons::ErrorFunction::get_function_by_
 
     if (tokens[0] == SIGMOID_CROSS_ENTROPY)
     {
-        return std::make_unique<Sigmoid_CrossEntropy>();
+        return std::make_unique<Sigmoid_CrossEntropy<dtype>>();
     }
     else if (tokens[0] == SOFTMAX_CROSS_ENTROPY)
     {
-        return std::make_unique<Softmax_CrossEntropy>();
+        return std::make_unique<Softmax_CrossEntropy<dtype>>();
     }
     else if (tokens[0] == HALF_SQUARE_ERROR)
     {
-        return std::make_unique<HalfSquareError>(Activation::get_function_by_name(tokens[1]));
+        return std::make_unique<HalfSquareError<dtype>>(Activation<dtype>::get_function_by_name(tokens[1]));
     }
     else if (tokens[0] == NULL_FUNC)
     {
@@ -342,33 +489,49 @@ std::unique_ptr<neurons::ErrorFunction> neurons::ErrorFunction::get_function_by_
     }
     else
     {
-        return std::make_unique<Softmax_CrossEntropy>();
+        return std::make_unique<Softmax_CrossEntropy<dtype>>();
     }
 }
 
-std::unique_ptr<neurons::Activation> neurons::ErrorFunction::get_act_func() const
+template <typename dtype>
+double neurons::ErrorFunction<dtype>::operator()(TMatrix<dtype> & pred, TMatrix<dtype> & diff, const TMatrix<dtype> & target,
+    const Shape & shape, const dtype *product, const TMatrix<dtype> & bias)
+{
+    check_bias(shape, bias, "ErrorFunction");
+    prepare_buffer(this->m_z, shape);
+    add_bias(0, shape.size(), product, bias, this->m_z.m_data);
+
+    return this->operator()(pred, diff, target, this->m_z);
+}
+
+template <typename dtype>
+std::unique_ptr<neurons::Activation<dtype>> neurons::ErrorFunction<dtype>::get_act_func() const
 {
     return this->m_act_func->clone();
 }
 
 
-neurons::HalfSquareError::HalfSquareError(const std::unique_ptr<Activation> & act_func)
+template <typename dtype>
+neurons::HalfSquareError<dtype>::HalfSquareError(const std::unique_ptr<Activation<dtype>> & act_func)
 {
     this->m_act_func = act_func->clone();
 }
 
-neurons::HalfSquareError::HalfSquareError(Activation * act_func)
+template <typename dtype>
+neurons::HalfSquareError<dtype>::HalfSquareError(Activation<dtype> * act_func)
 {
     this->m_act_func.reset(act_func);
 }
 
 
-std::unique_ptr<neurons::ErrorFunction> neurons::HalfSquareError::clone()
+template <typename dtype>
+std::unique_ptr<neurons::ErrorFunction<dtype>> neurons::HalfSquareError<dtype>::clone()
 {
-    return std::make_unique<neurons::HalfSquareError>(this->m_act_func->clone());
+    return std::make_unique<neurons::HalfSquareError<dtype>>(this->m_act_func->clone());
 }
 
-double neurons::HalfSquareError::operator()(TMatrix<> & diff, const TMatrix<> & target, const TMatrix<> & input)
+template <typename dtype>
+double neurons::HalfSquareError<dtype>::operator()(TMatrix<dtype> & diff, const TMatrix<dtype> & target, const TMatrix<dtype> & input)
 {
     if (target.shape().size() != input.shape().size())
     {
@@ -378,7 +541,37 @@ double neurons::HalfSquareError::operator()(TMatrix<> & diff, const TMatrix<> &
     // The activation function may be sigmoid, tanh, relu, etc
     this->m_act_func->operator()(this->m_act, diff, input);
 
-    TMatrix<> l_diff{ target.m_shape };
+    return this->loss(diff, target);
+}
+
+template <typename dtype>
+double neurons::HalfSquareError<dtype>::operator()(TMatrix<dtype> & pred, TMatrix<dtype> & diff, const TMatrix<dtype> & target, const TMatrix<dtype> & input)
+{
+    double loss = this->operator()(diff, target, input);
+    pred = this->m_act;
+
+    return loss;
+}
+
+template <typename dtype>
+double neurons::HalfSquareError<dtype>::operator()(TMatrix<dtype> & pred, TMatrix<dtype> & diff, const TMatrix<dtype> & target,
+    const Shape & shape, const dtype *product, const TMatrix<dtype> & bias)
+{
+    if (target.shape().size() != shape.size())
+    {
+        throw std::invalid_argument(std::string("ErrorFunction: target and pred should be of the same size."));
+    }
+
+    this->m_act_func->operator()(this->m_act, diff, shape, product, bias);
+    double loss = this->loss(diff, target);
+    pred = this->m_act;
+
+    return loss;
+}
+
+template <typename dtype>
+double neurons::HalfSquareError<dtype>::loss(TMatrix<dtype> & diff, const TMatrix<dtype> & target) const
+{
     lint size = target.m_shape.size();
 
     double sum = 0;
@@ -386,75 +579,61 @@ double neurons::HalfSquareError::operator()(TMatrix<> & diff, const TMatrix<> &
     {
         double sub = this->m_act.m_data[i] - target.m_data[i];
         sum += sub * sub;
-        
-        l_diff.m_data[i] = sub;
+
+        diff.m_data[i] *= sub;
     }
 
     sum /= 2;
-    diff = neurons::multiply(diff, l_diff);
 
     return sum;
 }
 
-double neurons::HalfSquareError::operator()(TMatrix<> & pred, TMatrix<> & diff, const TMatrix<> & target, const TMatrix<> & input)
-{
-    double loss = this->operator()(diff, target, input);
-    pred = this->m_act;
-
-    return loss;
-}
-
-neurons::TMatrix<> & neurons::HalfSquareError::get_activation() const
+template <typename dtype>
+neurons::TMatrix<dtype> & neurons::HalfSquareError<dtype>::get_activation() const
 {
     return this->m_act;
 }
 
-std::string neurons::HalfSquareError::to_string() const
+template <typename dtype>
+std::string neurons::HalfSquareError<dtype>::to_string() const
 {
-    return std::string(ErrorFunction::HALF_SQUARE_ERROR + " " + this->m_act_func->to_string());
+    return std::string(ErrorFunction<dtype>::HALF_SQUARE_ERROR + " " + this->m_act_func->to_string());
 }
 
 
-neurons::Sigmoid_CrossEntropy::Sigmoid_CrossEntropy()
+template <typename dtype>
+neurons::Sigmoid_CrossEntropy<dtype>::Sigmoid_CrossEntropy()
 {
-    this->m_act_func.reset(new Sigmoid);
+    this->m_act_func.reset(new Sigmoid<dtype>);
 }
 
-std::unique_ptr<neurons::ErrorFunction> neurons::Sigmoid_CrossEntropy::clone()
+template <typename dtype>
+std::unique_ptr<neurons::ErrorFunction<dtype>> neurons::Sigmoid_CrossEntropy<dtype>::clone()
 {
-    return std::make_unique<neurons::Sigmoid_CrossEntropy>();
+    return std::make_unique<neurons::Sigmoid_CrossEntropy<dtype>>();
 }
 
-double neurons::Sigmoid_CrossEntropy::operator()(TMatrix<> & diff, const TMatrix<> & target, const TMatrix<> & input)
+template <typename dtype>
+double neurons::Sigmoid_CrossEntropy<dtype>::operator()(TMatrix<dtype> & diff, const TMatrix<dtype> & target, const TMatrix<dtype> & input)
 {
     if (target.shape().size() != input.shape().size())
     {
         throw std::invalid_argument(std::string("ErrorFunction: target and pred should be of the same size."));
     }
 
-    diff = TMatrix<>{ target.m_shape };
-
-
-    if (this->m_act.m_shape.size() != target.m_shape.size())
-    {
-        this->m_act = TMatrix<>{ target.m_shape };
-    }
-    else if (this->m_act.m_shape != target.m_shape)
-    {
-        this->m_act.reshape(target.m_shape);
-    }
-
+    prepare_buffer(diff, target.m_shape);
+    prepare_buffer(this->m_act, target.m_shape);
 
     lint size = target.m_shape.size();
+    vector_sigmoid(size, input.m_data, this->m_act.m_data, nullptr);
+    // diff holds log(y) until it is overwritten by the gradient
+    vector_log(size, this->m_act.m_data, diff.m_data);
 
     double sum = 0;
     for (lint i = 0; i < size; ++i)
     {
-        double y = 1.0 / (1.0 + exp(input.m_data[i] * (-1)));
-        
-        this->m_act.m_data[i] = y;
-        sum += target.m_data[i] * log(y);
-        diff.m_data[i] = y - target.m_data[i];
+        sum += target.m_data[i] * diff.m_data[i];
+        diff.m_data[i] = this->m_act.m_data[i] - target.m_data[i];
     }
 
     sum *= -1;
@@ -462,7 +641,8 @@ double neurons::Sigmoid_CrossEntropy::operator()(TMatrix<> & diff, const TMatrix
     return sum;
 }
 
-double neurons::Sigmoid_CrossEntropy::operator()(TMatrix<> & pred, TMatrix<> & diff, const TMatrix<> & target, const TMatrix<> & input)
+template <typename dtype>
+double neurons::Sigmoid_CrossEntropy<dtype>::operator()(TMatrix<dtype> & pred, TMatrix<dtype> & diff, const TMatrix<dtype> & target, const TMatrix<dtype> & input)
 {
     double loss = this->operator()(diff, target, input);
     pred = this->m_act;
@@ -471,61 +651,72 @@ double neurons::Sigmoid_CrossEntropy::operator()(TMatrix<> & pred, TMatrix<> & d
 }
 
 
-neurons::TMatrix<> & neurons::Sigmoid_CrossEntropy::get_activation() const
+template <typename dtype>
+neurons::TMatrix<dtype> & neurons::Sigmoid_CrossEntropy<dtype>::get_activation() const
 {
     return this->m_act;
 }
 
-std::string neurons::Sigmoid_CrossEntropy::to_string() const
+template <typename dtype>
+std::string neurons::Sigmoid_CrossEntropy<dtype>::to_string() const
 {
-    return ErrorFunction::SIGMOID_CROSS_ENTROPY;
+    return ErrorFunction<dtype>::SIGMOID_CROSS_ENTROPY;
 }
 
 
-neurons::Softmax_CrossEntropy::Softmax_CrossEntropy()
+template <typename dtype>
+neurons::Softmax_CrossEntropy<dtype>::Softmax_CrossEntropy()
 {
-    this->m_act_func.reset(new Softmax);
+    this->m_act_func.reset(new Softmax<dtype>);
 }
 
-std::unique_ptr<neurons::ErrorFunction> neurons::Softmax_CrossEntropy::clone()
+template <typename dtype>
+std::unique_ptr<neurons::ErrorFunction<dtype>> neurons::Softmax_CrossEntropy<dtype>::clone()
 {
-    return std::make_unique<neurons::Softmax_CrossEntropy>();
+    return std::make_unique<neurons::Softmax_CrossEntropy<dtype>>();
 }
 
 
-double neurons::Softmax_CrossEntropy::operator()(TMatrix<> & diff, const TMatrix<> & target, const TMatrix<> & input)
+template <typename dtype>
+double neurons::Softmax_CrossEntropy<dtype>::operator()(TMatrix<dtype> & diff, const TMatrix<dtype> & target, const TMatrix<dtype> & input)
 {
     if (target.shape().size() != input.shape().size())
     {
         throw std::invalid_argument(std::string("ErrorFunction: target and pred should be of the same size."));
     }
 
-    diff = TMatrix<>{ target.m_shape };
+    prepare_buffer(diff, target.m_shape);
+    prepare_buffer(this->m_act, target.m_shape);
 
-    if (this->m_act.m_shape.size() != target.m_shape.size())
+    lint size = target.m_shape.size();
+    if (0 == size)
     {
-        this->m_act = TMatrix<>{ target.m_shape };
+        return 0;
     }
-    else if (this->m_act.m_shape != target.m_shape)
+
+    dtype max = *std::max_element(input.m_data, input.m_data + size);
+    for (lint i = 0; i < size; ++i)
     {
-        this->m_act.reshape(target.m_shape);
+        this->m_act.m_data[i] = input.m_data[i] - max;
     }
+    vector_exp(size, this->m_act.m_data, this->m_act.m_data);
 
-    lint size = target.m_shape.size();
     double softmax_sum = 0;
-
     for (lint i = 0; i < size; ++i)
     {
-        this->m_act.m_data[i] = exp(input.m_data[i]);
         softmax_sum += this->m_act.m_data[i];
     }
 
+    // log(softmax(x)) = x - max - log(sum), so no log is taken per element
+    double log_sum = max + log(softmax_sum);
+
+    double scale = 1 / softmax_sum;
     double centropy_sum = 0;
     for (lint i = 0; i < size; ++i)
     {
-        this->m_act.m_data[i] /= softmax_sum;
+        this->m_act.m_data[i] *= scale;
 
-        centropy_sum += target.m_data[i] * log(this->m_act.m_data[i]);
+        centropy_sum += target.m_data[i] * (input.m_data[i] - log_sum);
 
         diff.m_data[i] = this->m_act.m_data[i] - target.m_data[i];
     }
@@ -535,7 +726,8 @@ double neurons::Softmax_CrossEntropy::operator()(TMatrix<> & diff, const TMatrix
     return centropy_sum;
 }
 
-double neurons::Softmax_CrossEntropy::operator()(TMatrix<> & pred, TMatrix<> & diff, const TMatrix<> & target, const TMatrix<> & input)
+template <typename dtype>
+double neurons::Softmax_CrossEntropy<dtype>::operator()(TMatrix<dtype> & pred, TMatrix<dtype> & diff, const TMatrix<dtype> & target, const TMatrix<dtype> & input)
 {
     double loss = this->operator()(diff, target, input);
     pred = this->m_act;
@@ -543,14 +735,16 @@ double neurons::Softmax_CrossEntropy::operator()(TMatrix<> & pred, TMatrix<> & d
     return loss;
 }
 
-neurons::TMatrix<> & neurons::Softmax_CrossEntropy::get_activation() const
+template <typename dtype>
+neurons::TMatrix<dtype> & neurons::Softmax_CrossEntropy<dtype>::get_activation() const
 {
     return this->m_act;
 }
 
-std::string neurons::Softmax_CrossEntropy::to_string() const
+template <typename dtype>
+std::string neurons::Softmax_CrossEntropy<dtype>::to_string() const
 {
-    return ErrorFunction::SOFTMAX_CROSS_ENTROPY;
+    return ErrorFunction<dtype>::SOFTMAX_CROSS_ENTROPY;
 }
 
 lint neurons::now_in_seconds()
@@ -576,4 +770,32 @@ double neurons::gaussian_function(double mu, double sigma, double x)
     return left * right;
 }
 
-
+template class neurons::Activation<float>;
+template class neurons::Activation<double>;
+template class neurons::Linear<float>;
+template class neurons::Linear<double>;
+template class neurons::Sigmoid<float>;
+template class neurons::Sigmoid<double>;
+template class neurons::Tanh<float>;
+template class neurons::Tanh<double>;
+template class neurons::Relu<float>;
+template class neurons::Relu<double>;
+template class neurons::LeakyRelu<float>;
+template class neurons::LeakyRelu<double>;
+template class neurons::Arctan<float>;
+template class neurons::Arctan<double>;
+template class neurons::Sin<float>;
+template class neurons::Sin<double>;
+template class neurons::Softsign<float>;
+template class neurons::Softsign<double>;
+template class neurons::Softmax<float>;
+template class neurons::Softmax<double>;
+
+template class neurons::ErrorFunction<float>;
+template class neurons::ErrorFunction<double>;
+template class neurons::HalfSquareError<float>;
+template class neurons::HalfSquareError<double>;
+template class neurons::Sigmoid_CrossEntropy<float>;
+template class neurons::Sigmoid_CrossEntropy<double>;
+template class neurons::Softmax_CrossEntropy<float>;
+template class neurons::Softmax_CrossEntropy<double>;
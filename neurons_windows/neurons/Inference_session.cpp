@@ -0,0 +1,367 @@
+#include "Inference_session.h"
+#include "GEMM.h"
+#include "Traditional_NN_layer.h"
+#include <math.h>
+#include <algorithm>
+
+namespace
+{
+    // Shape of a batch of samples of sh, the first dimension of sh is that of the batch
+    neurons::Shape batch_shape(const neurons::Shape & sh, lint samples)
+    {
+        return neurons::Shape{ samples } + sh.sub_shape(1, sh.dim() - 1);
+    }
+}
+
+template <typename dtype>
+neurons::Inference_session<dtype>::Inference_session(
+    const std::vector<Model_layer> & layers, const Shape & input_sh, bool normalize_inputs,
+    lint threads, std::shared_ptr<const void> owner)
+    :
+    m_input_sh{ input_sh },
+    m_normalize{ normalize_inputs },
+    m_threads{ std::max<lint>(1, threads) },
+    m_owner{ owner },
+    m_workspaces{ 0 }
+{
+    if (0 == input_sh.size())
+    {
+        throw std::invalid_argument(std::string("neurons::Inference_session: samples have no elements"));
+    }
+
+    // Shapes of samples begin with a batch dimension of 1, as layers are fed with
+    Shape sh = input_sh;
+    if (sh.dim() < 2 || 1 != sh[0])
+    {
+        sh.left_extend();
+    }
+    this->m_input_sh = sh;
+
+    // Weights are borrowed only if somebody keeps them alive
+    bool borrow = nullptr != owner;
+
+    for (const Model_layer & layer : layers)
+    {
+        Stage stage;
+        stage.m_input_sh = sh;
+        stage.m_stride = 1;
+        stage.m_padding = 0;
+
+        if (Pooling_layer<dtype>::POOLING == layer.m_type)
+        {
+            if (4 != sh.dim())
+            {
+                throw std::invalid_argument(std::string("neurons::Inference_session: a pooling layer needs inputs of [1, rows, cols, channels]"));
+            }
+
+            stage.m_type = Stage_type::pooling;
+            stage.m_pooling = Pooling_layer<dtype>::from_model_layer(layer, sh, 1).pooling_2d();
+            stage.m_output_sh = stage.m_pooling->get_output_shape();
+        }
+        else
+        {
+            std::unique_ptr<ErrorFunction<dtype>> err_func;
+            std::string nn_type = Traditional_NN_layer<dtype>::from_model_layer(
+                layer, borrow, stage.m_w, stage.m_b, stage.m_act_func, err_func);
+
+            // Output layers predict with the activation of their error function
+            if (nullptr == stage.m_act_func && nullptr != err_func)
+            {
+                stage.m_act_func = err_func->get_act_func();
+            }
+            if (nullptr == stage.m_act_func)
+            {
+                throw std::invalid_argument(std::string("neurons::Inference_session: no activation function in a layer of ") + nn_type);
+            }
+
+            if (NN_layer<dtype>::FCNN == nn_type)
+            {
+                if (2 != stage.m_w.shape().dim() || stage.m_w.shape()[0] != sh.size())
+                {
+                    throw std::invalid_argument(std::string("neurons::Inference_session: weights of a FCNN layer do not match its inputs"));
+                }
+
+                stage.m_type = Stage_type::dense;
+                stage.m_output_sh = Shape{ 1, stage.m_w.shape()[1] };
+            }
+            else if (NN_layer<dtype>::CNN == nn_type && 2 == layer.m_params.size())
+            {
+                if (4 != sh.dim() || 4 != stage.m_w.shape().dim() || stage.m_w.shape()[2] != sh[3])
+                {
+                    throw std::invalid_argument(std::string("neurons::Inference_session: weights of a CNN layer do not match its inputs"));
+                }
+
+                stage.m_type = Stage_type::convolution;
+                stage.m_stride = layer.m_params[0];
+                stage.m_padding = layer.m_params[1];
+                stage.m_output_sh = Conv_2d<dtype>{
+                    sh, stage.m_w.shape(), stage.m_stride, stage.m_stride, stage.m_padding, stage.m_padding }.get_output_shape();
+            }
+            else
+            {
+                throw std::invalid_argument(std::string("neurons::Inference_session: unexpected layer of ") + nn_type);
+            }
+        }
+
+        sh = stage.m_output_sh;
+        this->m_stages.push_back(std::move(stage));
+    }
+
+    if (this->m_stages.empty())
+    {
+        throw std::invalid_argument(std::string("neurons::Inference_session: there is no layer"));
+    }
+
+    if (this->m_threads > 1)
+    {
+        this->m_pool = Thread_pool::process_pool(this->m_threads);
+    }
+}
+
+template <typename dtype>
+neurons::Shape neurons::Inference_session<dtype>::input_shape() const
+{
+    return this->m_input_sh;
+}
+
+template <typename dtype>
+lint neurons::Inference_session<dtype>::input_size() const
+{
+    return this->m_input_sh.size();
+}
+
+template <typename dtype>
+lint neurons::Inference_session<dtype>::output_size() const
+{
+    return this->m_stages.back().m_output_sh.size();
+}
+
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> neurons::Inference_session<dtype>::predict(const std::vector<const TMatrix<dtype> *> & inputs) const
+{
+    lint samples = inputs.size();
+    lint in_size = this->input_size();
+    lint out_size = this->output_size();
+
+    std::vector<TMatrix<dtype>> preds;
+    if (0 == samples)
+    {
+        return preds;
+    }
+
+    for (const TMatrix<dtype> * input : inputs)
+    {
+        if (input->shape().size() != in_size)
+        {
+            throw std::invalid_argument(std::string("neurons::Inference_session::predict: size of a sample does not match the network"));
+        }
+    }
+
+    std::unique_ptr<Workspace> workspace = this->acquire(samples);
+    for (lint i = 0; i < samples; ++i)
+    {
+        this->load_sample(*workspace, i, inputs[i]->m_data);
+    }
+
+    this->run(*workspace);
+
+    const dtype *output = workspace->m_activations.back().m_data;
+    preds.reserve(samples);
+    for (lint i = 0; i < samples; ++i)
+    {
+        preds.emplace_back(Shape{ out_size });
+        std::copy(output + i * out_size, output + (i + 1) * out_size, preds.back().m_data);
+    }
+
+    this->release(std::move(workspace));
+    return preds;
+}
+
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> neurons::Inference_session<dtype>::predict(const std::vector<TMatrix<dtype>> & inputs) const
+{
+    return this->predict(neurons::matrix_pointers(inputs));
+}
+
+template <typename dtype>
+neurons::TMatrix<dtype> neurons::Inference_session<dtype>::predict(const TMatrix<dtype> & input) const
+{
+    return std::move(this->predict(std::vector<const TMatrix<dtype> *>{ &input })[0]);
+}
+
+template <typename dtype>
+void neurons::Inference_session<dtype>::predict(lint samples, const dtype *inputs, dtype *outputs) const
+{
+    if (samples <= 0)
+    {
+        return;
+    }
+
+    lint in_size = this->input_size();
+    lint out_size = this->output_size();
+
+    std::unique_ptr<Workspace> workspace = this->acquire(samples);
+    for (lint i = 0; i < samples; ++i)
+    {
+        this->load_sample(*workspace, i, inputs + i * in_size);
+    }
+
+    this->run(*workspace);
+
+    const dtype *output = workspace->m_activations.back().m_data;
+    std::copy(output, output + samples * out_size, outputs);
+
+    this->release(std::move(workspace));
+}
+
+template <typename dtype>
+lint neurons::Inference_session<dtype>::workspaces() const
+{
+    std::lock_guard<std::mutex> lock{ this->m_mutex };
+    return this->m_workspaces;
+}
+
+template <typename dtype>
+std::unique_ptr<typename neurons::Inference_session<dtype>::Workspace> neurons::Inference_session<dtype>::acquire(lint samples) const
+{
+    {
+        std::lock_guard<std::mutex> lock{ this->m_mutex };
+        auto it = this->m_free.find(samples);
+        if (this->m_free.end() != it)
+        {
+            std::unique_ptr<Workspace> workspace = std::move(it->second);
+            this->m_free.erase(it);
+            return workspace;
+        }
+        ++this->m_workspaces;
+    }
+
+    // Buffers of the batch size are allocated once, outside of the lock
+    std::unique_ptr<Workspace> workspace = std::make_unique<Workspace>();
+    workspace->m_samples = samples;
+
+    workspace->m_activations.emplace_back(Shape{ samples, this->input_size() });
+    for (const Stage & stage : this->m_stages)
+    {
+        Shape in_sh = batch_shape(stage.m_input_sh, samples);
+        Shape out_sh = batch_shape(stage.m_output_sh, samples);
+
+        // Convolutions read their inputs in the batch shape, other stages read them flat
+        if (Stage_type::convolution == stage.m_type)
+        {
+            workspace->m_activations.back().reshape(in_sh);
+        }
+        workspace->m_activations.emplace_back(out_sh);
+
+        if (Stage_type::pooling == stage.m_type)
+        {
+            workspace->m_products.emplace_back();
+            workspace->m_convs.push_back(nullptr);
+        }
+        else
+        {
+            workspace->m_products.emplace_back(out_sh);
+            workspace->m_convs.push_back(Stage_type::convolution == stage.m_type ?
+                std::make_unique<Conv_2d<dtype>>(in_sh, stage.m_w.shape(), stage.m_stride, stage.m_stride, stage.m_padding, stage.m_padding) :
+                nullptr);
+        }
+    }
+
+    return workspace;
+}
+
+template <typename dtype>
+void neurons::Inference_session<dtype>::release(std::unique_ptr<Workspace> workspace) const
+{
+    std::lock_guard<std::mutex> lock{ this->m_mutex };
+    lint samples = workspace->m_samples;
+    this->m_free.emplace(samples, std::move(workspace));
+}
+
+template <typename dtype>
+void neurons::Inference_session<dtype>::load_sample(Workspace & workspace, lint i, const dtype *input) const
+{
+    lint size = this->input_size();
+    dtype *x = workspace.m_activations[0].m_data + i * size;
+
+    if (!this->m_normalize)
+    {
+        std::copy(input, input + size, x);
+        return;
+    }
+
+    // The same arithmetic as TMatrix::normalize, so predictions match those of the network
+    dtype mean = 0;
+    for (lint j = 0; j < size; ++j)
+    {
+        mean += input[j];
+    }
+    mean /= size;
+
+    dtype var = 0;
+    dtype sub;
+    for (lint j = 0; j < size; ++j)
+    {
+        sub = input[j] - mean;
+        var += sub * sub;
+    }
+    var /= size;
+    var = sqrt(var);
+
+    // TMatrix::normalize draws random elements for a constant sample, which a shared session cannot do
+    if (0 == var)
+    {
+        std::fill(x, x + size, static_cast<dtype>(0));
+        return;
+    }
+
+    for (lint j = 0; j < size; ++j)
+    {
+        x[j] = (input[j] - mean) / var;
+    }
+}
+
+template <typename dtype>
+void neurons::Inference_session<dtype>::run(Workspace & workspace) const
+{
+    Intra_op_scope scope{ this->m_threads };
+    lint samples = workspace.m_samples;
+
+    for (size_t s = 0; s < this->m_stages.size(); ++s)
+    {
+        const Stage & stage = this->m_stages[s];
+        const TMatrix<dtype> & in = workspace.m_activations[s];
+        TMatrix<dtype> & out = workspace.m_activations[s + 1];
+        TMatrix<dtype> & product = workspace.m_products[s];
+
+        lint in_size = stage.m_input_sh.size();
+        lint out_size = stage.m_output_sh.size();
+
+        switch (stage.m_type)
+        {
+        case Stage_type::dense:
+            // x * w, in which x of all samples are stacked together
+            neurons::gemm<dtype>(false, false, samples, out_size, in_size,
+                1, in.m_data, in_size, stage.m_w.m_data, out_size, 0, product.m_data, out_size);
+            break;
+        case Stage_type::convolution:
+            workspace.m_convs[s]->product(product, in, stage.m_w);
+            break;
+        case Stage_type::pooling:
+            for (lint i = 0; i < samples; ++i)
+            {
+                stage.m_pooling->infer(in.m_data + i * in_size, out.m_data + i * out_size);
+            }
+            continue;
+        }
+
+        // y = g(z) of each sample where z = product + b
+        for (lint i = 0; i < samples; ++i)
+        {
+            stage.m_act_func->infer(stage.m_output_sh, product.m_data + i * out_size, stage.m_b, out.m_data + i * out_size);
+        }
+    }
+}
+
+template class neurons::Inference_session<float>;
+template class neurons::Inference_session<double>;
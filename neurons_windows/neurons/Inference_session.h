@@ -0,0 +1,131 @@
+#pragma once
+#include "TMatrix.h"
+#include "Functions.h"
+#include "Convolution.h"
+#include "Pooling.h"
+#include "Model_file.h"
+#include "Thread_pool.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace neurons
+{
+    /*
+    Read-only inference of a trained network, built from the layers of its model file (see Model_layer):
+    fully connected (FCNN), convolutional (CNN) and pooling (POOLING) layers are run one after another
+    on a batch of samples, like network_predict of the network does, but nothing is kept for back
+    propagation: activations are computed without their derivatives (see Activation::infer), inputs of
+    layers are not copied and pooling keeps no argmax (see Pooling_2d::infer).
+
+    Buffers of a batch size (activations of all layers, convolutional products and the patches of
+    convolutions) are allocated once in a workspace and reused by all following calls of the same
+    batch size. A call takes a workspace of its batch size nobody else uses, so any number of threads
+    can call predict at the same time; there are as many workspaces of a batch size as calls of it
+    ever ran at the same time. Weights, activation functions and pooling are only read.
+
+    Weights are copied from the layers, unless an owner of their elements is given (such as the
+    Model_file they are mapped from): they are borrowed then and the session keeps the owner alive.
+
+    Operations of a call split their work over up to threads threads of the process pool
+    (see Intra_op_scope), by default they run on the calling thread only.
+    */
+    template <typename dtype = double>
+    class Inference_session
+    {
+    private:
+        enum class Stage_type
+        {
+            dense,
+            convolution,
+            pooling
+        };
+
+        // A layer of the network, shapes are of a single sample
+        struct Stage
+        {
+            Stage_type m_type;
+            Shape m_input_sh;
+            Shape m_output_sh;
+
+            // Dense and convolutional layers
+            TMatrix<dtype> m_w;
+            TMatrix<dtype> m_b;
+            std::unique_ptr<Activation<dtype>> m_act_func;
+            lint m_stride;
+            lint m_padding;
+
+            // Pooling layers, they pool a sample at a time
+            std::unique_ptr<Pooling_2d<dtype>> m_pooling;
+        };
+
+        // Buffers of a batch size
+        struct Workspace
+        {
+            lint m_samples;
+            // Inputs of the stages and the output of the last one, of shape [samples, ...]
+            std::vector<TMatrix<dtype>> m_activations;
+            // Products of dense and convolutional stages before their epilogue
+            std::vector<TMatrix<dtype>> m_products;
+            // Convolutions of the batch size, nullptr for other stages
+            std::vector<std::unique_ptr<Conv_2d<dtype>>> m_convs;
+        };
+
+        std::vector<Stage> m_stages;
+        Shape m_input_sh;
+        bool m_normalize;
+        lint m_threads;
+
+        std::shared_ptr<const void> m_owner;
+        std::shared_ptr<Thread_pool> m_pool;
+
+        // Workspaces no call is using, by batch size
+        mutable std::mutex m_mutex;
+        mutable std::multimap<lint, std::unique_ptr<Workspace>> m_free;
+        mutable lint m_workspaces;
+
+    public:
+        // A session of layers whose samples are of input_sh (the shape a sample is fed to the first layer in).
+        // If normalize_inputs is true, each sample is normalized to mean == 0 and variance == 1 first,
+        // as the network normalizes samples it predicts; a sample of zero variance becomes zeros.
+        Inference_session(const std::vector<Model_layer> & layers, const Shape & input_sh, bool normalize_inputs,
+            lint threads = 1, std::shared_ptr<const void> owner = nullptr);
+
+        Inference_session(const Inference_session & other) = delete;
+        Inference_session & operator = (const Inference_session & other) = delete;
+
+        Shape input_shape() const;
+
+        lint input_size() const;
+
+        lint output_size() const;
+
+        // Predictions of samples, each one a vector of output_size() elements.
+        // Samples may be of any shape of input_size() elements.
+        std::vector<TMatrix<dtype>> predict(const std::vector<const TMatrix<dtype> *> & inputs) const;
+
+        std::vector<TMatrix<dtype>> predict(const std::vector<TMatrix<dtype>> & inputs) const;
+
+        TMatrix<dtype> predict(const TMatrix<dtype> & input) const;
+
+        // Predictions of samples stored one after another in inputs (input_size() elements each),
+        // written one after another into outputs (output_size() elements each)
+        void predict(lint samples, const dtype *inputs, dtype *outputs) const;
+
+        // Number of workspaces allocated so far
+        lint workspaces() const;
+
+    private:
+        // A workspace of the batch size nobody else uses
+        std::unique_ptr<Workspace> acquire(lint samples) const;
+
+        void release(std::unique_ptr<Workspace> workspace) const;
+
+        // Copy (and normalize) a sample into row i of the input of a workspace
+        void load_sample(Workspace & workspace, lint i, const dtype *input) const;
+
+        // Run all stages on the input of the workspace
+        void run(Workspace & workspace) const;
+    };
+}
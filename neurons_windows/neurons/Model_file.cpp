@@ -0,0 +1,515 @@
+#include "Model_file.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const lint FILE_HEADER_SIZE = 64;
+    const std::string STATE_RECORD = "STATE";
+
+    lint align_up(lint offset)
+    {
+        return (offset + neurons::MODEL_FILE_ALIGNMENT - 1) / neurons::MODEL_FILE_ALIGNMENT * neurons::MODEL_FILE_ALIGNMENT;
+    }
+
+    // Bytes of a model file being written
+    class Writer
+    {
+    private:
+        std::vector<char> m_bytes;
+
+    public:
+        lint size() const
+        {
+            return static_cast<lint>(this->m_bytes.size());
+        }
+
+        char * data()
+        {
+            return this->m_bytes.data();
+        }
+
+        void bytes(const void *data, lint size)
+        {
+            const char *begin = static_cast<const char *>(data);
+            this->m_bytes.insert(this->m_bytes.end(), begin, begin + size);
+        }
+
+        template <typename T>
+        void value(T val)
+        {
+            this->bytes(&val, sizeof(T));
+        }
+
+        void name(const std::string & str)
+        {
+            if (str.size() > 255)
+            {
+                throw std::invalid_argument(std::string("neurons::write_model_file: name longer than 255 characters: ") + str);
+            }
+
+            this->value(static_cast<std::uint8_t>(str.size()));
+            this->bytes(str.data(), str.size());
+        }
+
+        void pad()
+        {
+            this->m_bytes.resize(align_up(this->size()), 0);
+        }
+
+        template <typename T>
+        void overwrite(lint offset, T val)
+        {
+            std::memcpy(this->m_bytes.data() + offset, &val, sizeof(T));
+        }
+
+        void layer(const neurons::Model_layer & layer)
+        {
+            lint record = this->size();
+            // Size of the record, which is known at last
+            this->value(static_cast<std::int64_t>(0));
+
+            this->name(layer.m_type);
+            this->name(layer.m_act_func);
+            this->name(layer.m_err_func);
+
+            this->value(static_cast<std::int64_t>(layer.m_params.size()));
+            for (lint param : layer.m_params)
+            {
+                this->value(static_cast<std::int64_t>(param));
+            }
+
+            // Offsets of elements are filled in when elements are written
+            std::vector<lint> offset_positions;
+            this->value(static_cast<std::int64_t>(layer.m_tensors.size()));
+            for (const neurons::Model_tensor & tensor : layer.m_tensors)
+            {
+                this->value(static_cast<std::int64_t>(tensor.m_element_size));
+                this->value(static_cast<std::int64_t>(tensor.m_shape.dim()));
+                for (lint i = 0; i < tensor.m_shape.dim(); ++i)
+                {
+                    this->value(static_cast<std::int64_t>(tensor.m_shape[i]));
+                }
+
+                offset_positions.push_back(this->size());
+                this->value(static_cast<std::int64_t>(0));
+            }
+
+            for (size_t i = 0; i < layer.m_tensors.size(); ++i)
+            {
+                const neurons::Model_tensor & tensor = layer.m_tensors[i];
+
+                this->pad();
+                this->overwrite(offset_positions[i], static_cast<std::int64_t>(this->size()));
+                this->bytes(tensor.m_data, tensor.m_shape.size() * tensor.m_element_size);
+            }
+
+            this->pad();
+            this->overwrite(record, static_cast<std::int64_t>(this->size() - record));
+        }
+    };
+
+    // Write data into a temporary file, flush it to disk and rename it over the file
+    bool write_file_atomically(const std::string & file_name, const char *data, lint size)
+    {
+        std::string temporary = file_name + ".tmp";
+
+#ifdef _WIN32
+        HANDLE file = CreateFileA(temporary.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (INVALID_HANDLE_VALUE == file)
+        {
+            return false;
+        }
+
+        bool written = true;
+        while (written && size > 0)
+        {
+            DWORD chunk = static_cast<DWORD>(std::min<lint>(size, 1 << 30));
+            DWORD done = 0;
+            written = WriteFile(file, data, chunk, &done, nullptr) && done > 0;
+            data += done;
+            size -= done;
+        }
+        written = written && FlushFileBuffers(file);
+        CloseHandle(file);
+
+        // Fails if a process maps the file, it is opened without FILE_SHARE_DELETE (see Model_file)
+        written = written &&
+            MoveFileExA(temporary.c_str(), file_name.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+        int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        bool written = true;
+        while (written && size > 0)
+        {
+            ssize_t done = write(fd, data, size);
+            written = done > 0;
+            data += written ? done : 0;
+            size -= written ? done : 0;
+        }
+        written = 0 == fsync(fd) && written;
+        written = 0 == close(fd) && written;
+
+        written = written && 0 == rename(temporary.c_str(), file_name.c_str());
+
+        // The rename itself is made durable by flushing the directory
+        if (written)
+        {
+            size_t slash = file_name.find_last_of('/');
+            std::string directory = std::string::npos == slash ? "." : file_name.substr(0, slash + 1);
+            int dir_fd = open(directory.c_str(), O_RDONLY);
+            if (dir_fd >= 0)
+            {
+                fsync(dir_fd);
+                close(dir_fd);
+            }
+        }
+#endif
+        if (!written)
+        {
+            std::remove(temporary.c_str());
+        }
+
+        return written;
+    }
+
+    // Bytes of a mapped model file being parsed, reading past the end throws
+    class Reader
+    {
+    private:
+        const char *m_data;
+        lint m_size;
+        lint m_pos;
+
+    public:
+        Reader(const char *data, lint size, lint pos)
+            : m_data{ data }, m_size{ size }, m_pos{ pos }
+        {}
+
+        const char * bytes(lint size)
+        {
+            if (size < 0 || this->m_pos + size > this->m_size)
+            {
+                throw std::invalid_argument(std::string("neurons::Model_file: the model file is corrupted"));
+            }
+
+            const char *data = this->m_data + this->m_pos;
+            this->m_pos += size;
+            return data;
+        }
+
+        template <typename T>
+        T value()
+        {
+            T val;
+            std::memcpy(&val, this->bytes(sizeof(T)), sizeof(T));
+            return val;
+        }
+
+        std::string name()
+        {
+            lint len = this->value<std::uint8_t>();
+            return std::string{ this->bytes(len), static_cast<size_t>(len) };
+        }
+    };
+}
+
+
+bool neurons::write_model_file(const std::string & file_name, const std::vector<Model_layer> & layers, const Training_state *state)
+{
+    Writer writer;
+
+    writer.bytes(MODEL_FILE_MAGIC, 8);
+    writer.value(MODEL_FILE_VERSION);
+    writer.value(static_cast<std::uint32_t>(FILE_HEADER_SIZE));
+    writer.value(static_cast<std::int64_t>(layers.size()));
+    // Size of the file, which is known at last
+    writer.value(static_cast<std::int64_t>(0));
+    writer.pad();
+
+    for (const Model_layer & layer : layers)
+    {
+        writer.layer(layer);
+    }
+
+    if (nullptr != state)
+    {
+        Model_layer record;
+        record.m_type = STATE_RECORD;
+        record.m_params = { state->m_step, state->m_steps };
+        // Shapes are not empty, so an empty state is a record without tensors
+        if (!state->m_random_state.empty())
+        {
+            record.m_tensors.push_back(Model_tensor{
+                Shape{ static_cast<lint>(state->m_random_state.size()) }, 1, state->m_random_state.data() });
+        }
+
+        writer.layer(record);
+    }
+
+    writer.overwrite(24, static_cast<std::int64_t>(writer.size()));
+
+    return write_file_atomically(file_name, writer.data(), writer.size());
+}
+
+
+bool neurons::Model_file::is_model_file(const std::string & file_name)
+{
+    std::ifstream in_file;
+    in_file.open(file_name, std::ios::in | std::ios::binary);
+
+    char magic[8];
+    if (!in_file || !in_file.read(magic, sizeof(magic)))
+    {
+        return false;
+    }
+
+    return 0 == std::memcmp(magic, MODEL_FILE_MAGIC, sizeof(magic));
+}
+
+neurons::Model_file::Model_file(const std::string & file_name)
+    : m_data{ nullptr }, m_size{ 0 }, m_has_training_state{ false }, m_training_state{ 0, 0, "" }
+{
+    std::string cannot_map = std::string("neurons::Model_file: cannot map ") + file_name;
+
+#ifdef _WIN32
+    this->m_mapping_handle = nullptr;
+    this->m_file_handle = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (INVALID_HANDLE_VALUE == this->m_file_handle)
+    {
+        this->m_file_handle = nullptr;
+        throw std::invalid_argument(cannot_map);
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(this->m_file_handle, &size) || size.QuadPart < FILE_HEADER_SIZE)
+    {
+        this->unmap();
+        throw std::invalid_argument(cannot_map);
+    }
+    this->m_size = size.QuadPart;
+
+    this->m_mapping_handle = CreateFileMappingA(this->m_file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (nullptr != this->m_mapping_handle)
+    {
+        this->m_data = static_cast<const char *>(MapViewOfFile(this->m_mapping_handle, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (nullptr == this->m_data)
+    {
+        this->unmap();
+        throw std::invalid_argument(cannot_map);
+    }
+#else
+    int fd = open(file_name.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::invalid_argument(cannot_map);
+    }
+
+    struct stat st;
+    if (0 != fstat(fd, &st) || st.st_size < FILE_HEADER_SIZE)
+    {
+        close(fd);
+        throw std::invalid_argument(cannot_map);
+    }
+    this->m_size = st.st_size;
+
+    // The mapping stays after the file is closed
+    void *data = mmap(nullptr, this->m_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == data)
+    {
+        throw std::invalid_argument(cannot_map);
+    }
+    this->m_data = static_cast<const char *>(data);
+#endif
+
+    try
+    {
+        this->parse();
+    }
+    catch (...)
+    {
+        this->unmap();
+        throw;
+    }
+}
+
+neurons::Model_file::~Model_file()
+{
+    this->unmap();
+}
+
+const std::vector<neurons::Model_layer> & neurons::Model_file::layers() const
+{
+    return this->m_layers;
+}
+
+bool neurons::Model_file::has_training_state() const
+{
+    return this->m_has_training_state;
+}
+
+const neurons::Training_state & neurons::Model_file::training_state() const
+{
+    return this->m_training_state;
+}
+
+void neurons::Model_file::parse()
+{
+    std::string corrupted = std::string("neurons::Model_file: the model file is corrupted");
+
+    Reader header{ this->m_data, this->m_size, 0 };
+    if (0 != std::memcmp(header.bytes(8), MODEL_FILE_MAGIC, 8))
+    {
+        throw std::invalid_argument(std::string("neurons::Model_file: not a model file"));
+    }
+
+    std::uint32_t version = header.value<std::uint32_t>();
+    if (version > MODEL_FILE_VERSION)
+    {
+        throw std::invalid_argument(
+            std::string("neurons::Model_file: unsupported version of model file: ") + std::to_string(version));
+    }
+
+    lint header_size = header.value<std::uint32_t>();
+    lint n_layers = header.value<std::int64_t>();
+    lint file_size = header.value<std::int64_t>();
+    if (header_size < FILE_HEADER_SIZE || header_size % MODEL_FILE_ALIGNMENT != 0 || file_size != this->m_size || n_layers < 0)
+    {
+        throw std::invalid_argument(corrupted);
+    }
+
+    // Layers, and the training state of checkpoints after them
+    lint record = header_size;
+    for (lint l = 0; l < n_layers || record < this->m_size; ++l)
+    {
+        Reader reader{ this->m_data, this->m_size, record };
+        lint record_size = reader.value<std::int64_t>();
+        if (record_size <= 0 || record_size % MODEL_FILE_ALIGNMENT != 0 || record + record_size > this->m_size)
+        {
+            throw std::invalid_argument(corrupted);
+        }
+
+        Model_layer layer;
+        layer.m_type = reader.name();
+        layer.m_act_func = reader.name();
+        layer.m_err_func = reader.name();
+
+        // Counts are checked against the record, so corrupted counts do not make long loops
+        lint n_params = reader.value<std::int64_t>();
+        if (n_params < 0 || n_params > record_size)
+        {
+            throw std::invalid_argument(corrupted);
+        }
+
+        for (lint i = 0; i < n_params; ++i)
+        {
+            layer.m_params.push_back(reader.value<std::int64_t>());
+        }
+
+        lint n_tensors = reader.value<std::int64_t>();
+        if (n_tensors < 0 || n_tensors > record_size)
+        {
+            throw std::invalid_argument(corrupted);
+        }
+
+        for (lint t = 0; t < n_tensors; ++t)
+        {
+            Model_tensor tensor;
+            tensor.m_element_size = reader.value<std::int64_t>();
+
+            lint dim = reader.value<std::int64_t>();
+            if (dim < 0 || dim > record_size || tensor.m_element_size <= 0)
+            {
+                throw std::invalid_argument(corrupted);
+            }
+
+            std::vector<lint> dims;
+            for (lint i = 0; i < dim; ++i)
+            {
+                dims.push_back(reader.value<std::int64_t>());
+            }
+            tensor.m_shape = Shape{ dims };
+
+            // Elements of each tensor must be aligned and inside the record
+            lint offset = reader.value<std::int64_t>();
+            if (offset % MODEL_FILE_ALIGNMENT != 0 || offset < record ||
+                offset + tensor.m_shape.size() * tensor.m_element_size > record + record_size)
+            {
+                throw std::invalid_argument(corrupted);
+            }
+            tensor.m_data = this->m_data + offset;
+
+            layer.m_tensors.push_back(tensor);
+        }
+
+        record += record_size;
+
+        if (l < n_layers)
+        {
+            this->m_layers.push_back(std::move(layer));
+        }
+        else if (STATE_RECORD == layer.m_type && 2 == layer.m_params.size() && layer.m_tensors.size() <= 1)
+        {
+            this->m_has_training_state = true;
+            this->m_training_state.m_step = layer.m_params[0];
+            this->m_training_state.m_steps = layer.m_params[1];
+
+            if (1 == layer.m_tensors.size())
+            {
+                const Model_tensor & random_state = layer.m_tensors[0];
+                this->m_training_state.m_random_state.assign(
+                    random_state.m_data, random_state.m_shape.size() * random_state.m_element_size);
+            }
+        }
+        else
+        {
+            throw std::invalid_argument(corrupted);
+        }
+    }
+}
+
+void neurons::Model_file::unmap()
+{
+#ifdef _WIN32
+    if (nullptr != this->m_data)
+    {
+        UnmapViewOfFile(this->m_data);
+    }
+    if (nullptr != this->m_mapping_handle)
+    {
+        CloseHandle(this->m_mapping_handle);
+    }
+    if (nullptr != this->m_file_handle)
+    {
+        CloseHandle(this->m_file_handle);
+    }
+    this->m_mapping_handle = nullptr;
+    this->m_file_handle = nullptr;
+#else
+    if (nullptr != this->m_data)
+    {
+        munmap(const_cast<char *>(this->m_data), this->m_size);
+    }
+#endif
+    this->m_data = nullptr;
+    this->m_size = 0;
+}
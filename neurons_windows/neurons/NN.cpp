@@ -1,51 +1,190 @@
 #include "NN.h"
-#include <thread>
 
-NN::NN(double l_rate, double mmt_rate, lint threads, const std::string & model_file, const dataset::Dataset &d_set)
+namespace
+{
+    // Samples and labels of a data set are converted to the precision of the network
+    template <typename dtype>
+    void convert_matrices(std::vector<neurons::TMatrix<dtype>> & to, std::vector<neurons::TMatrix<>> & from)
+    {
+        to.resize(from.size());
+        for (size_t i = 0; i < from.size(); ++i)
+        {
+            to[i] = neurons::TMatrix<dtype>{ from[i] };
+            // Release each double matrix as soon as it is converted
+            from[i] = neurons::TMatrix<>{};
+        }
+    }
+
+    void convert_matrices(std::vector<neurons::TMatrix<>> & to, std::vector<neurons::TMatrix<>> & from)
+    {
+        to = std::move(from);
+    }
+}
+
+template <typename dtype>
+NN<dtype>::NN(double l_rate, double mmt_rate, lint threads, const std::string & model_file, const dataset::Dataset &d_set)
     : 
+    m_sampling{ Sampling::with_replacement },
+    m_parallelism{ Parallelism::balanced },
+    m_prefetch_workers{ 1 },
+    m_prefetch_depth{ 2 },
+    m_resume{ false },
+    m_resume_state{ 0, 0, "" },
     m_l_rate{ l_rate },
     m_mmt_rate{ mmt_rate <= 1 ? mmt_rate : 1 },
     m_threads{ threads },
-    m_model_file{ model_file }
+    m_pool{ neurons::Thread_pool::process_pool(threads) },
+    m_model_file{ model_file },
+    m_raw_images{ false },
+    m_scaling{ dataset::Image_store::Scaling::none }
 {
-    // Load the training set
-    d_set.get_training_set(this->m_train_set, this->m_train_labels);
+    const dataset::Dataset::Stream_settings & stream_settings = d_set.stream_settings();
+    bool streaming = stream_settings.m_chunk_size > 0;
 
-    // Load the test set
-    d_set.get_test_set(this->m_test_set, this->m_test_labels);
+    if (streaming)
+    {
+        auto stream = d_set.open_training_stream(stream_settings.m_shard, stream_settings.m_shards);
+        if (!stream)
+        {
+            throw std::invalid_argument(std::string("The data set cannot be streamed."));
+        }
+
+        this->m_train_stream = std::make_unique<dataset::Shuffle_buffer>(
+            std::move(stream),
+            stream_settings.m_buffer_size,
+            stream_settings.m_chunk_size,
+            static_cast<unsigned int>(neurons::global::global_rand_engine()));
+    }
 
-    if (!(
-        this->m_train_set.size() > 0 &&
-        this->m_train_labels.size() > 0 &&
-        this->m_train_set.size() == this->m_train_labels.size() &&
-        this->m_test_set.size() > 0 &&
-        this->m_test_labels.size() > 0 &&
-        this->m_test_set.size() == this->m_test_labels.size() &&
-        this->m_train_set[0].shape() == this->m_test_set[0].shape() &&
-        this->m_train_labels[0].shape() == this->m_test_labels[0].shape()
-        ))
+    // Images are kept as raw pixels if the data set supports it
+    if ((streaming || d_set.get_training_store(this->m_train_images)) && d_set.get_test_store(this->m_test_images))
     {
-        throw std::invalid_argument(std::string("The data set is wrong."));
+        this->m_raw_images = true;
+
+        const neurons::Shape & image_shape =
+            streaming ? this->m_train_stream->image_shape() : this->m_train_images.image_shape();
+        lint classes = streaming ? this->m_train_stream->classes() : this->m_train_images.classes();
+
+        if (!(
+            (streaming || this->m_train_images.size() > 0) &&
+            this->m_test_images.size() > 0 &&
+            image_shape == this->m_test_images.image_shape() &&
+            classes == this->m_test_images.classes()
+            ))
+        {
+            throw std::invalid_argument(std::string("The data set is wrong."));
+        }
+
+        // Labels are small, so they are converted at once
+        neurons::Shape label_shape{ classes };
+
+        this->m_train_labels.resize(this->m_train_images.size());
+        for (lint i = 0; i < this->m_train_images.size(); ++i)
+        {
+            this->m_train_images.materialize_label(this->m_train_labels[i], i, label_shape);
+        }
+
+        this->m_test_labels.resize(this->m_test_images.size());
+        for (lint i = 0; i < this->m_test_images.size(); ++i)
+        {
+            this->m_test_images.materialize_label(this->m_test_labels[i], i, label_shape);
+        }
+
+        this->m_sample_shape = image_shape;
+        this->m_label_shape = label_shape;
     }
-    
-    this->m_train_distribution = std::uniform_int_distribution<size_t>{ 0, this->m_train_set.size() - 1 };
-    this->m_test_distribution = std::uniform_int_distribution<size_t>{ 0, this->m_test_set.size() - 1 };
+    else if (streaming)
+    {
+        throw std::invalid_argument(std::string("The data set cannot be streamed."));
+    }
+    else
+    {
+        std::vector<neurons::TMatrix<>> set, labels;
+
+        // Load the training set
+        d_set.get_training_set(set, labels);
+        convert_matrices(this->m_train_set, set);
+        convert_matrices(this->m_train_labels, labels);
+
+        // Load the test set
+        d_set.get_test_set(set, labels);
+        convert_matrices(this->m_test_set, set);
+        convert_matrices(this->m_test_labels, labels);
+
+        if (!(
+            this->m_train_set.size() > 0 &&
+            this->m_train_labels.size() > 0 &&
+            this->m_train_set.size() == this->m_train_labels.size() &&
+            this->m_test_set.size() > 0 &&
+            this->m_test_labels.size() > 0 &&
+            this->m_test_set.size() == this->m_test_labels.size() &&
+            this->m_train_set[0].shape() == this->m_test_set[0].shape() &&
+            this->m_train_labels[0].shape() == this->m_test_labels[0].shape()
+            ))
+        {
+            throw std::invalid_argument(std::string("The data set is wrong."));
+        }
+
+        this->m_sample_shape = this->m_train_set[0].shape();
+        this->m_label_shape = this->m_train_labels[0].shape();
+    }
+
+    this->reset_sampler(this->m_train_sampler, this->n_train_samples());
+    this->reset_sampler(this->m_test_sampler, this->n_test_samples());
 }
 
 
-NN::~NN()
+template <typename dtype>
+NN<dtype>::~NN()
 {}
 
 
-lint NN::n_layers() const
+template <typename dtype>
+lint NN<dtype>::n_layers() const
 {
     return this->m_layers.size();
 }
 
-void NN::print_train_set(std::ostream & os) const
+template <typename dtype>
+void NN<dtype>::set_sampling(Sampling sampling)
+{
+    this->m_sampling = sampling;
+
+    this->reset_sampler(this->m_train_sampler, this->n_train_samples());
+    this->reset_sampler(this->m_test_sampler, this->n_test_samples());
+}
+
+template <typename dtype>
+void NN<dtype>::set_prefetch(lint workers, lint depth)
+{
+    this->m_prefetch_workers = workers > 0 ? workers : 0;
+    this->m_prefetch_depth = depth > 0 ? depth : 1;
+}
+
+template <typename dtype>
+void NN<dtype>::set_parallelism(Parallelism parallelism)
+{
+    this->m_parallelism = parallelism;
+}
+
+template <typename dtype>
+void NN<dtype>::print_train_set(std::ostream & os) const
 {
-    os << "There are " << this->m_train_set.size() << " items in the training set\n";
-    if (this->m_train_set.size() > 0)
+    if (this->m_train_stream)
+    {
+        os << "The training set is streamed through a shuffle buffer of " << this->m_train_stream->size() << " items\n";
+        return;
+    }
+
+    os << "There are " << this->n_train_samples() << " items in the training set\n";
+    if (this->m_raw_images)
+    {
+        neurons::TMatrix<dtype> first;
+        this->m_train_images.materialize(first, 0, this->m_sample_shape, this->m_scaling);
+        os << "The first item:\n";
+        os << first << '\n';
+    }
+    else if (this->m_train_set.size() > 0)
     {
         os << "The first item:\n";
         os << this->m_train_set[0] << '\n';
@@ -53,7 +192,8 @@ void NN::print_train_set(std::ostream & os) const
 }
 
 
-void NN::print_train_label(std::ostream & os) const
+template <typename dtype>
+void NN<dtype>::print_train_label(std::ostream & os) const
 {
     os << "There are " << this->m_train_labels.size() << " items in the training label\n";
     if (this->m_train_labels.size() > 0)
@@ -64,10 +204,18 @@ void NN::print_train_label(std::ostream & os) const
 }
 
 
-void NN::print_test_set(std::ostream & os) const
+template <typename dtype>
+void NN<dtype>::print_test_set(std::ostream & os) const
 {
-    os << "There are " << this->m_test_set.size() << " items in the test set\n";
-    if (this->m_test_set.size() > 0)
+    os << "There are " << this->n_test_samples() << " items in the test set\n";
+    if (this->m_raw_images)
+    {
+        neurons::TMatrix<dtype> first;
+        this->m_test_images.materialize(first, 0, this->m_sample_shape, this->m_scaling);
+        os << "The first item:\n";
+        os << first << '\n';
+    }
+    else if (this->m_test_set.size() > 0)
     {
         os << "The first item:\n";
         os << this->m_test_set[0] << '\n';
@@ -75,7 +223,8 @@ void NN::print_test_set(std::ostream & os) const
 }
 
 
-void NN::print_test_label(std::ostream & os) const
+template <typename dtype>
+void NN<dtype>::print_test_label(std::ostream & os) const
 {
     os << "There are " << this->m_train_labels.size() << " items in the test labels\n";
     if (this->m_test_labels.size() > 0)
@@ -86,30 +235,103 @@ void NN::print_test_label(std::ostream & os) const
 }
 
 
-void NN::train_network(
+template <typename dtype>
+void NN<dtype>::prepare_samples(const neurons::Shape & sample_shape, const neurons::Shape & label_shape, bool normalize)
+{
+    if (this->m_raw_images)
+    {
+        this->m_scaling = normalize ? dataset::Image_store::Scaling::standardize : dataset::Image_store::Scaling::none;
+    }
+
+    for (size_t i = 0; i < this->m_train_set.size(); ++i)
+    {
+        this->m_train_set[i].reshape(sample_shape);
+        if (normalize)
+        {
+            this->m_train_set[i].normalize();
+        }
+    }
+
+    for (size_t i = 0; i < this->m_test_set.size(); ++i)
+    {
+        this->m_test_set[i].reshape(sample_shape);
+        if (normalize)
+        {
+            this->m_test_set[i].normalize();
+        }
+    }
+
+    for (size_t i = 0; i < this->m_train_labels.size(); ++i)
+    {
+        this->m_train_labels[i].reshape(label_shape);
+    }
+
+    for (size_t i = 0; i < this->m_test_labels.size(); ++i)
+    {
+        this->m_test_labels[i].reshape(label_shape);
+    }
+
+    this->m_sample_shape = sample_shape;
+    this->m_label_shape = label_shape;
+}
+
+
+template <typename dtype>
+void NN<dtype>::train_network(
     lint batch_size,
     lint epoch_size,
     lint epochs,
     lint epochs_between_saves,
     lint secs_allowed)
 {
-    std::vector<std::vector<neurons::TMatrix<>>> inputs;
-    std::vector<std::vector<neurons::TMatrix<>>> targets;
-    std::vector<std::vector<neurons::TMatrix<>>> preds;
+    std::vector<std::vector<neurons::TMatrix<dtype>>> preds;
 
     lint start_time = neurons::now_in_seconds();
+    lint failed_checkpoints = this->m_checkpoints.failed();
 
     double loss_sum = 0;
     double accuracy_sum = 0;
 
     lint steps = epoch_size * epochs;
 
-    for (lint i = 1; i <= steps; ++i)
+    // A run resumed from its checkpoint continues after the step of the checkpoint
+    lint first_step = 1;
+    if (this->m_resume)
+    {
+        this->m_resume = false;
+        if (this->resume_training(this->m_resume_state, steps))
+        {
+            first_step = this->m_resume_state.m_step + 1;
+        }
+    }
+
+    // Batches are drawn and materialized while the network is trained on the batches before them
+    neurons::Prefetch_pipeline<Batch> batches{
+        this->m_prefetch_workers, this->m_prefetch_depth, steps - first_step + 1,
+        [this, batch_size](Batch & batch)
+    {
+        if (this->m_train_stream)
+        {
+            this->draw_streamed_batch(batch_size, batch);
+        }
+        else
+        {
+            this->draw_batch(batch_size, batch, this->m_train_sampler);
+        }
+        batch.m_drawn = this->m_train_sampler.m_drawn;
+    },
+        [this](Batch & batch)
     {
-        this->get_batch
-        (batch_size, inputs, targets, this->m_train_set, this->m_train_labels, this->m_train_distribution);
-        loss_sum += this->train_step(batch_size, inputs, targets, preds);
-        accuracy_sum += this->get_accuracy(batch_size, preds, targets);
+        // Labels of streamed samples are materialized with them, as m_train_labels is empty
+        this->fill_batch(
+            batch, this->m_train_set, this->m_train_stream ? batch.m_images : this->m_train_images, this->m_train_labels);
+    } };
+
+    for (lint i = first_step; i <= steps; ++i)
+    {
+        Batch & batch = batches.next();
+        loss_sum += this->train_step(batch_size, batch.m_inputs, batch.m_targets, preds);
+        accuracy_sum += this->get_accuracy(batch_size, preds, batch.m_targets);
 
         lint now = neurons::now_in_seconds();
         if (now - start_time > secs_allowed)
@@ -125,6 +347,9 @@ void NN::train_network(
             std::cout << "Training epoch size: " << epoch_size << '\n';
             std::cout << "The avg loss: " << loss_sum / epoch_size << '\n';
             std::cout << "The avg accuracy: " << accuracy_sum / epoch_size << "\n";
+            neurons::Allocation_count allocations = neurons::last_step_allocations();
+            std::cout << "Allocations of the last step: " << allocations.m_allocations
+                << " (" << allocations.m_system_allocations << " from the system)\n";
             std::cout << "Time: " << now - start_time << " seconds\n\n";
 
             loss_sum = 0;
@@ -134,28 +359,93 @@ void NN::train_network(
         if (0 == i % (epoch_size * epochs_between_saves))
         {
             this->test_network(batch_size, epoch_size);
-            this->save(this->m_model_file);
+
+            // Training goes on while the checkpoint is written
+            if (this->writes_model_files())
+            {
+                this->m_checkpoints.save(
+                    this->m_model_file, this->model_layers(true), this->training_state(i, steps, batch.m_drawn));
+            }
+            else
+            {
+                this->save(this->m_model_file);
+            }
         }
 
     }
+
+    this->m_checkpoints.wait();
+    if (this->m_checkpoints.failed() > failed_checkpoints)
+    {
+        std::cout << "Checkpoints could not be written to " << this->m_model_file << "\n";
+    }
+}
+
+
+template <typename dtype>
+std::shared_ptr<neurons::Inference_session<dtype>> NN<dtype>::inference_session(lint threads) const
+{
+    return std::make_shared<neurons::Inference_session<dtype>>(
+        this->model_layers(false), this->m_sample_shape, this->normalizes_inputs(), threads, this->m_mapped_model);
+}
+
+
+template <typename dtype>
+std::vector<neurons::Model_layer> NN<dtype>::model_layers(bool momentum) const
+{
+    std::vector<neurons::Model_layer> layers;
+    for (const std::shared_ptr<neurons::NN_layer<dtype>> & layer : this->m_layers)
+    {
+        layers.push_back(layer->to_model_layer());
+        if (momentum)
+        {
+            layer->add_momentum(layers.back());
+        }
+    }
+
+    return layers;
 }
 
 
-void NN::test_network(lint batch_size, lint epoch_size)
+template <typename dtype>
+bool NN<dtype>::writes_model_files() const
 {
-    std::vector<std::vector<neurons::TMatrix<>>> inputs;
-    std::vector<std::vector<neurons::TMatrix<>>> targets;
-    std::vector<std::vector<neurons::TMatrix<>>> preds;
+    return false;
+}
+
+template <typename dtype>
+bool NN<dtype>::normalizes_inputs() const
+{
+    return true;
+}
+
+
+template <typename dtype>
+void NN<dtype>::restore_training_state(const neurons::Training_state & state)
+{
+    this->m_resume = true;
+    this->m_resume_state = state;
+}
+
+
+template <typename dtype>
+void NN<dtype>::test_network(lint batch_size, lint epoch_size)
+{
+    std::vector<std::vector<neurons::TMatrix<dtype>>> preds;
 
     double loss_sum = 0;
     double accuracy_sum = 0;
 
+    neurons::Prefetch_pipeline<Batch> batches{
+        this->m_prefetch_workers, this->m_prefetch_depth, epoch_size,
+        [this, batch_size](Batch & batch) { this->draw_batch(batch_size, batch, this->m_test_sampler); },
+        [this](Batch & batch) { this->fill_batch(batch, this->m_test_set, this->m_test_images, this->m_test_labels); } };
+
     for (lint i = 0; i < epoch_size; ++i)
     {
-        this->get_batch
-        (batch_size, inputs, targets, this->m_test_set, this->m_test_labels, this->m_test_distribution);
-        loss_sum += this->test_step(batch_size, inputs, targets, preds);
-        accuracy_sum += this->get_accuracy(batch_size, preds, targets);
+        Batch & batch = batches.next();
+        loss_sum += this->test_step(batch_size, batch.m_inputs, batch.m_targets, preds);
+        accuracy_sum += this->get_accuracy(batch_size, preds, batch.m_targets);
     }
 
     std::cout << "========Test batch size: " << batch_size << '\n';
@@ -165,10 +455,11 @@ void NN::test_network(lint batch_size, lint epoch_size)
 }
 
 
-std::vector<neurons::TMatrix<>> NN::network_predict(lint batch_size, const std::vector<neurons::TMatrix<>>& inputs) const
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> NN<dtype>::network_predict(lint batch_size, const std::vector<neurons::TMatrix<dtype>>& inputs) const
 {
-    std::vector<std::vector<neurons::TMatrix<>>> data_batch;
-    std::vector<neurons::TMatrix<>> all_preds;
+    std::vector<std::vector<const neurons::TMatrix<dtype> *>> data_batch;
+    std::vector<neurons::TMatrix<dtype>> all_preds;
 
     lint batch_size_of_each_thread = batch_size / this->m_threads;
 
@@ -177,7 +468,7 @@ std::vector<neurons::TMatrix<>> NN::network_predict(lint batch_size, const std::
         ++batch_size_of_each_thread;
     }
 
-    std::vector<neurons::TMatrix<>> data_batch_of_each_thread;
+    std::vector<const neurons::TMatrix<dtype> *> data_batch_of_each_thread;
 
     for (size_t i = 0; i < inputs.size(); i += batch_size)
     {
@@ -187,7 +478,7 @@ std::vector<neurons::TMatrix<>> NN::network_predict(lint batch_size, const std::
         {
             if (i + j < inputs.size())
             {
-                data_batch_of_each_thread.push_back(inputs[i + j]);
+                data_batch_of_each_thread.push_back(&inputs[i + j]);
             }
             else
             {
@@ -210,9 +501,9 @@ std::vector<neurons::TMatrix<>> NN::network_predict(lint batch_size, const std::
         }
 
         auto preds = this->predict_step(batch_size, data_batch);
-        for (const std::vector<neurons::TMatrix<>> & preds_each_thread : preds)
+        for (const std::vector<neurons::TMatrix<dtype>> & preds_each_thread : preds)
         {
-            for (const neurons::TMatrix<> & pred : preds_each_thread)
+            for (const neurons::TMatrix<dtype> & pred : preds_each_thread)
             {
                 all_preds.push_back(pred);
             }
@@ -223,167 +514,286 @@ std::vector<neurons::TMatrix<>> NN::network_predict(lint batch_size, const std::
 }
 
 
-void NN::get_batch(
-    lint batch_size,
-    std::vector<std::vector<neurons::TMatrix<>>> & data_batch,
-    std::vector<std::vector<neurons::TMatrix<>>> & label_batch,
-    const std::vector<neurons::TMatrix<>> & data,
-    const std::vector<neurons::TMatrix<>> & label,
-    std::uniform_int_distribution<size_t> & distribution)
+template <typename dtype>
+size_t NN<dtype>::n_train_samples() const
 {
-    data_batch.clear();
-    label_batch.clear();
+    return this->m_raw_images ? this->m_train_images.size() : this->m_train_set.size();
+}
 
-    lint batch_size_of_each_thread = batch_size / this->m_threads;
 
-    if (0 != batch_size % this->m_threads)
+template <typename dtype>
+size_t NN<dtype>::n_test_samples() const
+{
+    return this->m_raw_images ? this->m_test_images.size() : this->m_test_set.size();
+}
+
+
+template <typename dtype>
+void NN<dtype>::reset_sampler(Sampler & sampler, size_t size)
+{
+    this->seed_sampler(sampler, size, static_cast<unsigned int>(neurons::global::global_rand_engine()));
+}
+
+
+template <typename dtype>
+void NN<dtype>::seed_sampler(Sampler & sampler, size_t size, unsigned int seed)
+{
+    sampler.m_seed = seed;
+    sampler.m_drawn = 0;
+    sampler.m_engine.seed(seed);
+    sampler.m_distribution = std::uniform_int_distribution<size_t>{ 0, size - 1 };
+    sampler.m_order.clear();
+    sampler.m_next = 0;
+
+    if (Sampling::epoch_shuffle == this->m_sampling)
     {
-        ++batch_size_of_each_thread;
+        sampler.m_order.resize(size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            sampler.m_order[i] = i;
+        }
+
+        // Shuffled when the first sample is drawn
+        sampler.m_next = size;
     }
+}
 
-    std::vector<neurons::TMatrix<>> data_batch_of_each_thread;
-    std::vector<neurons::TMatrix<>> label_batch_of_each_thread;
 
-    for (lint i = 1; i <= batch_size; ++i)
-    {
-        // randomly select a training input
-        size_t j = distribution(neurons::global::global_rand_engine);
+template <typename dtype>
+neurons::Training_state NN<dtype>::training_state(lint step, lint steps, size_t train_drawn) const
+{
+    std::ostringstream random_state;
+    random_state << neurons::global::global_rand_engine << ' '
+        << this->m_train_sampler.m_seed << ' ' << train_drawn << ' '
+        << this->m_test_sampler.m_seed << ' ' << this->m_test_sampler.m_drawn;
 
-        data_batch_of_each_thread.push_back(data[j]);
-        label_batch_of_each_thread.push_back(label[j]);
+    return neurons::Training_state{ step, steps, random_state.str() };
+}
 
-        //std::cout << data[j];
-        //std::cout << label[j] << "\n";
 
-        if (0 == i % batch_size_of_each_thread)
-        {
-            data_batch.push_back(data_batch_of_each_thread);
-            label_batch.push_back(label_batch_of_each_thread);
+template <typename dtype>
+bool NN<dtype>::resume_training(const neurons::Training_state & state, lint steps)
+{
+    // Positions in a stream are not saved, and a checkpoint of another run does not apply
+    if (this->m_train_stream || state.m_steps != steps || state.m_step >= steps)
+    {
+        return false;
+    }
 
-            data_batch_of_each_thread.clear();
-            label_batch_of_each_thread.clear();
-        }
+    unsigned int train_seed = 0;
+    size_t train_drawn = 0;
+    unsigned int test_seed = 0;
+    size_t test_drawn = 0;
+    std::default_random_engine engine;
+
+    std::istringstream random_state{ state.m_random_state };
+    random_state >> engine >> train_seed >> train_drawn >> test_seed >> test_drawn;
+    if (!random_state)
+    {
+        return false;
+    }
+
+    // Samplers draw the samples drawn before the checkpoint again
+    this->seed_sampler(this->m_train_sampler, this->n_train_samples(), train_seed);
+    for (size_t i = 0; i < train_drawn; ++i)
+    {
+        this->next_sample(this->m_train_sampler);
     }
 
-    if (data_batch_of_each_thread.size() > 0)
+    this->seed_sampler(this->m_test_sampler, this->n_test_samples(), test_seed);
+    for (size_t i = 0; i < test_drawn; ++i)
     {
-        data_batch.push_back(data_batch_of_each_thread);
-        label_batch.push_back(label_batch_of_each_thread);
+        this->next_sample(this->m_test_sampler);
     }
+
+    neurons::global::global_rand_engine = engine;
+
+    return true;
 }
 
 
-double NN::train_step(
-    lint batch_size,
-    const std::vector<std::vector<neurons::TMatrix<>>> & inputs,
-    const std::vector<std::vector<neurons::TMatrix<>>> & targets,
-    std::vector<std::vector<neurons::TMatrix<>>> & preds)
+template <typename dtype>
+size_t NN<dtype>::next_sample(Sampler & sampler)
 {
-    preds.resize(inputs.size());
+    ++sampler.m_drawn;
 
-    size_t actual_threads = inputs.size();
-    size_t new_threads = actual_threads - 1;
-    std::vector<std::thread> train_threads{ new_threads };
+    if (Sampling::with_replacement == this->m_sampling)
+    {
+        return sampler.m_distribution(sampler.m_engine);
+    }
 
-    size_t thread_id = 0;
-    // Create new threads if there are extra threads needed
-    for (; thread_id < new_threads; ++thread_id)
+    // A new epoch starts with a new permutation
+    if (sampler.m_next >= sampler.m_order.size())
     {
-        train_threads[thread_id] = std::thread(
-            [this, &inputs, &targets, thread_id, &preds]
-        {
-            preds[thread_id] = this->optimise(inputs[thread_id], targets[thread_id], thread_id);
-        });
+        std::shuffle(sampler.m_order.begin(), sampler.m_order.end(), sampler.m_engine);
+        sampler.m_next = 0;
     }
-    // Do the training within the main thread
-    preds[thread_id] = this->optimise(inputs[thread_id], targets[thread_id], thread_id);
 
-    for (size_t i = 0; i < new_threads; ++i)
+    return sampler.m_order[sampler.m_next++];
+}
+
+
+template <typename dtype>
+void NN<dtype>::draw_batch(lint batch_size, Batch & batch, Sampler & sampler)
+{
+    batch.m_indices.resize(batch_size);
+    for (lint i = 0; i < batch_size; ++i)
     {
-        train_threads[i].join();
+        // select a training input
+        batch.m_indices[i] = this->next_sample(sampler);
     }
+}
 
-    double loss = 0;
-    for (size_t i = 0; i < this->m_layers.size(); ++i)
+
+template <typename dtype>
+void NN<dtype>::draw_streamed_batch(lint batch_size, Batch & batch)
+{
+    if (batch.m_images.image_shape() != this->m_train_stream->image_shape())
     {
-        loss += this->m_layers[i]->commit_training();
+        batch.m_images = dataset::Image_store{ this->m_train_stream->image_shape(), this->m_train_stream->classes() };
     }
 
-    return loss / batch_size;
+    batch.m_images.resize(batch_size);
+    batch.m_indices.resize(batch_size);
+    for (lint i = 0; i < batch_size; ++i)
+    {
+        this->m_train_stream->next(batch.m_images, i);
+        batch.m_indices[i] = i;
+    }
 }
 
 
-double NN::test_step(
-    lint batch_size,
-    const std::vector<std::vector<neurons::TMatrix<>>> & inputs,
-    const std::vector<std::vector<neurons::TMatrix<>>> & targets,
-    std::vector<std::vector<neurons::TMatrix<>>> & preds)
+template <typename dtype>
+void NN<dtype>::fill_batch(
+    Batch & batch,
+    const std::vector<neurons::TMatrix<dtype>> & data,
+    const dataset::Image_store & images,
+    const std::vector<neurons::TMatrix<dtype>> & label) const
 {
-    preds.resize(inputs.size());
+    lint batch_size = batch.m_indices.size();
+    lint batch_size_of_each_thread = batch_size / this->m_threads;
+
+    if (0 != batch_size % this->m_threads)
+    {
+        ++batch_size_of_each_thread;
+    }
 
-    size_t actual_threads = inputs.size();
-    size_t new_threads = actual_threads - 1;
-    std::vector<std::thread> test_threads{ actual_threads };
+    // Inner vectors keep their capacity, so no memory is allocated after the first batches
+    size_t batches = (batch_size + batch_size_of_each_thread - 1) / batch_size_of_each_thread;
+    batch.m_inputs.resize(batches);
+    batch.m_targets.resize(batches);
 
-    size_t thread_id = 0;
-    // Create new threads if there are extra threads needed
-    for (; thread_id < new_threads; ++thread_id)
+    for (size_t i = 0; i < batches; ++i)
     {
-        test_threads[thread_id] = std::thread(
-            [this, &inputs, &targets, thread_id, &preds]
-        {
-            preds[thread_id] = test(inputs[thread_id], targets[thread_id], thread_id);
-        });
+        batch.m_inputs[i].clear();
+        batch.m_targets[i].clear();
+    }
+
+    if (this->m_raw_images)
+    {
+        batch.m_samples.resize(batch_size);
     }
-    // Do the test within the main thread
-    preds[thread_id] = test(inputs[thread_id], targets[thread_id], thread_id);
-    
-    for (size_t i = 0; i < new_threads; ++i)
+
+    bool own_labels = label.empty();
+    if (own_labels)
     {
-        test_threads[i].join();
+        batch.m_labels.resize(batch_size);
+    }
+
+    for (lint i = 0; i < batch_size; ++i)
+    {
+        size_t j = batch.m_indices[i];
+
+        if (this->m_raw_images)
+        {
+            images.materialize(batch.m_samples[i], j, this->m_sample_shape, this->m_scaling);
+            batch.m_inputs[i / batch_size_of_each_thread].push_back(&batch.m_samples[i]);
+        }
+        else
+        {
+            batch.m_inputs[i / batch_size_of_each_thread].push_back(&data[j]);
+        }
+
+        if (own_labels)
+        {
+            images.materialize_label(batch.m_labels[i], j, this->m_label_shape);
+            batch.m_targets[i / batch_size_of_each_thread].push_back(&batch.m_labels[i]);
+        }
+        else
+        {
+            batch.m_targets[i / batch_size_of_each_thread].push_back(&label[j]);
+        }
     }
+}
+
+
+template <typename dtype>
+double NN<dtype>::train_step(
+    lint batch_size,
+    const std::vector<std::vector<const neurons::TMatrix<dtype> *>> & inputs,
+    const std::vector<std::vector<const neurons::TMatrix<dtype> *>> & targets,
+    std::vector<std::vector<neurons::TMatrix<dtype>>> & preds)
+{
+    preds.resize(inputs.size());
+
+    this->run_thread_tasks(inputs.size(), [this, &inputs, &targets, &preds](size_t thread_id)
+    {
+        preds[thread_id] = this->optimise(inputs[thread_id], targets[thread_id], thread_id);
+    });
 
     double loss = 0;
     for (size_t i = 0; i < this->m_layers.size(); ++i)
     {
-        loss += this->m_layers[i]->commit_testing();
+        loss += this->m_layers[i]->commit_training();
     }
 
+    // Matrices of the step are freed or reused from here on
+    neurons::end_allocation_step();
+
     return loss / batch_size;
 }
 
-std::vector<std::vector<neurons::TMatrix<>>> NN::predict_step
-(lint batch_size, const std::vector<std::vector<neurons::TMatrix<>>>& inputs) const
+
+template <typename dtype>
+double NN<dtype>::test_step(
+    lint batch_size,
+    const std::vector<std::vector<const neurons::TMatrix<dtype> *>> & inputs,
+    const std::vector<std::vector<const neurons::TMatrix<dtype> *>> & targets,
+    std::vector<std::vector<neurons::TMatrix<dtype>>> & preds)
 {
-    std::vector<std::vector<neurons::TMatrix<>>> preds;
     preds.resize(inputs.size());
 
-    size_t actual_threads = inputs.size();
-    size_t new_threads = actual_threads - 1;
-    std::vector<std::thread> test_threads{ actual_threads };
+    this->run_thread_tasks(inputs.size(), [this, &inputs, &targets, &preds](size_t thread_id)
+    {
+        preds[thread_id] = this->test(inputs[thread_id], targets[thread_id], thread_id);
+    });
 
-    size_t thread_id = 0;
-    // Create new threads if there are extra threads needed
-    for (; thread_id < new_threads; ++thread_id)
+    double loss = 0;
+    for (size_t i = 0; i < this->m_layers.size(); ++i)
     {
-        test_threads[thread_id] = std::thread(
-            [this, &inputs, thread_id, &preds]
-        {
-            preds[thread_id] = predict(inputs[thread_id], thread_id);
-        });
+        loss += this->m_layers[i]->commit_testing();
     }
-    // Do the test within the main thread
-    preds[thread_id] = predict(inputs[thread_id], thread_id);
 
-    for (size_t i = 0; i < new_threads; ++i)
+    return loss / batch_size;
+}
+
+template <typename dtype>
+std::vector<std::vector<neurons::TMatrix<dtype>>> NN<dtype>::predict_step
+(lint batch_size, const std::vector<std::vector<const neurons::TMatrix<dtype> *>> & inputs) const
+{
+    std::vector<std::vector<neurons::TMatrix<dtype>>> preds;
+    preds.resize(inputs.size());
+
+    this->run_thread_tasks(inputs.size(), [this, &inputs, &preds](size_t thread_id)
     {
-        test_threads[i].join();
-    }
+        preds[thread_id] = this->predict(inputs[thread_id], thread_id);
+    });
 
     return preds;
 }
 
-double NN::get_accuracy(const neurons::TMatrix<> & pred, const neurons::TMatrix<> & target)
+template <typename dtype>
+double NN<dtype>::get_accuracy(const neurons::TMatrix<dtype> & pred, const neurons::TMatrix<dtype> & target)
 {
     double acc = 0;
     neurons::Coordinate pred_argmax = pred.argmax();
@@ -400,10 +810,11 @@ double NN::get_accuracy(const neurons::TMatrix<> & pred, const neurons::TMatrix<
     return acc;
 }
 
-double NN::get_accuracy(
+template <typename dtype>
+double NN<dtype>::get_accuracy(
     lint batch_size,
-    const std::vector<std::vector<neurons::TMatrix<>>> & preds,
-    const std::vector<std::vector<neurons::TMatrix<>>> & targets)
+    const std::vector<std::vector<neurons::TMatrix<dtype>>> & preds,
+    const std::vector<std::vector<const neurons::TMatrix<dtype> *>> & targets)
 {
     double sum = 0;
 
@@ -411,14 +822,15 @@ double NN::get_accuracy(
     {
         for (size_t j = 0; j < preds[i].size(); ++j)
         {
-            sum += this->get_accuracy(preds[i][j], targets[i][j]);
+            sum += this->get_accuracy(preds[i][j], *targets[i][j]);
         }
     }
 
     return sum / batch_size;
 }
 
-std::ostream & operator<<(std::ostream & os, const NN & nn)
+template <typename dtype>
+std::ostream & operator<<(std::ostream & os, const NN<dtype> & nn)
 {
     nn.print_layers(os);
     nn.print_train_set(os);
@@ -428,3 +840,9 @@ std::ostream & operator<<(std::ostream & os, const NN & nn)
 
     return os;
 }
+
+template class NN<float>;
+template class NN<double>;
+
+template std::ostream & operator<<(std::ostream & os, const NN<float> & nn);
+template std::ostream & operator<<(std::ostream & os, const NN<double> & nn);
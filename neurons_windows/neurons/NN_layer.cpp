@@ -1,26 +1,48 @@
 #include "NN_layer.h"
 
-const std::string neurons::NN_layer::NN{ "NN" };
-const std::string neurons::NN_layer::FCNN{ "FCNN" };
-const std::string neurons::NN_layer::CNN{ "CNN" };
-const std::string neurons::NN_layer::RNN{ "RNN" };
+template <typename dtype>
+const std::string neurons::NN_layer<dtype>::NN{ "NN" };
+template <typename dtype>
+const std::string neurons::NN_layer<dtype>::FCNN{ "FCNN" };
+template <typename dtype>
+const std::string neurons::NN_layer<dtype>::CNN{ "CNN" };
+template <typename dtype>
+const std::string neurons::NN_layer<dtype>::RNN{ "RNN" };
+
+template <typename dtype>
+std::vector<const neurons::TMatrix<dtype> *> neurons::matrix_pointers(const std::vector<TMatrix<dtype>> & batch)
+{
+    std::vector<const TMatrix<dtype> *> pointers{ batch.size() };
+
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+        pointers[i] = &batch[i];
+    }
+
+    return pointers;
+}
 
-neurons::NN_layer::NN_layer()
+template <typename dtype>
+neurons::NN_layer<dtype>::NN_layer()
 {}
 
-neurons::NN_layer::NN_layer(lint threads)
+template <typename dtype>
+neurons::NN_layer<dtype>::NN_layer(lint threads)
     : m_ops{ static_cast<size_t>(threads) }
 {}
 
-neurons::NN_layer::NN_layer(const NN_layer & other)
+template <typename dtype>
+neurons::NN_layer<dtype>::NN_layer(const NN_layer & other)
     : m_ops{ static_cast<size_t>(other.m_ops.size()) }
 {}
 
-neurons::NN_layer::NN_layer(NN_layer && other)
+template <typename dtype>
+neurons::NN_layer<dtype>::NN_layer(NN_layer && other)
     : m_ops{ static_cast<size_t>(other.m_ops.size()) }
 {}
 
-neurons::NN_layer & neurons::NN_layer::operator = (const NN_layer & other)
+template <typename dtype>
+neurons::NN_layer<dtype> & neurons::NN_layer<dtype>::operator = (const NN_layer & other)
 {
     this->m_ops.resize(other.m_ops.size());
 
@@ -28,19 +50,22 @@ neurons::NN_layer & neurons::NN_layer::operator = (const NN_layer & other)
 }
 
 
-neurons::NN_layer & neurons::NN_layer::operator = (NN_layer && other)
+template <typename dtype>
+neurons::NN_layer<dtype> & neurons::NN_layer<dtype>::operator = (NN_layer && other)
 {
     this->m_ops.resize(other.m_ops.size());
 
     return *this;
 }
 
-std::vector<std::shared_ptr<neurons::NN_layer_op>>& neurons::NN_layer::operation_instances() const
+template <typename dtype>
+std::vector<std::shared_ptr<neurons::NN_layer_op<dtype>>>& neurons::NN_layer<dtype>::operation_instances() const
 {
     return this->m_ops;
 }
 
-double neurons::NN_layer::commit_training()
+template <typename dtype>
+double neurons::NN_layer<dtype>::commit_training()
 {
     double loss = 0;
 
@@ -53,7 +78,8 @@ double neurons::NN_layer::commit_training()
     return loss;
 }
 
-double neurons::NN_layer::commit_testing()
+template <typename dtype>
+double neurons::NN_layer<dtype>::commit_testing()
 {
     double loss = 0;
 
@@ -66,42 +92,89 @@ double neurons::NN_layer::commit_testing()
     return loss;
 }
 
-neurons::NN_layer_op::NN_layer_op()
+template <typename dtype>
+neurons::NN_layer_op<dtype>::NN_layer_op()
     : m_loss {0}
 {}
 
 
-neurons::NN_layer_op::NN_layer_op(const NN_layer_op & other)
+template <typename dtype>
+neurons::NN_layer_op<dtype>::NN_layer_op(const NN_layer_op & other)
     : m_loss{ other.m_loss }
 {}
 
 
-neurons::NN_layer_op::NN_layer_op(NN_layer_op && other)
+template <typename dtype>
+neurons::NN_layer_op<dtype>::NN_layer_op(NN_layer_op && other)
     : m_loss{ std::move(other.m_loss) }
 {}
 
 
-neurons::NN_layer_op & neurons::NN_layer_op::operator = (const NN_layer_op & other)
+template <typename dtype>
+neurons::NN_layer_op<dtype> & neurons::NN_layer_op<dtype>::operator = (const NN_layer_op & other)
 {
     this->m_loss = other.m_loss;
 
     return *this;
 }
 
-neurons::NN_layer_op & neurons::NN_layer_op::operator = (NN_layer_op && other)
+template <typename dtype>
+neurons::NN_layer_op<dtype> & neurons::NN_layer_op<dtype>::operator = (NN_layer_op && other)
 {
     this->m_loss = std::move(other.m_loss);
 
     return *this;
 }
 
-double neurons::NN_layer_op::get_loss() const
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> neurons::NN_layer_op<dtype>::batch_forward_propagate(const std::vector<const TMatrix<dtype> *> & inputs)
+{
+    std::vector<TMatrix<dtype>> l_inputs{ inputs.size() };
+
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        l_inputs[i] = *inputs[i];
+    }
+
+    return this->batch_forward_propagate(l_inputs);
+}
+
+template <typename dtype>
+std::vector<neurons::TMatrix<dtype>> neurons::NN_layer_op<dtype>::batch_forward_propagate(
+    const std::vector<const TMatrix<dtype> *> & inputs, const std::vector<const TMatrix<dtype> *> & targets)
+{
+    std::vector<TMatrix<dtype>> l_inputs{ inputs.size() };
+    std::vector<TMatrix<dtype>> l_targets{ targets.size() };
+
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        l_inputs[i] = *inputs[i];
+    }
+
+    for (size_t i = 0; i < targets.size(); ++i)
+    {
+        l_targets[i] = *targets[i];
+    }
+
+    return this->batch_forward_propagate(l_inputs, l_targets);
+}
+
+template <typename dtype>
+double neurons::NN_layer_op<dtype>::get_loss() const
 {
     return this->m_loss;
 }
 
-void neurons::NN_layer_op::clear_loss()
+template <typename dtype>
+void neurons::NN_layer_op<dtype>::clear_loss()
 {
     this->m_loss = 0;
 }
 
+template std::vector<const neurons::TMatrix<float> *> neurons::matrix_pointers(const std::vector<TMatrix<float>> & batch);
+template std::vector<const neurons::TMatrix<double> *> neurons::matrix_pointers(const std::vector<TMatrix<double>> & batch);
+
+template class neurons::NN_layer<float>;
+template class neurons::NN_layer<double>;
+template class neurons::NN_layer_op<float>;
+template class neurons::NN_layer_op<double>;
@@ -1,4 +1,5 @@
 #include "RNN_unit.h"
+#include "TMatrix_View.h"
 
 neurons::RNN_unit::RNN_unit()
 {}
@@ -7,8 +8,8 @@ neurons::RNN_unit::RNN_unit(
     lint input_size,
     lint output_size,
     lint bptt_len,
-    Activation *act_func,
-    ErrorFunction *err_func)
+    Activation<> *act_func,
+    ErrorFunction<> *err_func)
     :
     m_u { Shape { output_size, output_size } },
     m_w { Shape { input_size, output_size } },
@@ -27,8 +28,8 @@ neurons::RNN_unit::RNN_unit(
     lint input_size,
     lint output_size,
     lint bptt_len,
-    std::unique_ptr<neurons::Activation> &act_func,
-    std::unique_ptr<neurons::ErrorFunction> &err_func)
+    std::unique_ptr<neurons::Activation<>> &act_func,
+    std::unique_ptr<neurons::ErrorFunction<>> &err_func)
     :
     m_u{ Shape{ output_size, output_size } },
     m_w{ Shape{ input_size, output_size } },
@@ -198,29 +199,29 @@ std::vector<neurons::TMatrix<>> neurons::RNN_unit::back_propagate_through_time(
     {
         cache_item & it = this->m_cache_for_bptt[i];
 
-        neurons::TMatrix<> diff_E_to_z = neurons::multiply(it.m_act_diff, neurons::transpose(E_to_old_y_diff));
+        neurons::TMatrix<> diff_E_to_z = neurons::multiply(it.m_act_diff, neurons::transposed(E_to_old_y_diff));
 
         // std::cout << E_to_old_y_diff;
 
         // Calculate the derivative dE/d(old_y) via the chain rule (back propagation).
         // E is the error from the last layer.
         // old_y is output of last time as input of the current layer.
-        E_to_old_y_diff = this->m_u * neurons::transpose(diff_E_to_z);
+        E_to_old_y_diff = this->m_u * neurons::transposed(diff_E_to_z);
 
         // Calculate the derivative dE/dx via the chain rule (back propagation).
         // E is the error from the last layer.
         // x is input of the current layer.
-        TMatrix<> E_to_x_diff = this->m_w * neurons::transpose(diff_E_to_z);
+        TMatrix<> E_to_x_diff = this->m_w * neurons::transposed(diff_E_to_z);
 
         // Calculate dE/du and update the weights.
         // E is the error from the last layer.
         // u are weights of the current layer.
-        TMatrix<> u_gradient = neurons::transpose(it.m_y_in) * diff_E_to_z;
+        TMatrix<> u_gradient = neurons::transposed(it.m_y_in) * diff_E_to_z;
 
         // Calculate dE/dw and update the weights.
         // E is the error from the last layer.
         // w are weights of the current layer.
-        TMatrix<> w_gradient = neurons::transpose(it.m_x) * diff_E_to_z;
+        TMatrix<> w_gradient = neurons::transposed(it.m_x) * diff_E_to_z;
 
         // Calculate dE/db and update the bias.
         // E is the error from the last layer.
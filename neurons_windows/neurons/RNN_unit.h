@@ -26,10 +26,10 @@ namespace neurons
         TMatrix<> m_old_y;
 
         // The pointer of activation function (logist, softmax, etc)
-        std::unique_ptr<Activation> m_act_func;
+        std::unique_ptr<Activation<>> m_act_func;
 
         // The pointer of error function (sigmoid_crossentropy, softmax_crossentropy, etc)
-        std::unique_ptr<ErrorFunction> m_err_func;
+        std::unique_ptr<ErrorFunction<>> m_err_func;
 
     public:
         RNN_unit();
@@ -38,15 +38,15 @@ namespace neurons
             lint input_size,
             lint output_size,
             lint bptt_len,
-            neurons::Activation *act_func,
-            neurons::ErrorFunction *err_func = nullptr);
+            neurons::Activation<> *act_func,
+            neurons::ErrorFunction<> *err_func = nullptr);
 
         RNN_unit(
             lint input_size,
             lint output_size,
             lint bptt_len,
-            std::unique_ptr<neurons::Activation> &act_func,
-            std::unique_ptr<neurons::ErrorFunction> &err_func);
+            std::unique_ptr<neurons::Activation<>> &act_func,
+            std::unique_ptr<neurons::ErrorFunction<>> &err_func);
 
 
         //----------------------------
@@ -31,13 +31,18 @@ namespace neurons
         friend class TMatrix<int>;
         friend class TMatrix<lint>;
 
+    public:
+        // Shapes of up to this many dimensions are stored inside the object without heap allocation
+        static const lint INLINE_DIMS = 8;
+
     private:
         // How many dimensions this shape has
         lint m_dim;
         // Amount of elements this shape has
         lint m_size;
-        // Detailed information of this shape
+        // Detailed information of this shape, it points to m_inline if m_dim <= INLINE_DIMS
         lint *m_data;
+        lint m_inline[INLINE_DIMS];
 
     public:
         // A shape can be intialized by a list of dimension sizes
@@ -88,6 +93,17 @@ namespace neurons
 
         Shape sub_shape(lint dim_first, lint dim_last) const;
 
+    private:
+        // Point m_data to storage of dim dimensions, the old storage is released
+        void allocate(lint dim);
+
+        // Release storage of m_data if it is on the heap
+        void release();
+
+        // Take dimensions of other, which is left empty
+        void move_from(Shape & other);
+
+    public:
         friend bool operator == (const Shape &left, const Shape &right);
         friend bool operator != (const Shape &left, const Shape &right);
         friend Shape operator + (const Shape &left, const Shape &right);
@@ -3,11 +3,15 @@
 #include "Shape.h"
 #include "Coordinate.h"
 #include "Exceptions.h"
+#include "GEMM.h"
+#include "Transpose.h"
+#include "Allocator.h"
 
 #include "TMatrix_Iterator.h"
 #include <iostream>
 #include <random>
 #include <fstream>
+#include <vector>
 
 namespace neurons
 {
@@ -28,6 +32,9 @@ namespace neurons
     The bias of a neural network layer is a matrix.
     The labels/targets of a network are also saved in a matrix.
     */
+    template <typename dtype, typename Expr>
+    class TMatrix_Expression;
+
     template <typename dtype = double>
     class TMatrix
     {
@@ -37,6 +44,10 @@ namespace neurons
         // All the elements of this matrix
         dtype *m_data;
 
+    private:
+        // True if m_data is borrowed from memory this matrix does not own (see borrow)
+        bool m_borrowed = false;
+
     public:
         // The default constructor.
         // The matrix created by default constructor is not usable until
@@ -61,11 +72,34 @@ namespace neurons
         // Move constructor
         TMatrix(TMatrix && other);
 
+        // Copy a matrix of another element type, each element is converted to dtype
+        template <typename other_dtype>
+        explicit TMatrix(const TMatrix<other_dtype> & other);
+
         // Create a matrix from a vector
         TMatrix(const Vector & vec, bool transpose = false);
 
+        // Compute an expression of element by element arithmetic (see TMatrix_Expression.h)
+        template <typename Expr>
+        TMatrix(const TMatrix_Expression<dtype, Expr> & expr);
+
         ~TMatrix();
 
+        // A matrix whose elements are data, which is not copied and not freed by the matrix.
+        // data must outlive the matrix and is read-only: a borrowed matrix may be read, copied
+        // and moved, assigning to it gives it storage of its own, but its elements
+        // must not be updated in place (at, operator +=, etc).
+        static TMatrix borrow(const Shape & shape, const dtype *data);
+
+        // True if elements of this matrix are borrowed
+        bool borrowed() const;
+
+    private:
+        // Storage of size elements from the matrix allocator, nullptr if size < 1
+        static dtype * allocate(lint size);
+
+        static void deallocate(dtype *data, lint size);
+
     public:
         typedef TMatrix_Iterator<dtype> iterator;
 
@@ -82,6 +116,10 @@ namespace neurons
         // Assign a scalar value to all matrix elements
         TMatrix & operator = (dtype scalar);
 
+        // Compute an expression into this matrix, in place if the size does not change
+        template <typename Expr>
+        TMatrix & operator = (const TMatrix_Expression<dtype, Expr> & expr);
+
         // Get an element of a certain position
         dtype at(const Coordinate & pos) const;
 
@@ -101,6 +139,12 @@ namespace neurons
 
         TMatrix & operator -= (const TMatrix & other);
 
+        template <typename Expr>
+        TMatrix & operator += (const TMatrix_Expression<dtype, Expr> & expr);
+
+        template <typename Expr>
+        TMatrix & operator -= (const TMatrix_Expression<dtype, Expr> & expr);
+
         TMatrix & operator += (dtype scalar);
 
         TMatrix & operator -= (dtype scalar);
@@ -259,46 +303,6 @@ namespace neurons
         return !(left == right);
     }
 
-    // Overloading of a + b
-    template <typename dtype>
-    TMatrix<dtype> operator + (const TMatrix<dtype> &left, const TMatrix<dtype> &right)
-    {
-        if (left.m_shape.size() != right.m_shape.size())
-        {
-            throw std::invalid_argument(invalid_shape);
-        }
-
-        lint size = left.m_shape.size();
-
-        TMatrix<dtype> mat{ left.m_shape };
-        for (lint i = 0; i < size; ++i)
-        {
-            mat.m_data[i] = left.m_data[i] + right.m_data[i];
-        }
-
-        return mat;
-    }
-
-    // Overloading of a - b
-    template <typename dtype>
-    TMatrix<dtype> operator - (const TMatrix<dtype> &left, const TMatrix<dtype> &right)
-    {
-        if (left.m_shape.size() != right.m_shape.size())
-        {
-            throw std::invalid_argument(invalid_shape);
-        }
-
-        lint size = left.m_shape.size();
-
-        TMatrix<dtype> mat{ left.m_shape };
-        for (lint i = 0; i < size; ++i)
-        {
-            mat.m_data[i] = left.m_data[i] - right.m_data[i];
-        }
-
-        return mat;
-    }
-
     // TMatrix multiplication
     // Which dimensions should be merged together is manually defined here.
     // For example, two matrices: [7, 3, 2, 5, 6] and [6, 5, 6, 4], if l_dims_merge == 2 and r_dims_merge == 2,
@@ -338,32 +342,8 @@ namespace neurons
 
         // Calculation
         TMatrix<dtype> mat{ left_rows_sh + right_cols_sh };
-        dtype *left_start = left.m_data;
-        dtype *right_start = right.m_data;
-        dtype *mat_p = mat.m_data;
-
-        for (lint i = 0; i < left_rows; ++i)
-        {
-            for (lint j = 0; j < right_columns; ++j)
-            {
-                *mat_p = 0.0;
-                dtype * left_p = left_start;
-                dtype * right_p = right_start;
-
-                for (lint k = 0; k < left_columns; ++k)
-                {
-                    *mat_p += *left_p * *right_p;
-                    ++left_p;
-                    right_p += right_columns;
-                }
-
-                ++right_start;
-                ++mat_p;
-            }
-
-            left_start += left_columns;
-            right_start = right.m_data;
-        }
+        gemm<dtype>(false, false, left_rows, right_columns, left_columns,
+            1, left.m_data, left_columns, right.m_data, right_columns, 0, mat.m_data, right_columns);
 
         return mat;
     }
@@ -454,53 +434,8 @@ namespace neurons
         // Calculation
 
         TMatrix<dtype> mat{ left_rows_sh + right_cols_sh };
-        dtype *left_start = left.m_data;
-        dtype *right_start = right.m_data;
-        dtype *mat_p = mat.m_data;
-
-        for (lint i = 0; i < left_rows; ++i)
-        {
-            for (lint j = 0; j < right_columns; ++j)
-            {
-                *mat_p = 0;
-                dtype * left_p = left_start;
-                dtype * right_p = right_start;
-
-                for (lint k = 0; k < left_columns; ++k)
-                {
-                    *mat_p += *left_p * *right_p;
-                    ++left_p;
-                    right_p += right_columns;
-                }
-
-                ++right_start;
-                ++mat_p;
-            }
-
-            left_start += left_columns;
-            right_start = right.m_data;
-        }
-
-        return mat;
-    }
-
-    // Multiplication element by element.
-    // The two matrices should have the same shape.
-    template <typename dtype>
-    TMatrix<dtype> multiply(const TMatrix<dtype> & left, const TMatrix<dtype> & right)
-    {
-        if (left.m_shape != right.m_shape)
-        {
-            throw std::invalid_argument(invalid_shape);
-        }
-
-        lint size = left.m_shape.size();
-
-        TMatrix<dtype> mat{ left.m_shape };
-        for (lint i = 0; i < size; ++i)
-        {
-            mat.m_data[i] = left.m_data[i] * right.m_data[i];
-        }
+        gemm<dtype>(false, false, left_rows, right_columns, left_columns,
+            1, left.m_data, left_columns, right.m_data, right_columns, 0, mat.m_data, right_columns);
 
         return mat;
     }
@@ -538,51 +473,6 @@ namespace neurons
         return matrix_multiply(left, right);
     }
 
-    // Overloading of a * b, b is a scalar
-    template <typename dtype>
-    TMatrix<dtype> operator * (const TMatrix<dtype> &left, dtype scalar)
-    {
-        TMatrix<dtype> mat{ left.m_shape };
-
-        lint size = left.m_shape.size();
-        for (lint i = 0; i < size; ++i)
-        {
-            mat.m_data[i] = left.m_data[i] * scalar;
-        }
-
-        return mat;
-    }
-
-    // Overloading of a * b, a is a scalar
-    template <typename dtype>
-    TMatrix<dtype> operator * (dtype scalar, const TMatrix<dtype> &right)
-    {
-        TMatrix<dtype> mat{ right.m_shape };
-
-        lint size = right.m_shape.size();
-        for (lint i = 0; i < size; ++i)
-        {
-            mat.m_data[i] = right.m_data[i] * scalar;
-        }
-
-        return mat;
-    }
-
-    // Overloading of a / b, b is a scalar
-    template <typename dtype>
-    TMatrix<dtype> operator / (const TMatrix<dtype> &left, dtype scalar)
-    {
-        TMatrix<dtype> mat{ left.m_shape };
-
-        lint size = left.m_shape.size();
-        for (lint i = 0; i < size; ++i)
-        {
-            mat.m_data[i] = left.m_data[i] / scalar;
-        }
-
-        return mat;
-    }
-
     // Calculate power of a matrix
     template <typename dtype>
     TMatrix<dtype> matrix_pow(const TMatrix<dtype> & mat, int n)
@@ -610,64 +500,148 @@ namespace neurons
         }
     }
 
-    // Get a transposed matrix of a matrix
+    // Permute dimensions of a matrix: dimension i of the result is dimension axes[i] of in.
+    // For example, permute(in, { 0, 3, 1, 2 }) turns a batch of shape [N, H, W, C] into [N, C, H, W],
+    // and permute(in, { 0, 2, 3, 1 }) turns it back.
+    //
+    // Dimensions of size 1 are dropped, and neighbouring dimensions which stay neighbours are merged.
+    // If the last dimension stays the last one, rows are copied as they are. Otherwise the dimension
+    // with the contiguous elements of in and the last dimension of the result form planes, which are
+    // transposed by transpose_2d (blocked, with SIMD tiles for float and double).
     template <typename dtype>
-    TMatrix<dtype> transpose(const TMatrix<dtype> & in)
+    TMatrix<dtype> permute(const TMatrix<dtype> & in, const std::vector<lint> & axes)
     {
-        Shape reversed_shape{ reverse(in.m_shape) };
-        TMatrix<dtype> transposed{ reversed_shape };
+        lint dim = in.m_shape.dim();
+        if (static_cast<lint>(axes.size()) != dim)
+        {
+            throw std::invalid_argument(std::string("neurons::permute: one axis is needed for each dimension"));
+        }
+
+        std::vector<lint> in_strides(dim);
+        std::vector<bool> used(dim, false);
+        lint stride = 1;
+        for (lint i = dim - 1; i >= 0; --i)
+        {
+            in_strides[i] = stride;
+            stride *= in.m_shape[i];
+        }
 
-        lint size = in.m_shape.size();
+        std::vector<lint> out_dims;
+        for (lint axis : axes)
+        {
+            if (axis < 0 || axis >= dim || used[axis])
+            {
+                throw std::invalid_argument(std::string("neurons::permute: axes are not a permutation of the dimensions"));
+            }
+            used[axis] = true;
+            out_dims.push_back(in.m_shape[axis]);
+        }
 
-        lint plus_pos;
-        lint dim_size = reversed_shape.dim();
-        lint *coord_cache = new lint[dim_size];
-        lint *jump_forward_cache = new lint[dim_size];
+        TMatrix<dtype> permuted{ Shape{ out_dims } };
 
-        for (lint i = dim_size - 1; i >= 0; --i)
+        // Dimensions of the result as they are walked: sizes and strides of in
+        std::vector<lint> sizes;
+        std::vector<lint> src_strides;
+        for (lint i = 0; i < dim; ++i)
         {
-            coord_cache[i] = 0;
-            if (i < dim_size - 1)
+            lint size = in.m_shape[axes[i]];
+            lint src_stride = in_strides[axes[i]];
+            if (1 == size)
             {
-                jump_forward_cache[i] = jump_forward_cache[i + 1] * reversed_shape[i + 1];
+                continue;
+            }
+
+            if (!sizes.empty() && src_strides.back() == src_stride * size)
+            {
+                sizes.back() *= size;
+                src_strides.back() = src_stride;
             }
             else
             {
-                jump_forward_cache[i] = 1;
+                sizes.push_back(size);
+                src_strides.push_back(src_stride);
             }
         }
 
-        dtype *ele_pos = transposed.m_data;
+        lint n = sizes.size();
+        if (n < 2)
+        {
+            std::copy(in.m_data, in.m_data + in.m_shape.size(), permuted.m_data);
+            return permuted;
+        }
 
-        for (lint i = 0; i < size; ++i)
+        std::vector<lint> dst_strides(n);
+        stride = 1;
+        for (lint i = n - 1; i >= 0; --i)
         {
-            *ele_pos = in.m_data[i];
+            dst_strides[i] = stride;
+            stride *= sizes[i];
+        }
+
+        // Dimension of the contiguous elements of in, the inner dimension of a plane
+        lint inner = std::find(src_strides.begin(), src_strides.end(), 1) - src_strides.begin();
 
-            plus_pos = 0;
-            while (plus_pos < dim_size)
+        // The other dimensions are walked like an odometer
+        std::vector<lint> outer;
+        for (lint i = 0; i < n - 1; ++i)
+        {
+            if (i != inner)
+            {
+                outer.push_back(i);
+            }
+        }
+
+        std::vector<lint> coord(outer.size(), 0);
+        lint planes = permuted.m_shape.size() / (sizes[inner] * sizes[n - 1]);
+        if (inner == n - 1)
+        {
+            planes = permuted.m_shape.size() / sizes[n - 1];
+        }
+
+        const dtype *src = in.m_data;
+        dtype *dst = permuted.m_data;
+
+        for (lint p = 0; p < planes; ++p)
+        {
+            if (inner == n - 1)
+            {
+                std::copy(src, src + sizes[n - 1], dst);
+            }
+            else
             {
-                lint increased = coord_cache[plus_pos] + 1;
-                if (increased < reversed_shape[plus_pos])
+                // Rows of the plane in in are columns of it in the result
+                transpose_2d(sizes[n - 1], sizes[inner], src, src_strides[n - 1], dst, dst_strides[inner]);
+            }
+
+            for (lint d = static_cast<lint>(outer.size()) - 1; d >= 0; --d)
+            {
+                lint axis = outer[d];
+                if (++coord[d] < sizes[axis])
                 {
-                    coord_cache[plus_pos] = increased;
-                    ele_pos += jump_forward_cache[plus_pos];
-                    // std::cout << "forward: " << jump_forward_cache[plus_pos] << '\n';
+                    src += src_strides[axis];
+                    dst += dst_strides[axis];
                     break;
                 }
-                else
-                {
-                    coord_cache[plus_pos] = 0;
-                    ele_pos -= jump_forward_cache[plus_pos] * (reversed_shape[plus_pos] - 1);
-                    // std::cout << "backward: " << jump_forward_cache[plus_pos] * (reversed_shape[plus_pos] - 1) << '\n';
-                    ++plus_pos;
-                }
+                src -= (sizes[axis] - 1) * src_strides[axis];
+                dst -= (sizes[axis] - 1) * dst_strides[axis];
+                coord[d] = 0;
             }
         }
 
-        delete[]coord_cache;
-        delete[]jump_forward_cache;
+        return permuted;
+    }
+
+    // Get a transposed matrix of a matrix, all of its dimensions are reversed
+    template <typename dtype>
+    TMatrix<dtype> transpose(const TMatrix<dtype> & in)
+    {
+        std::vector<lint> axes;
+        for (lint i = in.m_shape.dim() - 1; i >= 0; --i)
+        {
+            axes.push_back(i);
+        }
 
-        return transposed;
+        return permute(in, axes);
     }
 
     /* Scale one dimension of the matrix with a vector of scales
@@ -802,7 +776,7 @@ neurons::TMatrix<dtype>::TMatrix(char * binary, lint & data_size)
     else
     {
         lint size = this->m_shape.m_size;
-        this->m_data = new dtype[size];
+        this->m_data = allocate(size);
 
         // Copy binary data of all elements into this matrix
         dtype * mat_data = reinterpret_cast<dtype *>(shape_data + n_dim + 1);
@@ -821,7 +795,7 @@ neurons::TMatrix<dtype>::TMatrix(const Shape & shape)
     }
     else
     {
-        m_data = new dtype[this->m_shape.m_size];
+        m_data = allocate(this->m_shape.m_size);
     }
 }
 
@@ -859,7 +833,7 @@ neurons::TMatrix<dtype>::TMatrix(const std::vector<TMatrix>& matrices)
             }
 
             this->m_shape = Shape{ array_size } +mat_sh;
-            this->m_data = new dtype[this->m_shape.m_size];
+            this->m_data = allocate(this->m_shape.m_size);
             dtype *this_pos = this->m_data;
             dtype *that_pos;
 
@@ -882,16 +856,29 @@ neurons::TMatrix<dtype>::TMatrix(const TMatrix & other)
     : m_shape{ other.m_shape }
 {
     lint size = m_shape.m_size;
-    m_data = new dtype[size];
+    m_data = allocate(size);
 
     std::memcpy(m_data, other.m_data, size * sizeof(dtype));
 }
 
 template <typename dtype>
 neurons::TMatrix<dtype>::TMatrix(TMatrix && other)
-    : m_shape{ std::move(other.m_shape) }, m_data{ other.m_data }
+    : m_shape{ std::move(other.m_shape) }, m_data{ other.m_data }, m_borrowed{ other.m_borrowed }
 {
     other.m_data = nullptr;
+    other.m_borrowed = false;
+}
+
+template <typename dtype>
+template <typename other_dtype>
+neurons::TMatrix<dtype>::TMatrix(const TMatrix<other_dtype> & other)
+    : TMatrix{ other.m_shape }
+{
+    lint size = this->m_shape.m_size;
+    for (lint i = 0; i < size; ++i)
+    {
+        this->m_data[i] = static_cast<dtype>(other.m_data[i]);
+    }
 }
 
 template <typename dtype>
@@ -905,7 +892,7 @@ neurons::TMatrix<dtype>::TMatrix(const Vector & vec, bool transpose)
     }
 
     lint size = m_shape.m_size;
-    m_data = new dtype[size];
+    m_data = allocate(size);
 
     std::memcpy(this->m_data, vec.m_data, size * sizeof(dtype));
 }
@@ -913,7 +900,44 @@ neurons::TMatrix<dtype>::TMatrix(const Vector & vec, bool transpose)
 template <typename dtype>
 neurons::TMatrix<dtype>::~TMatrix()
 {
-    delete[]this->m_data;
+    if (!this->m_borrowed)
+    {
+        deallocate(this->m_data, this->m_shape.m_size);
+    }
+}
+
+template <typename dtype>
+neurons::TMatrix<dtype> neurons::TMatrix<dtype>::borrow(const Shape & shape, const dtype *data)
+{
+    TMatrix<dtype> mat;
+    mat.m_shape = shape;
+    mat.m_data = shape.m_size < 1 ? nullptr : const_cast<dtype *>(data);
+    mat.m_borrowed = nullptr != mat.m_data;
+
+    return mat;
+}
+
+template <typename dtype>
+bool neurons::TMatrix<dtype>::borrowed() const
+{
+    return this->m_borrowed;
+}
+
+template <typename dtype>
+dtype * neurons::TMatrix<dtype>::allocate(lint size)
+{
+    if (size < 1)
+    {
+        return nullptr;
+    }
+
+    return static_cast<dtype *>(allocate_matrix_storage(size * sizeof(dtype)));
+}
+
+template <typename dtype>
+void neurons::TMatrix<dtype>::deallocate(dtype *data, lint size)
+{
+    deallocate_matrix_storage(data, std::max<lint>(size, 0) * sizeof(dtype));
 }
 
 template<typename dtype>
@@ -933,11 +957,25 @@ inline typename neurons::TMatrix<dtype>::iterator neurons::TMatrix<dtype>::end()
 template <typename dtype>
 neurons::TMatrix<dtype> & neurons::TMatrix<dtype>::operator = (const TMatrix & other)
 {
-    delete[]this->m_data;
-    this->m_shape = other.m_shape;
+    if (this == &other)
+    {
+        return *this;
+    }
+
+    // The buffer is reused if the size does not change, borrowed elements are never written
+    if (this->m_borrowed)
+    {
+        this->m_data = allocate(other.m_shape.m_size);
+        this->m_borrowed = false;
+    }
+    else if (this->m_shape.m_size != other.m_shape.m_size)
+    {
+        deallocate(this->m_data, this->m_shape.m_size);
+        this->m_data = allocate(other.m_shape.m_size);
+    }
 
+    this->m_shape = other.m_shape;
     lint size = this->m_shape.m_size;
-    this->m_data = new dtype[size];
 
     std::memcpy(this->m_data, other.m_data, size * sizeof(dtype));
 
@@ -947,11 +985,21 @@ neurons::TMatrix<dtype> & neurons::TMatrix<dtype>::operator = (const TMatrix & o
 template <typename dtype>
 neurons::TMatrix<dtype> & neurons::TMatrix<dtype>::operator = (TMatrix && other)
 {
-    delete[]m_data;
+    if (this == &other)
+    {
+        return *this;
+    }
+
+    if (!this->m_borrowed)
+    {
+        deallocate(this->m_data, this->m_shape.m_size);
+    }
     this->m_shape = std::move(other.m_shape);
 
     this->m_data = other.m_data;
+    this->m_borrowed = other.m_borrowed;
     other.m_data = nullptr;
+    other.m_borrowed = false;
 
     return *this;
 }
@@ -1788,9 +1836,4 @@ inline bool neurons::TMatrix<dtype>::save_matrix_as_image(const std::string & fi
     return true;
 }
 
-
-
-
-
-
-
+#include "TMatrix_Expression.h"
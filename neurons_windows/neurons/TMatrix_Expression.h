@@ -0,0 +1,377 @@
+#pragma once
+// This header is included at the end of TMatrix.h, it is not meant to be included alone.
+#include <type_traits>
+#include <utility>
+
+namespace neurons
+{
+    /*
+    Lazy element by element arithmetic of matrices.
+
+    a + b, a - b, a * scalar, scalar * a, a / scalar and multiply(a, b) do not compute anything,
+    they return expressions which remember their operands. A whole right-hand side such as
+
+        TMatrix<> y = rate * a + (1 - rate) * multiply(b, c) - d / 2;
+
+    is computed element by element in one loop when it is assigned to (or used to construct)
+    a matrix, without a temporary matrix for each operator. The loop is a plain loop over the
+    elements with every operator inlined, compilers vectorize it.
+
+    Matrices are operands by reference, temporary matrices (for example results of matrix
+    multiplication: a * b + c) are moved into the expression. Operands which are matrices
+    should not change before the expression is assigned.
+    An expression is converted to a matrix wherever a matrix is expected, functions which deduce
+    the element type from a matrix argument need eval().
+
+    Like the eager operators they replace, + and - need operands of the same size, and the result
+    has the shape of the left operand. multiply needs operands of the same shape.
+    Assigning an expression to one of its operands is safe: element i of the result only depends
+    on elements i of the operands.
+    */
+    template <typename dtype, typename Expr>
+    class TMatrix_Expression
+    {
+    public:
+        typedef dtype value_type;
+
+        const Expr & self() const
+        {
+            return static_cast<const Expr &>(*this);
+        }
+
+        // Shape of the result
+        const Shape & shape() const
+        {
+            return this->self().shape();
+        }
+
+        // Compute the expression into a new matrix
+        TMatrix<dtype> eval() const
+        {
+            return TMatrix<dtype>{ *this };
+        }
+    };
+
+    // Write the elements of an expression to data, in one loop
+    template <typename dtype, typename Expr>
+    void evaluate_expression(const TMatrix_Expression<dtype, Expr> & expression, dtype *data)
+    {
+        const Expr & expr = expression.self();
+        lint size = expr.shape().size();
+
+        for (lint i = 0; i < size; ++i)
+        {
+            data[i] = expr.element(i);
+        }
+    }
+
+    // A matrix as an operand of an expression
+    template <typename dtype>
+    class Matrix_reference : public TMatrix_Expression<dtype, Matrix_reference<dtype>>
+    {
+    private:
+        const TMatrix<dtype> & m_mat;
+
+    public:
+        explicit Matrix_reference(const TMatrix<dtype> & mat)
+            : m_mat(mat)
+        {}
+
+        const Shape & shape() const
+        {
+            return this->m_mat.m_shape;
+        }
+
+        dtype element(lint i) const
+        {
+            return this->m_mat.m_data[i];
+        }
+    };
+
+    // A temporary matrix as an operand of an expression, the expression owns it
+    template <typename dtype>
+    class Matrix_value : public TMatrix_Expression<dtype, Matrix_value<dtype>>
+    {
+    private:
+        TMatrix<dtype> m_mat;
+
+    public:
+        explicit Matrix_value(TMatrix<dtype> && mat)
+            : m_mat{ std::move(mat) }
+        {}
+
+        const Shape & shape() const
+        {
+            return this->m_mat.m_shape;
+        }
+
+        dtype element(lint i) const
+        {
+            return this->m_mat.m_data[i];
+        }
+    };
+
+    struct Add_op
+    {
+        template <typename dtype>
+        static dtype apply(dtype left, dtype right)
+        {
+            return left + right;
+        }
+
+        // Operands of + and - only need the same size
+        static bool compatible(const Shape & left, const Shape & right)
+        {
+            return left.size() == right.size();
+        }
+    };
+
+    struct Subtract_op
+    {
+        template <typename dtype>
+        static dtype apply(dtype left, dtype right)
+        {
+            return left - right;
+        }
+
+        static bool compatible(const Shape & left, const Shape & right)
+        {
+            return left.size() == right.size();
+        }
+    };
+
+    struct Multiply_op
+    {
+        template <typename dtype>
+        static dtype apply(dtype left, dtype right)
+        {
+            return left * right;
+        }
+
+        static bool compatible(const Shape & left, const Shape & right)
+        {
+            return left == right;
+        }
+    };
+
+    struct Divide_op
+    {
+        template <typename dtype>
+        static dtype apply(dtype left, dtype right)
+        {
+            return left / right;
+        }
+    };
+
+    // Op of elements of two expressions
+    template <typename dtype, typename Left, typename Right, typename Op>
+    class Binary_expression : public TMatrix_Expression<dtype, Binary_expression<dtype, Left, Right, Op>>
+    {
+    private:
+        Left m_left;
+        Right m_right;
+
+    public:
+        Binary_expression(Left && left, Right && right)
+            : m_left{ std::move(left) }, m_right{ std::move(right) }
+        {
+            if (!Op::compatible(this->m_left.shape(), this->m_right.shape()))
+            {
+                throw std::invalid_argument(invalid_shape);
+            }
+        }
+
+        const Shape & shape() const
+        {
+            return this->m_left.shape();
+        }
+
+        dtype element(lint i) const
+        {
+            return Op::apply(this->m_left.element(i), this->m_right.element(i));
+        }
+    };
+
+    // Op of elements of an expression and a scalar
+    template <typename dtype, typename Operand, typename Op>
+    class Scalar_expression : public TMatrix_Expression<dtype, Scalar_expression<dtype, Operand, Op>>
+    {
+    private:
+        Operand m_operand;
+        dtype m_scalar;
+
+    public:
+        Scalar_expression(Operand && operand, dtype scalar)
+            : m_operand{ std::move(operand) }, m_scalar{ scalar }
+        {}
+
+        const Shape & shape() const
+        {
+            return this->m_operand.shape();
+        }
+
+        dtype element(lint i) const
+        {
+            return Op::apply(this->m_operand.element(i), this->m_scalar);
+        }
+    };
+
+    // Operands of expressions: matrices are referred to, temporary matrices are moved,
+    // expressions are copied or moved.
+    template <typename dtype>
+    Matrix_reference<dtype> as_operand(const TMatrix<dtype> & mat)
+    {
+        return Matrix_reference<dtype>{ mat };
+    }
+
+    template <typename dtype>
+    Matrix_value<dtype> as_operand(TMatrix<dtype> && mat)
+    {
+        return Matrix_value<dtype>{ std::move(mat) };
+    }
+
+    template <typename dtype, typename Expr>
+    Expr as_operand(const TMatrix_Expression<dtype, Expr> & expr)
+    {
+        return expr.self();
+    }
+
+    template <typename dtype, typename Expr>
+    Expr as_operand(TMatrix_Expression<dtype, Expr> && expr)
+    {
+        return std::move(static_cast<Expr &>(expr));
+    }
+
+    // Operand type of T, only defined if T is a matrix or an expression
+    template <typename T>
+    using operand_t = decltype(as_operand(std::declval<T>()));
+
+    template <typename Left, typename Right, typename Op>
+    using binary_t = typename std::enable_if<
+        std::is_same<typename operand_t<Left>::value_type, typename operand_t<Right>::value_type>::value,
+        Binary_expression<typename operand_t<Left>::value_type, operand_t<Left>, operand_t<Right>, Op>>::type;
+
+    template <typename T, typename Op>
+    using scalar_t = Scalar_expression<typename operand_t<T>::value_type, operand_t<T>, Op>;
+
+    // True if T is an expression, not a matrix
+    template <typename T>
+    using is_expression = std::integral_constant<bool, !std::is_same<typename std::decay<T>::type,
+        TMatrix<typename operand_t<T>::value_type>>::value>;
+
+    // Overloading of a + b
+    template <typename Left, typename Right>
+    binary_t<Left, Right, Add_op> operator + (Left && left, Right && right)
+    {
+        return binary_t<Left, Right, Add_op>{
+            as_operand(std::forward<Left>(left)), as_operand(std::forward<Right>(right)) };
+    }
+
+    // Overloading of a - b
+    template <typename Left, typename Right>
+    binary_t<Left, Right, Subtract_op> operator - (Left && left, Right && right)
+    {
+        return binary_t<Left, Right, Subtract_op>{
+            as_operand(std::forward<Left>(left)), as_operand(std::forward<Right>(right)) };
+    }
+
+    // Multiplication element by element.
+    // The two matrices should have the same shape.
+    template <typename Left, typename Right>
+    binary_t<Left, Right, Multiply_op> multiply(Left && left, Right && right)
+    {
+        return binary_t<Left, Right, Multiply_op>{
+            as_operand(std::forward<Left>(left)), as_operand(std::forward<Right>(right)) };
+    }
+
+    // Overloading of a * b, b is a scalar
+    template <typename Mat>
+    scalar_t<Mat, Multiply_op> operator * (Mat && left, typename operand_t<Mat>::value_type scalar)
+    {
+        return scalar_t<Mat, Multiply_op>{ as_operand(std::forward<Mat>(left)), scalar };
+    }
+
+    // Overloading of a * b, a is a scalar
+    template <typename Mat>
+    scalar_t<Mat, Multiply_op> operator * (typename operand_t<Mat>::value_type scalar, Mat && right)
+    {
+        return scalar_t<Mat, Multiply_op>{ as_operand(std::forward<Mat>(right)), scalar };
+    }
+
+    // Overloading of a / b, b is a scalar
+    template <typename Mat>
+    scalar_t<Mat, Divide_op> operator / (Mat && left, typename operand_t<Mat>::value_type scalar)
+    {
+        return scalar_t<Mat, Divide_op>{ as_operand(std::forward<Mat>(left)), scalar };
+    }
+
+    // A matrix as it is, or an expression computed into a matrix
+    template <typename dtype>
+    const TMatrix<dtype> & evaluated(const TMatrix<dtype> & mat)
+    {
+        return mat;
+    }
+
+    template <typename dtype, typename Expr>
+    TMatrix<dtype> evaluated(const TMatrix_Expression<dtype, Expr> & expr)
+    {
+        return expr.eval();
+    }
+
+    // TMatrix multiplication of expressions, they are computed first
+    template <typename Left, typename Right>
+    typename std::enable_if<is_expression<Left>::value || is_expression<Right>::value,
+        TMatrix<typename operand_t<Left>::value_type>>::type operator * (const Left & left, const Right & right)
+    {
+        return matrix_multiply(evaluated(left), evaluated(right));
+    }
+
+    template <typename dtype, typename Expr>
+    std::ostream & operator << (std::ostream & os, const TMatrix_Expression<dtype, Expr> & expr)
+    {
+        return os << expr.eval();
+    }
+}
+
+
+template <typename dtype>
+template <typename Expr>
+neurons::TMatrix<dtype>::TMatrix(const TMatrix_Expression<dtype, Expr> & expr)
+    : m_shape{ expr.shape() }
+{
+    this->m_data = allocate(this->m_shape.size());
+    evaluate_expression(expr, this->m_data);
+}
+
+template <typename dtype>
+template <typename Expr>
+neurons::TMatrix<dtype> & neurons::TMatrix<dtype>::operator = (const TMatrix_Expression<dtype, Expr> & expr)
+{
+    if (this->m_shape.size() == expr.shape().size() && !this->m_borrowed)
+    {
+        // Element i of the result only depends on elements i of the operands, even if this is one of them
+        evaluate_expression(expr, this->m_data);
+        this->m_shape = expr.shape();
+    }
+    else
+    {
+        TMatrix<dtype> result{ expr };
+        *this = std::move(result);
+    }
+
+    return *this;
+}
+
+template <typename dtype>
+template <typename Expr>
+neurons::TMatrix<dtype> & neurons::TMatrix<dtype>::operator += (const TMatrix_Expression<dtype, Expr> & expr)
+{
+    return *this = *this + expr.self();
+}
+
+template <typename dtype>
+template <typename Expr>
+neurons::TMatrix<dtype> & neurons::TMatrix<dtype>::operator -= (const TMatrix_Expression<dtype, Expr> & expr)
+{
+    return *this = *this - expr.self();
+}
@@ -0,0 +1,544 @@
+#pragma once
+#include "TMatrix.h"
+#include <algorithm>
+#include <initializer_list>
+#include <vector>
+
+namespace neurons
+{
+    /*
+    A view of elements of a matrix, it does not own them.
+    A view has a shape and a stride for each dimension: element [i0, i1, ...] of the view is
+    m_data[i0 * stride(0) + i1 * stride(1) + ...]. A view of a whole matrix has the strides
+    of its row-major storage.
+
+    Transposes, slices, selections and reshapes only change the shape and the strides, they
+    never copy elements. Matrix multiplication (operator *), element by element operations
+    (multiply, +, -) and reductions (sum, reduce_sum, reduce_mean) read views directly.
+    Two dimensional views with a unit stride in either dimension are handed to gemm as they
+    are, as transposed or not transposed operands.
+
+    The viewed matrix has to outlive the view, and it should not be reshaped or reassigned
+    while it is viewed. Views have at most Shape::INLINE_DIMS dimensions.
+    */
+    template <typename dtype = double>
+    class TMatrix_View
+    {
+    private:
+        const dtype *m_data;
+        Shape m_shape;
+        lint m_strides[Shape::INLINE_DIMS];
+
+    public:
+        // View a whole matrix
+        TMatrix_View(const TMatrix<dtype> & mat)
+            : m_data{ mat.m_data }, m_shape{ mat.m_shape }
+        {
+            this->check_dims(this->m_shape.dim());
+
+            lint stride = 1;
+            for (lint i = this->m_shape.dim() - 1; i >= 0; --i)
+            {
+                this->m_strides[i] = stride;
+                stride *= this->m_shape[i];
+            }
+        }
+
+        // View elements of data with a shape and strides of each dimension
+        TMatrix_View(const dtype *data, const Shape & shape, std::initializer_list<lint> strides)
+            : m_data{ data }, m_shape{ shape }
+        {
+            this->check_dims(this->m_shape.dim());
+            if (static_cast<lint>(strides.size()) != this->m_shape.dim())
+            {
+                throw std::invalid_argument(std::string("neurons::TMatrix_View: one stride is needed for each dimension"));
+            }
+
+            lint *stride = this->m_strides;
+            for (lint s : strides)
+            {
+                *stride++ = s;
+            }
+        }
+
+    public:
+        const Shape & shape() const
+        {
+            return this->m_shape;
+        }
+
+        lint dim() const
+        {
+            return this->m_shape.dim();
+        }
+
+        lint size() const
+        {
+            return this->m_shape.size();
+        }
+
+        // Number of elements between two adjacent indexes of a dimension
+        lint stride(lint dim) const
+        {
+            return this->m_strides[dim];
+        }
+
+        // The first element of the view
+        const dtype * data() const
+        {
+            return this->m_data;
+        }
+
+        // True if elements of the view are stored one after another in row-major order
+        bool is_contiguous() const
+        {
+            lint stride = 1;
+            for (lint i = this->m_shape.dim() - 1; i >= 0; --i)
+            {
+                if (this->m_shape[i] > 1 && this->m_strides[i] != stride)
+                {
+                    return false;
+                }
+                stride *= this->m_shape[i];
+            }
+
+            return true;
+        }
+
+        // Get an element of a certain position
+        dtype at(const Coordinate & pos) const
+        {
+            if (pos.dim() != this->m_shape.dim())
+            {
+                throw std::invalid_argument(std::string("neurons::TMatrix_View::at: Shape and coordinate incompatible"));
+            }
+
+            lint offset = 0;
+            for (lint i = 0; i < this->m_shape.dim(); ++i)
+            {
+                if (pos[i] >= this->m_shape[i])
+                {
+                    throw std::invalid_argument(std::string("neurons::TMatrix_View::at: Shape and coordinate incompatible"));
+                }
+                offset += pos[i] * this->m_strides[i];
+            }
+
+            return this->m_data[offset];
+        }
+
+        // Reverse all the dimensions, like neurons::transpose does
+        TMatrix_View transpose() const
+        {
+            TMatrix_View transposed{ *this };
+            transposed.m_shape.reverse();
+
+            lint dim = this->m_shape.dim();
+            for (lint i = 0; i < dim; ++i)
+            {
+                transposed.m_strides[i] = this->m_strides[dim - 1 - i];
+            }
+
+            return transposed;
+        }
+
+        // Indexes [begin, end) of a dimension
+        TMatrix_View slice(lint dim, lint begin, lint end) const
+        {
+            if (dim < 0 || dim >= this->m_shape.dim() || begin < 0 || end > this->m_shape[dim] || begin >= end)
+            {
+                throw std::invalid_argument(std::string("neurons::TMatrix_View::slice: index out of range"));
+            }
+
+            std::vector<lint> dims = this->dims();
+            dims[dim] = end - begin;
+
+            TMatrix_View sliced{ *this };
+            sliced.m_data += begin * this->m_strides[dim];
+            sliced.m_shape = Shape{ dims };
+
+            return sliced;
+        }
+
+        // Index index of a dimension, the dimension is removed
+        TMatrix_View select(lint dim, lint index) const
+        {
+            if (this->m_shape.dim() < 2)
+            {
+                throw std::invalid_argument(std::string("neurons::TMatrix_View::select: a view of one dimension cannot lose it"));
+            }
+
+            if (dim < 0 || dim >= this->m_shape.dim() || index < 0 || index >= this->m_shape[dim])
+            {
+                throw std::invalid_argument(std::string("neurons::TMatrix_View::select: index out of range"));
+            }
+
+            std::vector<lint> dims = this->dims();
+            dims.erase(dims.begin() + dim);
+
+            TMatrix_View selected{ *this };
+            selected.m_data += index * this->m_strides[dim];
+            selected.m_shape = Shape{ dims };
+            for (lint i = dim; i < selected.m_shape.dim(); ++i)
+            {
+                selected.m_strides[i] = this->m_strides[i + 1];
+            }
+
+            return selected;
+        }
+
+        // The same elements in another shape of the same size, only contiguous views can be reshaped
+        TMatrix_View reshape(const Shape & shape) const
+        {
+            if (shape.size() != this->m_shape.size())
+            {
+                throw std::invalid_argument(std::string("neurons::TMatrix_View::reshape: size of the shape changes"));
+            }
+
+            if (!this->is_contiguous())
+            {
+                throw std::invalid_argument(std::string("neurons::TMatrix_View::reshape: the view is not contiguous"));
+            }
+
+            TMatrix_View<dtype> reshaped{ *this };
+            reshaped.check_dims(shape.dim());
+            reshaped.m_shape = shape;
+
+            lint stride = 1;
+            for (lint i = shape.dim() - 1; i >= 0; --i)
+            {
+                reshaped.m_strides[i] = stride;
+                stride *= shape[i];
+            }
+
+            return reshaped;
+        }
+
+        // Copy elements of the view into a matrix
+        TMatrix<dtype> materialize() const
+        {
+            TMatrix<dtype> mat{ this->m_shape };
+            dtype *ele = mat.m_data;
+            this->for_each([&ele](const dtype *e) { *ele++ = *e; });
+
+            return mat;
+        }
+
+        // Call func with a pointer to each element in row-major order
+        template <typename Func>
+        void for_each(Func func) const
+        {
+            lint dim = this->m_shape.dim();
+            lint size = this->m_shape.size();
+            if (size < 1)
+            {
+                return;
+            }
+
+            lint inner_size = this->m_shape[dim - 1];
+            lint inner_stride = this->m_strides[dim - 1];
+            lint coord[Shape::INLINE_DIMS] = { 0 };
+            const dtype *row = this->m_data;
+
+            for (lint done = 0; done < size; done += inner_size)
+            {
+                const dtype *ele = row;
+                for (lint i = 0; i < inner_size; ++i, ele += inner_stride)
+                {
+                    func(ele);
+                }
+
+                // Move to the next row like an odometer
+                for (lint d = dim - 2; d >= 0; --d)
+                {
+                    if (++coord[d] < this->m_shape[d])
+                    {
+                        row += this->m_strides[d];
+                        break;
+                    }
+                    row -= (this->m_shape[d] - 1) * this->m_strides[d];
+                    coord[d] = 0;
+                }
+            }
+        }
+
+    private:
+        void check_dims(lint dim) const
+        {
+            if (dim < 1 || dim > Shape::INLINE_DIMS)
+            {
+                throw std::invalid_argument(std::string("neurons::TMatrix_View: views have 1 to ")
+                    + std::to_string(Shape::INLINE_DIMS) + " dimensions");
+            }
+        }
+
+        std::vector<lint> dims() const
+        {
+            std::vector<lint> dims;
+            for (lint i = 0; i < this->m_shape.dim(); ++i)
+            {
+                dims.push_back(this->m_shape[i]);
+            }
+
+            return dims;
+        }
+    };
+
+    // A view of a whole matrix
+    template <typename dtype>
+    TMatrix_View<dtype> view(const TMatrix<dtype> & mat)
+    {
+        return TMatrix_View<dtype>{ mat };
+    }
+
+    // Transpose of a matrix without copying it
+    template <typename dtype>
+    TMatrix_View<dtype> transposed(const TMatrix<dtype> & mat)
+    {
+        return TMatrix_View<dtype>{ mat }.transpose();
+    }
+
+    // A two dimensional view as a gemm operand: whether it is transposed and its row stride.
+    // False if neither dimension has a unit stride.
+    template <typename dtype>
+    bool gemm_operand(const TMatrix_View<dtype> & v, bool & trans, lint & ld)
+    {
+        if (1 == v.stride(1) || 1 == v.shape()[1])
+        {
+            trans = false;
+            ld = std::max<lint>(v.stride(0), v.shape()[1]);
+            return true;
+        }
+
+        if (1 == v.stride(0) || 1 == v.shape()[0])
+        {
+            trans = true;
+            ld = std::max<lint>(v.stride(1), v.shape()[0]);
+            return true;
+        }
+
+        return false;
+    }
+
+    // Matrix multiplication of two dimensional views: [m, k] x [k, n] = [m, n]
+    // Views with a unit stride are multiplied in place, other views are copied first.
+    template <typename dtype>
+    TMatrix<dtype> matrix_multiply(const TMatrix_View<dtype> & left, const TMatrix_View<dtype> & right)
+    {
+        if (2 != left.dim() || 2 != right.dim())
+        {
+            throw std::invalid_argument(std::string(
+                "neurons::matrix_multiply: multiplication of views needs views of 2 dimensions"));
+        }
+
+        if (left.shape()[1] != right.shape()[0])
+        {
+            throw std::invalid_argument(incompatible_shape);
+        }
+
+        bool trans_a, trans_b;
+        lint lda, ldb;
+        if (!gemm_operand(left, trans_a, lda))
+        {
+            return matrix_multiply(TMatrix_View<dtype>{ left.materialize() }, right);
+        }
+
+        if (!gemm_operand(right, trans_b, ldb))
+        {
+            return matrix_multiply(left, TMatrix_View<dtype>{ right.materialize() });
+        }
+
+        lint m = left.shape()[0];
+        lint k = left.shape()[1];
+        lint n = right.shape()[1];
+
+        TMatrix<dtype> mat{ Shape{ m, n } };
+        gemm<dtype>(trans_a, trans_b, m, n, k, 1, left.data(), lda, right.data(), ldb, 0, mat.m_data, n);
+
+        return mat;
+    }
+
+    template <typename dtype>
+    TMatrix<dtype> operator * (const TMatrix_View<dtype> & left, const TMatrix_View<dtype> & right)
+    {
+        return matrix_multiply(left, right);
+    }
+
+    template <typename dtype>
+    TMatrix<dtype> operator * (const TMatrix_View<dtype> & left, const TMatrix<dtype> & right)
+    {
+        return matrix_multiply(left, TMatrix_View<dtype>{ right });
+    }
+
+    template <typename dtype>
+    TMatrix<dtype> operator * (const TMatrix<dtype> & left, const TMatrix_View<dtype> & right)
+    {
+        return matrix_multiply(TMatrix_View<dtype>{ left }, right);
+    }
+
+    // Apply op to elements of two views of the same shape, the result is a new matrix
+    template <typename dtype, typename Op>
+    TMatrix<dtype> elementwise(const TMatrix_View<dtype> & left, const TMatrix_View<dtype> & right, Op op)
+    {
+        if (left.shape() != right.shape())
+        {
+            throw std::invalid_argument(invalid_shape);
+        }
+
+        TMatrix<dtype> mat{ left.shape() };
+        if (left.is_contiguous() && right.is_contiguous())
+        {
+            lint size = left.size();
+            for (lint i = 0; i < size; ++i)
+            {
+                mat.m_data[i] = op(left.data()[i], right.data()[i]);
+            }
+
+            return mat;
+        }
+
+        // Right elements are read in the order of the left ones
+        TMatrix<dtype> right_copy = right.materialize();
+        dtype *ele = mat.m_data;
+        const dtype *r_ele = right_copy.m_data;
+        left.for_each([&](const dtype *l_ele) { *ele++ = op(*l_ele, *r_ele++); });
+
+        return mat;
+    }
+
+    // Multiplication element by element
+    template <typename dtype>
+    TMatrix<dtype> multiply(const TMatrix_View<dtype> & left, const TMatrix_View<dtype> & right)
+    {
+        return elementwise(left, right, [](dtype l, dtype r) { return l * r; });
+    }
+
+    template <typename dtype>
+    TMatrix<dtype> multiply(const TMatrix_View<dtype> & left, const TMatrix<dtype> & right)
+    {
+        return multiply(left, TMatrix_View<dtype>{ right });
+    }
+
+    template <typename dtype>
+    TMatrix<dtype> multiply(const TMatrix<dtype> & left, const TMatrix_View<dtype> & right)
+    {
+        return multiply(TMatrix_View<dtype>{ left }, right);
+    }
+
+    template <typename dtype>
+    TMatrix<dtype> operator + (const TMatrix_View<dtype> & left, const TMatrix_View<dtype> & right)
+    {
+        return elementwise(left, right, [](dtype l, dtype r) { return l + r; });
+    }
+
+    template <typename dtype>
+    TMatrix<dtype> operator + (const TMatrix_View<dtype> & left, const TMatrix<dtype> & right)
+    {
+        return left + TMatrix_View<dtype>{ right };
+    }
+
+    template <typename dtype>
+    TMatrix<dtype> operator + (const TMatrix<dtype> & left, const TMatrix_View<dtype> & right)
+    {
+        return TMatrix_View<dtype>{ left } + right;
+    }
+
+    template <typename dtype>
+    TMatrix<dtype> operator - (const TMatrix_View<dtype> & left, const TMatrix_View<dtype> & right)
+    {
+        return elementwise(left, right, [](dtype l, dtype r) { return l - r; });
+    }
+
+    template <typename dtype>
+    TMatrix<dtype> operator - (const TMatrix_View<dtype> & left, const TMatrix<dtype> & right)
+    {
+        return left - TMatrix_View<dtype>{ right };
+    }
+
+    template <typename dtype>
+    TMatrix<dtype> operator - (const TMatrix<dtype> & left, const TMatrix_View<dtype> & right)
+    {
+        return TMatrix_View<dtype>{ left } - right;
+    }
+
+    // Sum of all elements of a view
+    template <typename dtype>
+    dtype sum(const TMatrix_View<dtype> & v)
+    {
+        dtype total = 0;
+        v.for_each([&total](const dtype *e) { total += *e; });
+
+        return total;
+    }
+
+    // Sum over some dimensions of a view in one pass, the dimensions are removed.
+    // For example, reducing dimensions { 1, 2 } of a view of shape [1, 24, 24, 8] gives a matrix of shape [1, 8].
+    // If all the dimensions are reduced, the result is of shape [1].
+    template <typename dtype>
+    TMatrix<dtype> reduce_sum(const TMatrix_View<dtype> & v, std::initializer_list<lint> dims)
+    {
+        lint dim = v.dim();
+        bool reduced[Shape::INLINE_DIMS] = { false };
+        for (lint d : dims)
+        {
+            if (d < 0 || d >= dim)
+            {
+                throw std::invalid_argument(std::string("neurons::reduce_sum: dimension index out of range."));
+            }
+            reduced[d] = true;
+        }
+
+        std::vector<lint> kept;
+        for (lint i = 0; i < dim; ++i)
+        {
+            if (!reduced[i])
+            {
+                kept.push_back(v.shape()[i]);
+            }
+        }
+        if (kept.empty())
+        {
+            kept.push_back(1);
+        }
+
+        // Strides of the result for each dimension of the view, 0 for reduced dimensions
+        lint out_strides[Shape::INLINE_DIMS];
+        lint stride = 1;
+        for (lint i = dim - 1; i >= 0; --i)
+        {
+            out_strides[i] = reduced[i] ? 0 : stride;
+            stride *= reduced[i] ? 1 : v.shape()[i];
+        }
+
+        TMatrix<dtype> mat{ Shape{ kept }, 0 };
+        lint coord[Shape::INLINE_DIMS] = { 0 };
+        dtype *out = mat.m_data;
+
+        v.for_each([&](const dtype *e)
+        {
+            *out += *e;
+
+            for (lint d = dim - 1; d >= 0; --d)
+            {
+                if (++coord[d] < v.shape()[d])
+                {
+                    out += out_strides[d];
+                    break;
+                }
+                out -= (v.shape()[d] - 1) * out_strides[d];
+                coord[d] = 0;
+            }
+        });
+
+        return mat;
+    }
+
+    // Mean over some dimensions of a view in one pass, see reduce_sum
+    template <typename dtype>
+    TMatrix<dtype> reduce_mean(const TMatrix_View<dtype> & v, std::initializer_list<lint> dims)
+    {
+        TMatrix<dtype> mat = reduce_sum(v, dims);
+        mat /= static_cast<dtype>(v.size() / mat.shape().size());
+
+        return mat;
+    }
+}
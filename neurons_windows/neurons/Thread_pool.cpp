@@ -0,0 +1,294 @@
+#include "Thread_pool.h"
+#include <algorithm>
+
+namespace
+{
+    // The pool and the queue index of the current thread if it is a worker
+    thread_local neurons::Thread_pool *t_pool = nullptr;
+    thread_local lint t_index = -1;
+
+    // Limit of the innermost Intra_op_scope of the current thread, 0 if there is no scope
+    thread_local lint t_intra_op_threads = 0;
+
+    std::mutex & process_pool_mutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    std::weak_ptr<neurons::Thread_pool> & process_pool_ref()
+    {
+        static std::weak_ptr<neurons::Thread_pool> pool;
+        return pool;
+    }
+}
+
+neurons::Task_group::Task_group()
+    : m_pending{ 0 }
+{}
+
+neurons::Thread_pool::Thread_pool(lint threads)
+    : m_queued{ 0 }, m_stop{ false }
+{
+    lint workers = std::max<lint>(threads, 1) - 1;
+
+    for (lint i = 0; i <= workers; ++i)
+    {
+        this->m_queues.push_back(std::make_unique<Task_queue>());
+    }
+
+    for (lint i = 0; i < workers; ++i)
+    {
+        this->m_workers.push_back(std::thread(&Thread_pool::worker_loop, this, i));
+    }
+}
+
+neurons::Thread_pool::~Thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+        this->m_stop = true;
+    }
+    this->m_cv.notify_all();
+
+    for (std::thread & worker : this->m_workers)
+    {
+        worker.join();
+    }
+}
+
+lint neurons::Thread_pool::concurrency() const
+{
+    return this->m_workers.size() + 1;
+}
+
+lint neurons::Thread_pool::intra_op_threads() const
+{
+    lint threads = this->concurrency();
+    return t_intra_op_threads > 0 ? std::min(t_intra_op_threads, threads) : threads;
+}
+
+void neurons::Thread_pool::run(Task_group & group, std::function<void()> func)
+{
+    ++group.m_pending;
+
+    // Workers push to their own queues, other threads push to the last queue
+    lint index = this == t_pool ? t_index : this->m_queues.size() - 1;
+    {
+        std::lock_guard<std::mutex> lock(this->m_queues[index]->m_mutex);
+        this->m_queues[index]->m_tasks.push_back(Task{ std::move(func), &group });
+        ++this->m_queued;
+    }
+
+    // Lock and unlock so that a thread checking m_queued right now cannot miss the notification
+    {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+    }
+    this->m_cv.notify_all();
+}
+
+void neurons::Thread_pool::wait(Task_group & group)
+{
+    while (group.m_pending.load() > 0)
+    {
+        Task task;
+        if (this->try_pop(task))
+        {
+            this->execute(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(this->m_mutex);
+        this->m_cv.wait(lock, [this, &group]
+        {
+            return 0 == group.m_pending.load() || this->m_queued.load() > 0;
+        });
+    }
+
+    if (group.m_error)
+    {
+        std::exception_ptr error = group.m_error;
+        group.m_error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+void neurons::Thread_pool::parallel_for(lint begin, lint end, const std::function<void(lint, lint)> & body, lint grain)
+{
+    lint size = end - begin;
+    if (size <= 0)
+    {
+        return;
+    }
+
+    grain = std::max<lint>(grain, 1);
+    lint threads = this->intra_op_threads();
+    lint chunks = std::min(threads, (size + grain - 1) / grain);
+
+    if (chunks <= 1)
+    {
+        body(begin, end);
+        return;
+    }
+
+    lint chunk_size = (size + chunks - 1) / chunks;
+    // Threads left to operations inside each chunk
+    lint chunk_threads = std::max<lint>(threads / chunks, 1);
+    Task_group group;
+
+    for (lint chunk_begin = begin + chunk_size; chunk_begin < end; chunk_begin += chunk_size)
+    {
+        lint chunk_end = std::min(end, chunk_begin + chunk_size);
+        this->run(group, [&body, chunk_begin, chunk_end, chunk_threads]
+        {
+            Intra_op_scope scope{ chunk_threads };
+            body(chunk_begin, chunk_end);
+        });
+    }
+
+    // The first chunk is done by the calling thread
+    try
+    {
+        Intra_op_scope scope{ chunk_threads };
+        body(begin, std::min(end, begin + chunk_size));
+    }
+    catch (...)
+    {
+        // Other chunks still refer to body
+        try
+        {
+            this->wait(group);
+        }
+        catch (...)
+        {}
+
+        throw;
+    }
+
+    this->wait(group);
+}
+
+std::shared_ptr<neurons::Thread_pool> neurons::Thread_pool::process_pool(lint threads)
+{
+    std::lock_guard<std::mutex> lock(process_pool_mutex());
+
+    std::shared_ptr<Thread_pool> pool = process_pool_ref().lock();
+    if (!pool || pool->concurrency() < threads)
+    {
+        pool = std::make_shared<Thread_pool>(threads);
+        process_pool_ref() = pool;
+    }
+
+    return pool;
+}
+
+std::shared_ptr<neurons::Thread_pool> neurons::Thread_pool::current()
+{
+    std::lock_guard<std::mutex> lock(process_pool_mutex());
+
+    return process_pool_ref().lock();
+}
+
+neurons::Intra_op_scope::Intra_op_scope(lint threads)
+    : m_previous{ t_intra_op_threads }
+{
+    // Not limited by the scope around it: a waiting thread may run tasks of other operations
+    t_intra_op_threads = std::max<lint>(threads, 1);
+}
+
+neurons::Intra_op_scope::~Intra_op_scope()
+{
+    t_intra_op_threads = this->m_previous;
+}
+
+void neurons::Thread_pool::worker_loop(lint index)
+{
+    t_pool = this;
+    t_index = index;
+
+    while (true)
+    {
+        Task task;
+        if (this->try_pop(task))
+        {
+            this->execute(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(this->m_mutex);
+        this->m_cv.wait(lock, [this]
+        {
+            return this->m_stop || this->m_queued.load() > 0;
+        });
+
+        if (this->m_stop && 0 == this->m_queued.load())
+        {
+            return;
+        }
+    }
+}
+
+bool neurons::Thread_pool::try_pop(Task & task)
+{
+    lint queues = this->m_queues.size();
+    lint own = this == t_pool ? t_index : queues - 1;
+
+    // Latest task of the own queue first
+    {
+        Task_queue & queue = *this->m_queues[own];
+        std::lock_guard<std::mutex> lock(queue.m_mutex);
+        if (!queue.m_tasks.empty())
+        {
+            task = std::move(queue.m_tasks.back());
+            queue.m_tasks.pop_back();
+            --this->m_queued;
+            return true;
+        }
+    }
+
+    // Then steal the oldest task of another queue
+    for (lint i = 1; i < queues; ++i)
+    {
+        Task_queue & queue = *this->m_queues[(own + i) % queues];
+        std::lock_guard<std::mutex> lock(queue.m_mutex);
+        if (!queue.m_tasks.empty())
+        {
+            task = std::move(queue.m_tasks.front());
+            queue.m_tasks.pop_front();
+            --this->m_queued;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void neurons::Thread_pool::execute(Task & task)
+{
+    Task_group *group = task.m_group;
+
+    try
+    {
+        task.m_func();
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(group->m_error_mutex);
+        if (!group->m_error)
+        {
+            group->m_error = std::current_exception();
+        }
+    }
+
+    // Release resources captured by the task before the group is reported finished
+    task.m_func = nullptr;
+
+    if (1 == group->m_pending.fetch_sub(1))
+    {
+        // The group may be destroyed by its waiting thread from now on
+        {
+            std::lock_guard<std::mutex> lock(this->m_mutex);
+        }
+        this->m_cv.notify_all();
+    }
+}
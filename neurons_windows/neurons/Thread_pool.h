@@ -0,0 +1,150 @@
+#pragma once
+#include "Shape.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace neurons
+{
+    class Thread_pool;
+
+    /*
+    A group of tasks submitted to a Thread_pool that can be waited for together.
+    The first exception thrown by a task of the group is rethrown by Thread_pool::wait.
+    */
+    class Task_group
+    {
+        friend class Thread_pool;
+
+    private:
+        std::atomic<lint> m_pending;
+
+        std::mutex m_error_mutex;
+        std::exception_ptr m_error;
+
+    public:
+        Task_group();
+
+        Task_group(const Task_group & other) = delete;
+        Task_group & operator = (const Task_group & other) = delete;
+    };
+
+    /*
+    A persistent pool of worker threads with work stealing.
+
+    Every worker owns a deque of tasks: it pushes and pops its own tasks at the back,
+    and steals from the front of other deques when its own deque is empty.
+    A thread waiting for a Task_group keeps executing queued tasks instead of blocking,
+    so tasks may submit and wait for nested tasks (for example a GEMM called inside a
+    training task) without deadlocks or extra threads.
+
+    One pool serves the whole process: NN creates it with its number of threads, and
+    layers or kernels get it via Thread_pool::current() for intra-op parallelism.
+    Operations split their work over intra_op_threads() threads, which is limited by
+    Intra_op_scope when several operations (for example samples of a batch) run at the same time.
+    */
+    class Thread_pool
+    {
+    private:
+        struct Task
+        {
+            std::function<void()> m_func;
+            Task_group *m_group;
+        };
+
+        struct Task_queue
+        {
+            std::mutex m_mutex;
+            std::deque<Task> m_tasks;
+        };
+
+        std::vector<std::thread> m_workers;
+
+        // One queue per worker, the last one receives tasks submitted from outside the pool
+        std::vector<std::unique_ptr<Task_queue>> m_queues;
+
+        // Number of tasks in all queues
+        std::atomic<lint> m_queued;
+        bool m_stop;
+
+        // Idle workers and waiting threads sleep on this
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+
+    public:
+        // Threads are the total number of threads working on tasks including
+        // the thread that waits, so (threads - 1) workers are created.
+        explicit Thread_pool(lint threads);
+
+        ~Thread_pool();
+
+        Thread_pool(const Thread_pool & other) = delete;
+        Thread_pool(Thread_pool && other) = delete;
+        Thread_pool & operator = (const Thread_pool & other) = delete;
+        Thread_pool & operator = (Thread_pool && other) = delete;
+
+        // Number of threads that can run tasks at the same time (workers plus the waiting thread)
+        lint concurrency() const;
+
+        // Number of threads an operation running on the calling thread should split its work over:
+        // the limit of the innermost Intra_op_scope of the thread, or concurrency() outside of scopes.
+        lint intra_op_threads() const;
+
+        // Submit a task to the pool as a member of the group
+        void run(Task_group & group, std::function<void()> func);
+
+        // Execute queued tasks until all tasks of the group have finished
+        void wait(Task_group & group);
+
+        // Split [begin, end) into chunks of at least grain elements and run body(chunk_begin, chunk_end)
+        // on the pool, the calling thread takes part in the work.
+        // There are at most intra_op_threads() chunks, and they share the threads between them:
+        // operations called by body see intra_op_threads() / chunks threads.
+        void parallel_for(lint begin, lint end, const std::function<void(lint, lint)> & body, lint grain = 1);
+
+    public:
+        // Get the pool shared by the whole process, a new one is created if there is no pool
+        // alive or the pool alive has fewer threads.
+        static std::shared_ptr<Thread_pool> process_pool(lint threads);
+
+        // Get the pool shared by the whole process, nullptr if there is no pool alive.
+        static std::shared_ptr<Thread_pool> current();
+
+    private:
+        void worker_loop(lint index);
+
+        // Pop a task of this thread's own queue or steal one from the other queues.
+        bool try_pop(Task & task);
+
+        void execute(Task & task);
+    };
+
+    /*
+    Limits the threads which operations running on this thread split their work over
+    (see Thread_pool::intra_op_threads) until the scope ends. Scopes can be nested, the innermost
+    one is in effect.
+
+    A task running one of several samples at the same time gets a share of the pool this way,
+    so the operations of all samples together keep the threads of the pool busy without
+    flooding it with chunks. A limit of 1 makes operations single-threaded.
+    */
+    class Intra_op_scope
+    {
+    private:
+        lint m_previous;
+
+    public:
+        explicit Intra_op_scope(lint threads);
+
+        ~Intra_op_scope();
+
+        Intra_op_scope(const Intra_op_scope & other) = delete;
+        Intra_op_scope & operator = (const Intra_op_scope & other) = delete;
+    };
+}
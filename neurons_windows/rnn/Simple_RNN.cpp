@@ -9,53 +9,40 @@ Simple_RNN::Simple_RNN(
     const std::string & model_file,
     const dataset::Dataset &d_set)
     :
-    NN(l_rate, mmt_rate, threads, model_file, d_set)
+    NN<>(l_rate, mmt_rate, threads, model_file, d_set)
 {
     // Initialize all layers and
     // reshape all inputs and labels so that they are suitable for matrix multiplications
 
-    lint bptt_len = this->m_train_set[0].shape()[0];
+    lint bptt_len = this->m_sample_shape[0];
     // Each input sample should have at least 2 dimensions
-    lint input_size = this->m_train_set[0].shape()[1];
+    lint input_size = this->m_sample_shape[1];
     
-    lint output_size = this->m_train_labels[0].shape().size();
+    lint output_size = this->m_label_shape.size();
 
     // Add RNN layer to the network
     this->m_layers.push_back(
-        std::make_shared<neurons::Simple_RNN_layer>(input_size, 50, bptt_len, this->m_threads, new neurons::Tanh));
+        std::make_shared<neurons::Simple_RNN_layer>(input_size, 50, bptt_len, this->m_threads, new neurons::Tanh<>));
 
     // Add an output layer
     this->m_layers.push_back(
-        std::make_shared<neurons::FCNN_layer>(0, 50, output_size, this->m_threads, nullptr, new neurons::Sigmoid_CrossEntropy));
+        std::make_shared<neurons::FCNN_layer<>>(0, 50, output_size, this->m_threads, nullptr, new neurons::Sigmoid_CrossEntropy<>));
 
-    // Reshape all the training set and labels
-    for (size_t i = 0; i < this->m_train_set.size(); ++i)
-    {
-        // this->m_train_set[i].reshape(neurons::Shape{ 1, input_size });
-        this->m_train_set[i].normalize();
-        this->m_train_labels[i].reshape(neurons::Shape{ 1, output_size });
-    }
-
-    // Reshape all the test set and labels
-    for (size_t i = 0; i < this->m_test_set.size(); ++i)
-    {
-        // this->m_test_set[i].reshape(neurons::Shape{ 1, input_size });
-        this->m_test_set[i].normalize();
-        this->m_test_labels[i].reshape(neurons::Shape{ 1, output_size });
-    }
+    // Normalize all the samples and reshape all the labels
+    this->prepare_samples(this->m_sample_shape, neurons::Shape{ 1, output_size }, true);
 }
 
 
 std::vector<neurons::TMatrix<>> Simple_RNN::test(
-    const std::vector<neurons::TMatrix<>>& inputs,
-    const std::vector<neurons::TMatrix<>>& targets,
+    const std::vector<const neurons::TMatrix<> *> & inputs,
+    const std::vector<const neurons::TMatrix<> *> & targets,
     lint thread_id)
 {
     std::vector<neurons::TMatrix<>> preds;
     for (size_t i = 0; i < inputs.size(); ++i)
     {
         dynamic_cast<neurons::Simple_RNN_layer_op*>(this->m_layers[0]->operation_instances()[thread_id].get())->forget_all();
-        std::vector<neurons::TMatrix<>> sequence = inputs[i].collapse(0);
+        std::vector<neurons::TMatrix<>> sequence = inputs[i]->collapse(0);
 
         neurons::TMatrix<> pred;
         std::vector<neurons::TMatrix<>> s_hiddens;
@@ -68,7 +55,7 @@ std::vector<neurons::TMatrix<>> Simple_RNN::test(
 
         s_hiddens = this->m_layers[0]->operation_instances()[thread_id]->batch_forward_propagate(sequence);
 
-        pred = this->m_layers[1]->operation_instances()[thread_id]->forward_propagate(s_hiddens.back(), targets[i]);
+        pred = this->m_layers[1]->operation_instances()[thread_id]->forward_propagate(s_hiddens.back(), *targets[i]);
 
         preds.push_back(pred);
     }
@@ -78,15 +65,15 @@ std::vector<neurons::TMatrix<>> Simple_RNN::test(
 
 
 std::vector<neurons::TMatrix<>> Simple_RNN::optimise(
-    const std::vector<neurons::TMatrix<>>& inputs,
-    const std::vector<neurons::TMatrix<>>& targets,
+    const std::vector<const neurons::TMatrix<> *> & inputs,
+    const std::vector<const neurons::TMatrix<> *> & targets,
     lint thread_id)
 {
     std::vector<neurons::TMatrix<>> preds;
     for (size_t i = 0; i < inputs.size(); ++i)
     {
         dynamic_cast<neurons::Simple_RNN_layer_op*>(this->m_layers[0]->operation_instances()[thread_id].get())->forget_all();
-        std::vector<neurons::TMatrix<>> sequence = inputs[i].collapse(0);
+        std::vector<neurons::TMatrix<>> sequence = inputs[i]->collapse(0);
         
         neurons::TMatrix<> pred;
         std::vector<neurons::TMatrix<>> s_hiddens;
@@ -99,7 +86,7 @@ std::vector<neurons::TMatrix<>> Simple_RNN::optimise(
             
         s_hiddens = this->m_layers[0]->operation_instances()[thread_id]->batch_forward_propagate(sequence);
 
-        pred = this->m_layers[1]->operation_instances()[thread_id]->forward_propagate(s_hiddens.back(), targets[i]);
+        pred = this->m_layers[1]->operation_instances()[thread_id]->forward_propagate(s_hiddens.back(), *targets[i]);
 
         // Backward propagate
         std::vector<neurons::TMatrix<>> E_to_x_diffs;
@@ -143,7 +130,7 @@ void Simple_RNN::save(const std::string & file_name) const
 }
 
 std::vector<neurons::TMatrix<>> Simple_RNN::predict(
-    const std::vector<neurons::TMatrix<>>& inputs, lint thread_id) const
+    const std::vector<const neurons::TMatrix<> *> & inputs, lint thread_id) const
 {
     return std::vector<neurons::TMatrix<>>();
 }
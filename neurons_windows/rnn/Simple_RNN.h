@@ -9,7 +9,7 @@ Programmed by Chunnan Sheng
 #include <iostream>
 
 
-class Simple_RNN : public NN
+class Simple_RNN : public NN<>
 {
 private:
 
@@ -45,17 +45,17 @@ public:
 private:
 
     virtual std::vector<neurons::TMatrix<>> test(
-        const std::vector<neurons::TMatrix<>> & inputs,
-        const std::vector<neurons::TMatrix<>> & targets,
+        const std::vector<const neurons::TMatrix<> *> & inputs,
+        const std::vector<const neurons::TMatrix<> *> & targets,
         lint thread_id);
 
     virtual std::vector<neurons::TMatrix<>> optimise(
-        const std::vector<neurons::TMatrix<>> & inputs,
-        const std::vector<neurons::TMatrix<>> & targets,
+        const std::vector<const neurons::TMatrix<> *> & inputs,
+        const std::vector<const neurons::TMatrix<> *> & targets,
         lint thread_id);
 
     virtual std::vector<neurons::TMatrix<>> predict(
-        const std::vector<neurons::TMatrix<>> & inputs,
+        const std::vector<const neurons::TMatrix<> *> & inputs,
         lint thread_id) const;
 };
 
@@ -8,10 +8,10 @@ neurons::Simple_RNN_layer::Simple_RNN_layer(
     lint output_size,
     lint bptt_len,
     lint threads,
-    neurons::Activation *act_func,
-    neurons::ErrorFunction *err_func)
+    neurons::Activation<> *act_func,
+    neurons::ErrorFunction<> *err_func)
     :
-    NN_layer(threads),
+    NN_layer<>(threads),
     m_output_size {output_size},
     m_act_func {act_func},
     m_err_func {err_func}
@@ -25,7 +25,7 @@ neurons::Simple_RNN_layer::Simple_RNN_layer(
 
 neurons::Simple_RNN_layer::Simple_RNN_layer(const Simple_RNN_layer & other)
     :
-    NN_layer(other),
+    NN_layer<>(other),
     m_act_func{ other.m_act_func ? other.m_act_func->clone() : nullptr },
     m_err_func{ other.m_err_func ? other.m_err_func->clone() : nullptr }
 {
@@ -38,7 +38,7 @@ neurons::Simple_RNN_layer::Simple_RNN_layer(const Simple_RNN_layer & other)
 
 neurons::Simple_RNN_layer::Simple_RNN_layer(Simple_RNN_layer && other)
     : 
-    NN_layer(other),
+    NN_layer<>(other),
     m_act_func{ std::move(other.m_act_func) },
     m_err_func{ std::move(other.m_err_func) }
 {
@@ -50,7 +50,7 @@ neurons::Simple_RNN_layer::Simple_RNN_layer(Simple_RNN_layer && other)
 
 neurons::Simple_RNN_layer & neurons::Simple_RNN_layer::operator=(const Simple_RNN_layer & other)
 {
-    NN_layer::operator=(other);
+    NN_layer<>::operator=(other);
     this->m_act_func = other.m_act_func ? other.m_act_func->clone() : nullptr;
     this->m_err_func = other.m_err_func ? other.m_err_func->clone() : nullptr;
 
@@ -65,7 +65,7 @@ neurons::Simple_RNN_layer & neurons::Simple_RNN_layer::operator=(const Simple_RN
 
 neurons::Simple_RNN_layer & neurons::Simple_RNN_layer::operator=(Simple_RNN_layer && other)
 {
-    NN_layer::operator=(other);
+    NN_layer<>::operator=(other);
     this->m_act_func = std::move(other.m_act_func);
     this->m_err_func = std::move(other.m_err_func);
 
@@ -87,6 +87,16 @@ std::unique_ptr<char[]> neurons::Simple_RNN_layer::to_binary_data(lint & data_si
     return std::unique_ptr<char[]>();
 }
 
+neurons::Model_layer neurons::Simple_RNN_layer::to_model_layer() const
+{
+    Model_layer layer;
+    layer.m_type = this->nn_type();
+    layer.m_act_func = this->m_act_func ? this->m_act_func->to_string() : "NULL";
+    layer.m_err_func = this->m_err_func ? this->m_err_func->to_string() : "NULL";
+
+    return layer;
+}
+
 /////////////////////////////////////////////////
 
 neurons::Simple_RNN_layer_op::Simple_RNN_layer_op()
@@ -96,10 +106,10 @@ neurons::Simple_RNN_layer_op::Simple_RNN_layer_op(
     lint input_size,
     lint output_size,
     lint bptt_len,
-    const std::unique_ptr<Activation> &act_func,
-    const std::unique_ptr<ErrorFunction> &err_func)
+    const std::unique_ptr<Activation<>> &act_func,
+    const std::unique_ptr<ErrorFunction<>> &err_func)
     :
-    NN_layer_op(),
+    NN_layer_op<>(),
     m_rnn{
     input_size,
     output_size,
@@ -110,19 +120,19 @@ neurons::Simple_RNN_layer_op::Simple_RNN_layer_op(
 
 neurons::Simple_RNN_layer_op::Simple_RNN_layer_op(const Simple_RNN_layer_op & other)
     :
-    NN_layer_op(other),
+    NN_layer_op<>(other),
     m_rnn{ other.m_rnn }
 {}
 
 neurons::Simple_RNN_layer_op::Simple_RNN_layer_op(Simple_RNN_layer_op && other)
     :
-    NN_layer_op(other),
+    NN_layer_op<>(other),
     m_rnn{ std::move(other.m_rnn) }
 {}
 
 neurons::Simple_RNN_layer_op & neurons::Simple_RNN_layer_op::operator = (const Simple_RNN_layer_op & other)
 {
-    NN_layer_op::operator = (other);
+    NN_layer_op<>::operator = (other);
     this->m_rnn = other.m_rnn;
 
     return *this;
@@ -130,7 +140,7 @@ neurons::Simple_RNN_layer_op & neurons::Simple_RNN_layer_op::operator = (const S
 
 neurons::Simple_RNN_layer_op & neurons::Simple_RNN_layer_op::operator = (Simple_RNN_layer_op && other)
 {
-    NN_layer_op::operator = (other);
+    NN_layer_op<>::operator = (other);
     this->m_rnn = std::move(other.m_rnn);
 
     return *this;
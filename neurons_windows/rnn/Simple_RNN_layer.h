@@ -8,15 +8,15 @@ namespace neurons
     /*
     This is definition of a single layer of a fully connected neural network
     */
-    class Simple_RNN_layer : public NN_layer
+    class Simple_RNN_layer : public NN_layer<>
     {
     private:
 
         lint m_output_size;
         // The pointer of activation function (logist, softmax, etc)
-        std::unique_ptr<Activation> m_act_func;
+        std::unique_ptr<Activation<>> m_act_func;
         // The pointer of error function (sigmoid_crossentropy, softmax_crossentropy, etc)
-        std::unique_ptr<ErrorFunction> m_err_func;
+        std::unique_ptr<ErrorFunction<>> m_err_func;
 
     public:
         Simple_RNN_layer();
@@ -26,8 +26,8 @@ namespace neurons
             lint output_size,
             lint bptt_len,
             lint threads,
-            neurons::Activation *act_func,
-            neurons::ErrorFunction *err_func = nullptr);
+            neurons::Activation<> *act_func,
+            neurons::ErrorFunction<> *err_func = nullptr);
 
 
         Simple_RNN_layer(const Simple_RNN_layer & other);
@@ -42,10 +42,13 @@ namespace neurons
 
         virtual std::unique_ptr<char[]> to_binary_data(lint & data_size) const;
 
-        virtual std::string nn_type() const { return NN_layer::RNN; }
+        // Weights are kept by RNN units of the ops, they are not saved yet
+        virtual Model_layer to_model_layer() const;
+
+        virtual std::string nn_type() const { return NN_layer<>::RNN; }
     };
 
-    class Simple_RNN_layer_op : public NN_layer_op
+    class Simple_RNN_layer_op : public NN_layer_op<>
     {
     private:
         RNN_unit m_rnn;
@@ -58,8 +61,8 @@ namespace neurons
             lint input_size,
             lint output_size,
             lint bptt_len,
-            const std::unique_ptr<Activation> &act_func,
-            const std::unique_ptr<ErrorFunction> &err_func);
+            const std::unique_ptr<Activation<>> &act_func,
+            const std::unique_ptr<ErrorFunction<>> &err_func);
 
         //----------------------------
         // Copy and move operations
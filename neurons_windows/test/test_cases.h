@@ -1,17 +1,30 @@
 #pragma once
 #include "Vector.h"
 #include "TMatrix.h"
+#include "TMatrix_View.h"
+#include "GEMM.h"
+#include "Vector_math.h"
+#include "Thread_pool.h"
+#include "Prefetch_pipeline.h"
 #include "Functions.h"
 #include "Convolution.h"
 #include "Pooling.h"
+#include "FCNN_layer.h"
+#include "CNN_layer.h"
+#include "Checkpoint.h"
+#include "Inference_session.h"
+#include "Batching_server.h"
 #include "MixtureModel.h"
 #include "Dataset.h"
 #include "RNN_unit.h"
 #include "Mnist.h"
+#include "CIFAR_10.h"
 #include "PGM.h"
 #include "Review.h"
 #include "LinearRegression.h"
 #include <iostream>
+#include <fstream>
+#include <cstdio>
 #include <vector>
 #include <list>
 
@@ -683,13 +696,13 @@ void test_of_basic_neuron_operations()
     lint cols = images[0].shape()[1];
     lint targets = labels[0].shape()[0];
 
-    neurons::Sigmoid sigmoid;
-    neurons::Tanh tanh;
-    neurons::Relu relu;
-    neurons::Softmax softmax;
-    neurons::HalfSquareError hse{ std::make_unique<neurons::Tanh>() };
-    neurons::Sigmoid_CrossEntropy sig_cross;
-    neurons::Softmax_CrossEntropy sm_cross;
+    neurons::Sigmoid<> sigmoid;
+    neurons::Tanh<> tanh;
+    neurons::Relu<> relu;
+    neurons::Softmax<> softmax;
+    neurons::HalfSquareError<> hse{ std::make_unique<neurons::Tanh<>>() };
+    neurons::Sigmoid_CrossEntropy<> sig_cross;
+    neurons::Softmax_CrossEntropy<> sm_cross;
 
     neurons::TMatrix<> weights{ neurons::Shape{ rows, cols, targets } };
     weights.gaussian_random(0, 0.0001);
@@ -805,7 +818,7 @@ void test_conv_1d()
 
 void test_conv_2d()
 {
-    neurons::Conv_2d conv_2d{ neurons::Shape{ 1, 4, 4, 3 }, neurons::Shape{ 3, 3, 3, 5 }, 1, 1, 2, 2 };
+    neurons::Conv_2d<> conv_2d{ neurons::Shape{ 1, 4, 4, 3 }, neurons::Shape{ 3, 3, 3, 5 }, 1, 1, 2, 2 };
 
     neurons::TMatrix<> input{ neurons::Shape{ 1, 4, 4, 3 } };
 
@@ -855,11 +868,16 @@ void test_conv_2d()
     std::cout << "Output: " << '\n';
     std::cout << output << '\n';
 
-    std::cout << "d(conv)/d(w)\n";
-    std::cout << conv_2d.get_diff_to_weights() << '\n';
+    // Back propagation where dE/d(conv) is 1 everywhere
+    neurons::TMatrix<> diff_E_to_z{ output.shape(), 1 };
+
+    neurons::TMatrix<> diff_E_to_w{ weights.shape(), 0 };
+    conv_2d.add_diff_to_weights(diff_E_to_w, input, diff_E_to_z);
+    std::cout << "d(E)/d(w)\n";
+    std::cout << diff_E_to_w << '\n';
 
-    std::cout << "d(conv)/d(x)\n";
-    std::cout << conv_2d.get_diff_to_input() << '\n';
+    std::cout << "d(E)/d(x)\n";
+    std::cout << conv_2d.diff_to_input(diff_E_to_z, weights) << '\n';
 
     /*
     input.reshape(input.shape().sub_shape(1, 3));
@@ -872,12 +890,78 @@ void test_conv_2d()
 }
 
 
+// Compare derivatives of Conv_2d with numerical derivatives of E = sum(conv(x, w) * g)
+void test_conv_2d_gradients()
+{
+    std::cout << "=================== test_conv_2d_gradients ==================" << "\n";
+
+    // [in rows, in cols, chls, w rows, w cols, filters, stride, zero padding]
+    lint configs[][8] = { { 7, 6, 2, 3, 3, 4, 1, 0 }, { 7, 7, 3, 3, 3, 2, 2, 1 }, { 12, 12, 1, 6, 6, 3, 2, 2 } };
+
+    for (auto & cfg : configs)
+    {
+        neurons::Shape in_sh{ 1, cfg[0], cfg[1], cfg[2] };
+        neurons::Shape w_sh{ cfg[3], cfg[4], cfg[2], cfg[5] };
+        neurons::Conv_2d<> conv{ in_sh, w_sh, cfg[6], cfg[6], cfg[7], cfg[7] };
+
+        neurons::TMatrix<> x{ in_sh };
+        neurons::TMatrix<> w{ w_sh };
+        neurons::TMatrix<> b{ neurons::Shape{ 1, cfg[5] } };
+        neurons::TMatrix<> g{ conv.get_output_shape() };
+        x.gaussian_random(0, 1);
+        w.gaussian_random(0, 1);
+        b.gaussian_random(0, 1);
+        g.gaussian_random(0, 1);
+
+        auto error = [&]()
+        {
+            neurons::TMatrix<> z = conv(x, w, b);
+            double sum = 0;
+            for (lint i = 0; i < z.shape().size(); ++i)
+            {
+                sum += z.m_data[i] * g.m_data[i];
+            }
+            return sum;
+        };
+
+        neurons::TMatrix<> diff_x = conv.diff_to_input(g, w);
+        neurons::TMatrix<> diff_w{ w_sh, 0 };
+        conv.add_diff_to_weights(diff_w, x, g);
+
+        double max_err = 0;
+        double delta = 1e-5;
+
+        neurons::TMatrix<> * params[] = { &x, &w };
+        neurons::TMatrix<> * diffs[] = { &diff_x, &diff_w };
+
+        for (int p = 0; p < 2; ++p)
+        {
+            for (lint i = 0; i < params[p]->shape().size(); ++i)
+            {
+                double origin = params[p]->m_data[i];
+                params[p]->m_data[i] = origin + delta;
+                double e_plus = error();
+                params[p]->m_data[i] = origin - delta;
+                double e_minus = error();
+                params[p]->m_data[i] = origin;
+
+                double numerical = (e_plus - e_minus) / (2 * delta);
+                max_err = std::max(max_err, std::abs(numerical - diffs[p]->m_data[i]));
+            }
+        }
+
+        std::cout << "input " << in_sh << " weights " << w_sh << " stride " << cfg[6] << " padding " << cfg[7]
+            << " max error: " << max_err << (max_err < 1e-6 ? "  OK" : "  FAILED") << '\n';
+    }
+}
+
+
 void test_pooling_2d()
 {
     neurons::Shape in_sh{ 1, 4, 6, 3 };
     neurons::Shape k_sh{ 1, 2, 3, 3 };
 
-    neurons::MaxPooling_2d pool{ in_sh, k_sh };
+    neurons::MaxPooling_2d<> pool{ in_sh, k_sh };
     
     neurons::TMatrix<> input{ in_sh };
     input.uniform_random(0, 10);
@@ -897,7 +981,7 @@ void test_pooling_2d_special()
     neurons::Shape in_sh{ 1, 6, 6, 3 };
     neurons::Shape k_sh{ 1, 2, 3, 3 };
 
-    neurons::MaxPooling_2d pool{ in_sh, k_sh };
+    neurons::MaxPooling_2d<> pool{ in_sh, k_sh };
 
     neurons::TMatrix<> input{ in_sh };
     input.uniform_random(0, 10);
@@ -1103,6 +1187,175 @@ void test_linear_regression_B()
 }
 
 
+// The naive i-j-k loop matrix_multiply used before GEMM kernels were introduced
+template <typename dtype>
+void naive_matrix_multiply(lint m, lint n, lint k, const dtype *a, const dtype *b, dtype *c)
+{
+    for (lint i = 0; i < m; ++i)
+    {
+        for (lint j = 0; j < n; ++j)
+        {
+            dtype sum = 0;
+            const dtype *a_p = a + i * k;
+            const dtype *b_p = b + j;
+
+            for (lint p = 0; p < k; ++p)
+            {
+                sum += *a_p * *b_p;
+                ++a_p;
+                b_p += n;
+            }
+
+            c[i * n + j] = sum;
+        }
+    }
+}
+
+std::vector<neurons::GEMM_kernel> supported_gemm_kernels()
+{
+    std::vector<neurons::GEMM_kernel> kernels;
+    neurons::GEMM_kernel all[] = { neurons::GEMM_kernel::scalar, neurons::GEMM_kernel::avx2, neurons::GEMM_kernel::avx512 };
+
+    for (neurons::GEMM_kernel kernel : all)
+    {
+        if (kernel <= neurons::gemm_best_kernel())
+        {
+            kernels.push_back(kernel);
+        }
+    }
+
+    return kernels;
+}
+
+template <typename dtype>
+void test_gemm_of_type(const std::string & type_name, dtype tolerance)
+{
+    // Sizes around the register tiles and the cache blocks
+    lint sizes[][3] = { { 1, 300, 784 }, { 5, 1, 7 }, { 13, 17, 19 }, { 64, 300, 784 },
+                        { 64, 10, 300 }, { 197, 33, 300 }, { 100, 4100, 3 } };
+
+    neurons::GEMM_kernel original = neurons::gemm_kernel();
+
+    for (neurons::GEMM_kernel kernel : supported_gemm_kernels())
+    {
+        neurons::gemm_set_kernel(kernel);
+        dtype max_err = 0;
+
+        for (auto & size : sizes)
+        {
+            lint m = size[0];
+            lint n = size[1];
+            lint k = size[2];
+
+            for (int trans = 0; trans < 4; ++trans)
+            {
+                bool trans_a = 0 != (trans & 1);
+                bool trans_b = 0 != (trans & 2);
+
+                neurons::TMatrix<dtype> a{ trans_a ? neurons::Shape{ k, m } : neurons::Shape{ m, k } };
+                neurons::TMatrix<dtype> b{ trans_b ? neurons::Shape{ n, k } : neurons::Shape{ k, n } };
+                neurons::TMatrix<dtype> c{ neurons::Shape{ m, n } };
+                a.gaussian_random(0, 1);
+                b.gaussian_random(0, 1);
+                c.gaussian_random(0, 1);
+                neurons::TMatrix<dtype> expected{ c };
+
+                lint lda = trans_a ? m : k;
+                lint ldb = trans_b ? k : n;
+
+                neurons::gemm_plain<dtype>(trans_a, trans_b, m, n, k, 0.5, a.m_data, lda, b.m_data, ldb, 2, expected.m_data, n);
+                neurons::gemm<dtype>(trans_a, trans_b, m, n, k, 0.5, a.m_data, lda, b.m_data, ldb, 2, c.m_data, n);
+
+                for (lint i = 0; i < m * n; ++i)
+                {
+                    max_err = std::max(max_err, std::abs(c.m_data[i] - expected.m_data[i]));
+                }
+            }
+        }
+
+        std::cout << type_name << " gemm (" << neurons::gemm_kernel_name(kernel) << ") max error: " << max_err
+            << (max_err < tolerance ? "  OK" : "  FAILED") << '\n';
+    }
+
+    neurons::gemm_set_kernel(original);
+}
+
+void test_gemm()
+{
+    std::cout << "=================== test_gemm ==================" << "\n";
+
+    // Large products are split over the process pool while it is alive
+    std::shared_ptr<neurons::Thread_pool> pool = neurons::Thread_pool::process_pool(4);
+
+    test_gemm_of_type<double>("double", 1e-9);
+    test_gemm_of_type<float>("float", 1e-2f);
+}
+
+void bench_matrix_multiply()
+{
+    std::cout << "=================== bench_matrix_multiply ==================" << "\n";
+
+    // [name, m, n, k] where the product is [m, k] x [k, n]
+    struct GEMM_shape
+    {
+        std::string name;
+        lint m;
+        lint n;
+        lint k;
+    };
+
+    std::vector<GEMM_shape> shapes{
+        { "fcnn 784x300, batch 64", 64, 300, 784 },
+        { "fcnn 300x10, batch 64", 64, 10, 300 },
+        { "fcnn 784x300, batch 1", 1, 300, 784 },
+        { "conv 6x6x1x6 on 28x28/2", 196, 6, 36 },
+        { "conv 3x3x6x30 on 7x7", 49, 30, 54 },
+        { "conv 5x5x32x64 on 16x16", 256, 64, 800 },
+        { "square 512", 512, 512, 512 }
+    };
+
+    neurons::GEMM_kernel original = neurons::gemm_kernel();
+
+    for (const GEMM_shape & sh : shapes)
+    {
+        neurons::TMatrix<> a{ neurons::Shape{ sh.m, sh.k } };
+        neurons::TMatrix<> b{ neurons::Shape{ sh.k, sh.n } };
+        neurons::TMatrix<> c{ neurons::Shape{ sh.m, sh.n } };
+        a.gaussian_random(0, 1);
+        b.gaussian_random(0, 1);
+
+        double flops = 2.0 * sh.m * sh.n * sh.k;
+        // Repeat each product for roughly 2 GFLOP
+        lint repeats = std::max<lint>(1, static_cast<lint>(2e9 / flops));
+
+        std::cout << sh.name << " [" << sh.m << ", " << sh.k << "] x [" << sh.k << ", " << sh.n << "]\n";
+
+        lint start = neurons::now_in_milliseconds();
+        for (lint r = 0; r < repeats; ++r)
+        {
+            naive_matrix_multiply(sh.m, sh.n, sh.k, a.m_data, b.m_data, c.m_data);
+        }
+        double secs = std::max<lint>(1, neurons::now_in_milliseconds() - start) / 1000.0;
+        std::cout << "    naive loop: " << flops * repeats / secs / 1e9 << " GFLOP/s\n";
+
+        for (neurons::GEMM_kernel kernel : supported_gemm_kernels())
+        {
+            neurons::gemm_set_kernel(kernel);
+
+            start = neurons::now_in_milliseconds();
+            for (lint r = 0; r < repeats; ++r)
+            {
+                c = neurons::matrix_multiply(a, b);
+            }
+            secs = std::max<lint>(1, neurons::now_in_milliseconds() - start) / 1000.0;
+            std::cout << "    gemm " << neurons::gemm_kernel_name(kernel) << ": " << flops * repeats / secs / 1e9 << " GFLOP/s\n";
+        }
+    }
+
+    neurons::gemm_set_kernel(original);
+}
+
+
 void test_of_PGM()
 {
     std::cout << "=================== test_of_loading_PGM_dataset ==================" << "\n";
@@ -1147,6 +1400,2107 @@ void test_of_PGM()
 }
 
 
+void test_vector_math()
+{
+    std::cout << "=================== test_vector_math ==================" << "\n";
+
+    lint n = 100003;
+    neurons::TMatrix<> x{ neurons::Shape{ n } };
+    neurons::TMatrix<> positive{ neurons::Shape{ n } };
+    neurons::TMatrix<> y{ neurons::Shape{ n } };
+    neurons::TMatrix<> dy{ neurons::Shape{ n } };
+
+    // Mostly the range of activations, some far into saturation
+    x.uniform_random(-40, 40);
+    for (lint i = 0; i < n; i += 7)
+    {
+        x.m_data[i] *= 17;
+    }
+    for (lint i = 0; i < n; ++i)
+    {
+        positive.m_data[i] = exp(x.m_data[i]);
+    }
+
+    neurons::GEMM_kernel original = neurons::gemm_kernel();
+
+    for (neurons::GEMM_kernel kernel : supported_gemm_kernels())
+    {
+        neurons::gemm_set_kernel(kernel);
+        std::string name = neurons::gemm_kernel_name(kernel);
+
+        // exp, log and atan are compared by relative error, sigmoid and tanh by absolute error
+        double exp_err = 0;
+        neurons::vector_exp(n, x.m_data, y.m_data);
+        for (lint i = 0; i < n; ++i)
+        {
+            double expected = exp(x.m_data[i]);
+            exp_err = std::max(exp_err, std::abs(y.m_data[i] - expected) / expected);
+        }
+
+        double log_err = 0;
+        neurons::vector_log(n, positive.m_data, y.m_data);
+        for (lint i = 0; i < n; ++i)
+        {
+            double expected = log(positive.m_data[i]);
+            log_err = std::max(log_err, std::abs(y.m_data[i] - expected) / std::max(1.0, std::abs(expected)));
+        }
+
+        double atan_err = 0;
+        neurons::vector_atan(n, x.m_data, y.m_data, dy.m_data);
+        for (lint i = 0; i < n; ++i)
+        {
+            double expected = atan(x.m_data[i]);
+            double expected_diff = 1 / (1 + x.m_data[i] * x.m_data[i]);
+            atan_err = std::max(atan_err, std::abs(y.m_data[i] - expected) / std::abs(expected));
+            atan_err = std::max(atan_err, std::abs(dy.m_data[i] - expected_diff) / expected_diff);
+        }
+
+        double sigmoid_err = 0;
+        neurons::vector_sigmoid(n, x.m_data, y.m_data, dy.m_data);
+        for (lint i = 0; i < n; ++i)
+        {
+            double expected = 1 / (1 + exp(-x.m_data[i]));
+            sigmoid_err = std::max(sigmoid_err, std::abs(y.m_data[i] - expected));
+            sigmoid_err = std::max(sigmoid_err, std::abs(dy.m_data[i] - expected * (1 - expected)));
+        }
+
+        double tanh_err = 0;
+        neurons::vector_tanh(n, x.m_data, y.m_data, dy.m_data);
+        for (lint i = 0; i < n; ++i)
+        {
+            double expected = tanh(x.m_data[i]);
+            tanh_err = std::max(tanh_err, std::abs(y.m_data[i] - expected));
+            tanh_err = std::max(tanh_err, std::abs(dy.m_data[i] - (1 - expected * expected)));
+        }
+
+        std::cout << name << " exp max error: " << exp_err << (exp_err < 1e-15 ? "  OK" : "  FAILED") << '\n';
+        std::cout << name << " log max error: " << log_err << (log_err < 1e-15 ? "  OK" : "  FAILED") << '\n';
+        std::cout << name << " atan max error: " << atan_err << (atan_err < 1e-15 ? "  OK" : "  FAILED") << '\n';
+        std::cout << name << " sigmoid max error: " << sigmoid_err << (sigmoid_err < 1e-15 ? "  OK" : "  FAILED") << '\n';
+        std::cout << name << " tanh max error: " << tanh_err << (tanh_err < 1e-15 ? "  OK" : "  FAILED") << '\n';
+
+        // Saturation, the input buffer is also the output buffer
+        double special[] = { -1e6, 1e6, 0 };
+        neurons::vector_sigmoid(3, special, special, nullptr);
+        bool saturated = special[0] < 1e-300 && 1 == special[1] && 0.5 == special[2];
+        std::cout << name << " sigmoid saturation: " << (saturated ? "OK" : "FAILED") << '\n';
+    }
+
+    neurons::gemm_set_kernel(original);
+
+    // Activation functions reuse the buffers they are given
+    neurons::Sigmoid<> sigmoid;
+    neurons::TMatrix<> in{ neurons::Shape{ 30, 20 } };
+    neurons::TMatrix<> output{ neurons::Shape{ 20, 30 } };
+    neurons::TMatrix<> diff{ neurons::Shape{ 600 } };
+    in.gaussian_random(0, 1);
+    double *output_data = output.m_data;
+    double *diff_data = diff.m_data;
+    sigmoid(output, diff, in);
+    bool reused = output.m_data == output_data && diff.m_data == diff_data
+        && output.shape() == in.shape() && diff.shape() == in.shape();
+    std::cout << "activation buffers reused: " << (reused ? "OK" : "FAILED") << '\n';
+
+    // Softmax cross entropy stays finite for large inputs
+    neurons::Softmax_CrossEntropy<> softmax_ce;
+    neurons::TMatrix<> logits{ neurons::Shape{ 1, 3 } };
+    neurons::TMatrix<> target{ neurons::Shape{ 1, 3 }, 0 };
+    logits.m_data[0] = 1000;
+    logits.m_data[1] = 999;
+    logits.m_data[2] = 0;
+    target.m_data[1] = 1;
+    double loss = softmax_ce(diff, target, logits);
+    double expected_loss = log(1 + exp(1.0));
+    std::cout << "softmax cross entropy loss: " << loss
+        << (std::abs(loss - expected_loss) < 1e-12 ? "  OK" : "  FAILED") << '\n';
+}
+
+void test_fused_epilogue()
+{
+    std::cout << "=================== test_fused_epilogue ==================" << "\n";
+
+    // Larger than one block of the epilogue and not a multiple of it
+    neurons::Shape shape{ 1, 7, 9, 13 };
+    neurons::TMatrix<> product{ shape };
+    neurons::TMatrix<> bias{ neurons::Shape{ 1, 13 } };
+    product.gaussian_random(0, 2);
+    bias.gaussian_random(0, 1);
+
+    // z = product + bias as it was built before the epilogue was fused
+    neurons::TMatrix<> z{ product };
+    for (lint i = 0; i < shape.size(); ++i)
+    {
+        z.m_data[i] += bias.m_data[i % 13];
+    }
+
+    std::vector<std::string> names{ neurons::Activation<>::LINEAR, neurons::Activation<>::SIGMOID,
+        neurons::Activation<>::TANH, neurons::Activation<>::RELU, neurons::Activation<>::LEAKYRELU,
+        neurons::Activation<>::ARCTAN, neurons::Activation<>::SIN, neurons::Activation<>::SOFTSIGN,
+        neurons::Activation<>::SOFTMAX };
+
+    for (const std::string & name : names)
+    {
+        std::unique_ptr<neurons::Activation<>> act = neurons::Activation<>::get_function_by_name(name);
+
+        neurons::TMatrix<> expected;
+        neurons::TMatrix<> expected_diff;
+        act->operator()(expected, expected_diff, z);
+
+        neurons::TMatrix<> output;
+        neurons::TMatrix<> diff;
+        act->operator()(output, diff, shape, product.m_data, bias);
+
+        double max_err = 0;
+        for (lint i = 0; i < shape.size(); ++i)
+        {
+            max_err = std::max(max_err, std::abs(output.m_data[i] - expected.m_data[i]));
+            max_err = std::max(max_err, std::abs(diff.m_data[i] - expected_diff.m_data[i]));
+        }
+
+        bool same_shape = output.shape() == shape && diff.shape() == shape;
+        std::cout << name << " fused epilogue max error: " << max_err
+            << (max_err < 1e-12 && same_shape ? "  OK" : "  FAILED") << '\n';
+    }
+
+    // Error functions on an output layer of 10
+    neurons::TMatrix<> out_product{ neurons::Shape{ 1, 10 } };
+    neurons::TMatrix<> out_bias{ neurons::Shape{ 1, 10 } };
+    neurons::TMatrix<> out_z{ neurons::Shape{ 1, 10 } };
+    neurons::TMatrix<> target{ neurons::Shape{ 1, 10 }, 0 };
+    out_product.gaussian_random(0, 2);
+    out_bias.gaussian_random(0, 1);
+    for (lint i = 0; i < 10; ++i)
+    {
+        out_z.m_data[i] = out_product.m_data[i] + out_bias.m_data[i];
+    }
+    target.m_data[3] = 1;
+
+    std::vector<std::string> err_names{ neurons::ErrorFunction<>::SIGMOID_CROSS_ENTROPY,
+        neurons::ErrorFunction<>::SOFTMAX_CROSS_ENTROPY, neurons::ErrorFunction<>::HALF_SQUARE_ERROR + " " + neurons::Activation<>::TANH };
+
+    for (std::string & name : err_names)
+    {
+        std::unique_ptr<neurons::ErrorFunction<>> err = neurons::ErrorFunction<>::get_function_by_name(name);
+
+        neurons::TMatrix<> expected;
+        neurons::TMatrix<> expected_diff;
+        double expected_loss = err->operator()(expected, expected_diff, target, out_z);
+
+        neurons::TMatrix<> pred;
+        neurons::TMatrix<> diff;
+        double loss = err->operator()(pred, diff, target, out_z.shape(), out_product.m_data, out_bias);
+
+        double max_err = std::abs(loss - expected_loss);
+        for (lint i = 0; i < 10; ++i)
+        {
+            max_err = std::max(max_err, std::abs(pred.m_data[i] - expected.m_data[i]));
+            max_err = std::max(max_err, std::abs(diff.m_data[i] - expected_diff.m_data[i]));
+        }
+
+        std::cout << name << " fused epilogue max error: " << max_err << (max_err < 1e-12 ? "  OK" : "  FAILED") << '\n';
+    }
+
+    // A bias which does not match the last dimension is rejected
+    bool thrown = false;
+    try
+    {
+        neurons::TMatrix<> output;
+        neurons::TMatrix<> diff;
+        neurons::Sigmoid<>{}(output, diff, shape, product.m_data, out_bias);
+    }
+    catch (const std::invalid_argument &)
+    {
+        thrown = true;
+    }
+    std::cout << "mismatched bias: " << (thrown ? "OK" : "FAILED") << '\n';
+}
+
+void bench_activation_functions()
+{
+    std::cout << "=================== bench_activation_functions ==================" << "\n";
+
+    // A batch of 64 samples of a 300 wide layer
+    lint n = 64 * 300;
+    lint repeats = 500;
+    neurons::TMatrix<> in{ neurons::Shape{ 64, 300 } };
+    neurons::TMatrix<> target{ neurons::Shape{ 64, 300 }, 0 };
+    neurons::TMatrix<> output;
+    neurons::TMatrix<> diff;
+    in.gaussian_random(0, 3);
+    for (lint i = 0; i < 64; ++i)
+    {
+        target.m_data[i * 300 + i] = 1;
+    }
+
+    // The element-wise libm loops used before the vector kernels, they allocate their results per call
+    std::vector<std::pair<std::string, std::function<void()>>> libm{
+        { "sigmoid", [&] {
+            neurons::TMatrix<> y{ in.m_shape };
+            neurons::TMatrix<> d{ in.m_shape };
+            for (lint i = 0; i < n; ++i)
+            {
+                y.m_data[i] = 1.0 / (1.0 + exp(-in.m_data[i]));
+                d.m_data[i] = y.m_data[i] * (1 - y.m_data[i]);
+            }
+            output = std::move(y);
+            diff = std::move(d);
+        } },
+        { "tanh", [&] {
+            output = neurons::TMatrix<>{ in.m_shape };
+            diff = neurons::TMatrix<>{ in.m_shape };
+            for (lint i = 0; i < n; ++i)
+            {
+                output.m_data[i] = tanh(in.m_data[i]);
+                diff.m_data[i] = 1 - output.m_data[i] * output.m_data[i];
+            }
+        } },
+        { "relu", [&] {
+            output = neurons::TMatrix<>{ in.m_shape };
+            diff = neurons::TMatrix<>{ in.m_shape };
+            for (lint i = 0; i < n; ++i)
+            {
+                bool positive = in.m_data[i] >= 0;
+                output.m_data[i] = positive ? in.m_data[i] : 0;
+                diff.m_data[i] = positive ? 1 : 0;
+            }
+        } },
+        { "arctan", [&] {
+            output = neurons::TMatrix<>{ in.m_shape };
+            diff = neurons::TMatrix<>{ in.m_shape };
+            for (lint i = 0; i < n; ++i)
+            {
+                output.m_data[i] = atan(in.m_data[i]);
+                diff.m_data[i] = 1 / (1 + in.m_data[i] * in.m_data[i]);
+            }
+        } },
+        { "softsign", [&] {
+            output = neurons::TMatrix<>{ in.m_shape };
+            diff = neurons::TMatrix<>{ in.m_shape };
+            for (lint i = 0; i < n; ++i)
+            {
+                double d = 1 + fabs(in.m_data[i]);
+                output.m_data[i] = in.m_data[i] / d;
+                diff.m_data[i] = 1 / (d * d);
+            }
+        } },
+        { "softmax", [&] {
+            output = neurons::TMatrix<>{ in.m_shape };
+            diff = neurons::TMatrix<>{ in.m_shape };
+            double sum = 0;
+            for (lint i = 0; i < n; ++i)
+            {
+                output.m_data[i] = exp(in.m_data[i]);
+                sum += output.m_data[i];
+            }
+            for (lint i = 0; i < n; ++i)
+            {
+                output.m_data[i] /= sum;
+                diff.m_data[i] = output.m_data[i] * (1 - output.m_data[i]);
+            }
+        } },
+        { "sigmoid cross entropy", [&] {
+            diff = neurons::TMatrix<>{ in.m_shape };
+            double sum = 0;
+            for (lint i = 0; i < n; ++i)
+            {
+                double y = 1.0 / (1.0 + exp(-in.m_data[i]));
+                output.m_data[i] = y;
+                sum += target.m_data[i] * log(y);
+                diff.m_data[i] = y - target.m_data[i];
+            }
+        } },
+        { "softmax cross entropy", [&] {
+            diff = neurons::TMatrix<>{ in.m_shape };
+            double sum = 0;
+            for (lint i = 0; i < n; ++i)
+            {
+                output.m_data[i] = exp(in.m_data[i]);
+                sum += output.m_data[i];
+            }
+            double loss = 0;
+            for (lint i = 0; i < n; ++i)
+            {
+                output.m_data[i] /= sum;
+                loss += target.m_data[i] * log(output.m_data[i]);
+                diff.m_data[i] = output.m_data[i] - target.m_data[i];
+            }
+        } }
+    };
+
+    neurons::Sigmoid<> sigmoid;
+    neurons::Tanh<> tanh_act;
+    neurons::Relu<> relu;
+    neurons::Arctan<> arctan;
+    neurons::Softsign<> softsign;
+    neurons::Softmax<> softmax;
+    neurons::Sigmoid_CrossEntropy<> sigmoid_ce;
+    neurons::Softmax_CrossEntropy<> softmax_ce;
+
+    std::vector<std::function<void()>> vectorized{
+        [&] { sigmoid(output, diff, in); },
+        [&] { tanh_act(output, diff, in); },
+        [&] { relu(output, diff, in); },
+        [&] { arctan(output, diff, in); },
+        [&] { softsign(output, diff, in); },
+        [&] { softmax(output, diff, in); },
+        [&] { sigmoid_ce(diff, target, in); },
+        [&] { softmax_ce(diff, target, in); }
+    };
+
+    output = neurons::TMatrix<>{ in.m_shape };
+    neurons::GEMM_kernel original = neurons::gemm_kernel();
+
+    for (size_t f = 0; f < libm.size(); ++f)
+    {
+        std::cout << libm[f].first << " [64, 300]\n";
+
+        lint start = neurons::now_in_milliseconds();
+        for (lint r = 0; r < repeats; ++r)
+        {
+            libm[f].second();
+        }
+        double secs = std::max<lint>(1, neurons::now_in_milliseconds() - start) / 1000.0;
+        std::cout << "    libm loop: " << n * repeats / secs / 1e6 << " M elements/s\n";
+
+        for (neurons::GEMM_kernel kernel : supported_gemm_kernels())
+        {
+            neurons::gemm_set_kernel(kernel);
+
+            start = neurons::now_in_milliseconds();
+            for (lint r = 0; r < repeats; ++r)
+            {
+                vectorized[f]();
+            }
+            secs = std::max<lint>(1, neurons::now_in_milliseconds() - start) / 1000.0;
+            std::cout << "    " << neurons::gemm_kernel_name(kernel) << ": " << n * repeats / secs / 1e6 << " M elements/s\n";
+        }
+    }
+
+    neurons::gemm_set_kernel(original);
+}
+
+
+void test_thread_pool()
+{
+    std::cout << "=================== test_thread_pool ==================" << "\n";
+
+    neurons::Thread_pool pool{ 4 };
+    std::cout << "Concurrency: " << pool.concurrency() << '\n';
+
+    // Parallel for
+    std::vector<lint> values(100000, 0);
+    pool.parallel_for(0, values.size(), [&values](lint begin, lint end)
+    {
+        for (lint i = begin; i < end; ++i)
+        {
+            values[i] = i;
+        }
+    });
+    lint sum = 0;
+    for (lint v : values)
+    {
+        sum += v;
+    }
+    std::cout << "Sum of parallel for: " << sum << (sum == 99999LL * 100000 / 2 ? "  OK" : "  FAILED") << '\n';
+
+    // Tasks waiting for nested tasks
+    std::atomic<lint> counter{ 0 };
+    neurons::Task_group group;
+    for (int i = 0; i < 8; ++i)
+    {
+        pool.run(group, [&pool, &counter]
+        {
+            neurons::Task_group nested;
+            for (int j = 0; j < 8; ++j)
+            {
+                pool.run(nested, [&counter] { ++counter; });
+            }
+            pool.wait(nested);
+        });
+    }
+    pool.wait(group);
+    std::cout << "Nested tasks: " << counter.load() << (64 == counter.load() ? "  OK" : "  FAILED") << '\n';
+
+    // Exceptions of tasks are rethrown by wait
+    neurons::Task_group failing;
+    pool.run(failing, [] { throw std::invalid_argument(std::string("task failed")); });
+    try
+    {
+        pool.wait(failing);
+        std::cout << "Exception of task: FAILED\n";
+    }
+    catch (std::invalid_argument & ex)
+    {
+        std::cout << "Exception of task: " << ex.what() << "  OK\n";
+    }
+}
+
+void test_commit_training()
+{
+    std::cout << "=================== test_commit_training ==================" << "\n";
+
+    std::shared_ptr<neurons::Thread_pool> pool = neurons::Thread_pool::process_pool(4);
+
+    // The layer is wide enough to split the reduction into several chunks,
+    // and the odd number of ops leaves one gradient out of the first level of the tree.
+    const lint threads = 5;
+    const double mmt_rate = 0.5;
+    neurons::FCNN_layer<> layer{ mmt_rate, 120, 100, threads, new neurons::Linear<> };
+
+    neurons::TMatrix<> w_expected = layer.weights();
+    neurons::TMatrix<> b_expected = layer.bias();
+    neurons::TMatrix<> w_gradient_sum{ w_expected.shape(), 0 };
+    neurons::TMatrix<> b_gradient_sum{ b_expected.shape(), 0 };
+
+    auto & ops = layer.operation_instances();
+    for (lint i = 0; i < threads; ++i)
+    {
+        neurons::TMatrix<> x{ neurons::Shape{ 1, 120 } };
+        neurons::TMatrix<> E_to_y{ neurons::Shape{ 100, 1 } };
+        x.gaussian_random(0, 1);
+        E_to_y.gaussian_random(0, 1);
+
+        ops[i]->forward_propagate(x);
+        ops[i]->back_propagate(0.1, E_to_y);
+
+        auto op = dynamic_cast<neurons::Traditional_NN_layer_op<>*>(ops[i].get());
+        w_gradient_sum += op->get_weight_gradient();
+        b_gradient_sum += op->get_bias_gradient();
+    }
+
+    layer.commit_training();
+
+    // Momentum starts from zero, so the first update is (1 - mmt_rate) * gradient
+    w_expected -= (1 - mmt_rate) * w_gradient_sum;
+    b_expected -= (1 - mmt_rate) * b_gradient_sum;
+
+    neurons::TMatrix<> w = layer.weights();
+    neurons::TMatrix<> b = layer.bias();
+    double max_err = 0;
+    for (lint i = 0; i < w.shape().size(); ++i)
+    {
+        max_err = std::max(max_err, std::abs(w.m_data[i] - w_expected.m_data[i]));
+    }
+    for (lint i = 0; i < b.shape().size(); ++i)
+    {
+        max_err = std::max(max_err, std::abs(b.m_data[i] - b_expected.m_data[i]));
+    }
+    std::cout << "Max error of weights and bias: " << max_err << (max_err < 1e-12 ? "  OK" : "  FAILED") << '\n';
+
+    // Ops see the updated weights without copying them
+    neurons::TMatrix<> x{ neurons::Shape{ 1, 120 }, 1 };
+    neurons::TMatrix<> y_expected = x * w + b;
+    double y_err = 0;
+    for (lint i = 0; i < threads; ++i)
+    {
+        neurons::TMatrix<> y = ops[i]->forward_propagate(x);
+        for (lint j = 0; j < y.shape().size(); ++j)
+        {
+            y_err = std::max(y_err, std::abs(y.m_data[j] - y_expected.m_data[j]));
+        }
+    }
+    std::cout << "Max error of outputs after commit: " << y_err << (y_err < 1e-9 ? "  OK" : "  FAILED") << '\n';
+}
+
+void test_image_store()
+{
+    std::cout << "=================== test_image_store ==================" << "\n";
+
+    dataset::Image_store images{ neurons::Shape{ 4, 3, 2 }, 5 };
+    images.resize(3);
+
+    std::uniform_int_distribution<int> pixel_dist{ 0, 255 };
+    for (lint i = 0; i < images.size(); ++i)
+    {
+        uint8_t *pixels = images.writable_pixels(i);
+        for (lint j = 0; j < images.image_shape().size(); ++j)
+        {
+            pixels[j] = static_cast<uint8_t>(pixel_dist(neurons::global::global_rand_engine));
+        }
+        images.set_label(i, static_cast<uint8_t>(i + 2));
+    }
+
+    std::vector<neurons::TMatrix<>> matrices;
+    std::vector<neurons::TMatrix<>> labels;
+    images.to_matrices(matrices, labels);
+    std::cout << "Number of matrices: " << matrices.size() << (3 == matrices.size() && 3 == labels.size() ? "  OK" : "  FAILED") << '\n';
+
+    // Lazy normalization gives the same samples as normalizing the matrices
+    neurons::Shape sample_shape{ 1, 4, 3, 2 };
+    neurons::TMatrix<> sample;
+    double max_err = 0;
+    bool labels_ok = true;
+    for (lint i = 0; i < images.size(); ++i)
+    {
+        neurons::TMatrix<> expected = matrices[i];
+        expected.left_extend_shape();
+        expected.normalize();
+
+        images.materialize(sample, i, sample_shape, dataset::Image_store::Scaling::standardize);
+        labels_ok = labels_ok && sample.shape() == sample_shape;
+        for (lint j = 0; j < sample.shape().size(); ++j)
+        {
+            max_err = std::max(max_err, std::abs(sample.m_data[j] - expected.m_data[j]));
+        }
+
+        labels_ok = labels_ok && labels[i].shape() == neurons::Shape{ 5 } && labels[i][{ i + 2 }] == 1;
+    }
+    std::cout << "Max error of standardized images: " << max_err << (max_err < 1e-12 ? "  OK" : "  FAILED") << '\n';
+    std::cout << "Shapes and labels: " << (labels_ok ? "OK" : "FAILED") << '\n';
+
+    neurons::TMatrix<float> unit;
+    images.materialize(unit, 1, neurons::Shape{ 24 }, dataset::Image_store::Scaling::unit);
+    float unit_err = 0;
+    for (lint j = 0; j < unit.shape().size(); ++j)
+    {
+        unit_err = std::max(unit_err, std::abs(unit.m_data[j] - images.pixels(1)[j] / 255.0f));
+    }
+    std::cout << "Max error of unit scaled image: " << unit_err << (unit_err < 1e-6 ? "  OK" : "  FAILED") << '\n';
+}
+
+void test_mapped_dataset()
+{
+    std::cout << "=================== test_mapped_dataset ==================" << "\n";
+
+    // Write a small MNIST pair of files, headers are big endian
+    const lint count = 5, rows = 4, cols = 3;
+    auto write_u32 = [](std::ofstream & os, uint32_t v)
+    {
+        char bytes[4] = { char(v >> 24), char(v >> 16), char(v >> 8), char(v) };
+        os.write(bytes, 4);
+    };
+
+    std::vector<uint8_t> pixels(count * rows * cols);
+    std::vector<uint8_t> labels(count);
+    for (size_t i = 0; i < pixels.size(); ++i)
+    {
+        pixels[i] = static_cast<uint8_t>(i * 7);
+    }
+    for (lint i = 0; i < count; ++i)
+    {
+        labels[i] = static_cast<uint8_t>(i % 3);
+    }
+
+    {
+        std::ofstream images_file{ "test_mapped_images.idx", std::ios::binary };
+        write_u32(images_file, 0x803); write_u32(images_file, count); write_u32(images_file, rows); write_u32(images_file, cols);
+        images_file.write(reinterpret_cast<const char *>(pixels.data()), pixels.size());
+
+        std::ofstream labels_file{ "test_mapped_labels.idx", std::ios::binary };
+        write_u32(labels_file, 0x801); write_u32(labels_file, count);
+        labels_file.write(reinterpret_cast<const char *>(labels.data()), labels.size());
+    }
+
+    dataset::Mnist mnist{ "test_mapped_images.idx", "test_mapped_labels.idx", "test_mapped_images.idx", "test_mapped_labels.idx" };
+    dataset::Image_store store;
+    mnist.get_training_store(store, 4);
+
+    bool mnist_ok = 4 == store.size() && 3 == store.classes() && neurons::Shape{ rows, cols, 1 } == store.image_shape();
+    for (lint i = 0; i < store.size(); ++i)
+    {
+        mnist_ok = mnist_ok && store.label(i) == labels[i] && store.pixels(i)[5] == pixels[i * rows * cols + 5];
+    }
+    std::cout << "Mapped MNIST files: " << (mnist_ok ? "OK" : "FAILED") << '\n';
+
+    std::remove("test_mapped_images.idx");
+    std::remove("test_mapped_labels.idx");
+
+    // CIFAR records: a label followed by planes of channels
+    const lint channels = 3, plane = rows * cols, record = 1 + channels * plane;
+    auto buffer = std::make_shared<std::vector<uint8_t>>(2 * record);
+    for (lint i = 0; i < 2; ++i)
+    {
+        (*buffer)[i * record] = static_cast<uint8_t>(i + 1);
+        for (lint j = 0; j < channels * plane; ++j)
+        {
+            (*buffer)[i * record + 1 + j] = static_cast<uint8_t>(i * 100 + j);
+        }
+    }
+
+    dataset::Image_store planar{ neurons::Shape{ rows, cols, channels }, 3 };
+    dataset::Image_store::Span span;
+    span.m_pixel_owner = buffer;
+    span.m_label_owner = buffer;
+    span.m_pixels = buffer->data() + 1;
+    span.m_labels = buffer->data();
+    span.m_images = 2;
+    span.m_image_stride = record;
+    span.m_label_stride = record;
+    span.m_planar = true;
+    planar.add_span(span);
+
+    neurons::TMatrix<> image;
+    planar.materialize(image, 1, planar.image_shape(), dataset::Image_store::Scaling::none);
+    bool planar_ok = 2 == planar.size() && 2 == planar.label(1);
+    for (lint i = 0; i < rows; ++i)
+    {
+        for (lint j = 0; j < cols; ++j)
+        {
+            for (lint c = 0; c < channels; ++c)
+            {
+                planar_ok = planar_ok && image[{ i, j, c }] == 100 + c * plane + i * cols + j;
+            }
+        }
+    }
+    std::cout << "Planar span: " << (planar_ok ? "OK" : "FAILED") << '\n';
+}
+
+void test_prefetch_pipeline()
+{
+    std::cout << "=================== test_prefetch_pipeline ==================" << "\n";
+
+    struct Batch
+    {
+        lint m_sequence;
+        std::vector<lint> m_values;
+    };
+
+    for (lint workers : { 0, 3 })
+    {
+        const lint depth = 2, batches = 50;
+        std::atomic<lint> planned{ 0 };
+        lint consumed = 0;
+        lint max_ahead = 0;
+
+        neurons::Prefetch_pipeline<Batch> pipeline{ workers, depth, batches,
+            [&planned](Batch & batch) { batch.m_sequence = planned++; },
+            [](Batch & batch)
+            {
+                batch.m_values.resize(1000);
+                for (lint i = 0; i < 1000; ++i)
+                {
+                    batch.m_values[i] = batch.m_sequence * i;
+                }
+            } };
+
+        bool in_order = true;
+        for (lint i = 0; i < batches; ++i)
+        {
+            Batch & batch = pipeline.next();
+            ++consumed;
+            max_ahead = std::max(max_ahead, planned.load() - consumed);
+            in_order = in_order && i == batch.m_sequence && i * 999 == batch.m_values[999];
+        }
+        std::cout << "Workers: " << workers << " batches in order: " << (in_order ? "OK" : "FAILED")
+            << " batches ahead: " << (max_ahead <= depth ? "OK" : "FAILED") << '\n';
+    }
+
+    // Exceptions of preparing a batch are rethrown when the batch is asked for
+    neurons::Prefetch_pipeline<Batch> failing{ 2, 2, 3,
+        [](Batch &) {},
+        [](Batch &) { throw std::invalid_argument(std::string("fill failed")); } };
+    try
+    {
+        failing.next();
+        std::cout << "Exception of batch: FAILED\n";
+    }
+    catch (std::invalid_argument & ex)
+    {
+        std::cout << "Exception of batch: " << ex.what() << "  OK\n";
+    }
+}
+
+void test_streamed_dataset()
+{
+    std::cout << "=================== test_streamed_dataset ==================" << "\n";
+
+    // 5 CIFAR batch files of 3 records each
+    const lint records = 3;
+    const lint image_len = 32 * 32 * 3;
+    for (lint f = 0; f < 5; ++f)
+    {
+        std::ofstream file{ "test_stream_data_batch_" + std::to_string(f + 1) + ".bin", std::ios::binary };
+        for (lint r = 0; r < records; ++r)
+        {
+            std::vector<char> record(image_len + 1);
+            record[0] = static_cast<char>((f * records + r) % 10);
+            for (lint j = 0; j < image_len; ++j)
+            {
+                record[j + 1] = static_cast<char>((f * records + r) * 13 + j);
+            }
+            file.write(record.data(), record.size());
+        }
+    }
+
+    dataset::CIFAR_10 cifar{ "test_stream_" };
+    dataset::Image_store mapped;
+    cifar.get_training_store(mapped);
+
+    // Shards of the stream cover the training set without overlapping, chunks cross files
+    bool shards_ok = true;
+    lint streamed = 0;
+    neurons::TMatrix<> expected;
+    neurons::TMatrix<> actual;
+    for (lint shard = 0; shard < 4; ++shard)
+    {
+        auto stream = cifar.open_training_stream(shard, 4);
+        dataset::Image_store chunk{ stream->image_shape(), stream->classes() };
+
+        for (lint pass = 0; pass < 2; ++pass)
+        {
+            chunk.resize(0);
+            while (stream->read(chunk, 2) > 0);
+            stream->rewind();
+        }
+
+        for (lint i = 0; i < chunk.size(); ++i)
+        {
+            mapped.materialize(expected, streamed + i, mapped.image_shape(), dataset::Image_store::Scaling::none);
+            chunk.materialize(actual, i, chunk.image_shape(), dataset::Image_store::Scaling::none);
+            shards_ok = shards_ok && expected == actual && mapped.label(streamed + i) == chunk.label(i);
+        }
+        streamed += chunk.size();
+    }
+    std::cout << "Streamed samples: " << streamed << (mapped.size() == streamed && shards_ok ? "  OK" : "  FAILED") << '\n';
+
+    // Every sample of the stream is drawn from the shuffle buffer sooner or later
+    dataset::Shuffle_buffer buffer{ cifar.open_training_stream(1, 2), 4, 3, 1 };
+    dataset::Image_store drawn{ buffer.image_shape(), buffer.classes() };
+    drawn.resize(1);
+    std::vector<lint> counts(10, 0);
+    for (lint i = 0; i < 200; ++i)
+    {
+        buffer.next(drawn, 0);
+        ++counts[drawn.label(0)];
+    }
+    // The second shard is records 7 ~ 14, whose labels are 7, 8, 9, 0, 1, 2, 3, 4
+    bool drawn_ok = 4 == buffer.size() && 0 == counts[5] && 0 == counts[6];
+    for (lint label : { 7, 8, 9, 0, 1, 2, 3, 4 })
+    {
+        drawn_ok = drawn_ok && counts[label] > 0;
+    }
+    std::cout << "Shuffle buffer: " << (drawn_ok ? "OK" : "FAILED") << '\n';
+
+    for (lint f = 0; f < 5; ++f)
+    {
+        std::remove(("test_stream_data_batch_" + std::to_string(f + 1) + ".bin").c_str());
+    }
+}
+
+// Train a two layer network on the samples in the precision of dtype, return its accuracy on them
+template <typename dtype>
+double train_of_type(const std::vector<neurons::TMatrix<>> & set, const std::vector<neurons::TMatrix<>> & labels)
+{
+    // Both precisions start from the same weights
+    neurons::global::global_rand_engine.seed(7);
+    neurons::FCNN_layer<dtype> hidden{ 0.3, set[0].shape().size(), 16, 1, new neurons::Tanh<dtype> };
+    neurons::FCNN_layer<dtype> output{ 0.3, 16, labels[0].shape().size(), 1, nullptr, new neurons::Softmax_CrossEntropy<dtype> };
+
+    std::vector<neurons::TMatrix<dtype>> inputs;
+    std::vector<neurons::TMatrix<dtype>> targets;
+    for (size_t i = 0; i < set.size(); ++i)
+    {
+        inputs.push_back(neurons::TMatrix<dtype>{ set[i] });
+        targets.push_back(neurons::TMatrix<dtype>{ labels[i] });
+    }
+
+    const size_t batch_size = 10;
+    for (lint epoch = 0; epoch < 30; ++epoch)
+    {
+        for (size_t begin = 0; begin < inputs.size(); begin += batch_size)
+        {
+            std::vector<const neurons::TMatrix<dtype> *> x, t;
+            for (size_t i = begin; i < begin + batch_size; ++i)
+            {
+                x.push_back(&inputs[i]);
+                t.push_back(&targets[i]);
+            }
+
+            std::vector<neurons::TMatrix<dtype>> h = hidden.operation_instances()[0]->batch_forward_propagate(x);
+            output.operation_instances()[0]->batch_forward_propagate(neurons::matrix_pointers(h), t);
+            hidden.operation_instances()[0]->batch_back_propagate(
+                0.01, output.operation_instances()[0]->batch_back_propagate(0.01));
+            hidden.commit_training();
+            output.commit_training();
+        }
+    }
+
+    double rights = 0;
+    std::vector<neurons::TMatrix<dtype>> preds = output.operation_instances()[0]->batch_forward_propagate(
+        hidden.operation_instances()[0]->batch_forward_propagate(inputs));
+    for (size_t i = 0; i < preds.size(); ++i)
+    {
+        if (preds[i].argmax() == targets[i].argmax())
+        {
+            rights += 1;
+        }
+    }
+
+    return rights / preds.size();
+}
+
+void test_float_training()
+{
+    std::cout << "=================== test_float_training ==================" << "\n";
+
+    // Samples of 3 classes around different centers
+    neurons::global::global_rand_engine.seed(3);
+    std::vector<neurons::TMatrix<>> centers;
+    for (lint c = 0; c < 3; ++c)
+    {
+        centers.push_back(neurons::TMatrix<>{ neurons::Shape{ 1, 8 } }.gaussian_random(0, 1));
+    }
+
+    std::vector<neurons::TMatrix<>> set;
+    std::vector<neurons::TMatrix<>> labels;
+    for (lint i = 0; i < 300; ++i)
+    {
+        neurons::TMatrix<> noise{ neurons::Shape{ 1, 8 } };
+        set.push_back(centers[i % 3] + noise.gaussian_random(0, 0.8));
+        labels.push_back(neurons::TMatrix<>{ neurons::Shape{ 1, 3 }, 0 });
+        labels.back().m_data[i % 3] = 1;
+    }
+
+    double acc_double = train_of_type<double>(set, labels);
+    double acc_float = train_of_type<float>(set, labels);
+
+    std::cout << "Accuracy of double: " << acc_double << " float: " << acc_float
+        << (acc_double > 0.8 && std::abs(acc_double - acc_float) <= 0.02 ? "  OK" : "  FAILED") << '\n';
+}
+
+void test_allocator()
+{
+    std::cout << "=================== test_allocator ==================" << "\n";
+
+    // Shapes and coordinates of few dimensions are inline, others are on the heap
+    neurons::Shape small{ 2, 3, 4 };
+    neurons::Shape large{ 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+    neurons::Shape moved_small{ std::move(neurons::Shape{ small }) };
+    neurons::Shape moved_large{ std::move(neurons::Shape{ large }) };
+    neurons::Shape extended{ small + large };
+    extended.left_extend();
+    bool shapes_ok = moved_small == small && moved_large == large &&
+        13 == extended.dim() && 1 == extended[0] && 2 == extended[1] && 9 == extended[12] &&
+        small.size() * large.size() == extended.size() && large == extended.sub_shape(4, 12);
+    neurons::Coordinate coord{ large };
+    for (lint i = 0; i < 100; ++i)
+    {
+        ++coord;
+    }
+    neurons::Coordinate coord_copy{ coord };
+    neurons::Coordinate coord_moved{ std::move(coord_copy) };
+    shapes_ok = shapes_ok && coord_moved == coord && 1 == coord_moved[8] && 3 == coord_moved[7] && 1 == coord_moved[6];
+    std::cout << "Inline and heap shapes: " << (shapes_ok ? "OK" : "FAILED") << '\n';
+
+    // Storage is aligned, and a freed block is reused by the next matrix of its size class
+    bool aligned = true;
+    for (lint size : { 1, 100, 1000000 })
+    {
+        neurons::TMatrix<> mat{ neurons::Shape{ size } };
+        aligned = aligned && 0 == reinterpret_cast<size_t>(mat.m_data) % neurons::Allocator::ALIGNMENT;
+    }
+    double *freed;
+    {
+        neurons::TMatrix<> mat{ neurons::Shape{ 30, 30 } };
+        freed = mat.m_data;
+    }
+    neurons::TMatrix<> reused{ neurons::Shape{ 31, 31 } };
+    std::cout << "Aligned storage: " << (aligned ? "OK" : "FAILED")
+        << " reused block: " << (freed == reused.m_data ? "OK" : "FAILED") << '\n';
+
+    // Steps after the first one get all blocks from the free lists
+    neurons::FCNN_layer<> layer{ 0.5, 50, 20, 1, new neurons::Tanh<> };
+    neurons::TMatrix<> x{ neurons::Shape{ 1, 50 } };
+    neurons::TMatrix<> E_to_y{ neurons::Shape{ 20, 1 } };
+    x.gaussian_random(0, 1);
+    E_to_y.gaussian_random(0, 1);
+    for (lint step = 0; step < 3; ++step)
+    {
+        layer.operation_instances()[0]->forward_propagate(x);
+        layer.operation_instances()[0]->back_propagate(0.1, E_to_y);
+        layer.commit_training();
+        neurons::end_allocation_step();
+    }
+    neurons::Allocation_count count = neurons::last_step_allocations();
+    std::cout << "Allocations of a step: " << count.m_allocations << " from the system: " << count.m_system_allocations
+        << (count.m_allocations > 0 && 0 == count.m_system_allocations ? "  OK" : "  FAILED") << '\n';
+
+    // An allocator wrapping the one it replaces
+    struct Counting_allocator : public neurons::Allocator
+    {
+        std::shared_ptr<neurons::Allocator> m_wrapped;
+        lint m_allocations = 0;
+
+        virtual void * allocate(size_t bytes)
+        {
+            ++this->m_allocations;
+            return this->m_wrapped->allocate(bytes);
+        }
+
+        virtual void deallocate(void *block, size_t bytes)
+        {
+            this->m_wrapped->deallocate(block, bytes);
+        }
+    };
+    auto counting = std::make_shared<Counting_allocator>();
+    counting->m_wrapped = neurons::set_matrix_allocator(counting);
+    {
+        neurons::TMatrix<> a{ neurons::Shape{ 10, 10 }, 1 };
+        neurons::TMatrix<> b = a * a;
+    }
+    neurons::set_matrix_allocator(counting->m_wrapped);
+    std::cout << "Replaced allocator: " << counting->m_allocations << (counting->m_allocations >= 2 ? "  OK" : "  FAILED") << '\n';
+
+    // Blocks allocated by a thread and freed by another one, without steps: the free lists
+    // of the freeing thread stay within their limit
+    lint cached_before = neurons::cached_matrix_bytes();
+    std::mutex handed_mutex;
+    std::condition_variable handed_cv;
+    std::deque<neurons::TMatrix<>> handed;
+    bool handed_all = false;
+    std::thread freeing{ [&]
+    {
+        std::unique_lock<std::mutex> lock{ handed_mutex };
+        while (!handed_all || !handed.empty())
+        {
+            handed_cv.wait(lock, [&] { return handed_all || !handed.empty(); });
+            while (!handed.empty())
+            {
+                handed.pop_front();
+            }
+            handed_cv.notify_all();
+        }
+    } };
+    lint max_cached = 0;
+    for (lint i = 0; i < 20000; ++i)
+    {
+        neurons::TMatrix<> request{ neurons::Shape{ 2048 } };
+        std::unique_lock<std::mutex> lock{ handed_mutex };
+        handed_cv.wait(lock, [&] { return handed.size() < 64; });
+        handed.push_back(std::move(request));
+        handed_cv.notify_all();
+        if (0 == i % 1000)
+        {
+            lock.unlock();
+            max_cached = std::max(max_cached, neurons::cached_matrix_bytes() - cached_before);
+        }
+    }
+    {
+        std::unique_lock<std::mutex> lock{ handed_mutex };
+        handed_cv.wait(lock, [&] { return handed.empty(); });
+        max_cached = std::max(max_cached, neurons::cached_matrix_bytes() - cached_before);
+        handed_all = true;
+        handed_cv.notify_all();
+    }
+    freeing.join();
+    std::cout << "Blocks freed by another thread: " << (
+        max_cached <= static_cast<lint>(neurons::Pool_allocator::MAX_CACHED_BYTES) ? "OK" : "FAILED") << '\n';
+}
+
+void test_tensor_view()
+{
+    std::cout << "=================== test_tensor_view ==================" << "\n";
+
+    auto same = [](const neurons::TMatrix<> & a, const neurons::TMatrix<> & b)
+    {
+        if (a.shape() != b.shape())
+        {
+            return false;
+        }
+        for (lint i = 0; i < a.shape().size(); ++i)
+        {
+            if (std::abs(a.m_data[i] - b.m_data[i]) > 1e-9)
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    neurons::TMatrix<> a{ neurons::Shape{ 7, 5 } };
+    neurons::TMatrix<> b{ neurons::Shape{ 7, 4 } };
+    neurons::TMatrix<> c{ neurons::Shape{ 4, 5 } };
+    a.gaussian_random(0, 1);
+    b.gaussian_random(0, 1);
+    c.gaussian_random(0, 1);
+
+    // Transposes are metadata only
+    neurons::TMatrix_View<> a_t = neurons::transposed(a);
+    bool metadata_ok = a_t.data() == a.m_data && 1 == a_t.stride(0) && 5 == a_t.stride(1) && !a_t.is_contiguous()
+        && same(a_t.materialize(), neurons::transpose(a)) && a_t.at(neurons::Coordinate{ 3, 6 }) == a[{ 6, 3 }];
+    std::cout << "Transposed view: " << (metadata_ok ? "OK" : "FAILED") << '\n';
+
+    // Products of transposed views go to gemm without copies
+    bool gemm_ok = same(neurons::transposed(b) * a, neurons::transpose(b) * a)
+        && same(a * neurons::transposed(c), a * neurons::transpose(c))
+        && same(neurons::transposed(c) * neurons::transposed(b), neurons::transpose(c) * neurons::transpose(b));
+    std::cout << "Products of views: " << (gemm_ok ? "OK" : "FAILED") << '\n';
+
+    // Slices and selections
+    neurons::TMatrix_View<> rows = neurons::view(a).slice(0, 2, 5);
+    neurons::TMatrix_View<> cols = neurons::view(a).slice(1, 1, 3);
+    neurons::TMatrix_View<> column = neurons::view(a).select(1, 4);
+    bool slices_ok = rows.is_contiguous() && rows.data() == a.m_data + 10 && neurons::Shape{ 3, 5 } == rows.shape()
+        && !cols.is_contiguous() && cols.at(neurons::Coordinate{ 6, 1 }) == a[{ 6, 2 }]
+        && neurons::Shape{ 7 } == column.shape() && column.at(neurons::Coordinate{ 2 }) == a[{ 2, 4 }]
+        && same(cols * neurons::TMatrix<>{ neurons::Shape{ 2, 3 }, 1 }, cols.materialize() * neurons::TMatrix<>{ neurons::Shape{ 2, 3 }, 1 });
+    std::cout << "Slices: " << (slices_ok ? "OK" : "FAILED") << '\n';
+
+    // Element by element operations between views of different strides
+    neurons::TMatrix<> at_copy = neurons::transpose(a);
+    neurons::TMatrix<> b_sq{ neurons::Shape{ 5, 5 } };
+    b_sq.gaussian_random(0, 1);
+    bool elementwise_ok = same(neurons::multiply(a_t, at_copy), neurons::multiply(at_copy, at_copy))
+        && same(a_t + at_copy, at_copy + at_copy)
+        && same(neurons::transposed(b_sq) - b_sq, neurons::transpose(b_sq) - b_sq);
+    std::cout << "Element by element: " << (elementwise_ok ? "OK" : "FAILED") << '\n';
+
+    // One pass reductions agree with chained reduce_mean
+    neurons::TMatrix<> z{ neurons::Shape{ 1, 6, 5, 3 } };
+    z.gaussian_random(0, 1);
+    bool reduce_ok = same(neurons::reduce_mean(neurons::view(z), { 1, 2 }), z.reduce_mean(1).reduce_mean(1))
+        && same(neurons::reduce_sum(neurons::view(z), { 2 }), z.fuse(2))
+        && std::abs(neurons::sum(neurons::transposed(z)) - z.mean() * z.shape().size()) < 1e-9
+        && neurons::Shape{ 1 } == neurons::reduce_sum(neurons::view(z), { 0, 1, 2, 3 }).shape();
+    std::cout << "Reductions: " << (reduce_ok ? "OK" : "FAILED") << '\n';
+
+    bool thrown = false;
+    try
+    {
+        neurons::transposed(a).reshape(neurons::Shape{ 35 });
+    }
+    catch (std::invalid_argument &)
+    {
+        thrown = true;
+    }
+    std::cout << "Reshape of a strided view: " << (thrown ? "OK" : "FAILED") << '\n';
+}
+
+void test_matrix_expressions()
+{
+    std::cout << "=================== test_matrix_expressions ==================" << "\n";
+
+    neurons::TMatrix<> a{ neurons::Shape{ 30, 40 } };
+    neurons::TMatrix<> b{ neurons::Shape{ 30, 40 } };
+    neurons::TMatrix<> c{ neurons::Shape{ 30, 40 } };
+    neurons::TMatrix<> d{ neurons::Shape{ 1200 } };
+    a.gaussian_random(0, 1);
+    b.gaussian_random(0, 1);
+    c.gaussian_random(0, 1);
+    d.gaussian_random(0, 1);
+    double rate = 0.9;
+
+    // A whole right-hand side is one loop and one allocation
+    neurons::end_allocation_step();
+    neurons::TMatrix<> y = rate * a + (1 - rate) * neurons::multiply(b, c) - d / 2.0;
+    neurons::end_allocation_step();
+    lint allocations = neurons::last_step_allocations().m_allocations;
+
+    bool values_ok = neurons::Shape{ 30, 40 } == y.shape();
+    for (lint i = 0; i < 1200; ++i)
+    {
+        double expected = rate * a.m_data[i] + (1 - rate) * b.m_data[i] * c.m_data[i] - d.m_data[i] / 2.0;
+        values_ok = values_ok && std::abs(y.m_data[i] - expected) < 1e-12;
+    }
+    std::cout << "Fused expression: " << (values_ok ? "OK" : "FAILED")
+        << " allocations: " << allocations << (1 == allocations ? "  OK" : "  FAILED") << '\n';
+
+    // Assigning to an operand is done in place
+    neurons::TMatrix<> a_copy{ a };
+    neurons::end_allocation_step();
+    a = a * 2.0 - b;
+    a += multiply(b, b);
+    neurons::end_allocation_step();
+    allocations = neurons::last_step_allocations().m_allocations;
+    bool in_place_ok = 0 == allocations;
+    for (lint i = 0; i < 1200; ++i)
+    {
+        double expected = a_copy.m_data[i] * 2.0 - b.m_data[i] + b.m_data[i] * b.m_data[i];
+        in_place_ok = in_place_ok && std::abs(a.m_data[i] - expected) < 1e-12;
+    }
+    std::cout << "Assignment in place: " << (in_place_ok ? "OK" : "FAILED") << '\n';
+
+    // Temporaries are owned by the expression, expressions convert to matrices where matrices are expected
+    neurons::TMatrix<> w{ neurons::Shape{ 40, 5 }, 0.5 };
+    neurons::TMatrix<> bias{ neurons::Shape{ 30, 5 }, 1 };
+    neurons::TMatrix<> z = a * w + b * w + bias;
+    neurons::TMatrix<> expected_z = neurons::matrix_multiply(a, w);
+    expected_z += neurons::matrix_multiply(b, w);
+    expected_z += bias;
+    neurons::TMatrix<> product = (a + b) * w;
+    std::vector<neurons::TMatrix<>> matrices;
+    matrices.push_back(z - bias);
+    bool temporaries_ok = z == expected_z && (z - bias).eval() == matrices[0]
+        && std::abs(product.euclidean_norm() - (z - bias).eval().euclidean_norm()) < 1e-9;
+    std::cout << "Temporaries and conversions: " << (temporaries_ok ? "OK" : "FAILED") << '\n';
+
+    bool thrown = false;
+    try
+    {
+        neurons::TMatrix<> wrong = neurons::multiply(a, d);
+    }
+    catch (std::invalid_argument &)
+    {
+        thrown = true;
+    }
+    std::cout << "Operands of different shapes: " << (thrown ? "OK" : "FAILED") << '\n';
+}
+
+// Permutation of dimensions element by element, as a reference
+template <typename dtype>
+neurons::TMatrix<dtype> permute_by_coordinates(const neurons::TMatrix<dtype> & in, const std::vector<lint> & axes)
+{
+    std::vector<lint> out_dims;
+    for (lint axis : axes)
+    {
+        out_dims.push_back(in.shape()[axis]);
+    }
+
+    neurons::TMatrix<dtype> out{ neurons::Shape{ out_dims } };
+    neurons::Coordinate in_pos{ in.shape() };
+    neurons::Coordinate out_pos{ out.shape() };
+    for (lint i = 0; i < in.shape().size(); ++i, ++in_pos)
+    {
+        for (size_t d = 0; d < axes.size(); ++d)
+        {
+            out_pos[d] = in_pos[axes[d]];
+        }
+        out[out_pos] = in[in_pos];
+    }
+
+    return out;
+}
+
+template <typename dtype>
+bool permute_of_type(const neurons::Shape & shape, const std::vector<lint> & axes)
+{
+    neurons::TMatrix<dtype> in{ shape };
+    for (lint i = 0; i < shape.size(); ++i)
+    {
+        in.m_data[i] = static_cast<dtype>(i % 1009 - 500);
+    }
+
+    return neurons::permute(in, axes) == permute_by_coordinates(in, axes);
+}
+
+void test_permute()
+{
+    std::cout << "=================== test_permute ==================" << "\n";
+
+    bool planes_ok = true;
+    for (lint rows : { 1, 7, 8, 37, 64, 129 })
+    {
+        for (lint cols : { 3, 8, 16, 53, 100 })
+        {
+            planes_ok = planes_ok && permute_of_type<double>(neurons::Shape{ rows, cols }, { 1, 0 })
+                && permute_of_type<float>(neurons::Shape{ rows, cols }, { 1, 0 })
+                && permute_of_type<lint>(neurons::Shape{ rows, cols }, { 1, 0 });
+        }
+    }
+    std::cout << "Transposes of planes: " << (planes_ok ? "OK" : "FAILED") << '\n';
+
+    // NHWC <-> NCHW, reversals, and permutations keeping the last dimension
+    bool permutations_ok = permute_of_type<double>(neurons::Shape{ 4, 13, 11, 6 }, { 0, 3, 1, 2 })
+        && permute_of_type<double>(neurons::Shape{ 4, 6, 13, 11 }, { 0, 2, 3, 1 })
+        && permute_of_type<float>(neurons::Shape{ 2, 40, 40, 9 }, { 0, 3, 1, 2 })
+        && permute_of_type<double>(neurons::Shape{ 3, 5, 7, 2, 4 }, { 4, 3, 2, 1, 0 })
+        && permute_of_type<double>(neurons::Shape{ 5, 1, 6, 7 }, { 2, 0, 1, 3 })
+        && permute_of_type<double>(neurons::Shape{ 9, 10, 11 }, { 1, 2, 0 })
+        && permute_of_type<float>(neurons::Shape{ 9, 10, 11 }, { 0, 1, 2 });
+
+    neurons::TMatrix<> nhwc{ neurons::Shape{ 2, 5, 6, 3 } };
+    nhwc.gaussian_random(0, 1);
+    neurons::TMatrix<> nchw = neurons::permute(nhwc, { 0, 3, 1, 2 });
+    permutations_ok = permutations_ok && neurons::Shape{ 2, 3, 5, 6 } == nchw.shape()
+        && nhwc == neurons::permute(nchw, { 0, 2, 3, 1 })
+        && neurons::transpose(nhwc) == permute_by_coordinates(nhwc, { 3, 2, 1, 0 });
+    std::cout << "Permutations: " << (permutations_ok ? "OK" : "FAILED") << '\n';
+
+    // The scalar tiles give the same results as the SIMD ones
+    neurons::GEMM_kernel original = neurons::gemm_kernel();
+    neurons::gemm_set_kernel(neurons::GEMM_kernel::scalar);
+    bool scalar_ok = permute_of_type<double>(neurons::Shape{ 37, 53 }, { 1, 0 })
+        && permute_of_type<float>(neurons::Shape{ 3, 17, 33 }, { 2, 0, 1 });
+    neurons::gemm_set_kernel(original);
+    std::cout << "Scalar tiles: " << (scalar_ok ? "OK" : "FAILED") << '\n';
+
+    bool thrown = false;
+    try
+    {
+        neurons::permute(nhwc, { 0, 1, 1, 2 });
+    }
+    catch (std::invalid_argument &)
+    {
+        thrown = true;
+    }
+    std::cout << "Invalid axes: " << (thrown ? "OK" : "FAILED") << '\n';
+}
+
+// The old transpose walking the result with a coordinate carry per element
+template <typename dtype>
+void transpose_by_carry(const neurons::TMatrix<dtype> & in, neurons::TMatrix<dtype> & transposed)
+{
+    neurons::Shape reversed_shape{ neurons::reverse(in.shape()) };
+    lint size = in.shape().size();
+    lint dim_size = reversed_shape.dim();
+    std::vector<lint> coord_cache(dim_size, 0);
+    std::vector<lint> jump_forward_cache(dim_size, 1);
+    for (lint i = dim_size - 2; i >= 0; --i)
+    {
+        jump_forward_cache[i] = jump_forward_cache[i + 1] * reversed_shape[i + 1];
+    }
+
+    dtype *ele_pos = transposed.m_data;
+    for (lint i = 0; i < size; ++i)
+    {
+        *ele_pos = in.m_data[i];
+
+        for (lint plus_pos = 0; plus_pos < dim_size; ++plus_pos)
+        {
+            if (++coord_cache[plus_pos] < reversed_shape[plus_pos])
+            {
+                ele_pos += jump_forward_cache[plus_pos];
+                break;
+            }
+            coord_cache[plus_pos] = 0;
+            ele_pos -= jump_forward_cache[plus_pos] * (reversed_shape[plus_pos] - 1);
+        }
+    }
+}
+
+void bench_transpose()
+{
+    std::cout << "=================== bench_transpose ==================" << "\n";
+
+    std::vector<neurons::Shape> shapes{
+        neurons::Shape{ 1024, 1024 },
+        neurons::Shape{ 3000, 700 },
+        neurons::Shape{ 64, 28, 28, 32 }
+    };
+
+    for (const neurons::Shape & shape : shapes)
+    {
+        neurons::TMatrix<> in{ shape };
+        in.gaussian_random(0, 1);
+        neurons::TMatrix<> out{ neurons::reverse(shape) };
+        lint repeats = 10;
+
+        lint start = neurons::now_in_milliseconds();
+        for (lint r = 0; r < repeats; ++r)
+        {
+            transpose_by_carry(in, out);
+        }
+        double carry_ms = static_cast<double>(neurons::now_in_milliseconds() - start) / repeats;
+
+        start = neurons::now_in_milliseconds();
+        for (lint r = 0; r < repeats; ++r)
+        {
+            out = neurons::transpose(in);
+        }
+        double blocked_ms = static_cast<double>(neurons::now_in_milliseconds() - start) / repeats;
+
+        std::cout << shape << " coordinate carry: " << carry_ms << " ms, blocked: " << blocked_ms << " ms\n";
+    }
+
+    // Layout conversion of a batch of feature maps
+    neurons::TMatrix<> nhwc{ neurons::Shape{ 64, 28, 28, 32 } };
+    nhwc.gaussian_random(0, 1);
+    lint start = neurons::now_in_milliseconds();
+    neurons::TMatrix<> nchw = neurons::permute(nhwc, { 0, 3, 1, 2 });
+    std::cout << "NHWC to NCHW of " << nhwc.shape() << ": " << neurons::now_in_milliseconds() - start << " ms\n";
+}
+
+// Max or average of a window computed directly from coordinates
+double pooled_by_coordinates(const neurons::TMatrix<> & in, bool max, lint n, lint top, lint left,
+    lint k_rows, lint k_cols, lint ch)
+{
+    double result = max ? -1e300 : 0;
+    for (lint r = top; r < top + k_rows; ++r)
+    {
+        for (lint c = left; c < left + k_cols; ++c)
+        {
+            double ele = in[{ n, r, c, ch }];
+            result = max ? std::max(result, ele) : result + ele / (k_rows * k_cols);
+        }
+    }
+    return result;
+}
+
+void test_pooling_types()
+{
+    std::cout << "=================== test_pooling_types ==================" << "\n";
+
+    neurons::Shape in_sh{ 2, 7, 9, 4 };
+    neurons::Shape k_sh{ 1, 3, 3, 4 };
+    neurons::TMatrix<> input{ in_sh };
+    input.uniform_random(-5, 5);
+
+    // Overlapping windows: 3 x 3 kernels moving by 2
+    for (neurons::Pooling_type type : { neurons::Pooling_type::max, neurons::Pooling_type::average })
+    {
+        bool max = neurons::Pooling_type::max == type;
+        std::unique_ptr<neurons::Pooling_2d<>> pool = neurons::make_pooling_2d<double>(type, in_sh, k_sh, 2, 2);
+        neurons::TMatrix<> output = (*pool)(input);
+
+        bool forward_ok = neurons::Shape{ 2, 3, 4, 4 } == output.shape();
+        for (neurons::Coordinate pos{ output.shape() }, end{ output.shape() }; forward_ok; )
+        {
+            double expected = pooled_by_coordinates(input, max, pos[0], pos[1] * 2, pos[2] * 2, 3, 3, pos[3]);
+            forward_ok = std::abs(output[pos] - expected) < 1e-12;
+            if (++pos == end)
+            {
+                break;
+            }
+        }
+
+        // Derivatives of E = sum(dE/dy * y) against finite differences
+        neurons::TMatrix<> E_to_y{ output.shape() };
+        E_to_y.gaussian_random(0, 1);
+        neurons::TMatrix<> E_to_x = pool->back_propagate(E_to_y);
+
+        std::unique_ptr<neurons::Pooling_2d<>> shifted_pool = pool->clone();
+        double max_err = 0;
+        for (lint i = 0; i < in_sh.size(); i += 7)
+        {
+            neurons::TMatrix<> shifted{ input };
+            shifted.m_data[i] += 1e-6;
+            neurons::TMatrix<> shifted_output = (*shifted_pool)(shifted);
+            double numeric = neurons::dot_product(E_to_y, (shifted_output - output).eval()) / 1e-6;
+            max_err = std::max(max_err, std::abs(numeric - E_to_x.m_data[i]));
+        }
+
+        std::cout << (max ? "Max" : "Average") << " pooling of overlapping windows: " << (forward_ok ? "OK" : "FAILED")
+            << " derivatives: " << (max_err < 1e-5 ? "OK" : "FAILED") << '\n';
+    }
+
+    // Global pooling gives one value per sample and channel
+    neurons::Pooling_layer<> global{ in_sh, neurons::Pooling_type::average, 1 };
+    std::vector<neurons::TMatrix<>> pooled = global.operation_instances()[0]->forward_propagate({ input });
+    bool global_ok = neurons::Shape{ 2, 1, 1, 4 } == global.output_shape() && neurons::Shape{ 2, 1, 1, 4 } == pooled[0].shape()
+        && std::abs(pooled[0][{ 1, 0, 0, 2 }] - pooled_by_coordinates(input, false, 1, 0, 0, 7, 9, 2)) < 1e-12;
+    std::vector<neurons::TMatrix<>> spread = global.operation_instances()[0]->back_propagate({ neurons::TMatrix<>{ pooled[0].shape(), 63 } });
+    global_ok = global_ok && std::abs(spread[0][{ 1, 4, 8, 3 }] - 1) < 1e-12;
+    std::cout << "Global pooling: " << (global_ok ? "OK" : "FAILED") << '\n';
+}
+
+// Largest difference between elements of two matrices of the same size
+double max_difference(const neurons::TMatrix<> & a, const neurons::TMatrix<> & b)
+{
+    double max_diff = 0;
+    for (lint i = 0; i < a.shape().size(); ++i)
+    {
+        max_diff = std::max(max_diff, std::abs(a.m_data[i] - b.m_data[i]));
+    }
+    return max_diff;
+}
+
+void test_conv_parallelism()
+{
+    std::cout << "=================== test_conv_parallelism ==================" << "\n";
+
+    std::shared_ptr<neurons::Thread_pool> pool = neurons::Thread_pool::process_pool(4);
+
+    // Threads given to operations
+    {
+        neurons::Intra_op_scope scope{ 4 };
+        std::atomic<lint> chunks{ 0 };
+        std::atomic<lint> chunk_threads{ 0 };
+        pool->parallel_for(0, 2, [&](lint, lint)
+        {
+            ++chunks;
+            chunk_threads += pool->intra_op_threads();
+        });
+        std::cout << "Threads of 2 chunks: " << chunk_threads.load() << " in " << chunks.load() << " chunks"
+            << (2 == chunks.load() && 4 == chunk_threads.load() ? "  OK" : "  FAILED") << '\n';
+
+        neurons::Intra_op_scope inner{ 1 };
+        std::cout << "Threads of a single-threaded scope: " << pool->intra_op_threads()
+            << (1 == pool->intra_op_threads() ? "  OK" : "  FAILED") << '\n';
+    }
+    std::cout << "Threads out of scopes: " << pool->intra_op_threads()
+        << (pool->concurrency() == pool->intra_op_threads() ? "  OK" : "  FAILED") << '\n';
+
+    // [in_rows, in_cols, chls, w_rows, w_cols, filters, stride, padding], batches of 6 samples.
+    // Overlapping patches, padding and strides make rows of the input gather several patches.
+    std::vector<std::vector<lint>> configs{
+        { 24, 24, 8, 5, 5, 16, 1, 2 },
+        { 31, 27, 6, 4, 3, 24, 2, 1 }
+    };
+
+    bool all_equal = true;
+    for (const std::vector<lint> & cfg : configs)
+    {
+        neurons::Shape in_sh{ 6, cfg[0], cfg[1], cfg[2] };
+        neurons::Shape w_sh{ cfg[3], cfg[4], cfg[2], cfg[5] };
+        neurons::Conv_2d<> conv{ in_sh, w_sh, cfg[6], cfg[6], cfg[7], cfg[7] };
+
+        neurons::TMatrix<> x{ in_sh };
+        neurons::TMatrix<> w{ w_sh };
+        neurons::TMatrix<> diff_E_to_z{ conv.get_output_shape() };
+        x.gaussian_random(0, 1);
+        w.gaussian_random(0, 1);
+        diff_E_to_z.gaussian_random(0, 1);
+
+        neurons::TMatrix<> z[2];
+        neurons::TMatrix<> diff_E_to_x[2];
+        neurons::TMatrix<> diff_E_to_w[2]{ neurons::TMatrix<>{ w_sh, 0 }, neurons::TMatrix<>{ w_sh, 0 } };
+
+        // Single-threaded, then split over all threads of the pool
+        for (lint threads : { 1, 4 })
+        {
+            neurons::Intra_op_scope scope{ threads };
+            lint k = 1 == threads ? 0 : 1;
+
+            conv.product(z[k], x, w);
+            diff_E_to_x[k] = conv.diff_to_input(diff_E_to_z, w);
+            conv.add_diff_to_weights(diff_E_to_w[k], x, diff_E_to_z);
+        }
+
+        double diff = std::max(max_difference(z[0], z[1]),
+            std::max(max_difference(diff_E_to_x[0], diff_E_to_x[1]), max_difference(diff_E_to_w[0], diff_E_to_w[1])));
+        all_equal = all_equal && diff < 1e-9;
+
+        std::cout << "Product and derivatives of " << in_sh << " by " << w_sh << " on 1 and 4 threads: "
+            << (diff < 1e-9 ? "equal  OK" : "different  FAILED") << '\n';
+    }
+
+    std::cout << "Convolution split over threads: " << (all_equal ? "OK" : "FAILED") << '\n';
+}
+
+void bench_conv_parallelism()
+{
+    std::cout << "=================== bench_conv_parallelism ==================" << "\n";
+
+    lint hardware = std::max<lint>(std::thread::hardware_concurrency(), 1);
+    std::shared_ptr<neurons::Thread_pool> pool = neurons::Thread_pool::process_pool(hardware);
+
+    // Latency of a single image, [batch, rows, cols, channels] by [rows, cols, channels, filters]
+    std::vector<std::pair<neurons::Shape, neurons::Shape>> shapes{
+        { neurons::Shape{ 1, 28, 28, 1 }, neurons::Shape{ 5, 5, 1, 32 } },
+        { neurons::Shape{ 1, 64, 64, 16 }, neurons::Shape{ 3, 3, 16, 32 } },
+        { neurons::Shape{ 4, 56, 56, 64 }, neurons::Shape{ 3, 3, 64, 64 } }
+    };
+
+    for (const auto & shape : shapes)
+    {
+        neurons::Conv_2d<float> conv{ shape.first, shape.second, 1, 1, 1, 1 };
+        neurons::TMatrix<float> x{ shape.first };
+        neurons::TMatrix<float> w{ shape.second };
+        neurons::TMatrix<float> diff_E_to_z{ conv.get_output_shape(), 1 };
+        neurons::TMatrix<float> diff_E_to_w{ shape.second, 0 };
+        neurons::TMatrix<float> z;
+        lint repeats = 20;
+
+        std::cout << shape.first << " by " << shape.second << '\n';
+        for (lint threads : { lint{ 1 }, hardware })
+        {
+            neurons::Intra_op_scope scope{ threads };
+
+            lint start = neurons::now_in_milliseconds();
+            for (lint r = 0; r < repeats; ++r)
+            {
+                conv.product(z, x, w);
+            }
+            double forward_ms = static_cast<double>(neurons::now_in_milliseconds() - start) / repeats;
+
+            start = neurons::now_in_milliseconds();
+            for (lint r = 0; r < repeats; ++r)
+            {
+                conv.diff_to_input(diff_E_to_z, w);
+                conv.add_diff_to_weights(diff_E_to_w, x, diff_E_to_z);
+            }
+            double backward_ms = static_cast<double>(neurons::now_in_milliseconds() - start) / repeats;
+
+            std::cout << "    " << threads << " threads, forward: " << forward_ms << " ms, dX and dW: " << backward_ms << " ms\n";
+        }
+    }
+}
+
+template <typename dtype>
+void test_winograd_of_type(const std::string & type_name, double tolerance_2, double tolerance_4)
+{
+    // [in rows, in cols, chls, filters, zero padding], batches of 2 samples.
+    // Sizes which are not multiples of tiles leave tiles partly past the input and the output.
+    std::vector<std::vector<lint>> configs{
+        { 8, 8, 1, 4, 0 },
+        { 11, 9, 3, 5, 1 },
+        { 16, 13, 16, 24, 2 },
+        { 3, 4, 2, 3, 0 }
+    };
+
+    for (const std::vector<lint> & cfg : configs)
+    {
+        neurons::Shape in_sh{ 2, cfg[0], cfg[1], cfg[2] };
+        neurons::Shape w_sh{ 3, 3, cfg[2], cfg[3] };
+
+        neurons::Conv_2d<dtype> direct{ in_sh, w_sh, 1, 1, cfg[4], cfg[4] };
+        direct.set_winograd(false);
+
+        neurons::TMatrix<dtype> x{ neurons::TMatrix<>{ in_sh }.gaussian_random(0, 1) };
+        neurons::TMatrix<dtype> w{ neurons::TMatrix<>{ w_sh }.gaussian_random(0, 1) };
+        neurons::TMatrix<dtype> z_direct;
+        direct.product(z_direct, x, w);
+
+        double z_max = 0;
+        for (lint i = 0; i < z_direct.shape().size(); ++i)
+        {
+            z_max = std::max(z_max, std::abs(static_cast<double>(z_direct.m_data[i])));
+        }
+
+        for (lint tile : { 2, 4 })
+        {
+            neurons::Winograd_2d<dtype> winograd{ in_sh, w_sh, cfg[4], cfg[4], tile };
+            neurons::TMatrix<dtype> z;
+            winograd.product(z, x, w);
+
+            double max_err = 0;
+            for (lint i = 0; i < z.shape().size(); ++i)
+            {
+                max_err = std::max(max_err, std::abs(static_cast<double>(z.m_data[i]) - z_direct.m_data[i]));
+            }
+
+            // Relative to the largest element of the output
+            double tolerance = 2 == tile ? tolerance_2 : tolerance_4;
+            bool ok = z.shape() == z_direct.shape() && max_err <= tolerance * z_max;
+
+            std::cout << type_name << " F(" << tile << "x" << tile << ", 3x3) of " << in_sh << " padding " << cfg[4] << ": "
+                << (ok ? "OK" : "FAILED") << '\n';
+        }
+    }
+}
+
+void test_winograd()
+{
+    std::cout << "=================== test_winograd ==================" << "\n";
+
+    test_winograd_of_type<double>("double", 1e-13, 1e-12);
+    test_winograd_of_type<float>("float", 1e-5, 1e-4);
+
+    // Conv_2d only selects Winograd convolution for filters of 3 x 3 with stride 1
+    neurons::Conv_2d<> conv_3x3{ neurons::Shape{ 1, 32, 32, 32 }, neurons::Shape{ 3, 3, 32, 32 }, 1, 1, 1, 1 };
+    neurons::Conv_2d<> conv_strided{ neurons::Shape{ 1, 32, 32, 32 }, neurons::Shape{ 3, 3, 32, 32 }, 2, 2, 1, 1 };
+    neurons::Conv_2d<> conv_5x5{ neurons::Shape{ 1, 32, 32, 32 }, neurons::Shape{ 5, 5, 32, 32 }, 1, 1, 1, 1 };
+
+    bool selected = conv_3x3.uses_winograd() && !conv_strided.uses_winograd() && !conv_5x5.uses_winograd();
+    std::cout << "Winograd convolution selected for 3x3 with stride 1 only: " << (selected ? "OK" : "FAILED") << '\n';
+
+    // ... and only if the product is large enough, unless it is asked for
+    neurons::Conv_2d<> conv_small{ neurons::Shape{ 1, 8, 7, 6 }, neurons::Shape{ 3, 3, 6, 30 } };
+    bool small_direct = !conv_small.uses_winograd();
+    conv_small.set_winograd(true);
+    std::cout << "Small products multiplied directly: " << (small_direct && conv_small.uses_winograd() ? "OK" : "FAILED") << '\n';
+}
+
+void bench_winograd()
+{
+    std::cout << "=================== bench_winograd ==================" << "\n";
+
+    // Single images, [batch, rows, cols, channels] by 3 x 3 filters
+    std::vector<std::pair<neurons::Shape, lint>> shapes{
+        { neurons::Shape{ 1, 8, 7, 6 }, 30 },
+        { neurons::Shape{ 1, 56, 56, 64 }, 64 },
+        { neurons::Shape{ 1, 28, 28, 128 }, 128 },
+        { neurons::Shape{ 8, 32, 32, 32 }, 32 }
+    };
+
+    for (const auto & shape : shapes)
+    {
+        neurons::Shape w_sh{ 3, 3, shape.first[3], shape.second };
+        neurons::Conv_2d<float> conv{ shape.first, w_sh, 1, 1, 1, 1 };
+        neurons::TMatrix<float> x{ shape.first, 1 };
+        neurons::TMatrix<float> w{ w_sh, 1 };
+        neurons::TMatrix<float> z;
+
+        // Multiplications of the products, the transforms are mostly additions
+        lint tile = neurons::Winograd_2d<float>{ shape.first, w_sh, 1, 1 }.tile();
+        double direct_mults = 9.0 * conv.get_output_shape().size() * shape.first[3];
+        double tiles = static_cast<double>(shape.first[0]) * ((shape.first[1] + tile - 1) / tile) * ((shape.first[2] + tile - 1) / tile);
+        double winograd_mults = tiles * (tile + 2) * (tile + 2) * shape.first[3] * shape.second;
+
+        lint repeats = 20;
+        double ms[2];
+        for (int k = 0; k < 2; ++k)
+        {
+            conv.set_winograd(1 == k);
+            lint start = neurons::now_in_milliseconds();
+            for (lint r = 0; r < repeats; ++r)
+            {
+                conv.product(z, x, w);
+            }
+            ms[k] = static_cast<double>(neurons::now_in_milliseconds() - start) / repeats;
+        }
+
+        std::cout << shape.first << " by " << w_sh << ", F(" << tile << "x" << tile << ", 3x3): multiplications "
+            << direct_mults / winograd_mults << " times fewer, direct: " << ms[0] << " ms, Winograd: " << ms[1] << " ms\n";
+    }
+}
+
+void test_model_file()
+{
+    std::cout << "=================== test_model_file ==================" << "\n";
+
+    std::string file_name = "test_model_file.bin";
+
+    neurons::global::global_rand_engine.seed(7);
+    neurons::FCNN_layer<float> fcnn{ 0.9, 12, 5, 1, new neurons::Tanh<float> };
+    neurons::CNN_layer<float> cnn{ 0.9, 6, 6, 2, 3, 3, 3, 2, 1, 1, new neurons::Relu<float> };
+
+    bool written = neurons::write_model_file(file_name, { fcnn.to_model_layer(), cnn.to_model_layer() });
+    std::cout << "Model file written: " << (written ? "OK" : "FAILED") << '\n';
+    std::cout << "Recognized as a model file: " << (neurons::Model_file::is_model_file(file_name) ? "OK" : "FAILED") << '\n';
+
+    {
+        neurons::Model_file model{ file_name };
+        const std::vector<neurons::Model_layer> & layers = model.layers();
+
+        bool header = 2 == layers.size() &&
+            neurons::NN_layer<float>::FCNN == layers[0].m_type && neurons::Activation<float>::TANH == layers[0].m_act_func &&
+            neurons::NN_layer<float>::CNN == layers[1].m_type && std::vector<lint>{ 2, 1 } == layers[1].m_params;
+        std::cout << "Types, functions and parameters of layers: " << (header ? "OK" : "FAILED") << '\n';
+
+        // Weights of float borrow their elements from the mapping
+        neurons::TMatrix<float> w, b;
+        std::unique_ptr<neurons::Activation<float>> act_func;
+        std::unique_ptr<neurons::ErrorFunction<float>> err_func;
+        neurons::Traditional_NN_layer<float>::from_model_layer(layers[0], true, w, b, act_func, err_func);
+
+        bool borrowed = w.borrowed() && b.borrowed() &&
+            reinterpret_cast<const char *>(w.m_data) == layers[0].m_tensors[0].m_data &&
+            0 == reinterpret_cast<std::uintptr_t>(w.m_data) % neurons::MODEL_FILE_ALIGNMENT &&
+            0 == reinterpret_cast<std::uintptr_t>(b.m_data) % neurons::MODEL_FILE_ALIGNMENT &&
+            w == fcnn.weights() && b == fcnn.bias();
+        std::cout << "Weights borrowed from aligned elements of the mapping: " << (borrowed ? "OK" : "FAILED") << '\n';
+
+        // A copy owns its elements, assigning to a borrowed matrix gives it elements of its own
+        neurons::TMatrix<float> copy = w;
+        neurons::TMatrix<float> assigned = neurons::TMatrix<float>::borrow(w.shape(), w.m_data);
+        assigned = copy * 2.0f;
+        bool owned = !copy.borrowed() && copy.m_data != w.m_data && !assigned.borrowed() && w == fcnn.weights();
+        std::cout << "Copies of borrowed matrices own their elements: " << (owned ? "OK" : "FAILED") << '\n';
+
+        // A layer of borrowed weights infers like the layer it was saved from, but it cannot be trained
+        neurons::FCNN_layer<float> mapped{ 0.9, 1, std::move(w), std::move(b), act_func, err_func };
+        neurons::TMatrix<float> x{ neurons::Shape{ 1, 12 } };
+        x.gaussian_random(0, 1);
+        bool same = mapped.weights() == fcnn.weights() &&
+            mapped.operation_instances()[0]->forward_propagate(x) == fcnn.operation_instances()[0]->forward_propagate(x);
+        std::cout << "Inference of a layer of borrowed weights: " << (same ? "OK" : "FAILED") << '\n';
+
+        bool thrown = false;
+        try
+        {
+            mapped.commit_training();
+        }
+        catch (std::invalid_argument &)
+        {
+            thrown = true;
+        }
+        std::cout << "Training borrowed weights is refused: " << (thrown ? "OK" : "FAILED") << '\n';
+
+        // Elements of float are converted for layers of double
+        neurons::TMatrix<double> w_d, b_d;
+        std::unique_ptr<neurons::Activation<double>> act_d;
+        std::unique_ptr<neurons::ErrorFunction<double>> err_d;
+        neurons::Traditional_NN_layer<double>::from_model_layer(layers[1], true, w_d, b_d, act_d, err_d);
+        bool converted = !w_d.borrowed() && neurons::TMatrix<float>{ w_d } == cnn.weights() &&
+            neurons::TMatrix<float>{ b_d } == cnn.bias() && neurons::Activation<double>::RELU == act_d->to_string();
+        std::cout << "Elements converted to double: " << (converted ? "OK" : "FAILED") << '\n';
+    }
+
+    // Truncated files and files of newer versions are refused
+    std::vector<char> bytes;
+    {
+        std::ifstream in_file{ file_name, std::ios::binary };
+        bytes.assign(std::istreambuf_iterator<char>{ in_file }, std::istreambuf_iterator<char>{});
+    }
+
+    auto refused = [&file_name](const std::vector<char> & data)
+    {
+        {
+            std::ofstream out_file{ file_name, std::ios::binary | std::ios::trunc };
+            out_file.write(data.data(), data.size());
+        }
+
+        try
+        {
+            neurons::Model_file model{ file_name };
+        }
+        catch (std::invalid_argument &)
+        {
+            return true;
+        }
+        return false;
+    };
+
+    std::vector<char> truncated{ bytes.begin(), bytes.begin() + bytes.size() / 2 };
+    std::vector<char> newer = bytes;
+    newer[8] = static_cast<char>(neurons::MODEL_FILE_VERSION + 1);
+    std::cout << "Corrupted files refused: " << (refused(truncated) && refused(newer) ? "OK" : "FAILED") << '\n';
+
+    std::remove(file_name.c_str());
+}
+
+void test_checkpoint()
+{
+    std::cout << "=================== test_checkpoint ==================" << "\n";
+
+    std::string file_name = "test_checkpoint.bin";
+
+    neurons::global::global_rand_engine.seed(11);
+    neurons::FCNN_layer<float> layer{ 0.9, 12, 5, 1, new neurons::Tanh<float> };
+    neurons::TMatrix<float> x{ neurons::Shape{ 1, 12 } };
+    neurons::TMatrix<float> E_to_y{ neurons::Shape{ 5, 1 } };
+    x.gaussian_random(0, 1);
+    E_to_y.gaussian_random(0, 1);
+
+    auto train_step = [&x, &E_to_y](neurons::FCNN_layer<float> & l)
+    {
+        l.operation_instances()[0]->forward_propagate(x);
+        l.operation_instances()[0]->back_propagate(0.1, E_to_y);
+        l.commit_training();
+    };
+
+    train_step(layer);
+    neurons::TMatrix<float> w_saved = layer.weights();
+
+    neurons::Model_layer model_layer = layer.to_model_layer();
+    layer.add_momentum(model_layer);
+
+    {
+        neurons::Checkpoint_writer writer;
+        writer.save(file_name, { model_layer }, neurons::Training_state{ 3, 10, "1 2 3 4 5" });
+
+        // The checkpoint is a snapshot: training goes on while it is written
+        train_step(layer);
+        writer.wait();
+
+        std::ifstream temp_file{ file_name + ".tmp" };
+        bool written = 1 == writer.written() && 0 == writer.failed() && !temp_file;
+        std::cout << "Checkpoint written and renamed: " << (written ? "OK" : "FAILED") << '\n';
+    }
+
+    neurons::Model_file model{ file_name };
+    const neurons::Model_layer & saved = model.layers()[0];
+
+    bool state = model.has_training_state() && 3 == model.training_state().m_step &&
+        10 == model.training_state().m_steps && "1 2 3 4 5" == model.training_state().m_random_state;
+    std::cout << "Training state of the checkpoint: " << (state ? "OK" : "FAILED") << '\n';
+
+    // A layer resumed from the checkpoint takes the same step as the layer it was saved from
+    neurons::TMatrix<float> w, b;
+    std::unique_ptr<neurons::Activation<float>> act_func;
+    std::unique_ptr<neurons::ErrorFunction<float>> err_func;
+    neurons::Traditional_NN_layer<float>::from_model_layer(saved, false, w, b, act_func, err_func);
+    neurons::FCNN_layer<float> resumed{ 0.9, 1, std::move(w), std::move(b), act_func, err_func };
+    resumed.restore_momentum(saved);
+
+    bool snapshot = 4 == saved.m_tensors.size() && resumed.weights() == w_saved;
+    train_step(resumed);
+    bool same = resumed.weights() == layer.weights() && resumed.bias() == layer.bias();
+    std::cout << "Snapshot of weights and momentum: " << (snapshot ? "OK" : "FAILED")
+        << " resumed step: " << (same ? "OK" : "FAILED") << '\n';
+
+    // Saving again replaces the checkpoint
+    {
+        neurons::Checkpoint_writer writer;
+        writer.save(file_name, { resumed.to_model_layer() }, neurons::Training_state{ 4, 10, "" });
+    }
+    neurons::Model_file replaced{ file_name };
+    bool replaced_ok = 4 == replaced.training_state().m_step && 2 == replaced.layers()[0].m_tensors.size();
+    std::cout << "Checkpoint replaced: " << (replaced_ok ? "OK" : "FAILED") << '\n';
+
+    std::remove(file_name.c_str());
+}
+
+void test_cnn_model_file()
+{
+    std::cout << "=================== test_cnn_model_file ==================" << "\n";
+
+    std::string file_name = "test_cnn_model_file.bin";
+
+    // A convolution of stride 2 and padding 1, overlapping max pooling and global average pooling
+    neurons::global::global_rand_engine.seed(13);
+    neurons::CNN_layer<> cnn{ 0.9, 9, 9, 2, 4, 3, 3, 2, 1, 1, new neurons::Relu<> };
+    neurons::Pooling_layer<> max_pool{ cnn.output_shape(), neurons::Shape{ 1, 3, 3, 4 }, 1, neurons::Pooling_type::max, 1, 1 };
+    neurons::Pooling_layer<> global_pool{ max_pool.output_shape(), neurons::Pooling_type::average, 1 };
+
+    bool written = neurons::write_model_file(
+        file_name, { cnn.to_model_layer(), max_pool.to_model_layer(), global_pool.to_model_layer() });
+    std::cout << "Model file of convolution and pooling layers written: " << (written ? "OK" : "FAILED") << '\n';
+
+    neurons::Model_file model{ file_name };
+    const std::vector<neurons::Model_layer> & layers = model.layers();
+
+    bool records = 3 == layers.size() && std::vector<lint>{ 2, 1 } == layers[0].m_params &&
+        neurons::Pooling_layer<>::POOLING == layers[1].m_type && layers[1].m_tensors.empty() &&
+        std::vector<lint>{ static_cast<lint>(neurons::Pooling_type::max), 3, 3, 1, 1 } == layers[1].m_params &&
+        std::vector<lint>{ static_cast<lint>(neurons::Pooling_type::average), 3, 3, 0, 0 } == layers[2].m_params;
+    std::cout << "Stride, padding and pooling parameters: " << (records ? "OK" : "FAILED") << '\n';
+
+    // Layers rebuilt from the file, inputs of each are outputs of the one before
+    neurons::TMatrix<> w, b;
+    std::unique_ptr<neurons::Activation<>> act_func;
+    std::unique_ptr<neurons::ErrorFunction<>> err_func;
+    neurons::Traditional_NN_layer<>::from_model_layer(layers[0], false, w, b, act_func, err_func);
+    neurons::CNN_layer<> loaded_cnn{ 0.9, 9, 9, 2, layers[0].m_params[0], layers[0].m_params[1], 1, w, b, act_func, err_func };
+    neurons::Pooling_layer<> loaded_max = neurons::Pooling_layer<>::from_model_layer(layers[1], loaded_cnn.output_shape(), 1);
+    neurons::Pooling_layer<> loaded_global = neurons::Pooling_layer<>::from_model_layer(layers[2], loaded_max.output_shape(), 1);
+
+    std::vector<neurons::TMatrix<>> x{ neurons::TMatrix<>{ neurons::Shape{ 1, 9, 9, 2 } } };
+    x[0].gaussian_random(0, 1);
+
+    auto forward = [&x](neurons::CNN_layer<> & c, neurons::Pooling_layer<> & p1, neurons::Pooling_layer<> & p2)
+    {
+        std::vector<neurons::TMatrix<>> y = c.operation_instances()[0]->batch_forward_propagate(x);
+        return p2.operation_instances()[0]->forward_propagate(p1.operation_instances()[0]->forward_propagate(y));
+    };
+
+    std::vector<neurons::TMatrix<>> expected = forward(cnn, max_pool, global_pool);
+    std::vector<neurons::TMatrix<>> actual = forward(loaded_cnn, loaded_max, loaded_global);
+    bool same = loaded_global.output_shape() == global_pool.output_shape() && expected[0] == actual[0];
+    std::cout << "Outputs of the loaded layers: " << (same ? "OK" : "FAILED") << '\n';
+
+    bool thrown = false;
+    try
+    {
+        neurons::Pooling_layer<>::from_model_layer(layers[0], cnn.output_shape(), 1);
+    }
+    catch (std::invalid_argument &)
+    {
+        thrown = true;
+    }
+    std::cout << "Other layers are not pooling layers: " << (thrown ? "OK" : "FAILED") << '\n';
+
+    std::remove(file_name.c_str());
+}
+
+void test_inference_session()
+{
+    std::cout << "=================== test_inference_session ==================" << "\n";
+
+    // A 3 x 3 convolution, max pooling and a softmax output layer, as a convolutional network predicts
+    neurons::global::global_rand_engine.seed(17);
+    neurons::CNN_layer<> cnn{ 0.9, 9, 9, 2, 4, 3, 3, 1, 0, 1, new neurons::Relu<> };
+    neurons::Pooling_layer<> pool{ cnn.output_shape(), neurons::Shape{ 1, 2, 2, 4 }, 1 };
+    neurons::FCNN_layer<> fcnn{ 0.9, pool.output_shape().size(), 3, 1, nullptr, new neurons::Softmax_CrossEntropy<> };
+
+    neurons::Inference_session<> session{
+        { cnn.to_model_layer(), pool.to_model_layer(), fcnn.to_model_layer() }, neurons::Shape{ 9, 9, 2 }, false };
+
+    std::vector<neurons::TMatrix<>> x;
+    for (lint i = 0; i < 5; ++i)
+    {
+        x.push_back(neurons::TMatrix<>{ neurons::Shape{ 1, 9, 9, 2 } });
+        x.back().gaussian_random(0, 1);
+    }
+
+    std::vector<neurons::TMatrix<>> expected = pool.operation_instances()[0]->forward_propagate(
+        cnn.operation_instances()[0]->batch_forward_propagate(x));
+    for (neurons::TMatrix<> & y : expected)
+    {
+        y.reshape(neurons::Shape{ 1, y.shape().size() });
+    }
+    expected = fcnn.operation_instances()[0]->batch_forward_propagate(expected);
+
+    std::vector<neurons::TMatrix<>> preds = session.predict(x);
+    bool same = preds.size() == x.size() && neurons::Shape{ 3 } == preds[0].shape();
+    for (size_t i = 0; same && i < preds.size(); ++i)
+    {
+        for (lint j = 0; j < 3; ++j)
+        {
+            same = same && fabs(preds[i].m_data[j] - expected[i].m_data[j]) < 1e-12;
+        }
+    }
+    std::cout << "Predictions of the layers: " << (same ? "OK" : "FAILED") << '\n';
+
+    // A single sample, flat, through the raw interface
+    neurons::TMatrix<> single{ neurons::Shape{ 162 } };
+    std::copy(x[2].m_data, x[2].m_data + 162, single.m_data);
+    neurons::TMatrix<> raw{ neurons::Shape{ 3 } };
+    session.predict(1, single.m_data, raw.m_data);
+    bool single_same = raw == session.predict(single);
+    for (lint j = 0; j < 3; ++j)
+    {
+        single_same = single_same && fabs(raw.m_data[j] - expected[2].m_data[j]) < 1e-12;
+    }
+    std::cout << "Single samples: " << (single_same ? "OK" : "FAILED") << '\n';
+
+    // Threads predicting at the same time get the same predictions, workspaces are reused
+    std::vector<std::thread> threads;
+    std::vector<bool> thread_same(4, true);
+    for (size_t t = 0; t < thread_same.size(); ++t)
+    {
+        threads.emplace_back([&, t]
+        {
+            for (lint r = 0; r < 50; ++r)
+            {
+                thread_same[t] = thread_same[t] && session.predict(x) == preds && session.predict(single) == raw;
+            }
+        });
+    }
+    for (std::thread & thread : threads)
+    {
+        thread.join();
+    }
+    bool concurrent = std::all_of(thread_same.begin(), thread_same.end(), [](bool b) { return b; }) &&
+        session.workspaces() <= 2 * static_cast<lint>(thread_same.size());
+    std::cout << "Concurrent predictions: " << (concurrent ? "OK" : "FAILED") << '\n';
+
+    // Samples are normalized like TMatrix::normalize does
+    neurons::Inference_session<> normalizing{
+        { cnn.to_model_layer(), pool.to_model_layer(), fcnn.to_model_layer() }, neurons::Shape{ 1, 9, 9, 2 }, true };
+    neurons::TMatrix<> scaled{ x[0].shape() };
+    for (lint i = 0; i < scaled.shape().size(); ++i)
+    {
+        scaled.m_data[i] = x[0].m_data[i] * 3 + 1;
+    }
+    neurons::TMatrix<> normalized = scaled;
+    normalized.normalize();
+    std::cout << "Normalized samples: " << (normalizing.predict(scaled) == session.predict(normalized) ? "OK" : "FAILED") << '\n';
+}
+
+void bench_inference_session()
+{
+    std::cout << "=================== bench_inference_session ==================" << "\n";
+
+    neurons::CNN_layer<float> cnn{ 0.9, 28, 28, 1, 16, 3, 3, 1, 1, 1, new neurons::Relu<float> };
+    neurons::Pooling_layer<float> pool{ cnn.output_shape(), neurons::Shape{ 1, 2, 2, 16 }, 1 };
+    neurons::FCNN_layer<float> fcnn{ 0.9, pool.output_shape().size(), 10, 1, nullptr, new neurons::Softmax_CrossEntropy<float> };
+    neurons::Inference_session<float> session{
+        { cnn.to_model_layer(), pool.to_model_layer(), fcnn.to_model_layer() }, neurons::Shape{ 1, 28, 28, 1 }, false };
+
+    std::vector<neurons::TMatrix<float>> x{ neurons::TMatrix<float>{ neurons::Shape{ 1, 28, 28, 1 } } };
+    x[0].gaussian_random(0, 1);
+    lint repeats = 1000;
+
+    // Latency of a single sample through the layer operations of training and through the session
+    lint start = neurons::now_in_milliseconds();
+    for (lint r = 0; r < repeats; ++r)
+    {
+        std::vector<neurons::TMatrix<float>> y = pool.operation_instances()[0]->forward_propagate(
+            cnn.operation_instances()[0]->batch_forward_propagate(x));
+        y[0].reshape(neurons::Shape{ 1, y[0].shape().size() });
+        fcnn.operation_instances()[0]->batch_forward_propagate(y);
+    }
+    double ops_us = static_cast<double>(neurons::now_in_milliseconds() - start) * 1000 / repeats;
+
+    start = neurons::now_in_milliseconds();
+    for (lint r = 0; r < repeats; ++r)
+    {
+        session.predict(x[0]);
+    }
+    double session_us = static_cast<double>(neurons::now_in_milliseconds() - start) * 1000 / repeats;
+
+    std::cout << "Layer operations: " << ops_us << " us, inference session: " << session_us << " us per sample\n";
+}
+
+void test_batching_server()
+{
+    std::cout << "=================== test_batching_server ==================" << "\n";
+
+    neurons::global::global_rand_engine.seed(19);
+    neurons::FCNN_layer<> hidden{ 0.9, 6, 8, 1, new neurons::Tanh<> };
+    neurons::FCNN_layer<> output{ 0.9, 8, 3, 1, nullptr, new neurons::Softmax_CrossEntropy<> };
+    std::shared_ptr<neurons::Inference_session<>> session = std::make_shared<neurons::Inference_session<>>(
+        std::vector<neurons::Model_layer>{ hidden.to_model_layer(), output.to_model_layer() }, neurons::Shape{ 1, 6 }, false);
+
+    std::vector<neurons::TMatrix<>> x;
+    for (lint i = 0; i < 8; ++i)
+    {
+        x.push_back(neurons::TMatrix<>{ neurons::Shape{ 1, 6 } });
+        x.back().gaussian_random(0, 1);
+    }
+    std::vector<neurons::TMatrix<>> expected = session->predict(x);
+
+    auto close_to = [](const neurons::TMatrix<> & a, const neurons::TMatrix<> & b)
+    {
+        bool close = a.shape() == b.shape();
+        for (lint i = 0; close && i < a.shape().size(); ++i)
+        {
+            close = fabs(a.m_data[i] - b.m_data[i]) < 1e-12;
+        }
+        return close;
+    };
+
+    // Callers predicting at the same time are answered in batches of up to 4 samples
+    neurons::Batching_server<> server{ session, 4, 20000 };
+    std::vector<std::thread> threads;
+    std::vector<bool> thread_same(x.size(), true);
+    for (size_t t = 0; t < x.size(); ++t)
+    {
+        threads.emplace_back([&, t]
+        {
+            for (lint r = 0; r < 10; ++r)
+            {
+                thread_same[t] = thread_same[t] && close_to(server.predict(x[t]), expected[t]);
+            }
+        });
+    }
+    for (std::thread & thread : threads)
+    {
+        thread.join();
+    }
+
+    neurons::Batching_stats stats = server.stats();
+    bool same = std::all_of(thread_same.begin(), thread_same.end(), [](bool b) { return b; });
+    std::cout << "Predictions of concurrent callers: " << (same ? "OK" : "FAILED") << '\n';
+    std::cout << "Requests coalesced into batches: " << (
+        80 == stats.m_requests && stats.m_batches < stats.m_requests && stats.m_mean_batch_size <= 4 ? "OK" : "FAILED") << '\n';
+    std::cout << "Latency and throughput counters: " << (
+        stats.m_p50_us > 0 && stats.m_p50_us <= stats.m_p99_us && stats.m_throughput > 0 ? "OK" : "FAILED") << '\n';
+
+    // Clients of the socket are batched together with callers in the process
+    server.reset_stats();
+    std::string socket_path = "test_batching_server.sock";
+    bool listening = server.listen(socket_path);
+    bool socket_same = listening;
+    bool refused = false;
+    if (listening)
+    {
+        neurons::Batching_client<> first{ socket_path };
+        neurons::Batching_client<> second{ socket_path };
+        std::future<neurons::TMatrix<>> local = server.submit(x[2]);
+        socket_same = close_to(first.predict(x[0]), expected[0]) && close_to(second.predict(x[1]), expected[1]) &&
+            close_to(local.get(), expected[2]) && close_to(first.predict(x[3]), expected[3]);
+
+        try
+        {
+            second.predict(neurons::TMatrix<>{ neurons::Shape{ 1, 5 }, 0 });
+        }
+        catch (std::invalid_argument &)
+        {
+            refused = true;
+        }
+        refused = refused && close_to(second.predict(x[4]), expected[4]) && 1 == server.stats().m_refused;
+    }
+    std::cout << "Predictions over a Unix domain socket: " << (socket_same ? "OK" : "FAILED") << '\n';
+    std::cout << "Samples of another size refused: " << (refused ? "OK" : "FAILED") << '\n';
+
+    server.stop();
+    bool stopped = false;
+    try
+    {
+        server.submit(x[0]);
+    }
+    catch (std::invalid_argument &)
+    {
+        stopped = true;
+    }
+    std::cout << "Stopped server: " << (stopped && 5 == server.stats().m_requests ? "OK" : "FAILED") << '\n';
+
+    // A long run: inputs are freed by the worker and predictions by the caller, nobody ends a training
+    // step, and the blocks kept in free lists stop growing once they reach their limits
+    neurons::FCNN_layer<> wide{ 0.9, 2048, 3, 1, nullptr, new neurons::Softmax_CrossEntropy<> };
+    std::shared_ptr<neurons::Inference_session<>> wide_session = std::make_shared<neurons::Inference_session<>>(
+        std::vector<neurons::Model_layer>{ wide.to_model_layer() }, neurons::Shape{ 1, 2048 }, false);
+    neurons::TMatrix<> wide_x{ neurons::Shape{ 1, 2048 } };
+    wide_x.gaussian_random(0, 1);
+    lint cached_early = 0;
+    {
+        neurons::Batching_server<> long_server{ wide_session, 1, 0 };
+        for (lint i = 1; i <= 30000; ++i)
+        {
+            long_server.predict(wide_x);
+            if (10000 == i)
+            {
+                cached_early = neurons::cached_matrix_bytes();
+            }
+        }
+        lint growth = neurons::cached_matrix_bytes() - cached_early;
+        std::cout << "Memory of a long run: " << (growth < (8 << 20) ? "OK" : "FAILED") << '\n';
+    }
+}
+
 void test_of_basic_operations()
 {
     /*
@@ -1156,6 +3510,31 @@ void test_of_basic_operations()
     test_matrix_indexing();
     test_matrix_self_cal();
     test_matrix_mul();
+    test_gemm();
+    bench_matrix_multiply();
+    test_vector_math();
+    test_fused_epilogue();
+    bench_activation_functions();
+    test_thread_pool();
+    test_commit_training();
+    test_image_store();
+    test_mapped_dataset();
+    test_prefetch_pipeline();
+    test_streamed_dataset();
+    test_float_training();
+    test_allocator();
+    test_tensor_view();
+    test_matrix_expressions();
+    test_permute();
+    bench_transpose();
+    test_pooling_types();
+    test_conv_parallelism();
+    test_winograd();
+    test_model_file();
+    test_checkpoint();
+    test_cnn_model_file();
+    test_inference_session();
+    test_batching_server();
     test_multiply_and_dot_product();
 
     test_matrix_dim_scale_up();
@@ -1169,6 +3548,7 @@ void test_of_basic_operations()
 
     test_conv_1d();
     test_conv_2d();
+    test_conv_2d_gradients();
 
     test_pooling_2d();
     test_pooling_2d_special();